@@ -17,11 +17,14 @@
 #include <sys/stat.h>
 
 #include "exfat.h"
+#include "index.h"
 #include "catexfat.h"
+#include "trans.h"
 
 FILE *output;
 unsigned int print_level = PRINT_WARNING;
 struct exfat_info info;
+uint8_t flags = 0;
 
 /**
  * Special Option(no short option)
@@ -35,6 +38,7 @@ enum
 /* option data {"long name", needs argument, flags, "short name"} */
 static struct option const longopts[] =
 {
+	{"index", no_argument, NULL, 'i'},
 	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
 	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
 	{0,0,0,0}
@@ -49,6 +53,7 @@ static void usage(void)
 	fprintf(stderr, "print on the standard output\n");
 	fprintf(stderr, "\n");
 
+	fprintf(stderr, "  -i, --index\tuse (or create) index IMAGE.idx.\n");
 	fprintf(stderr, "  --help\tDESCRIPTION.\n");
 	fprintf(stderr, "  --version\toutput version information and exit.\n");
 	fprintf(stderr, "\n");
@@ -67,6 +72,37 @@ static void version(const char *command_name, const char *version, const char *a
 	fprintf(stdout, "Written by %s.\n", author);
 }
 
+/**
+ * exfat_print_extents - print cluster runs like "cat"
+ * @ext:                 extents
+ * @count:               the number of extents
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int exfat_print_extents(const struct exfat_index_extent *ext, uint32_t count)
+{
+	int ret = 0;
+	uint32_t i, clu, len, n;
+	size_t max = MAX(CAT_BUFFER_SIZE / info.cluster_size, 1);
+	void *data;
+
+	if ((data = malloc(max * info.cluster_size)) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; !ret && i < count; i++) {
+		clu = le32_to_cpu(ext[i].Cluster);
+		len = le32_to_cpu(ext[i].Length);
+		for (; !ret && len; clu += n, len -= n) {
+			n = MIN(len, max);
+			if ((ret = get_clusters(data, clu, n)) == 0)
+				allwrite(STDOUT_FILENO, data, (size_t)n * info.cluster_size);
+		}
+	}
+	free(data);
+	return ret;
+}
+
 /**
  * exfat_print_dentry - print dentry like "cat"
  * @fst:                first cluster
@@ -76,7 +112,8 @@ static void version(const char *command_name, const char *version, const char *a
  */
 static int exfat_print_file(uint32_t fst, int index)
 {
-	uint32_t clu;
+	uint32_t clu, count;
+	const struct exfat_index_extent *ext;
 	void *data;
 	node2_t *tmp;
 	struct exfat_fileinfo *f;
@@ -95,6 +132,10 @@ static int exfat_print_file(uint32_t fst, int index)
 	if (!tmp)
 		return -EINVAL;
 
+	/* Index has already resolved FAT chain */
+	if ((ext = exfat_index_extents(info.root[index]->index, fst, &count)) != NULL)
+		return exfat_print_extents(ext, count);
+
 	data = malloc(info.cluster_size);
 	for (clu = fst; clu != EXFAT_LASTCLUSTER; clu = exfat_next_cluster(f, clu)) {
 		get_cluster(data, clu);
@@ -123,9 +164,12 @@ int main(int argc, char *argv[])
 	struct exfat_fileinfo *f;
 
 	while ((opt = getopt_long(argc, argv,
-					"",
+					"i",
 					longopts, &longindex)) != -1) {
 		switch (opt) {
+			case 'i':
+				flags |= OPTION_INDEX;
+				break;
 			case GETOPT_HELP_CHAR:
 				usage();
 				exit(EXIT_SUCCESS);
@@ -140,6 +184,7 @@ int main(int argc, char *argv[])
 
 #ifdef EXFAT_DEBUG
 	print_level = PRINT_DEBUG;
+	print_ring_setup();
 #endif
 
 	if (optind != argc - 2) {
@@ -156,14 +201,19 @@ int main(int argc, char *argv[])
 		ret = -EIO;
 		goto out;
 	}
+	exfat_journal_check(argv[optind]);
 	path = argv[optind + 1];
 
 	if (exfat_load_bootsec(&boot))
 		goto out;
 	if (exfat_store_info(&boot))
 		goto out;
-	if (exfat_traverse_root_directory())
+	if (flags & OPTION_INDEX) {
+		if (exfat_index_open(argv[optind]))
+			goto out;
+	} else if (exfat_traverse_root_directory()) {
 		goto out;
+	}
 	if ((clu = exfat_lookup(info.root_offset, path)) == 0) {
 		ret = ENOENT;
 		goto out;
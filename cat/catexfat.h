@@ -20,4 +20,9 @@
 #define PROGRAM_AUTHOR   "LeavaTail"
 #define COPYRIGHT_YEAR   "2021"
 
+#define OPTION_INDEX     (1 << 0)
+
+/* Read size when file is read by extents */
+#define CAT_BUFFER_SIZE  (1024 * 1024)
+
 #endif /*_CATEXFAT_H */
@@ -18,10 +18,13 @@
 
 #include "checkexfat.h"
 #include "exfat.h"
+#include "carve.h"
+#include "trans.h"
 
 FILE *output = NULL;
 unsigned int print_level = PRINT_WARNING;
 struct exfat_info info = {0};
+uint8_t flags = 0;
 
 /**
  * Special Option(no short option)
@@ -35,6 +38,7 @@ enum
 /* option data {"long name", needs argument, flags, "short name"} */
 static struct option const longopts[] =
 {
+	{"lost", no_argument, NULL, 'l'},
 	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
 	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
 	{0,0,0,0}
@@ -49,6 +53,7 @@ static void usage(void)
 	fprintf(stderr, "Write any data to exfat image\n");
 	fprintf(stderr, "\n");
 
+	fprintf(stderr, "  -l, --lost\trebuild lost directories from unused clusters.\n");
 	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
 	fprintf(stderr, "  --version\toutput version information and exit.\n");
 	fprintf(stderr, "\n");
@@ -118,6 +123,110 @@ static int exfat_set_reserved_bitmap(uint8_t *b, uint32_t clu, uint64_t len)
 	return ret;
 }
 
+/**
+ * exfat_check_directories - set bit at all files in directory cache
+ * @b                        Allocation bitmap cache
+ * @start                    first index of directory cache
+ *
+ * @return                   index of directory cache which isn't traversed
+ */
+static int exfat_check_directories(uint8_t *b, int start)
+{
+	int i;
+	uint32_t clu;
+	node2_t *tmp;
+	struct exfat_fileinfo *f;
+
+	for (i = start; i < info.root_size && info.root[i]; i++) {
+		exfat_traverse_directory(info.root[i]->index);
+		tmp = info.root[i];
+		clu = tmp->index;
+		/* Traverse directory chain */
+		while (tmp->next != NULL) {
+			tmp = tmp->next;
+			f = (struct exfat_fileinfo *)tmp->data;
+			/* File */
+			for (clu = tmp->index;
+					clu != 0 && clu != EXFAT_LASTCLUSTER;
+					clu = exfat_next_cluster(f, clu))
+				exfat_set_bitmap(b, clu);
+		}
+	}
+	return i;
+}
+
+/**
+ * exfat_print_lost_file - print file in lost directory
+ * @f:                     file information
+ * @node:                  directory cache node
+ * @path:                  path of file
+ * @arg:                   unused
+ *
+ * @return                 0 (continue walking)
+ */
+static int exfat_print_lost_file(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	pr_msg("%s%s\n", path, (f->attr & ATTR_DIRECTORY) ? "/" : "");
+	return 0;
+}
+
+/**
+ * exfat_check_lost - rebuild lost directories from unused clusters
+ * @b                 Allocation bitmap cache
+ * @start             first index of directory cache which isn't traversed
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: Clusters which are allocated but aren't referenced from any file are carved,
+ *       and lost directory trees are attached to directory cache as LOST.XXXXXXXX.
+ */
+static int exfat_check_lost(uint8_t *b, int start)
+{
+	int ret, idx;
+	size_t i, count, num;
+	uint8_t *target;
+	uint32_t clu;
+	char name[16], path[32];
+	struct exfat_carve_root *roots;
+	struct exfat_carve_set *sets;
+	struct exfat_fileinfo *f;
+
+	if ((target = malloc(info.cluster_count / CHAR_BIT + 1)) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < info.cluster_count / CHAR_BIT + 1; i++)
+		target[i] = info.alloc_table[i] & ~b[i];
+
+	ret = exfat_carve_heap(target, &sets, &count);
+	free(target);
+	if (ret)
+		return ret;
+
+	ret = exfat_carve_lost_directories(sets, count, &roots, &num);
+	free(sets);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < num; i++) {
+		snprintf(name, sizeof(name), LOST_DIRECTORY_NAME, roots[i].clu);
+		if (exfat_carve_create_cache(&roots[i], name))
+			continue;
+		idx = exfat_get_cache(roots[i].clu);
+		f = (struct exfat_fileinfo *)info.root[idx]->data;
+		for (clu = roots[i].clu; clu != 0 && clu != EXFAT_LASTCLUSTER; clu = exfat_next_cluster(f, clu))
+			exfat_set_bitmap(b, clu);
+		start = exfat_check_directories(b, start);
+
+		pr_warn("Cluster#%u is lost directory.\n", roots[i].clu);
+		snprintf(path, sizeof(path), "/%s", name);
+		pr_msg("%s/\n", path);
+		exfat_walk_subtree(roots[i].clu, path, exfat_print_lost_file, NULL);
+	}
+
+	free(roots);
+	return 0;
+}
+
 /**
  * exfat_check_bitmap - check whether Freed cluster is fine in Allocation bitmap 
  * @b                   Allocation bitmap cache
@@ -152,16 +261,17 @@ int main(int argc, char *argv[])
 	int longindex;
 	int i;
 	int ret = -EINVAL;
-	uint32_t clu = 0;
 	struct exfat_bootsec boot;
 	uint8_t *alloc_table = NULL;
-	node2_t *tmp;
 	struct exfat_fileinfo *f;
 
 	while ((opt = getopt_long(argc, argv,
-					"",
+					"l",
 					longopts, &longindex)) != -1) {
 		switch (opt) {
+			case 'l':
+				flags |= OPTION_LOST;
+				break;
 			case GETOPT_HELP_CHAR:
 				usage();
 				exit(EXIT_SUCCESS);
@@ -176,6 +286,7 @@ int main(int argc, char *argv[])
 
 #ifdef EXFAT_DEBUG
 	print_level = PRINT_DEBUG;
+	print_ring_setup();
 #endif
 
 	if (optind != argc - 1) {
@@ -192,6 +303,7 @@ int main(int argc, char *argv[])
 		ret = -EIO;
 		goto out;
 	}
+	exfat_journal_check(argv[optind]);
 
 	if (exfat_load_bootsec(&boot)) 
 		goto out;
@@ -201,6 +313,10 @@ int main(int argc, char *argv[])
 		goto out;
 	if (exfat_check_bootchecksum())
 		goto out;
+	if (exfat_check_backup_bootsec() < 0)
+		goto out;
+	if (exfat_check_fat_mirror() < 0)
+		goto out;
 
 	/* Ignore errot message in Root Directory */
 	if (exfat_traverse_root_directory())
@@ -215,22 +331,11 @@ int main(int argc, char *argv[])
 	exfat_set_reserved_bitmap(alloc_table, info.upcase_offset, info.upcase_size);
 	exfat_set_reserved_bitmap(alloc_table, info.root_offset, f->datalen);
 
-	for (i = 0; i < info.root_size && info.root[i]; i++) {
-		exfat_traverse_directory(info.root[i]->index);
-		tmp = info.root[i];
-		clu = tmp->index;
-		/* Traverse directory chain */
-		while (tmp->next != NULL) {
-			tmp = tmp->next;
-			f = (struct exfat_fileinfo *)tmp->data;
-			/* File */
-			for (clu = tmp->index;
-					clu != 0 && clu != EXFAT_LASTCLUSTER;
-					clu = exfat_next_cluster(f, clu))
-				exfat_set_bitmap(alloc_table, clu);
-		}
-	}
+	i = exfat_check_directories(alloc_table, 0);
+	if ((flags & OPTION_LOST) && (ret = exfat_check_lost(alloc_table, i)) < 0)
+		goto fat_free;
 	exfat_check_bitmap(alloc_table);
+	exfat_print_checksum_report();
 	exfat_print_cache();
 
 	ret = EXIT_SUCCESS;
@@ -20,4 +20,9 @@
 #define PROGRAM_AUTHOR   "LeavaTail"
 #define COPYRIGHT_YEAR   "2021"
 
+#define OPTION_LOST      (1 << 0)
+
+/* Name of lost directory (first cluster) */
+#define LOST_DIRECTORY_NAME    "LOST.%08x"
+
 #endif /*_CHECKEXFAT_H */
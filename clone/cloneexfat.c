@@ -0,0 +1,584 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <mntent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cloneexfat.h"
+#include "exfat.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+uint8_t flags = 0;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"metadata", no_argument, NULL, 'm'},
+	{"sha256", no_argument, NULL, 's'},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE [OUTPUT]\n", PROGRAM_NAME);
+	fprintf(stderr, "copy only allocated clusters in exFAT image to OUTPUT (or stdout)\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -m, --metadata\texport metadata (without file data) only.\n");
+	fprintf(stderr, "  -s, --sha256\tdisplay SHA-256 of copied data.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * clone_add_extent - append byte range to be copied
+ * @ctx:              clone context
+ * @offset:           byte offset in the image
+ * @length:           length
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: Range next to the last one is merged.
+ */
+static int clone_add_extent(struct clone_ctx *ctx, off_t offset, uint64_t length)
+{
+	struct clone_extent *tmp;
+
+	if (offset >= ctx->size)
+		return 0;
+	length = MIN(length, (uint64_t)(ctx->size - offset));
+
+	if (ctx->count && ctx->ext[ctx->count - 1].offset + ctx->ext[ctx->count - 1].length == offset) {
+		ctx->ext[ctx->count - 1].length += length;
+		return 0;
+	}
+
+	/* Expand list by power of two */
+	if (!(ctx->count & (ctx->count - 1))) {
+		tmp = realloc(ctx->ext, (ctx->count ? ctx->count * 2 : 1) * sizeof(struct clone_extent));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->ext = tmp;
+	}
+	ctx->ext[ctx->count].offset = offset;
+	ctx->ext[ctx->count].length = length;
+	ctx->count++;
+	return 0;
+}
+
+/**
+ * clone_add_clusters - append allocated clusters to be copied
+ * @clu:                first cluster
+ * @len:                the number of clusters
+ * @arg:                clone context
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ */
+static int clone_add_clusters(uint32_t clu, uint32_t len, void *arg)
+{
+	off_t heap_start = (off_t)info.heap_offset * info.sector_size;
+
+	return clone_add_extent(arg,
+			heap_start + (off_t)(clu - EXFAT_FIRST_CLUSTER) * info.cluster_size,
+			(uint64_t)len * info.cluster_size);
+}
+
+/**
+ * clone_write - write whole buffer to output
+ * @fd:          output file descriptor
+ * @data:        buffer
+ * @len:         length of @data
+ * @offset:      offset in output (ignored if @seekable is false)
+ * @seekable:    whether or not output is regular file
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ */
+static int clone_write(int fd, const void *data, size_t len, off_t offset, bool seekable)
+{
+	ssize_t n;
+	const uint8_t *p = data;
+
+	while (len) {
+		n = seekable ? pwrite(fd, p, len, offset) : write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			n = -errno;
+			pr_err("write: %s\n", strerror(-n));
+			return n;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * clone_write_zero - fill output with zero (only for stream)
+ * @fd:               output file descriptor
+ * @len:              length to fill
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ */
+static int clone_write_zero(int fd, uint64_t len)
+{
+	int ret;
+	size_t n;
+	static const uint8_t zero[64 * 1024];
+
+	for (; len; len -= n) {
+		n = MIN(len, sizeof(zero));
+		if ((ret = clone_write(fd, zero, n, 0, false)))
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * clone_mark_chain - mark clusters in chain as metadata
+ * @b:                metadata clusters (Output)
+ * @clu:              first cluster
+ * @len:              length in bytes (0 means until end of FAT chain)
+ * @contiguous:       whether or not chain is contiguous (NoFatChain)
+ */
+static void clone_mark_chain(bitmap_t *b, uint32_t clu, uint64_t len, bool contiguous)
+{
+	uint64_t i, num = len ? ROUNDUP(len, info.cluster_size) : info.cluster_count;
+
+	for (i = 0; i < num; i++) {
+		if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1 || get_bitmap(b, clu))
+			break;
+		set_bitmap(b, clu);
+		if (contiguous)
+			clu++;
+		else if (exfat_get_fat(clu, &clu))
+			break;
+	}
+}
+
+/**
+ * clone_mark_directory - mark directory clusters as metadata
+ * @f:                    file information
+ * @node:                 cache node (unused)
+ * @path:                 file path (unused)
+ * @arg:                  metadata clusters (Output)
+ *
+ * @return                0 (continue walking)
+ */
+static int clone_mark_directory(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	if (f->attr & ATTR_DIRECTORY)
+		clone_mark_chain(arg, f->clu, f->datalen, f->flags & ALLOC_NOFATCHAIN);
+	return 0;
+}
+
+/**
+ * clone_add_metadata - append metadata clusters to be copied
+ * @ctx:                clone context
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Allocation Bitmap, Up-case table, and all directories.
+ */
+static int clone_add_metadata(struct clone_ctx *ctx)
+{
+	int ret;
+	uint32_t clu;
+	bitmap_t b;
+
+	init_bitmap(&b, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	if (!b.data)
+		return -ENOMEM;
+
+	clone_mark_chain(&b, info.alloc_offset, info.alloc_length, false);
+	clone_mark_chain(&b, info.upcase_offset, info.upcase_size, false);
+	clone_mark_chain(&b, info.root_offset, 0, false);
+	if ((ret = exfat_walk_tree(clone_mark_directory, &b)) < 0)
+		goto out;
+
+	for (clu = EXFAT_FIRST_CLUSTER; clu < info.cluster_count + EXFAT_FIRST_CLUSTER; clu++) {
+		if (get_bitmap(&b, clu) && (ret = clone_add_clusters(clu, 1, ctx)) < 0)
+			break;
+	}
+out:
+	free_bitmap(&b);
+	return ret;
+}
+
+/**
+ * clone_write_header - write header and extent table of metadata image
+ * @ctx:                clone context
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Extent data is packed from EXFAT_META_ALIGN aligned offset.
+ */
+static int clone_write_header(struct clone_ctx *ctx)
+{
+	int ret;
+	size_t i, len;
+	uint64_t pos;
+	uint8_t *buf;
+	struct exfat_meta_header *h;
+	struct exfat_meta_extent *e;
+
+	len = sizeof(*h) + ctx->count * sizeof(*e);
+	ctx->data_offset = ROUNDUP(len, EXFAT_META_ALIGN) * EXFAT_META_ALIGN;
+	if ((buf = calloc(ctx->data_offset, 1)) == NULL)
+		return -ENOMEM;
+
+	h = (struct exfat_meta_header *)buf;
+	memcpy(h->Magic, EXFAT_META_MAGIC, sizeof(h->Magic));
+	h->Version = cpu_to_le32(EXFAT_META_VERSION);
+	h->ExtentCount = cpu_to_le32(ctx->count);
+	h->ImageSize = cpu_to_le64(ctx->size);
+
+	e = (struct exfat_meta_extent *)(buf + sizeof(*h));
+	for (i = 0, pos = ctx->data_offset; i < ctx->count; pos += ctx->ext[i].length, i++) {
+		e[i].Offset = cpu_to_le64(ctx->ext[i].offset);
+		e[i].Length = cpu_to_le64(ctx->ext[i].length);
+		e[i].FileOffset = cpu_to_le64(pos);
+	}
+
+	ret = clone_write(ctx->fd, buf, ctx->data_offset, 0, ctx->seekable);
+	free(buf);
+	return ret;
+}
+
+/**
+ * clone_hasher - hash stage in pipeline
+ * @arg:          clone context
+ */
+static void *clone_hasher(void *arg)
+{
+	struct clone_ctx *ctx = arg;
+	struct clone_buffer *b;
+
+	while ((b = exfat_queue_pop(&ctx->hash_q)) != NULL) {
+		sha256_update(&ctx->sha, b->data, b->length);
+		exfat_queue_push(&ctx->write_q, b);
+	}
+	exfat_queue_close(&ctx->write_q);
+	return NULL;
+}
+
+/**
+ * clone_writer - write stage in pipeline
+ * @arg:          clone context
+ *
+ * NOTE: Regular file leaves holes for free clusters,
+ *       and other outputs (pipe, device) are filled with zero.
+ */
+static void *clone_writer(void *arg)
+{
+	int ret = 0;
+	off_t pos = 0;
+	struct clone_ctx *ctx = arg;
+	struct clone_buffer *b;
+
+	while ((b = exfat_queue_pop(&ctx->write_q)) != NULL) {
+		if (!ret && !ctx->seekable && !ctx->packed)
+			ret = clone_write_zero(ctx->fd, b->offset - pos);
+		if (!ret)
+			ret = clone_write(ctx->fd, b->data, b->length,
+					ctx->packed ? ctx->data_offset + (off_t)ctx->copied : b->offset,
+					ctx->seekable);
+		if (!ret) {
+			pos = b->offset + b->length;
+			ctx->copied += b->length;
+		} else {
+			__atomic_store_n(&ctx->error, ret, __ATOMIC_RELAXED);
+		}
+		exfat_queue_push(&ctx->free_q, b);
+	}
+
+	if (ctx->packed)
+		goto out;
+	if (!ret && ctx->seekable && ftruncate(ctx->fd, ctx->size) < 0)
+		ret = -errno;
+	if (!ret && !ctx->seekable)
+		ret = clone_write_zero(ctx->fd, ctx->size - pos);
+out:
+	if (ret)
+		__atomic_store_n(&ctx->error, ret, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * clone_reader - read stage in pipeline
+ * @ctx:          clone context
+ * @next:         next stage
+ *
+ * @return        == 0 (success)
+ *                <  0 (failed)
+ */
+static int clone_reader(struct clone_ctx *ctx, struct exfat_queue *next)
+{
+	int ret = 0;
+	size_t i;
+	uint64_t done;
+	struct clone_buffer *b;
+
+	for (i = 0; !ret && i < ctx->count; i++) {
+		for (done = 0; done < ctx->ext[i].length; done += b->length) {
+			if ((ret = __atomic_load_n(&ctx->error, __ATOMIC_RELAXED)))
+				break;
+			b = exfat_queue_pop(&ctx->free_q);
+			b->offset = ctx->ext[i].offset + done;
+			b->length = MIN(ctx->ext[i].length - done, CLONE_BUFFER_SIZE);
+			if ((ret = get_sector(b->data, b->offset,
+							ROUNDUP(b->length, info.sector_size)))) {
+				exfat_queue_push(&ctx->free_q, b);
+				break;
+			}
+			exfat_queue_push(next, b);
+		}
+	}
+	exfat_queue_close(next);
+	return ret;
+}
+
+/**
+ * clone_image - copy allocated clusters to output
+ * @fd:          output file descriptor
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ */
+static int clone_image(int fd)
+{
+	int i, ret;
+	struct stat st;
+	pthread_t hasher, writer;
+	struct clone_buffer bufs[CLONE_BUFFERS] = {0};
+	struct clone_ctx ctx = {0};
+	bool hash = flags & OPTION_SHA256;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char hex[SHA256_DIGEST_SIZE * 2 + 1];
+
+	ctx.fd = fd;
+	ctx.size = (off_t)info.vol_size * info.sector_size;
+	if (info.total_size && info.total_size < ctx.size)
+		ctx.size = info.total_size;
+	ctx.seekable = !fstat(fd, &st) && S_ISREG(st.st_mode);
+	if (ctx.seekable && ftruncate(fd, 0) < 0) {
+		ret = -errno;
+		pr_err("ftruncate: %s\n", strerror(-ret));
+		return ret;
+	}
+	sha256_init(&ctx.sha);
+
+	/* Boot regions, FAT and allocated (or metadata) clusters */
+	if ((ret = clone_add_extent(&ctx, 0, (off_t)info.heap_offset * info.sector_size)) < 0)
+		goto out;
+	if (flags & OPTION_METADATA) {
+		ctx.packed = true;
+		if ((ret = clone_add_metadata(&ctx)) < 0)
+			goto out;
+		if ((ret = clone_write_header(&ctx)) < 0)
+			goto out;
+	} else if ((ret = exfat_scan_used_extents(clone_add_clusters, &ctx)) < 0) {
+		goto out;
+	}
+
+	if ((ret = exfat_queue_init(&ctx.free_q, CLONE_BUFFERS)) < 0)
+		goto out;
+	if ((ret = exfat_queue_init(&ctx.hash_q, CLONE_BUFFERS)) < 0)
+		goto free_q;
+	if ((ret = exfat_queue_init(&ctx.write_q, CLONE_BUFFERS)) < 0)
+		goto free_hash_q;
+	for (i = 0; i < CLONE_BUFFERS; i++) {
+		if (posix_memalign((void **)&bufs[i].data, 4096, CLONE_BUFFER_SIZE)) {
+			ret = -ENOMEM;
+			goto free_buf;
+		}
+		exfat_queue_push(&ctx.free_q, &bufs[i]);
+	}
+
+	if ((ret = pthread_create(&writer, NULL, clone_writer, &ctx))) {
+		pr_err("pthread_create: %s\n", strerror(ret));
+		ret = -ret;
+		goto free_buf;
+	}
+	if (hash && (ret = pthread_create(&hasher, NULL, clone_hasher, &ctx))) {
+		pr_err("pthread_create: %s\n", strerror(ret));
+		ret = -ret;
+		exfat_queue_close(&ctx.write_q);
+		pthread_join(writer, NULL);
+		goto free_buf;
+	}
+
+	ret = clone_reader(&ctx, hash ? &ctx.hash_q : &ctx.write_q);
+
+	if (hash)
+		pthread_join(hasher, NULL);
+	pthread_join(writer, NULL);
+	if (!ret)
+		ret = ctx.error;
+	if (ret)
+		goto free_buf;
+
+	pr_msg("%-16s: %" PRIu64 " bytes\n", "Volume size", (uint64_t)ctx.size);
+	pr_msg("%-16s: %" PRIu64 " bytes (%.2lf%%)\n", "Copied", ctx.copied,
+			ctx.size ? (double)ctx.copied * 100 / ctx.size : 0);
+	if (ctx.packed)
+		pr_msg("%-16s: %zu\n", "Extents", ctx.count);
+	if (hash) {
+		sha256_final(&ctx.sha, digest);
+		hash_to_hex(digest, SHA256_DIGEST_SIZE, hex);
+		pr_msg("%-16s: %s\n", "SHA-256", hex);
+	}
+
+free_buf:
+	for (i = 0; i < CLONE_BUFFERS; i++)
+		free(bufs[i].data);
+	exfat_queue_destroy(&ctx.write_q);
+free_hash_q:
+	exfat_queue_destroy(&ctx.hash_q);
+free_q:
+	exfat_queue_destroy(&ctx.free_q);
+out:
+	free(ctx.ext);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	int fd = STDOUT_FILENO;
+	struct exfat_bootsec boot;
+
+	while ((opt = getopt_long(argc, argv,
+					"ms",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case 'm':
+				flags |= OPTION_METADATA;
+				break;
+			case 's':
+				flags |= OPTION_SHA256;
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1 && optind != argc - 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	/* Image is written to stdout, so messages go to stderr */
+	output = stdout;
+	if (optind == argc - 1 || !strcmp(argv[optind + 1], "-")) {
+		output = stderr;
+		if (isatty(STDOUT_FILENO)) {
+			pr_err("Refusing to write image to terminal.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+	exfat_journal_check(argv[optind]);
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+
+	if (output == stdout && (fd = open(argv[optind + 1], O_WRONLY | O_CREAT, 0644)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+
+	if (clone_image(fd))
+		goto close_fd;
+
+	ret = EXIT_SUCCESS;
+close_fd:
+	if (fd != STDOUT_FILENO)
+		close(fd);
+out:
+	exfat_clean_info();
+	return ret;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _CLONEEXFAT_H
+#define _CLONEEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "hash.h"
+#include "thread.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "cloneexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+#define OPTION_SHA256    (1 << 0)
+#define OPTION_METADATA  (1 << 1)
+
+/* Buffers passed through pipeline (reader -> hasher -> writer) */
+#define CLONE_BUFFER_SIZE    (4 * 1024 * 1024)
+#define CLONE_BUFFERS        8
+
+/* Byte range in the image to be copied */
+struct clone_extent {
+	off_t offset;
+	uint64_t length;
+};
+
+struct clone_buffer {
+	off_t offset;
+	size_t length;
+	uint8_t *data;
+};
+
+struct clone_ctx {
+	struct clone_extent *ext;
+	size_t count;
+	off_t size;
+	int fd;
+	bool seekable;
+	bool packed;
+	off_t data_offset;
+	int error;
+	uint64_t copied;
+	struct sha256_ctx sha;
+	struct exfat_queue free_q;
+	struct exfat_queue hash_q;
+	struct exfat_queue write_q;
+};
+
+#endif /*_CLONEEXFAT_H */
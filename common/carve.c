@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "exfat.h"
+#include "thread.h"
+#include "carve.h"
+
+extern struct exfat_info info;
+
+/* Work shared by carving workers */
+struct exfat_carve_ctx {
+	pthread_mutex_t lock;
+	const uint8_t *target;
+	uint32_t chunk;
+	struct exfat_carve_set *sets;
+	size_t count;
+	size_t size;
+	int error;
+};
+
+/* Repeat byte @c in all bytes of 64bit word */
+#define CARVE_BYTES(c)    (0x0101010101010101ULL * (uint8_t)(c))
+/* The number of EntryType which are packed into 64bit word */
+#define CARVE_LANES       (sizeof(uint64_t))
+
+/**
+ * exfat_carve_match - find bytes which equal to @c in @x
+ * @x:                 8 bytes
+ * @c:                 byte to find
+ *
+ * @return             MSB of each byte is set, if the byte may equal to @c
+ *
+ * NOTE: Byte above matched byte can be set by borrow (false positive),
+ *       but matched byte is never missed.
+ */
+static inline uint64_t exfat_carve_match(uint64_t x, uint8_t c)
+{
+	x ^= CARVE_BYTES(c);
+	return (x - CARVE_BYTES(0x01)) & ~x & CARVE_BYTES(0x80);
+}
+
+/**
+ * exfat_carve_prefilter - find File entry followed by Stream entry
+ * @d:                     directory entries
+ * @i:                     first index of CARVE_LANES entries
+ * @entries:               the number of entries in @d
+ *
+ * @return                 MSB of k-th byte is set, if @d[@i + k] may be start of entry set
+ *
+ * NOTE: EntryType of 8 entries are packed into one word and compared at once,
+ *       so that most of clusters (file data) are skipped without branch per entry.
+ */
+static inline uint64_t exfat_carve_prefilter(struct exfat_dentry *d, size_t i, size_t entries)
+{
+	size_t k;
+	uint64_t types = 0, next;
+
+	for (k = 0; k < CARVE_LANES && i + k < entries; k++)
+		types |= (uint64_t)d[i + k].EntryType << (k * CHAR_BIT);
+	next = types >> CHAR_BIT;
+	if (i + CARVE_LANES < entries)
+		next |= (uint64_t)d[i + CARVE_LANES].EntryType << ((CARVE_LANES - 1) * CHAR_BIT);
+
+	return exfat_carve_match(types, DENTRY_FILE) & exfat_carve_match(next, DENTRY_STREAM);
+}
+
+/**
+ * exfat_carve_check_set - verify entry set
+ * @d:                     directory entries
+ * @i:                     index of File entry
+ * @entries:               the number of entries in @d
+ *
+ * @return                 the number of secondary entries (entry set is valid)
+ *                         0 (not entry set)
+ */
+static int exfat_carve_check_set(struct exfat_dentry *d, size_t i, size_t entries)
+{
+	int count;
+	uint32_t first;
+
+	if ((count = exfat_check_entry_set(d, i, entries, ENTRY_SET_CHECKSUM)) == 0)
+		return 0;
+
+	first = le32_to_cpu(d[i + 1].dentry.stream.FirstCluster);
+	if (first && (first < EXFAT_FIRST_CLUSTER || first > info.cluster_count + 1))
+		return 0;
+	return count;
+}
+
+/**
+ * exfat_carve_set_error - record error of worker
+ * @ctx:                   carving context
+ * @err:                   error code
+ *
+ * NOTE: The first error is kept.
+ */
+static void exfat_carve_set_error(struct exfat_carve_ctx *ctx, int err)
+{
+	pthread_mutex_lock(&ctx->lock);
+	if (!ctx->error)
+		ctx->error = err;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * exfat_carve_add_set - record entry set
+ * @ctx:                 carving context
+ * @d:                   File entry (and following secondary entries)
+ * @clu:                 cluster which contains File entry
+ * @entry:               index of File entry in @clu
+ * @count:               the number of secondary entries
+ */
+static void exfat_carve_add_set(struct exfat_carve_ctx *ctx, struct exfat_dentry *d,
+		uint32_t clu, uint32_t entry, int count)
+{
+	struct exfat_carve_set *tmp, s;
+
+	s.clu = clu;
+	s.entry = entry;
+	s.first = le32_to_cpu(d[1].dentry.stream.FirstCluster);
+	s.datalen = le64_to_cpu(d[1].dentry.stream.DataLength);
+	s.attr = le16_to_cpu(d[0].dentry.file.FileAttributes);
+	s.flags = d[1].dentry.stream.GeneralSecondaryFlags;
+	s.count = count;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->sets, (ctx->size ? ctx->size * 2 : 64) * sizeof(struct exfat_carve_set));
+		if (!tmp) {
+			if (!ctx->error)
+				ctx->error = -ENOMEM;
+			pthread_mutex_unlock(&ctx->lock);
+			return;
+		}
+		ctx->sets = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 64;
+	}
+	ctx->sets[ctx->count++] = s;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * exfat_carve_scan - find entry sets in clusters
+ * @ctx:              carving context
+ * @d:                clusters
+ * @entries:          the number of entries in @d
+ * @limit:            the number of entries where entry set can start
+ * @clu:              first cluster of @d
+ */
+static void exfat_carve_scan(struct exfat_carve_ctx *ctx, struct exfat_dentry *d,
+		size_t entries, size_t limit, uint32_t clu)
+{
+	int count;
+	size_t i, k;
+	size_t per_cluster = info.cluster_size / sizeof(struct exfat_dentry);
+	uint64_t m;
+
+	for (i = 0; i < limit; i += CARVE_LANES) {
+		m = exfat_carve_prefilter(d, i, entries);
+		while (m) {
+			k = i + __builtin_ctzll(m) / CHAR_BIT;
+			m &= m - 1;
+			if (k >= limit || !(count = exfat_carve_check_set(d, k, entries)))
+				continue;
+			exfat_carve_add_set(ctx, d + k, clu + k / per_cluster, k % per_cluster, count);
+		}
+	}
+}
+
+/**
+ * exfat_carve_target - whether or not @clu should be scanned
+ * @ctx:                carving context
+ * @clu:                cluster index
+ *
+ * @return              1 (scan @clu)
+ *                      0 (skip @clu)
+ */
+static inline int exfat_carve_target(struct exfat_carve_ctx *ctx, uint32_t clu)
+{
+	uint32_t i = clu - EXFAT_FIRST_CLUSTER;
+
+	return (ctx->target[i / CHAR_BIT] >> (i % CHAR_BIT)) & 0x01;
+}
+
+/**
+ * exfat_carve_worker - scan one chunk of cluster heap
+ * @i:                  chunk index
+ * @arg:                carving context
+ *
+ * NOTE: Contiguous target clusters are read at once.
+ *       One more cluster is read, so that entry set across clusters is found.
+ */
+static void exfat_carve_worker(size_t i, void *arg)
+{
+	void *data;
+	struct exfat_carve_ctx *ctx = arg;
+	uint32_t clu = EXFAT_FIRST_CLUSTER + i * ctx->chunk;
+	uint32_t last = info.cluster_count + EXFAT_FIRST_CLUSTER;
+	uint32_t end = MIN(clu + ctx->chunk, last);
+	uint32_t run, len;
+	size_t per_cluster = info.cluster_size / sizeof(struct exfat_dentry);
+
+	if ((data = malloc(((size_t)ctx->chunk + 1) * info.cluster_size)) == NULL) {
+		exfat_carve_set_error(ctx, -ENOMEM);
+		return;
+	}
+
+	while (clu < end) {
+		if (!exfat_carve_target(ctx, clu)) {
+			clu++;
+			continue;
+		}
+		for (run = clu + 1; run < end && exfat_carve_target(ctx, run); run++)
+			;
+		len = run - clu;
+		if (run < last && exfat_carve_target(ctx, run))
+			len++;
+
+		if (get_clusters(data, clu, len)) {
+			exfat_carve_set_error(ctx, -EIO);
+			break;
+		}
+		exfat_carve_scan(ctx, data, len * per_cluster, (run - clu) * per_cluster, clu);
+		clu = run;
+	}
+	free(data);
+}
+
+/**
+ * exfat_carve_compare - compare entry sets by location
+ * @a:                   entry set
+ * @b:                   entry set
+ *
+ * @return               order of @a and @b
+ */
+static int exfat_carve_compare(const void *a, const void *b)
+{
+	const struct exfat_carve_set *x = a, *y = b;
+
+	if (x->clu != y->clu)
+		return x->clu < y->clu ? -1 : 1;
+	if (x->entry != y->entry)
+		return x->entry < y->entry ? -1 : 1;
+	return 0;
+}
+
+/**
+ * exfat_carve_heap - find entry sets in cluster heap
+ * @target:           clusters to be scanned (same format as Allocation Bitmap)
+ *                    NULL (all allocated clusters)
+ * @sets:             entry sets sorted by location (Output)
+ * @count:            the number of @sets (Output)
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: Cluster heap is split into chunks, which are scanned by worker threads.
+ *       Only entry sets which are in use and whose SetChecksum is valid are found.
+ *       Caller must release @sets.
+ */
+int exfat_carve_heap(const uint8_t *target, struct exfat_carve_set **sets, size_t *count)
+{
+	size_t chunks;
+	struct exfat_carve_ctx ctx = {0};
+
+	*sets = NULL;
+	*count = 0;
+
+	ctx.target = target ? target : info.alloc_table;
+	if (!ctx.target || !info.cluster_count)
+		return -EINVAL;
+
+	ctx.chunk = MAX(EXFAT_CARVE_CHUNK_SIZE / info.cluster_size, 1);
+	chunks = ROUNDUP((size_t)info.cluster_count, ctx.chunk);
+	pthread_mutex_init(&ctx.lock, NULL);
+	exfat_parallel_for(chunks, 0, exfat_carve_worker, &ctx);
+	pthread_mutex_destroy(&ctx.lock);
+
+	if (ctx.error) {
+		free(ctx.sets);
+		return ctx.error;
+	}
+
+	if (ctx.count)
+		qsort(ctx.sets, ctx.count, sizeof(struct exfat_carve_set), exfat_carve_compare);
+	*sets = ctx.sets;
+	*count = ctx.count;
+	return 0;
+}
+
+/**
+ * exfat_carve_lost_directories - find top of lost directory trees
+ * @sets:                         entry sets found by exfat_carve_heap()
+ * @count:                        the number of @sets
+ * @roots:                        lost directories (Output)
+ * @num:                          the number of @roots (Output)
+ *
+ * @return                        == 0 (success)
+ *                                <  0 (failed)
+ *
+ * NOTE: Cluster which contains entry sets is regarded as directory.
+ *       It is top of lost tree, unless it is referenced as subdirectory
+ *       from other entry set or is continued from other directory cluster.
+ *       Directory cluster whose FAT entry is unused is continued to the next
+ *       cluster if it is also such directory cluster (NoFatChain).
+ *       Caller must release @roots.
+ */
+int exfat_carve_lost_directories(const struct exfat_carve_set *sets, size_t count,
+		struct exfat_carve_root **roots, size_t *num)
+{
+	int ret = 0;
+	size_t i, n = 0;
+	uint32_t clu, next;
+	uint64_t j, len;
+	bitmap_t referenced, carved, contiguous;
+	struct exfat_carve_root *tmp;
+
+	*roots = NULL;
+	*num = 0;
+
+	init_bitmap(&referenced, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	init_bitmap(&carved, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	init_bitmap(&contiguous, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	if (!referenced.data || !carved.data || !contiguous.data) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < count; i++)
+		set_bitmap(&carved, sets[i].clu);
+
+	for (i = 0; i < count; i++) {
+		if (!(sets[i].attr & ATTR_DIRECTORY) || !sets[i].first)
+			continue;
+
+		/* Subdirectory */
+		len = MIN(MAX(ROUNDUP(sets[i].datalen, info.cluster_size), 1), info.cluster_count);
+		for (j = 0, clu = sets[i].first; j < len; j++) {
+			set_bitmap(&referenced, clu);
+			if (sets[i].flags & ALLOC_NOFATCHAIN)
+				next = clu + 1;
+			else if (exfat_get_fat(clu, &next))
+				break;
+			if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1)
+				break;
+			clu = next;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		clu = sets[i].clu;
+		if (i && sets[i - 1].clu == clu)
+			continue;
+
+		/* Continued directory cluster */
+		if (exfat_get_fat(clu, &next))
+			continue;
+		if (next != clu && next >= EXFAT_FIRST_CLUSTER && next <= info.cluster_count + 1)
+			set_bitmap(&referenced, next);
+		else if (!next && clu <= info.cluster_count && get_bitmap(&carved, clu + 1) &&
+				!get_bitmap(&referenced, clu + 1) &&
+				!exfat_get_fat(clu + 1, &next) && !next)
+			set_bitmap(&contiguous, clu + 1);
+	}
+
+	for (i = 0; i < count; i++) {
+		clu = sets[i].clu;
+		if ((i && sets[i - 1].clu == clu) || get_bitmap(&referenced, clu) ||
+				get_bitmap(&contiguous, clu))
+			continue;
+
+		/* Expand list by power of two */
+		if (!(n & (n - 1))) {
+			tmp = realloc(*roots, (n ? n * 2 : 1) * sizeof(struct exfat_carve_root));
+			if (!tmp) {
+				free(*roots);
+				*roots = NULL;
+				ret = -ENOMEM;
+				goto out;
+			}
+			*roots = tmp;
+		}
+		(*roots)[n].clu = clu;
+		for (len = 1; clu + len <= info.cluster_count + 1 &&
+				get_bitmap(&contiguous, clu + len); len++)
+			;
+		(*roots)[n++].contiguous = len;
+	}
+
+	*num = n;
+out:
+	free_bitmap(&contiguous);
+	free_bitmap(&carved);
+	free_bitmap(&referenced);
+	return ret;
+}
+
+/**
+ * exfat_carve_create_cache - register lost directory in directory cache
+ * @root:                     lost directory
+ * @name:                     name of lost directory
+ *
+ * @return                    == 0 (success)
+ *                            <  0 (failed)
+ *
+ * NOTE: Size of lost directory is estimated by FAT chain,
+ *       or by contiguous directory clusters if FAT chain isn't used.
+ */
+int exfat_carve_create_cache(const struct exfat_carve_root *root, const char *name)
+{
+	int index;
+	uint32_t clu = root->clu;
+	uint32_t next, tmp = clu;
+	uint64_t num;
+	struct exfat_fileinfo *d;
+
+	if (exfat_check_cache(clu))
+		return -EEXIST;
+
+	for (num = 1, next = 0; num < info.cluster_count; num++) {
+		if (exfat_get_fat(tmp, &next))
+			break;
+		if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1 ||
+				exfat_load_bitmap(next) != 1)
+			break;
+		tmp = next;
+	}
+
+	if ((d = calloc(sizeof(struct exfat_fileinfo), 1)) == NULL)
+		return -ENOMEM;
+	if ((d->name = (unsigned char *)strdup(name)) == NULL) {
+		free(d);
+		return -ENOMEM;
+	}
+	d->namelen = strlen(name);
+	d->attr = ATTR_DIRECTORY;
+	d->clu = clu;
+	/* FAT entry isn't used (NoFatChain), so contiguous clusters are trusted */
+	if (num == 1 && next != EXFAT_LASTCLUSTER) {
+		d->flags = ALLOC_NOFATCHAIN;
+		num = MAX(root->contiguous, 1);
+	}
+	d->datalen = num * info.cluster_size;
+
+	index = exfat_get_cache(clu);
+	info.root[index] = init_node2(clu, d);
+	if (info.root[index] == NULL) {
+		free(d->name);
+		free(d);
+		return -ENOMEM;
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _CARVE_H
+#define _CARVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of cluster heap scanned by one worker at a time */
+#define EXFAT_CARVE_CHUNK_SIZE    (4 * 1024 * 1024)
+
+/* Entry set (File, Stream and Name) found in cluster heap */
+struct exfat_carve_set {
+	uint32_t clu;
+	uint32_t entry;
+	uint32_t first;
+	uint64_t datalen;
+	uint16_t attr;
+	uint8_t flags;
+	uint8_t count;
+};
+
+/* Top of lost directory tree */
+struct exfat_carve_root {
+	uint32_t clu;
+	/* The number of contiguous clusters (only used if FAT chain isn't used) */
+	uint32_t contiguous;
+};
+
+int exfat_carve_heap(const uint8_t *, struct exfat_carve_set **, size_t *);
+int exfat_carve_lost_directories(const struct exfat_carve_set *, size_t,
+		struct exfat_carve_root **, size_t *);
+int exfat_carve_create_cache(const struct exfat_carve_root *, const char *);
+
+#endif /*_CARVE_H */
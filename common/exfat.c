@@ -14,15 +14,65 @@
 #include <sys/stat.h>
 #include "bitmap.h"
 #include "exfat.h"
+#include "index.h"
+#include "trans.h"
+#include "trace.h"
 
 extern struct exfat_info info;
 
+/* Shared page for characters which aren't changed by up-case table */
+static uint16_t upcase_identity_page[UPCASE_PAGE_SIZE];
+
 /*************************************************************************************************/
 /*                                                                                               */
 /* GENERIC FUNCTION                                                                              */
 /*                                                                                               */
 /*************************************************************************************************/
 
+/**
+ * exfat_read_meta - Read data from metadata image
+ * @data:            raw data (Output)
+ * @index:           Start bytes in original image
+ * @len:             length
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ *
+ * NOTE: Range which isn't exported is filled with zero.
+ */
+static int exfat_read_meta(void *data, off_t index, size_t len)
+{
+	int ret;
+	uint32_t lo = 0, hi = info.meta_count, mid;
+	uint64_t start, end, pos = index, last = index + len;
+	struct exfat_meta_extent *e;
+
+	memset(data, 0, len);
+
+	/* first extent which ends after @index */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = &info.meta[mid];
+		if (e->Offset + e->Length <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < info.meta_count && info.meta[lo].Offset < last; lo++) {
+		e = &info.meta[lo];
+		start = MAX(e->Offset, pos);
+		end = MIN(e->Offset + e->Length, last);
+		if (pread(info.fd, (char *)data + (start - pos),
+					end - start, e->FileOffset + (start - e->Offset)) < 0) {
+			ret = -errno;
+			pr_err("read: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
 /**
  * get_sector - Get Raw-Data from any sector
  * @data:       Sector raw data (Output)
@@ -36,14 +86,24 @@ extern struct exfat_info info;
  */
 int get_sector(void *data, off_t index, size_t count)
 {
+	int ret = 0;
 	size_t sector_size = info.sector_size;
 
+	trace_exfat2(get_sector__entry, index, count);
 	pr_debug("Get: Sector from 0x%lx to 0x%lx\n", index , index + (count * sector_size) - 1);
-	if ((pread(info.fd, data, count * sector_size, index)) < 0) {
-		pr_err("read: %s\n", strerror(errno));
-		return -errno;
-	}
-	return 0;
+	if (info.trans && exfat_trans_cached(index, count))
+		ret = 0;
+	else if (info.meta)
+		ret = exfat_read_meta(data, index, count * sector_size);
+	else if ((pread(info.fd, data, count * sector_size, index)) < 0) {
+		ret = -errno;
+		pr_err("read: %s\n", strerror(-ret));
+	}
+	/* Sectors written in transaction aren't on disk yet */
+	if (!ret && info.trans)
+		exfat_trans_read(data, index, count);
+	trace_exfat2(get_sector__return, index, ret);
+	return ret;
 }
 
 /**
@@ -59,14 +119,22 @@ int get_sector(void *data, off_t index, size_t count)
  */
 int set_sector(void *data, off_t index, size_t count)
 {
+	int ret = 0;
 	size_t sector_size = info.sector_size;
 
+	trace_exfat2(set_sector__entry, index, count);
 	pr_debug("Set: Sector from 0x%lx to 0x%lx\n", index, index + (count * sector_size) - 1);
-	if ((pwrite(info.fd, data, count * sector_size, index)) < 0) {
-		pr_err("write: %s\n", strerror(errno));
-		return -errno;
-	}
-	return 0;
+	if (info.meta) {
+		pr_err("write: metadata image is read-only.\n");
+		ret = -EROFS;
+	} else if (info.trans) {
+		ret = exfat_trans_write(data, index, count);
+	} else if ((pwrite(info.fd, data, count * sector_size, index)) < 0) {
+		ret = -errno;
+		pr_err("write: %s\n", strerror(-ret));
+	}
+	trace_exfat2(set_sector__return, index, ret);
+	return ret;
 }
 
 /**
@@ -115,7 +183,7 @@ int get_clusters(void *data, off_t index, size_t num)
 	size_t clu_per_sec = info.cluster_size / info.sector_size;
 	off_t heap_start = info.heap_offset * info.sector_size;
 
-	if (index < EXFAT_FIRST_CLUSTER || index + num > info.cluster_count) {
+	if (index < EXFAT_FIRST_CLUSTER || index + num > info.cluster_count + EXFAT_FIRST_CLUSTER) {
 		pr_err("Internal Error: invalid cluster range %lu ~ %lu.\n", index, index + num - 1);
 		return -EINVAL;
 	}
@@ -141,7 +209,7 @@ int set_clusters(void *data, off_t index, size_t num)
 	size_t clu_per_sec = info.cluster_size / info.sector_size;
 	off_t heap_start = info.heap_offset * info.sector_size;
 
-	if (index < EXFAT_FIRST_CLUSTER || index + num > info.cluster_count) {
+	if (index < EXFAT_FIRST_CLUSTER || index + num > info.cluster_count + EXFAT_FIRST_CLUSTER) {
 		pr_err("Internal Error: invalid cluster range %lu ~ %lu.\n", index, index + num - 1);
 		return -EINVAL;
 	}
@@ -174,17 +242,28 @@ int exfat_init_info(void)
 	info.cluster_count = 0;
 	info.fat_offset = 0;
 	info.fat_length = 0;
+	info.fat_count = 0;
+	info.fat_table = NULL;
 	info.heap_offset = 0;
 	info.root_offset = 0;
 	info.alloc_offset = 0;
 	info.alloc_length = 0;
 	info.alloc_table = NULL;
 	info.upcase_table = NULL;
+	info.upcase_pages = NULL;
 	info.upcase_size = 0;
 	info.vol_label = calloc(sizeof(uint16_t), 11);
 	info.vol_length = 0;
 	info.root_size = DENTRY_LISTSIZE;
 	info.root = calloc(info.root_size, sizeof(node2_t *));
+	info.csum_errors = NULL;
+	info.csum_error_count = 0;
+	info.csum_error_size = 0;
+	info.meta = NULL;
+	info.meta_count = 0;
+	info.index = NULL;
+	info.trans = NULL;
+	info.journal = NULL;
 
 	if (!info.vol_label || !info.root)
 		return -ENOMEM;
@@ -206,8 +285,9 @@ int exfat_store_info(struct exfat_bootsec *b)
 	struct exfat_fileinfo *f;
 
 	if (fstat(info.fd, &s) < 0) {
-		pr_err("stat: %s\n", strerror(errno));
-		return -errno;
+		ret = -errno;
+		pr_err("stat: %s\n", strerror(-ret));
+		return ret;
 	}
 
 	if ((f = calloc(sizeof(struct exfat_fileinfo), 1)) == NULL)
@@ -217,7 +297,9 @@ int exfat_store_info(struct exfat_bootsec *b)
 		return -ENOMEM;
 	}
 
-	info.total_size = s.st_size;
+	/* Metadata image keeps the size of original image */
+	if (!info.meta)
+		info.total_size = s.st_size;
 	info.partition_offset = cpu_to_le64(b->PartitionOffset);
 	info.vol_size = cpu_to_le64(b->VolumeLength);
 	info.sector_size = 1 << b->BytesPerSectorShift;
@@ -225,6 +307,7 @@ int exfat_store_info(struct exfat_bootsec *b)
 	info.cluster_count = cpu_to_le32(b->ClusterCount);
 	info.fat_offset = cpu_to_le32(b->FatOffset);
 	info.fat_length = b->NumberOfFats * cpu_to_le32(b->FatLength) * info.sector_size;
+	info.fat_count = b->NumberOfFats;
 	info.heap_offset = cpu_to_le32(b->ClusterHeapOffset);
 	info.root_offset = cpu_to_le32(b->FirstClusterOfRootDirectory);
 	info.root[0] = init_node2(info.root_offset, f);
@@ -254,8 +337,14 @@ int exfat_clean_info(void)
 	node2_t *tmp;
 	struct exfat_fileinfo *f;
 
+	/* Uncommitted transaction is discarded */
+	while (info.trans)
+		exfat_trans_abort();
+
 	free(info.alloc_table);
+	free(info.fat_table);
 	free(info.upcase_table);
+	exfat_clean_upcase_table();
 	free(info.vol_label);
 
 	for(index = 0; index < info.root_size && info.root[index]; index++) {
@@ -269,11 +358,21 @@ int exfat_clean_info(void)
 		free(tmp);
 	}
 	free(info.root);
+	free(info.csum_errors);
+	free(info.meta);
+	free(info.journal);
+	exfat_index_close();
 
 	info.alloc_table = NULL;
+	info.fat_table = NULL;
 	info.upcase_table = NULL;
 	info.vol_label = NULL;
 	info.root = NULL;
+	info.csum_errors = NULL;
+	info.csum_error_count = 0;
+	info.meta = NULL;
+	info.meta_count = 0;
+	info.journal = NULL;
 
 	if (info.fd != -1)
 		close(info.fd);
@@ -281,6 +380,62 @@ int exfat_clean_info(void)
 	return 0;
 }
 
+/**
+ * exfat_load_meta - load extent table if image is metadata image
+ *
+ * @return:          == 0 (Success, or image isn't metadata image)
+ *                   <  0 (failed)
+ */
+int exfat_load_meta(void)
+{
+	uint32_t i, count;
+	size_t len;
+	struct exfat_meta_header h;
+	struct exfat_meta_extent *e;
+
+	if (info.meta)
+		return 0;
+	if (pread(info.fd, &h, sizeof(h), 0) != sizeof(h) ||
+			memcmp(h.Magic, EXFAT_META_MAGIC, sizeof(h.Magic)))
+		return 0;
+
+	if (le32_to_cpu(h.Version) != EXFAT_META_VERSION) {
+		pr_err("Metadata image version %u is not supported.\n", le32_to_cpu(h.Version));
+		return -EINVAL;
+	}
+
+	count = le32_to_cpu(h.ExtentCount);
+	len = (size_t)count * sizeof(struct exfat_meta_extent);
+	if (!count) {
+		pr_err("Metadata image: extent table is empty.\n");
+		return -EINVAL;
+	}
+	if ((e = malloc(len)) == NULL)
+		return -ENOMEM;
+	if (pread(info.fd, e, len, sizeof(h)) != (ssize_t)len) {
+		pr_err("Metadata image: extent table is truncated.\n");
+		free(e);
+		return -EIO;
+	}
+
+	for (i = 0; i < count; i++) {
+		e[i].Offset = le64_to_cpu(e[i].Offset);
+		e[i].Length = le64_to_cpu(e[i].Length);
+		e[i].FileOffset = le64_to_cpu(e[i].FileOffset);
+		if (i && e[i - 1].Offset + e[i - 1].Length > e[i].Offset) {
+			pr_err("Metadata image: extent table is not sorted.\n");
+			free(e);
+			return -EINVAL;
+		}
+	}
+
+	info.meta = e;
+	info.meta_count = count;
+	info.total_size = le64_to_cpu(h.ImageSize);
+	pr_info("Metadata image: %u extents\n", count);
+	return 0;
+}
+
 /**
  * exfat_load_bootsec - load boot sector
  * @b:                  boot sector pointer in exFAT (Output)
@@ -290,6 +445,8 @@ int exfat_clean_info(void)
  */
 int exfat_load_bootsec(struct exfat_bootsec *b)
 {
+	if (exfat_load_meta())
+		return -EIO;
 	if (get_sector(b, 0, 1))
 		return -EIO;
 
@@ -437,49 +594,217 @@ int exfat_check_bootchecksum(void)
 {
 	int i;
 	uint8_t *b;
-	uint32_t *bootchecksum = NULL;
+	uint32_t *bootchecksum;
 	uint32_t checksum = 0;
+	struct exfat_checksum_ctx ctx;
 
-	if ((b = calloc(info.sector_size, 11)) == NULL)
-		return -ENOMEM;
-
-	if (get_sector(b, 0, 11)) {
-		free(b);
-		return -EIO;
-	}
-	checksum = exfat_calculate_bootchecksum(b, info.sector_size);
-
-	if ((bootchecksum = calloc(info.sector_size, 1)) == NULL) {
-		free(b);
+	if ((b = calloc(info.sector_size, 12)) == NULL)
 		return -ENOMEM;
-	}
 
-	if (get_sector(bootchecksum, info.sector_size * 11, 1)) {
-		free(bootchecksum);
+	if (get_sector(b, 0, 12)) {
 		free(b);
 		return -EIO;
 	}
+	exfat_checksum_init(&ctx);
+	exfat_bootchecksum_update(&ctx, b, info.sector_size * 11);
+	checksum = exfat_checksum_final(&ctx);
 
+	bootchecksum = (uint32_t *)(b + info.sector_size * 11);
 	for (i = 0; i < info.sector_size / sizeof(uint32_t); i++) {
-		if (cpu_to_le32(bootchecksum[i]) != checksum) {
+		if (le32_to_cpu(bootchecksum[i]) != checksum) {
 			pr_err("Boot region checksum(%08x) is unmatched.\n", checksum);
-			free(bootchecksum);
 			free(b);
 			return -EINVAL;
 		}
 	}
 
-	free(bootchecksum);
 	free(b);
 	return 0;
 }
 
+/* Differing range between two copies of redundant region */
+struct exfat_diff_range {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	bool open;
+	uint64_t count;
+};
+
+/**
+ * exfat_diff_close - report differing range if exists
+ * @r:                range information
+ */
+static void exfat_diff_close(struct exfat_diff_range *r)
+{
+	if (!r->open)
+		return;
+
+	pr_warn("%s: offset 0x%" PRIx64 " - 0x%" PRIx64 " is different.\n",
+			r->name, r->start, r->end - 1);
+	r->open = false;
+	r->count++;
+}
+
+/**
+ * exfat_diff_chunk - find differing ranges in chunk
+ * @r:                range information
+ * @a:                chunk in first copy
+ * @b:                chunk in second copy
+ * @len:              chunk length
+ * @off:              offset of chunk from the beginning of region
+ *
+ * NOTE: Differing words next to each other are merged into one range,
+ *       and range which continues to next chunk is kept open.
+ */
+static void exfat_diff_chunk(struct exfat_diff_range *r,
+		const uint8_t *a, const uint8_t *b, size_t len, uint64_t off)
+{
+	size_t i, j, width;
+	uint64_t wa, wb;
+
+	if (!memcmp(a, b, len)) {
+		exfat_diff_close(r);
+		return;
+	}
+
+	for (i = 0; i < len; i += width) {
+		width = MIN(len - i, sizeof(uint64_t));
+		wa = wb = 0;
+		memcpy(&wa, a + i, width);
+		memcpy(&wb, b + i, width);
+		if (wa == wb) {
+			exfat_diff_close(r);
+			continue;
+		}
+
+		if (!r->open) {
+			for (j = 0; a[i + j] == b[i + j]; j++)
+				;
+			r->open = true;
+			r->start = off + i + j;
+		}
+		for (j = width; a[i + j - 1] == b[i + j - 1]; j--)
+			;
+		r->end = off + i + j;
+	}
+}
+
+/**
+ * exfat_check_backup_bootsec - compare Main Boot region with Backup Boot region
+ *
+ * @return                      == 0 (same)
+ *                              >  0 (the number of differing ranges)
+ *                              <  0 (failed)
+ *
+ * NOTE: VolumeFlags and PercentInUse are excluded, the same as Boot checksum.
+ */
+int exfat_check_backup_bootsec(void)
+{
+	uint8_t *b;
+	size_t len = info.sector_size * 12;
+	struct exfat_diff_range r = {"Backup Boot region", 0, 0, false, 0};
+
+	if ((b = calloc(info.sector_size, 24)) == NULL)
+		return -ENOMEM;
+
+	if (get_sector(b, 0, 24)) {
+		free(b);
+		return -EIO;
+	}
+
+	b[106] = b[107] = b[112] = 0;
+	b[len + 106] = b[len + 107] = b[len + 112] = 0;
+
+	exfat_diff_chunk(&r, b, b + len, len, 0);
+	exfat_diff_close(&r);
+
+	free(b);
+	return r.count;
+}
+
+/**
+ * exfat_check_fat_mirror - compare First FAT with Second FAT
+ *
+ * @return                  == 0 (same, or there is only one FAT)
+ *                          >  0 (the number of differing ranges)
+ *                          <  0 (failed)
+ */
+int exfat_check_fat_mirror(void)
+{
+	int ret = 0;
+	void *fat1 = NULL, *fat2 = NULL;
+	off_t first, second;
+	uint64_t offset, length;
+	size_t len;
+	struct exfat_diff_range r = {"Second FAT", 0, 0, false, 0};
+
+	if (info.fat_count != 2)
+		return 0;
+
+	length = info.fat_length / info.fat_count;
+	first = (off_t)info.fat_offset * info.sector_size;
+	second = first + length;
+
+	if (posix_memalign(&fat1, EXFAT_COMPARE_CHUNK, EXFAT_COMPARE_CHUNK) ||
+			posix_memalign(&fat2, EXFAT_COMPARE_CHUNK, EXFAT_COMPARE_CHUNK)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (offset = 0; offset < length; offset += len) {
+		len = MIN(length - offset, EXFAT_COMPARE_CHUNK);
+		if (get_sector(fat1, first + offset, len / info.sector_size) ||
+				get_sector(fat2, second + offset, len / info.sector_size)) {
+			ret = -EIO;
+			goto out;
+		}
+		exfat_diff_chunk(&r, fat1, fat2, len, offset);
+	}
+	exfat_diff_close(&r);
+	ret = r.count;
+out:
+	free(fat2);
+	free(fat1);
+	return ret;
+}
+
 /*************************************************************************************************/
 /*                                                                                               */
 /* FAT-ENTRY FUNCTION                                                                            */
 /*                                                                                               */
 /*************************************************************************************************/
 
+/**
+ * exfat_load_fat_table - load First FAT into memory
+ *
+ * @return                == 0 (success)
+ *                        <  0 (failed)
+ *
+ * NOTE: After loading, exfat_get_fat() doesn't read FAT from the image,
+ *       and exfat_set_fat() updates both of the image and the table.
+ */
+int exfat_load_fat_table(void)
+{
+	size_t length = ((size_t)info.cluster_count + EXFAT_FIRST_CLUSTER) * sizeof(uint32_t);
+	size_t sector_num = ROUNDUP(length, info.sector_size);
+	uint32_t *fat;
+
+	if (info.fat_table)
+		return 0;
+
+	if ((fat = malloc(sector_num * info.sector_size)) == NULL)
+		return -ENOMEM;
+
+	if (get_sector(fat, (off_t)info.fat_offset * info.sector_size, sector_num)) {
+		free(fat);
+		return -EIO;
+	}
+
+	info.fat_table = fat;
+	return 0;
+}
+
 /**
  * exfat_get_fat - Whether or not cluster is continuous
  * @clu:           index of the cluster want to check
@@ -492,15 +817,11 @@ int exfat_get_fat(uint32_t clu, uint32_t *entry)
 {
 	int ret = -EINVAL;
 	size_t entry_per_sector = info.sector_size / sizeof(uint32_t);
-	uint32_t fat_index = (info.fat_offset +  clu / entry_per_sector) * info.sector_size;
-	uint32_t *fat;
+	off_t fat_index = ((off_t)info.fat_offset +  clu / entry_per_sector) * info.sector_size;
+	uint32_t *fat = NULL;
 	uint32_t offset = (clu) % entry_per_sector;
 
-	if ((fat = malloc(info.sector_size)) == NULL)
-		return -ENOMEM;;
-	if (get_sector(fat, fat_index, 1))
-		goto out;
-
+	trace_exfat1(get_fat__entry, clu);
 	if (clu == EXFAT_BADCLUSTER)
 		pr_err("Internal Error: Cluster %x is bad cluster.\n", clu);
 	else if (clu == EXFAT_LASTCLUSTER)
@@ -510,12 +831,24 @@ int exfat_get_fat(uint32_t clu, uint32_t *entry)
 	else
 		ret = 0;
 
-	if (!ret) {
-		*entry = cpu_to_le32(fat[offset]);
-		pr_debug("Get FAT[%u]  0x%x.\n", clu, *entry);
+	if (ret)
+		goto out;
+
+	if (info.fat_table) {
+		*entry = le32_to_cpu(info.fat_table[clu]);
+	} else {
+		if ((fat = malloc(info.sector_size)) == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if ((ret = get_sector(fat, fat_index, 1)))
+			goto out;
+		*entry = le32_to_cpu(fat[offset]);
 	}
+	pr_debug("Get FAT[%u]  0x%x.\n", clu, *entry);
 
 out:
+	trace_exfat3(get_fat__return, clu, ret ? 0 : *entry, ret);
 	free(fat);
 	return ret;
 }
@@ -523,16 +856,16 @@ out:
 /**
  * exfat_set_fat - Update FAT Entry to any cluster
  * @clu:           index of the cluster want to check
- * @entry:         any cluster index
+ * @entry:         any cluster index (0: free, EXFAT_LASTCLUSTER: end of chain)
  *
  * @return         == 0 (success)
  *                 <  0 (failed)
  */
 int exfat_set_fat(uint32_t clu, uint32_t entry)
 {
-	uint32_t ret = -EINVAL;
+	int ret = -EINVAL;
 	size_t entry_per_sector = info.sector_size / sizeof(uint32_t);
-	uint32_t fat_index = (info.fat_offset +  clu / entry_per_sector) * info.sector_size;
+	off_t fat_index = ((off_t)info.fat_offset +  clu / entry_per_sector) * info.sector_size;
 	uint32_t *fat;
 	uint32_t offset = (clu) % entry_per_sector;
 
@@ -541,23 +874,24 @@ int exfat_set_fat(uint32_t clu, uint32_t entry)
 	if (get_sector(fat, fat_index, 1))
 		goto out;
 
-	ret = fat[offset];
-
 	if (clu == EXFAT_BADCLUSTER || entry == EXFAT_BADCLUSTER)
 		pr_err("Internal Error: Cluster %x or Entry %x is bad cluster.\n", clu, entry);
 	else if (clu == EXFAT_LASTCLUSTER)
 		pr_err("Internal Error: Cluster: %u is the last cluster.\n", clu);
 	else if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1)
 		pr_err("Internal Error: Cluster %u is invalid.\n", clu);
-	else if (entry < EXFAT_FIRST_CLUSTER || entry > info.cluster_count + 1)
+	else if (entry && entry != EXFAT_LASTCLUSTER &&
+			(entry < EXFAT_FIRST_CLUSTER || entry > info.cluster_count + 1))
 		pr_err("Internal Error: Entry %u is invalid.\n", entry);
 	else
 		ret = 0;
 	
 	if (!ret) {
+		pr_debug("Set FAT[%u]  0x%x -> 0x%x.\n", clu, le32_to_cpu(fat[offset]), entry);
 		fat[offset] = cpu_to_le32(entry);
-		set_sector(fat, fat_index, 1);
-		pr_debug("Set FAT[%u]  0x%x -> 0x%x.\n", clu, ret, fat[offset]);
+		ret = set_sector(fat, fat_index, 1);
+		if (info.fat_table)
+			info.fat_table[clu] = fat[offset];
 	}
 
 out:
@@ -632,19 +966,33 @@ void exfat_print_fat_chain(struct exfat_fileinfo *f, uint32_t clu)
  * @clu:                  first cluster
  * @num_alloc:            number of cluster
  *
- * @return                the number of allocated cluster
+ * @return                >= 0 (the number of clusters which couldn't be allocated)
+ *                        <  0 (failed to write)
+ *
+ * NOTE: FAT, Allocation Bitmap and directory entry are written at once by transaction.
+ *       If free clusters are short, only found clusters are allocated.
  */
 int exfat_alloc_clusters(struct exfat_fileinfo *f, uint32_t clu, size_t num_alloc)
 {
+	int ret;
+	uint32_t i;
 	uint32_t tmp = clu;
 	uint32_t next_clu;
 	uint32_t last_clu;
 	int total_alloc = num_alloc;
 	bool nofatchain = true;
 
+	if ((ret = exfat_trans_begin()))
+		return ret;
+
 	clu = next_clu = last_clu = exfat_get_last_cluster(f, clu);
-	for (next_clu = last_clu + 1; next_clu != last_clu; next_clu++) {
-		if (next_clu > info.cluster_count - 1)
+	if (last_clu == (uint32_t)-1) {
+		exfat_trans_abort();
+		return -EINVAL;
+	}
+	/* Each cluster is visited at most once, even if the volume is full */
+	for (i = 0; i < info.cluster_count && total_alloc; i++) {
+		if (++next_clu > info.cluster_count + 1)
 			next_clu = EXFAT_FIRST_CLUSTER;
 
 		if (exfat_load_bitmap(next_clu))
@@ -652,21 +1000,27 @@ int exfat_alloc_clusters(struct exfat_fileinfo *f, uint32_t clu, size_t num_allo
 
 		if (nofatchain && (next_clu - clu != 1))
 			nofatchain = false;
-		exfat_set_fat(next_clu, EXFAT_LASTCLUSTER);
-		exfat_set_fat(clu, next_clu);
-		exfat_save_bitmap(next_clu, 1);
+		if ((ret = exfat_set_fat(next_clu, EXFAT_LASTCLUSTER)) ||
+				(ret = exfat_set_fat(clu, next_clu)) ||
+				(ret = exfat_save_bitmap(next_clu, 1)))
+			goto err;
 		clu = next_clu;
-		if (--total_alloc == 0)
-			break;
-
+		total_alloc--;
 	}
 	if ((f->flags & ALLOC_NOFATCHAIN) && !nofatchain) {
 		f->flags &= ~ALLOC_NOFATCHAIN;
-		exfat_set_fat_chain(f, tmp);
-	}
-	f->datalen += num_alloc * info.cluster_size;
-	exfat_update_filesize(f, tmp);
+		if ((ret = exfat_set_fat_chain(f, tmp)))
+			goto err;
+	}
+	f->datalen += (num_alloc - total_alloc) * info.cluster_size;
+	if ((ret = exfat_update_filesize(f, tmp)))
+		goto err;
+	if ((ret = exfat_trans_commit()))
+		return ret;
 	return total_alloc;
+err:
+	exfat_trans_abort();
+	return ret;
 }
 
 /**
@@ -675,21 +1029,22 @@ int exfat_alloc_clusters(struct exfat_fileinfo *f, uint32_t clu, size_t num_allo
  * @clu:                 first cluster
  * @num_alloc:           number of cluster
  *
- * @return               0 (success)
+ * @return               == 0 (success)
+ *                       <  0 (failed)
  */
 int exfat_free_clusters(struct exfat_fileinfo *f, uint32_t clu, size_t num_alloc)
 {
-	int i;
+	int i, ret;
 	uint32_t tmp = clu;
 	uint32_t next_clu;
 	size_t cluster_num = ROUNDUP(f->datalen, info.cluster_size);
 
 	/* NO_FAT_CHAIN */
-	if (f->flags & ALLOC_NOFATCHAIN) {
-		for (i = cluster_num - num_alloc; i < cluster_num; i++)
-			exfat_save_bitmap(clu + i, 0);
-		return 0;
-	}
+	if (f->flags & ALLOC_NOFATCHAIN)
+		return exfat_save_bitmap_range(clu + cluster_num - num_alloc, num_alloc, 0);
+
+	if ((ret = exfat_trans_begin()))
+		return ret;
 
 	/* FAT_CHAIN */
 	for (i = 0; i < cluster_num - num_alloc - 1; i++) 
@@ -697,15 +1052,20 @@ int exfat_free_clusters(struct exfat_fileinfo *f, uint32_t clu, size_t num_alloc
 			break;
 
 	while (i++ < cluster_num - 1) {
-		exfat_get_fat(clu, &next_clu);
-		exfat_set_fat(clu, EXFAT_LASTCLUSTER);
-		exfat_save_bitmap(next_clu, 0);
+		if ((ret = exfat_get_fat(clu, &next_clu)) ||
+				(ret = exfat_set_fat(clu, EXFAT_LASTCLUSTER)) ||
+				(ret = exfat_save_bitmap(next_clu, 0)))
+			goto err;
 		clu = next_clu;
 	}
 
 	f->datalen -= num_alloc * info.cluster_size;
-	exfat_update_filesize(f, tmp);
-	return 0;
+	if ((ret = exfat_update_filesize(f, tmp)))
+		goto err;
+	return exfat_trans_commit();
+err:
+	exfat_trans_abort();
+	return ret;
 }
 
 /**
@@ -719,25 +1079,33 @@ int exfat_new_clusters(size_t num_alloc)
 	uint32_t next_clu, clu;
 	uint32_t fst_clu = 0;
 
-	for (next_clu = EXFAT_FIRST_CLUSTER; next_clu < info.cluster_count; next_clu++) {
+	if (exfat_trans_begin())
+		return 0;
+
+	for (next_clu = EXFAT_FIRST_CLUSTER; next_clu <= info.cluster_count + 1; next_clu++) {
 		if (exfat_load_bitmap(next_clu))
 			continue;
 
 		if (!fst_clu) {
 			fst_clu = clu = next_clu;
-			exfat_set_fat(fst_clu, EXFAT_LASTCLUSTER);
-			exfat_save_bitmap(fst_clu, 1);
+			if (exfat_set_fat(fst_clu, EXFAT_LASTCLUSTER) || exfat_save_bitmap(fst_clu, 1))
+				goto err;
 		} else {
-			exfat_set_fat(next_clu, EXFAT_LASTCLUSTER);
-			exfat_set_fat(clu, next_clu);
-			exfat_save_bitmap(clu, 1);
+			if (exfat_set_fat(next_clu, EXFAT_LASTCLUSTER) || exfat_set_fat(clu, next_clu) ||
+					exfat_save_bitmap(next_clu, 1))
+				goto err;
 			clu = next_clu;
 		}
 
 		if (--num_alloc == 0)
 			break;
 	}
+	if (exfat_trans_commit())
+		return 0;
 	return fst_clu;
+err:
+	exfat_trans_abort();
+	return 0;
 }
 
 /**
@@ -815,18 +1183,20 @@ uint32_t exfat_concat_cluster(struct exfat_fileinfo *f, uint32_t clu, void **dat
 
 	/* FAT_CHAIN */
 	for (allocated = 1; allocated < cluster_num; allocated++) { 
-		if (!exfat_get_fat(tmp_clu, &tmp_clu))
-			break;;
-		if (get_bitmap(&b, tmp_clu - EXFAT_FIRST_CLUSTER)) {
-			pr_err("Detected a loop in File (Cluster #%u).\n", clu);
+		if (exfat_get_fat(tmp_clu, &tmp_clu))
 			break;
-		}
-		set_bitmap(&b, tmp_clu - EXFAT_FIRST_CLUSTER);
 		if (tmp_clu == EXFAT_LASTCLUSTER) {
 			pr_err("File size(%" PRIu64 ") and FAT chain size(%" PRIu64 ") are un-matched.\n",
 				f->datalen, allocated * info.cluster_size);
 			break;
 		}
+		if (tmp_clu < EXFAT_FIRST_CLUSTER || tmp_clu > info.cluster_count + 1)
+			break;
+		if (get_bitmap(&b, tmp_clu - EXFAT_FIRST_CLUSTER)) {
+			pr_err("Detected a loop in File (Cluster #%u).\n", clu);
+			break;
+		}
+		set_bitmap(&b, tmp_clu - EXFAT_FIRST_CLUSTER);
 		if (exfat_load_bitmap(tmp_clu) != 1) {
 			pr_err("FAT and Allocation Bitmap are un-matched. Ignore #%u.\n", tmp_clu);
 			break;
@@ -946,13 +1316,13 @@ int exfat_get_last_cluster(struct exfat_fileinfo *f, uint32_t clu)
 	uint32_t next_clu;
 	size_t cluster_num = ROUNDUP(f->datalen, info.cluster_size);
 
-	for (i = 0; i < cluster_num; i++) {
+	for (i = 1; i < cluster_num; i++) {
 		next_clu = exfat_next_cluster(f, clu);
-		if (!next_clu)
+		if (!next_clu || next_clu == EXFAT_LASTCLUSTER)
 			return -1;
 		clu = next_clu;
 	}
-	return next_clu;
+	return clu;
 }
 
 /*************************************************************************************************/
@@ -1021,7 +1391,7 @@ int exfat_get_cache(uint32_t clu)
 	info.root_size += DENTRY_LISTSIZE;
 	node2_t **tmp = calloc(sizeof(node2_t **), info.root_size);
 	if (tmp) {
-		memcpy(tmp, info.root, info.root_size - DENTRY_LISTSIZE);
+		memcpy(tmp, info.root, (info.root_size - DENTRY_LISTSIZE) * sizeof(node2_t *));
 		free(info.root);
 		info.root = tmp;
 	} else {
@@ -1068,12 +1438,14 @@ int exfat_clean_cache(uint32_t index)
  * @file:               file dentry
  * @stream:             stream Extension dentry
  * @uniname:            File Name dentry
+ * @entry:              index of File entry in parent Directory
+ *                      (EXFAT_UNKNOWN_ENTRY if it isn't known)
  *
  * @return              == 0 (success)
  *                      <  0 (failed)
  */
 int exfat_create_cache(node2_t *head, uint32_t clu,
-		struct exfat_dentry *file, struct exfat_dentry *stream, uint16_t *uniname)
+		struct exfat_dentry *file, struct exfat_dentry *stream, uint16_t *uniname, uint32_t entry)
 {
 	int index, next_index = le32_to_cpu(stream->dentry.stream.FirstCluster);
 	struct exfat_fileinfo *f;
@@ -1085,7 +1457,6 @@ int exfat_create_cache(node2_t *head, uint32_t clu,
 		free(f);
 		return -ENOMEM;
 	}
-	memset(f->name, '\0', namelen * UTF8_MAX_CHARSIZE + 1);
 
 	exfat_convert_uniname(uniname, namelen, f->name);
 	f->namelen = namelen;
@@ -1094,33 +1465,42 @@ int exfat_create_cache(node2_t *head, uint32_t clu,
 	f->flags = stream->dentry.stream.GeneralSecondaryFlags;
 	f->hash = le16_to_cpu(stream->dentry.stream.NameHash);
 	f->clu = le32_to_cpu(stream->dentry.stream.FirstCluster);
-
-	exfat_convert_unixtime(&f->ctime, le32_to_cpu(file->dentry.file.CreateTimestamp),
-			file->dentry.file.Create10msIncrement,
-			file->dentry.file.CreateUtcOffset);
-	exfat_convert_unixtime(&f->mtime, le32_to_cpu(file->dentry.file.LastModifiedTimestamp),
-			file->dentry.file.LastModified10msIncrement,
-			file->dentry.file.LastModifiedUtcOffset);
-	exfat_convert_unixtime(&f->atime, le32_to_cpu(file->dentry.file.LastAccessedTimestamp),
-			0,
-			file->dentry.file.LastAccessdUtcOffset);
+	f->parent = head;
+	f->entry = entry;
+
+	f->ctime.time = le32_to_cpu(file->dentry.file.CreateTimestamp);
+	f->ctime.subsec = file->dentry.file.Create10msIncrement;
+	f->ctime.tz = file->dentry.file.CreateUtcOffset;
+	f->mtime.time = le32_to_cpu(file->dentry.file.LastModifiedTimestamp);
+	f->mtime.subsec = file->dentry.file.LastModified10msIncrement;
+	f->mtime.tz = file->dentry.file.LastModifiedUtcOffset;
+	f->atime.time = le32_to_cpu(file->dentry.file.LastAccessedTimestamp);
+	f->atime.subsec = 0;
+	f->atime.tz = file->dentry.file.LastAccessdUtcOffset;
+	exfat_check_timestamp(f->ctime.time, f->ctime.subsec);
+	exfat_check_timestamp(f->mtime.time, f->mtime.subsec);
+	exfat_check_timestamp(f->atime.time, f->atime.subsec);
 	append_node2(head, next_index, f);
+	trace_exfat3(create_cache, clu, f->clu, f->namelen);
 	((struct exfat_fileinfo *)(head->data))->cached = 1;
 
 	/* If this entry is Directory, prepare to create next chain */
 	if ((f->attr & ATTR_DIRECTORY) && (!exfat_check_cache(next_index))) {
 		struct exfat_fileinfo *d = calloc(sizeof(struct exfat_fileinfo), 1);
-		if ((d->name = malloc(f->namelen + 1)) == NULL) {
+		if ((d->name = (unsigned char *)strdup((char *)f->name)) == NULL) {
 			free(f->name);
 			free(f);
 			return -ENOMEM;
 		}
-		strncpy((char *)d->name, (char *)f->name, f->namelen + 1);
 		d->namelen = namelen;
 		d->datalen = le64_to_cpu(stream->dentry.stream.DataLength);
 		d->attr = le16_to_cpu(file->dentry.file.FileAttributes);
 		d->flags = stream->dentry.stream.GeneralSecondaryFlags;
 		d->hash = le16_to_cpu(stream->dentry.stream.NameHash);
+		/* Entry set is updated via cache in parent Directory */
+		d->clu = next_index;
+		d->parent = head;
+		d->entry = EXFAT_UNKNOWN_ENTRY;
 
 		index = exfat_get_cache(next_index);
 		info.root[index] = init_node2(next_index, d);
@@ -1181,16 +1561,15 @@ void exfat_print_label(void)
 {
 	unsigned char *name;
 
-	name = malloc(info.vol_length * sizeof(uint16_t) + 1);
-	memset(name, '\0', info.vol_length * sizeof(uint16_t) + 1);
-
+	name = malloc(info.vol_length * UTF8_MAX_CHARSIZE + 1);
 	if (!info.vol_label || !name) {
 		pr_err("Can't print Volume Label\n");
+		free(name);
 		return;
 	}
 
 	pr_msg("volume Label: ");
-	utf16s_to_utf8s(cpu_to_le16(info.vol_label), info.vol_length, name);
+	exfat_convert_uniname(info.vol_label, info.vol_length, name);
 	pr_msg("%s\n", name);
 	free(name);
 }
@@ -1342,103 +1721,274 @@ int exfat_load_bitmap(uint32_t clu)
 }
 
 /**
- * exfat_save_bitmap - function to save allocation table
- * @clu:               cluster index
- * @value:             Bit
+ * exfat_load_bitmap_word - load 64 clusters from allocation table
+ * @index:                  word index
  *
- * @return             == 0 (success)
- *                     <  0 (failed)
+ * @return                  allocation bits (Bits beyond the last cluster are 1)
  */
-int exfat_save_bitmap(uint32_t clu, uint32_t value)
+static uint64_t exfat_load_bitmap_word(uint32_t index)
 {
-	int offset, byte;
-	uint8_t mask = 0x01;
-	uint8_t *raw_bitmap;
-
-	if (!info.alloc_table) {
-		pr_err("Internal Error: Allocation Bitmap is not loaded.\n");
-		return -ENODATA;
-	}
+	uint64_t w;
+	uint32_t bits = info.cluster_count - index * 64;
+
+	memcpy(&w, info.alloc_table + (size_t)index * sizeof(w), sizeof(w));
+	w = le64_to_cpu(w);
+	if (bits < 64)
+		w |= ~(((uint64_t)1 << bits) - 1);
+	return w;
+}
 
-	if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1) {
-		pr_err("cluster: %u is invalid.\n", clu);
-		return -EINVAL;
-	}
+/**
+ * exfat_count_used_clusters - count allocated clusters in allocation table
+ *
+ * @return                     the number of allocated clusters
+ */
+uint32_t exfat_count_used_clusters(void)
+{
+	uint32_t i, used = 0;
+	uint32_t words = ROUNDUP(info.cluster_count, 64);
 
-	clu -= EXFAT_FIRST_CLUSTER;
-	byte = clu / CHAR_BIT;
-	offset = clu % CHAR_BIT;
+	if (!info.alloc_table)
+		return 0;
 
-	pr_debug("index %u: allocation bitmap is 0x%x ->", clu, info.alloc_table[byte]);
-	mask <<= offset;
-	if (value)
-		info.alloc_table[byte] |= mask;
-	else
-		info.alloc_table[byte] &= ~mask;
+	for (i = 0; i < words; i++)
+		used += __builtin_popcountll(exfat_load_bitmap_word(i));
 
-	pr_debug("0x%x\n", info.alloc_table[byte]);
-	raw_bitmap = malloc(info.cluster_size);
-	get_cluster(raw_bitmap, info.alloc_offset);
-	if (value)
-		raw_bitmap[byte] |= mask;
-	else
-		raw_bitmap[byte] &= ~mask;
-	set_cluster(raw_bitmap, info.alloc_offset);
-	free(raw_bitmap);
-	return 0;
+	/* Padding bits in the last word are counted as allocated */
+	return used - (words * 64 - info.cluster_count);
 }
 
 /**
- * exfat_load_bitmap_cluster - function to load Allocation Bitmap
- * @d:                         directory entry about allocation bitmap
+ * exfat_scan_extents - call @cb for each free (or allocated) extent in allocation table
+ * @allocated:          scan allocated clusters instead of free clusters
+ * @cb:                 function called with first cluster and length
+ * @arg:                argument passed to @cb
  *
- * @return                      0 (success)
- *                              1 (bitmap was already loaded)
- *                             -1 (failed)
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *                      >  0 (@cb stopped scanning)
+ *
+ * NOTE: Word filled with free (or allocated) clusters is skipped at once,
+ *       and boundary in word is found by count trailing zeros.
  */
-int exfat_load_bitmap_cluster(struct exfat_dentry d)
+static int exfat_scan_extents(bool allocated, exfat_extent_t cb, void *arg)
 {
-	uint32_t fstclu;
-	uint64_t datalen;
-
-	if (info.alloc_offset)
-		return 1;
+	int ret;
+	bool in_run = false;
+	uint32_t i, bit, start = 0;
+	uint32_t words = ROUNDUP(info.cluster_count, 64);
+	uint32_t bits;
+	uint64_t used, x;
+
+	if (!info.alloc_table)
+		return -ENODATA;
 
-	fstclu = le32_to_cpu(d.dentry.bitmap.FirstCluster);
-	datalen = le64_to_cpu(d.dentry.bitmap.DataLength);
+	for (i = 0; i < words; i++) {
+		used = exfat_load_bitmap_word(i);
+		/* Bits beyond the last cluster terminate allocated run too */
+		if (allocated) {
+			bits = info.cluster_count - i * 64;
+			used = ~used;
+			if (bits < 64)
+				used |= ~(((uint64_t)1 << bits) - 1);
+		}
+		if (used == (in_run ? 0 : ~(uint64_t)0))
+			continue;
 
-	pr_debug("Get: allocation table: cluster 0x%x, size: 0x%" PRIx64 "\n", fstclu, datalen);
-	info.alloc_offset = fstclu;
-	info.alloc_length = datalen;
-	info.alloc_table = calloc(info.cluster_size, 1);
-	if (!info.alloc_table) {
-		pr_err("Can't load bitmap cluster.\n");
-		return -ENODATA;
+		for (bit = 0; bit < 64;) {
+			x = (in_run ? used : ~used) >> bit;
+			if (!x)
+				break;
+			bit += __builtin_ctzll(x);
+			if (in_run) {
+				ret = cb(start + EXFAT_FIRST_CLUSTER, i * 64 + bit - start, arg);
+				if (ret)
+					return ret;
+			} else {
+				start = i * 64 + bit;
+			}
+			in_run = !in_run;
+		}
 	}
 
-	get_cluster(info.alloc_table, info.alloc_offset);
-	exfat_concat_cluster_fast(info.alloc_offset, (void **)(&(info.alloc_table)), info.alloc_length);
-	pr_info("Allocation Bitmap (#%u):\n", info.alloc_offset);
-
+	if (in_run)
+		return cb(start + EXFAT_FIRST_CLUSTER, info.cluster_count - start, arg);
 	return 0;
 }
 
 /**
- * exfat_load_upcase_cluster - function to load Upcase table
- * @d:                         directory entry about Upcase table
+ * exfat_scan_free_extents - call @cb for each free extent in allocation table
+ * @cb:                      function called with first cluster and length
+ * @arg:                     argument passed to @cb
  *
- * @return                     == 0 (success)
- *                             == 1 (bitmap was already loaded)
- *                             <  0 (failed)
+ * @return                   == 0 (success)
+ *                           <  0 (failed)
+ *                           >  0 (@cb stopped scanning)
  */
-int exfat_load_upcase_cluster(struct exfat_dentry d)
+int exfat_scan_free_extents(exfat_extent_t cb, void *arg)
 {
-	uint32_t fstclu;
-	uint32_t datalen;
-	uint32_t checksum = 0;
+	return exfat_scan_extents(false, cb, arg);
+}
 
-	if (info.upcase_size)
-		return -EINVAL;
+/**
+ * exfat_scan_used_extents - call @cb for each allocated extent in allocation table
+ * @cb:                      function called with first cluster and length
+ * @arg:                     argument passed to @cb
+ *
+ * @return                   == 0 (success)
+ *                           <  0 (failed)
+ *                           >  0 (@cb stopped scanning)
+ */
+int exfat_scan_used_extents(exfat_extent_t cb, void *arg)
+{
+	return exfat_scan_extents(true, cb, arg);
+}
+
+/**
+ * exfat_flush_bitmap - write allocation table to disk
+ * @first:              first byte in allocation table
+ * @last:               last byte in allocation table
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Only sectors which contain @first ~ @last are written.
+ */
+static int exfat_flush_bitmap(size_t first, size_t last)
+{
+	int ret;
+	size_t i, sec, end, count;
+	size_t sec_per_clu = info.cluster_size / info.sector_size;
+	uint32_t clu = info.alloc_offset;
+	off_t heap_start = (off_t)info.heap_offset * info.sector_size;
+
+	sec = first / info.sector_size;
+	end = last / info.sector_size;
+
+	/* Allocation Bitmap may be FAT chain */
+	for (i = 0; i < sec / sec_per_clu; i++)
+		if ((ret = exfat_get_fat(clu, &clu)))
+			return ret;
+
+	while (sec <= end) {
+		count = MIN(end - sec + 1, sec_per_clu - sec % sec_per_clu);
+		ret = set_sector(info.alloc_table + sec * info.sector_size,
+				heap_start + (off_t)(clu - EXFAT_FIRST_CLUSTER) * info.cluster_size +
+				(sec % sec_per_clu) * info.sector_size,
+				count);
+		if (ret)
+			return ret;
+		sec += count;
+		if (sec <= end && (ret = exfat_get_fat(clu, &clu)))
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * exfat_save_bitmap_range - function to save allocation table for clusters
+ * @clu:                     first cluster index
+ * @num:                     the number of clusters
+ * @value:                   Bit
+ *
+ * @return                   == 0 (success)
+ *                           <  0 (failed)
+ */
+int exfat_save_bitmap_range(uint32_t clu, uint32_t num, uint32_t value)
+{
+	uint32_t i, bit;
+
+	if (!info.alloc_table) {
+		pr_err("Internal Error: Allocation Bitmap is not loaded.\n");
+		return -ENODATA;
+	}
+
+	if (!num || clu < EXFAT_FIRST_CLUSTER ||
+			(uint64_t)clu + num > (uint64_t)info.cluster_count + EXFAT_FIRST_CLUSTER) {
+		pr_err("cluster: %u ~ %u is invalid.\n", clu, clu + num - 1);
+		return -EINVAL;
+	}
+
+	pr_debug("index %u ~ %u: allocation bitmap is set to %u\n", clu, clu + num - 1, !!value);
+	for (i = 0; i < num; i++) {
+		bit = clu - EXFAT_FIRST_CLUSTER + i;
+		if (value)
+			info.alloc_table[bit / CHAR_BIT] |= (1 << (bit % CHAR_BIT));
+		else
+			info.alloc_table[bit / CHAR_BIT] &= ~(1 << (bit % CHAR_BIT));
+	}
+
+	return exfat_flush_bitmap((clu - EXFAT_FIRST_CLUSTER) / CHAR_BIT,
+			(clu - EXFAT_FIRST_CLUSTER + num - 1) / CHAR_BIT);
+}
+
+/**
+ * exfat_save_bitmap - function to save allocation table
+ * @clu:               cluster index
+ * @value:             Bit
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+int exfat_save_bitmap(uint32_t clu, uint32_t value)
+{
+	return exfat_save_bitmap_range(clu, 1, value);
+}
+
+/**
+ * exfat_load_bitmap_cluster - function to load Allocation Bitmap
+ * @d:                         directory entry about allocation bitmap
+ *
+ * @return                      0 (success)
+ *                              1 (bitmap was already loaded)
+ *                             -1 (failed)
+ */
+int exfat_load_bitmap_cluster(struct exfat_dentry d)
+{
+	uint32_t fstclu;
+	uint64_t datalen;
+
+	if (info.alloc_offset)
+		return 1;
+
+	fstclu = le32_to_cpu(d.dentry.bitmap.FirstCluster);
+	datalen = le64_to_cpu(d.dentry.bitmap.DataLength);
+
+	pr_debug("Get: allocation table: cluster 0x%x, size: 0x%" PRIx64 "\n", fstclu, datalen);
+	info.alloc_offset = fstclu;
+	info.alloc_length = datalen;
+	info.alloc_table = calloc(info.cluster_size, 1);
+	if (!info.alloc_table) {
+		pr_err("Can't load bitmap cluster.\n");
+		return -ENODATA;
+	}
+
+	get_cluster(info.alloc_table, info.alloc_offset);
+	exfat_concat_cluster_fast(info.alloc_offset, (void **)(&(info.alloc_table)), info.alloc_length);
+	pr_info("Allocation Bitmap (#%u):\n", info.alloc_offset);
+
+	return 0;
+}
+
+/**
+ * exfat_load_upcase_cluster - function to load Upcase table
+ * @d:                         directory entry about Upcase table
+ *
+ * @return                     == 0 (success)
+ *                             == 1 (bitmap was already loaded)
+ *                             <  0 (failed)
+ */
+int exfat_load_upcase_cluster(struct exfat_dentry d)
+{
+	uint32_t fstclu, clu;
+	uint32_t datalen;
+	uint32_t checksum = 0;
+	size_t offset, len;
+	struct exfat_checksum_ctx ctx;
+
+	if (info.upcase_size)
+		return -EINVAL;
 
 	fstclu = le32_to_cpu(d.dentry.upcase.FirstCluster);
 	datalen = le64_to_cpu(d.dentry.upcase.DataLength);
@@ -1446,25 +1996,93 @@ int exfat_load_upcase_cluster(struct exfat_dentry d)
 	pr_debug("Get: Up-case table: cluster 0x%x, size: 0x%" PRIx32 "\n", fstclu, datalen);
 	info.upcase_offset = fstclu;
 	info.upcase_size = datalen;
-	info.upcase_table = calloc(info.cluster_size, 1);
+	info.upcase_table = calloc(ROUNDUP(datalen, info.cluster_size), info.cluster_size);
 
 	if (!info.upcase_table) {
 		pr_err("Can't load bitmap cluster.\n");
 		return -ENOMEM;
 	}
 
-	get_cluster(info.upcase_table, info.upcase_offset);
-	exfat_concat_cluster_fast(info.upcase_offset, (void **)(&(info.upcase_table)), info.upcase_size);
-
-	checksum = exfat_calculate_tablechecksum((unsigned char *)info.upcase_table, info.upcase_size);
+	/* Calculate checksum for each cluster as soon as it is read */
+	exfat_checksum_init(&ctx);
+	for (clu = fstclu, offset = 0; offset < datalen; offset += info.cluster_size) {
+		if (offset && exfat_get_fat(clu, &clu))
+			break;
+		get_cluster((char *)info.upcase_table + offset, clu);
+		len = MIN(datalen - offset, info.cluster_size);
+		exfat_tablechecksum_update(&ctx, (unsigned char *)info.upcase_table + offset, len);
+	}
+	checksum = exfat_checksum_final(&ctx);
 	if (checksum != d.dentry.upcase.TableCheckSum)
 		pr_warn("Up-case table checksum is difference. (dentry: %x, calculate: %x)\n",
 				d.dentry.upcase.TableCheckSum,
 				checksum);
 
+	return exfat_expand_upcase_table(info.upcase_table, info.upcase_size / sizeof(uint16_t));
+}
+
+/**
+ * exfat_expand_upcase_table - expand Up-case table to page table
+ * @table:                     Up-case table (compressed or not)
+ * @len:                       the number of entries in @table
+ *
+ * @return                     == 0 (success)
+ *                             <  0 (failed)
+ *
+ * NOTE: Each page keeps the difference from original character,
+ *       so that all pages without mapping share one zero-filled page.
+ */
+int exfat_expand_upcase_table(uint16_t *table, uint32_t len)
+{
+	uint32_t i, c = 0;
+	uint16_t entry, *page;
+
+	exfat_clean_upcase_table();
+	if ((info.upcase_pages = malloc(UPCASE_PAGES * sizeof(uint16_t *))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < UPCASE_PAGES; i++)
+		info.upcase_pages[i] = upcase_identity_page;
+
+	for (i = 0; i < len && c < 0x10000; i++) {
+		entry = le16_to_cpu(table[i]);
+		/* Compressed: identity mapping for the next N characters */
+		if (entry == UPCASE_IDENTITY && i + 1 < len) {
+			c += le16_to_cpu(table[++i]);
+			continue;
+		}
+		if (entry != c) {
+			page = info.upcase_pages[c >> UPCASE_PAGE_SHIFT];
+			if (page == upcase_identity_page) {
+				if ((page = calloc(UPCASE_PAGE_SIZE, sizeof(uint16_t))) == NULL) {
+					exfat_clean_upcase_table();
+					return -ENOMEM;
+				}
+				info.upcase_pages[c >> UPCASE_PAGE_SHIFT] = page;
+			}
+			page[c & UPCASE_PAGE_MASK] = (uint16_t)(entry - c);
+		}
+		c++;
+	}
 	return 0;
 }
 
+/**
+ * exfat_clean_upcase_table - release expanded Up-case table
+ */
+void exfat_clean_upcase_table(void)
+{
+	int i;
+
+	if (!info.upcase_pages)
+		return;
+
+	for (i = 0; i < UPCASE_PAGES; i++)
+		if (info.upcase_pages[i] != upcase_identity_page)
+			free(info.upcase_pages[i]);
+	free(info.upcase_pages);
+	info.upcase_pages = NULL;
+}
+
 /**
  * exfat_load_volume_label - function to load volume label
  * @d:                       directory entry about volume label
@@ -1572,7 +2190,7 @@ out:
  */
 int exfat_traverse_directory(uint32_t clu)
 {
-	int i, j, name_len;
+	int i, j, name_len, fst = 0;
 	uint16_t uniname[MAX_NAME_LENGTH] = {0};
 	size_t index = exfat_get_cache(clu);
 	struct exfat_fileinfo *f = (struct exfat_fileinfo *)info.root[index]->data;
@@ -1585,18 +2203,28 @@ int exfat_traverse_directory(uint32_t clu)
 	struct exfat_dentry d;
 	struct exfat_dentry file, stream;
 
+	trace_exfat1(traverse_directory__entry, clu);
 	if (f->cached) {
 		pr_debug("Directory %s was already traversed.\n", f->name);
+		trace_exfat2(traverse_directory__return, clu, 0);
+		return 0;
+	}
+
+	/* Directory cache can be created without reading directory */
+	if (info.index && !exfat_index_load_directory(info.root[index], clu)) {
+		trace_exfat2(traverse_directory__return, clu, 0);
 		return 0;
 	}
 
 	if ((data = malloc(info.cluster_size)) == NULL) {
 		pr_err("Can't allocate memory for directory.\n");
+		trace_exfat2(traverse_directory__return, clu, -ENOMEM);
 		return -ENOMEM;
 	}
 
 	if ((get_cluster(data, clu))) {
 		free(data);
+		trace_exfat2(traverse_directory__return, clu, -EIO);
 		return -EIO;
 	}
 
@@ -1618,12 +2246,13 @@ int exfat_traverse_directory(uint32_t clu)
 				break;
 			case DENTRY_FILE:
 				file = d;
+				fst = i;
 				raw_count = d.dentry.file.SecondaryCount;
 				prev = DENTRY_FILE;
 				continue;
 			case DENTRY_STREAM:
 				if (prev != DENTRY_FILE) {
-					pr_warn("clu#%u index#%d: It's not continuous files. (Expect: %x, Actual: %x)\n",
+					pr_warn_ratelimited("clu#%u index#%d: It's not continuous files. (Expect: %x, Actual: %x)\n",
 							clu, i, DENTRY_STREAM, prev);
 					prev = DENTRY_UNUSED;
 					continue;
@@ -1634,15 +2263,18 @@ int exfat_traverse_directory(uint32_t clu)
 				continue;
 			case DENTRY_NAME:
 				if (prev != DENTRY_STREAM) {
-					pr_warn("clu#%u index#%d: It's not continuous files. (Expect: %x, Actual: %x)\n",
+					pr_warn_ratelimited("clu#%u index#%d: It's not continuous files. (Expect: %x, Actual: %x)\n",
 							clu, i, DENTRY_NAME, prev);
 					prev = DENTRY_UNUSED;
 					continue;
 				}
+				if (fst + raw_count < entries)
+					exfat_verify_checksum(clu, fst,
+							(unsigned char *)((struct exfat_dentry *)data + fst), raw_count);
 				if (i + raw_count - 1 >= entries) {
 					raw_count = entries - i - 1;
 					raw_length = (raw_count - 1)  * ENTRY_NAME_MAX;
-					pr_warn("clu#%u index#%d: File name is too long. (Expect: < %d, Actual: %d)\n",
+					pr_warn_ratelimited("clu#%u index#%d: File name is too long. (Expect: < %d, Actual: %d)\n",
 							clu, i, raw_length, stream.dentry.stream.NameLength);
 				}
 				for (j = 0; j < raw_count - 1; j++) {
@@ -1655,7 +2287,7 @@ int exfat_traverse_directory(uint32_t clu)
 				file.dentry.file.SecondaryCount = raw_count;
 				stream.dentry.stream.NameLength = raw_length;
 				exfat_create_cache(info.root[index], clu,
-						&file, &stream, uniname);
+						&file, &stream, uniname, fst);
 				i += j - 1;
 				break;
 		}
@@ -1670,189 +2302,1235 @@ out:
 	}
 
 	free(data);
+	trace_exfat2(traverse_directory__return, clu, 0);
 	return 0;
 }
 
 /**
- * exfat_calculate_bootchecksum - Calculate Boot region Checksum
- * @sectors:                      points to an in-memory copy of the 11 sectors
- * @bps:                          bytes per sector
+ * exfat_read_directory - call @cb for each entry set in one directory
+ * @dir:                  directory information (flags and datalen are used)
+ * @clu:                  first cluster of directory
+ * @cb:                   function called with file, UTF-16 name and @arg
+ * @arg:                  argument passed to @cb
  *
- * @return                        Checksum
+ * @return                == 0 (success)
+ *                        != 0 (failed, or @cb stopped reading)
+ *
+ * NOTE: Directory cache isn't used nor updated, so that this function
+ *       can be called from multiple threads at the same time.
+ *       Contiguous clusters in FAT chain are read at once.
+ *       file passed to @cb (and its name) is released after @cb returns.
  */
-uint32_t exfat_calculate_bootchecksum(unsigned char *sectors, uint16_t bps)
+int exfat_read_directory(struct exfat_fileinfo *dir, uint32_t clu, exfat_dentry_t cb, void *arg)
 {
-	uint32_t bytes = (uint32_t)bps * 11;
-	uint32_t checksum = 0;
-	uint32_t index;
+	int ret = 0, count, names;
+	size_t i, j, entries;
+	uint32_t *chain, next, num = MIN(ROUNDUP(dir->datalen, info.cluster_size), info.cluster_count);
+	uint16_t uniname[MAX_NAME_LENGTH + ENTRY_NAME_MAX];
+	unsigned char name[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE + 1];
+	struct exfat_dentry *d;
+	struct exfat_fileinfo f;
+
+	if (!num || clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1)
+		return 0;
 
-	for (index = 0; index < bytes; index++)
-	{
-		if ((index == 106) || (index == 107) || (index == 112))
-		{
-			continue;
-		}
-		checksum = 
-			((checksum & 1) ? 0x80000000 : 0) + (checksum >> 1) + cpu_to_le32((uint32_t)sectors[index]);
+	if ((chain = malloc(num * sizeof(uint32_t))) == NULL)
+		return -ENOMEM;
+	if ((d = malloc((size_t)num * info.cluster_size)) == NULL) {
+		free(chain);
+		return -ENOMEM;
 	}
 
-	return checksum;
-}
+	for (i = 0; i < num; i++) {
+		chain[i] = clu;
+		if (i + 1 == num)
+			break;
+		if (dir->flags & ALLOC_NOFATCHAIN)
+			next = clu + 1;
+		else if (exfat_get_fat(clu, &next))
+			break;
+		if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1)
+			break;
+		clu = next;
+	}
+	num = MIN(i + 1, num);
 
-/**
- * exfat_calculate_checksum - Calculate file entry Checksum
- * @entry:                    points to an in-memory copy of the directory entry set
- * @count:                    the number of secondary directory entries
- *
- * @return                    Checksum
- */
-uint16_t exfat_calculate_checksum(unsigned char *entry, unsigned char count)
-{
-	uint16_t bytes = ((uint16_t)count + 1) * 32;
-	uint16_t checksum = 0;
-	uint16_t index;
+	for (i = 0; i < num; i = j) {
+		for (j = i + 1; j < num && chain[j] == chain[j - 1] + 1; j++)
+			;
+		if ((ret = get_clusters((char *)d + i * info.cluster_size, chain[i], j - i)))
+			goto out;
+	}
 
-	for (index = 0; index < bytes; index++) {
-		if ((index == 2) || (index == 3))
+	entries = (size_t)num * info.cluster_size / sizeof(struct exfat_dentry);
+	for (i = 0; i < entries && d[i].EntryType != DENTRY_UNUSED; i++) {
+		if ((count = exfat_check_entry_set(d, i, entries, 0)) == 0)
 			continue;
-		checksum = ((checksum & 1) ? 0x8000 : 0) + (checksum >> 1) +  le16_to_cpu((uint16_t)entry[index]);
+
+		names = ROUNDUP(d[i + 1].dentry.stream.NameLength, ENTRY_NAME_MAX);
+		for (j = 0; j < names; j++)
+			memcpy(uniname + j * ENTRY_NAME_MAX, d[i + j + 2].dentry.name.FileName,
+					ENTRY_NAME_MAX * sizeof(uint16_t));
+
+		memset(&f, 0, sizeof(f));
+		f.name = name;
+		f.namelen = d[i + 1].dentry.stream.NameLength;
+		exfat_convert_uniname(uniname, f.namelen, f.name);
+		f.datalen = le64_to_cpu(d[i + 1].dentry.stream.DataLength);
+		f.attr = le16_to_cpu(d[i].dentry.file.FileAttributes);
+		f.flags = d[i + 1].dentry.stream.GeneralSecondaryFlags;
+		f.hash = le16_to_cpu(d[i + 1].dentry.stream.NameHash);
+		f.clu = le32_to_cpu(d[i + 1].dentry.stream.FirstCluster);
+		f.ctime.time = le32_to_cpu(d[i].dentry.file.CreateTimestamp);
+		f.ctime.subsec = d[i].dentry.file.Create10msIncrement;
+		f.ctime.tz = d[i].dentry.file.CreateUtcOffset;
+		f.mtime.time = le32_to_cpu(d[i].dentry.file.LastModifiedTimestamp);
+		f.mtime.subsec = d[i].dentry.file.LastModified10msIncrement;
+		f.mtime.tz = d[i].dentry.file.LastModifiedUtcOffset;
+		f.atime.time = le32_to_cpu(d[i].dentry.file.LastAccessedTimestamp);
+		f.atime.tz = d[i].dentry.file.LastAccessdUtcOffset;
+
+		if ((ret = cb(&f, uniname, arg)))
+			break;
+		i += count;
 	}
-	return checksum;
+out:
+	free(d);
+	free(chain);
+	return ret;
 }
 
 /**
- * exfat_calculate_Tablechecksum - Calculate Up-case table Checksum
- * @entry:                         points to an in-memory copy of the directory entry set
- * @count:                         the number of secondary directory entries
+ * exfat_next_extent - obtain contiguous clusters in file
+ * @f:                 file information
+ * @clu:               first cluster of extent
+ * @max:               upper limit of the number of clusters
+ * @next:              first cluster of next extent (Output)
  *
- * @return                         Checksum
+ * @return             the number of clusters in extent
+ *                     0 (cluster chain is broken)
  */
-uint32_t exfat_calculate_tablechecksum(unsigned char *table, uint64_t length)
+static uint32_t exfat_next_extent(struct exfat_fileinfo *f, uint32_t clu, uint32_t max, uint32_t *next)
 {
-	uint32_t checksum = 0;
-	uint64_t index;
+	uint32_t n, last = info.cluster_count + 1;
 
-	for (index = 0; index < length; index++)
-		checksum =
-			((checksum & 1) ? 0x80000000 : 0) + (checksum >> 1) + le32_to_cpu((uint32_t)table[index]);
+	if (clu < EXFAT_FIRST_CLUSTER || clu > last)
+		return 0;
 
-	return checksum;
+	if (f->flags & ALLOC_NOFATCHAIN) {
+		n = MIN(max, last - clu + 1);
+		*next = clu + n;
+		return n;
+	}
+
+	for (n = 1; ; n++) {
+		if (exfat_get_fat(clu + n - 1, next))
+			return 0;
+		if (n == max || *next != clu + n)
+			break;
+	}
+	return n;
 }
 
 /**
- * exfat_calculate_namehash - Calculate name hash
- * @name:                     points to an in-memory copy of the up-cased file name
- * @len:                      Name length
+ * exfat_read_file - call @cb for each contiguous extent of file data
+ * @f:               file information
+ * @size:            upper limit of one read request (bytes)
+ * @cb:              function called with data, length and @arg
+ * @arg:             argument passed to @cb
  *
- * @return                    NameHash
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ *                   >  0 (@cb stopped reading)
+ *
+ * NOTE: Directory cache isn't used, so it can be called by multiple threads
+ *       after exfat_load_fat_table().
  */
-uint16_t exfat_calculate_namehash(uint16_t *name, uint8_t len)
+int exfat_read_file(struct exfat_fileinfo *f, size_t size, exfat_data_t cb, void *arg)
 {
-	unsigned char* buffer = (unsigned char *)name;
-	uint16_t bytes = (uint16_t)len * 2;
-	uint16_t hash = 0;
-	uint16_t index;
+	int ret = 0;
+	void *data;
+	size_t len;
+	uint32_t clu, next, n, max;
+	uint64_t remain = f->datalen;
 
-	for (index = 0; index < bytes; index++)
-		hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (le16_to_cpu(uint16_t)buffer[index]);
+	max = MIN(ROUNDUP(remain, info.cluster_size), MAX(size / info.cluster_size, 1));
+	if (!remain)
+		return 0;
+	if ((data = malloc((size_t)max * info.cluster_size)) == NULL)
+		return -ENOMEM;
 
-	return hash;
+	for (clu = f->clu; remain; clu = next) {
+		n = MIN(ROUNDUP(remain, info.cluster_size), max);
+		if ((n = exfat_next_extent(f, clu, n, &next)) == 0) {
+			ret = -EINVAL;
+			break;
+		}
+		if ((ret = get_clusters(data, clu, n)))
+			break;
+		len = MIN(remain, (uint64_t)n * info.cluster_size);
+		if ((ret = cb(data, len, arg)))
+			break;
+		remain -= len;
+	}
+	free(data);
+	return ret;
 }
 
 /**
- * exfat_update_filesize - flush filesize to disk
- * @f:                     file information pointer
- * @clu:                   first cluster
+ * exfat_walk_directory - call @cb for each file under the directory
+ * @clu:                  directory cluster index
+ * @prefix:               directory path
+ * @visited:              directories which were already walked
+ * @cb:                   function called for each file
+ * @arg:                  argument passed to @cb
  *
- * @return                 == 0 (success)
- *                         <  0 (failed)
+ * @return                == 0 (success)
+ *                        != 0 (failed, or @cb stopped walking)
  */
-int exfat_update_filesize(struct exfat_fileinfo *f, uint32_t clu)
+static int exfat_walk_directory(uint32_t clu, const char *prefix, bitmap_t *visited,
+		exfat_walk_t cb, void *arg)
 {
-	int i, j;
-	uint32_t parent_clu = 0;
-	size_t cluster_num;
-	struct exfat_fileinfo *dir;
-	struct exfat_dentry d;
-	void *data;
-	uint32_t fstclu;
+	int ret = 0, index;
+	size_t len;
+	char *path;
+	node2_t *tmp;
+	struct exfat_fileinfo *f;
 
-	if (clu == info.root_offset)
+	if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1 || get_bitmap(visited, clu))
 		return 0;
+	set_bitmap(visited, clu);
 
-	for (i = 0; i < info.root_size && info.root[i]; i++) {
-		if (search_node2(info.root[i], clu)) {
-			parent_clu = info.root[i]->index;
-			dir = info.root[i]->data;
-			break;
-		}
-	}
+	exfat_traverse_directory(clu);
+	index = exfat_get_cache(clu);
+	tmp = info.root[index];
+	if (!tmp)
+		return 0;
 
-	if (!parent_clu) {
-		pr_err("Can't find cluster %u parent directory.\n", clu);
-		return -EINVAL;
-	}
+	while (!ret && tmp->next != NULL) {
+		tmp = tmp->next;
+		f = (struct exfat_fileinfo *)tmp->data;
 
-	cluster_num = (dir->datalen + (info.cluster_size - 1)) / info.cluster_size;
-	if ((data = malloc(info.cluster_size)) == NULL) {
-		pr_err("Can't allocate memory for root directory.\n");
-		return -ENOMEM;
-	}
+		len = strlen(prefix) + strlen((char *)f->name) + 2;
+		if ((path = malloc(len)) == NULL)
+			return -ENOMEM;
+		snprintf(path, len, "%s/%s", prefix, f->name);
 
-	for (i = 0; i < cluster_num; i++) {
-		if (get_cluster(data, parent_clu))
-			goto out;
-		for (j = 0; j < (info.cluster_size / sizeof(struct exfat_dentry)); j++) {
-			d = ((struct exfat_dentry *)data)[j];
-			fstclu = le32_to_cpu(d.dentry.stream.FirstCluster);
-			if (d.EntryType == DENTRY_STREAM && fstclu == clu) {
-				d.dentry.stream.DataLength = cpu_to_le64(f->datalen);
-				d.dentry.stream.GeneralSecondaryFlags = f->flags;
-				goto out;
-			}
-		}
-		/* traverse next cluster */
-		if (dir->flags & ALLOC_NOFATCHAIN)
-			parent_clu++;
-		else
-			exfat_get_fat(parent_clu, &parent_clu);
+		ret = cb(f, tmp, path, arg);
+		if (!ret && (f->attr & ATTR_DIRECTORY) && tmp->index)
+			ret = exfat_walk_directory(tmp->index, path, visited, cb, arg);
+		free(path);
 	}
-	parent_clu = 0;
-out:
-	set_cluster(data, parent_clu);
-	free(data);
-	return 0;
+
+	return ret;
 }
 
 /**
- * exfat_convert_unixname - function to get timestamp in file
- * @t:                      output pointer (Output)
- * @time:                   Timestamp Field in File Directory Entry
- * @subsec:                 10msincrement Field in File Directory Entry
- * @tz:                     UtcOffset in File Directory Entry
+ * exfat_walk_subtree - call @cb for each file under @clu (depth first)
+ * @clu:                directory cluster index (must be in directory cache)
+ * @prefix:             path of the directory
+ * @cb:                 function called with file, cache node, path and @arg
+ * @arg:                argument passed to @cb
+ *
+ * @return              == 0 (success)
+ *                      != 0 (failed, or @cb stopped walking)
  */
-void exfat_convert_unixtime(struct tm *t, uint32_t time, uint8_t subsec, uint8_t tz)
+int exfat_walk_subtree(uint32_t clu, const char *prefix, exfat_walk_t cb, void *arg)
 {
-	uint8_t sec, min, hour, day, mon, year = 0;
-	char buf[80] = {};
+	int ret;
+	bitmap_t visited;
 
-	year = (time >> EXFAT_YEAR) & 0x7f;
-	mon  = (time >> EXFAT_MONTH) & 0x0f;
-	day = (time >> EXFAT_DAY) & 0x1f;
-	hour = (time >> EXFAT_HOUR) & 0x1f;
-	min  = (time >> EXFAT_MINUTE) & 0x3f;
-	sec  = (time & 0x1f);
+	init_bitmap(&visited, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	if (!visited.data)
+		return -ENOMEM;
 
-	snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d",
-		1980 + year, mon, day, hour, min, (sec * 2) + (subsec / 100));
+	ret = exfat_walk_directory(clu, prefix, &visited, cb, arg);
+	free(visited.data);
+	return ret;
+}
 
-	if ((mon < 1 || 12 < mon) ||
+/**
+ * exfat_walk_tree - call @cb for each file in exFAT (depth first)
+ * @cb:              function called with file, cache node, path and @arg
+ * @arg:             argument passed to @cb
+ *
+ * @return           == 0 (success)
+ *                   != 0 (failed, or @cb stopped walking)
+ *
+ * NOTE: path passed to @cb is released after @cb returns.
+ *       Directory which appears twice (corrupted image) is walked only once.
+ */
+int exfat_walk_tree(exfat_walk_t cb, void *arg)
+{
+	return exfat_walk_subtree(info.root_offset, "", cb, arg);
+}
+
+/**
+ * exfat_calculate_bootchecksum - Calculate Boot region Checksum
+ * @sectors:                      points to an in-memory copy of the 11 sectors
+ * @bps:                          bytes per sector
+ *
+ * @return                        Checksum
+ */
+uint32_t exfat_calculate_bootchecksum(unsigned char *sectors, uint16_t bps)
+{
+	struct exfat_checksum_ctx ctx;
+
+	exfat_checksum_init(&ctx);
+	exfat_bootchecksum_update(&ctx, sectors, (size_t)bps * 11);
+	return exfat_checksum_final(&ctx);
+}
+
+/* Checksum step: rotate right and add a byte */
+#define CHECKSUM32(sum, b)    ((uint32_t)(((sum) >> 1) | ((sum) << 31)) + (uint8_t)(b))
+
+/**
+ * exfat_checksum_bytes - Calculate 32bit checksum for continuous bytes
+ * @checksum:             current checksum
+ * @data:                 points to bytes
+ * @len:                  length of @data
+ *
+ * @return                Checksum
+ */
+static uint32_t exfat_checksum_bytes(uint32_t checksum, const unsigned char *data, size_t len)
+{
+	size_t index = 0;
+	uint64_t w;
+
+	for (; index + sizeof(w) <= len; index += sizeof(w)) {
+		memcpy(&w, data + index, sizeof(w));
+		w = le64_to_cpu(w);
+		checksum = CHECKSUM32(checksum, w);
+		checksum = CHECKSUM32(checksum, w >> 8);
+		checksum = CHECKSUM32(checksum, w >> 16);
+		checksum = CHECKSUM32(checksum, w >> 24);
+		checksum = CHECKSUM32(checksum, w >> 32);
+		checksum = CHECKSUM32(checksum, w >> 40);
+		checksum = CHECKSUM32(checksum, w >> 48);
+		checksum = CHECKSUM32(checksum, w >> 56);
+	}
+	for (; index < len; index++)
+		checksum = CHECKSUM32(checksum, data[index]);
+
+	return checksum;
+}
+
+/**
+ * exfat_checksum_init - Initialize checksum context
+ * @ctx:                 checksum context
+ */
+void exfat_checksum_init(struct exfat_checksum_ctx *ctx)
+{
+	ctx->checksum = 0;
+	ctx->pos = 0;
+}
+
+/**
+ * exfat_bootchecksum_update - Feed Boot region to checksum context
+ * @ctx:                       checksum context
+ * @data:                      next chunk of Boot region
+ * @len:                       length of @data
+ *
+ * NOTE: VolumeFlags (offset 106, 107) and PercentInUse (offset 112)
+ *       in Main Boot Sector are skipped.
+ */
+void exfat_bootchecksum_update(struct exfat_checksum_ctx *ctx, const unsigned char *data, size_t len)
+{
+	uint32_t checksum = ctx->checksum;
+	size_t index = 0;
+
+	/* Main Boot Sector up to PercentInUse */
+	for (; index < len && ctx->pos + index <= 112; index++) {
+		switch (ctx->pos + index) {
+		case 106:
+		case 107:
+		case 112:
+			continue;
+		}
+		checksum = CHECKSUM32(checksum, data[index]);
+	}
+
+	ctx->checksum = exfat_checksum_bytes(checksum, data + index, len - index);
+	ctx->pos += len;
+}
+
+/**
+ * exfat_tablechecksum_update - Feed Up-case table to checksum context
+ * @ctx:                        checksum context
+ * @data:                       next chunk of Up-case table
+ * @len:                        length of @data
+ */
+void exfat_tablechecksum_update(struct exfat_checksum_ctx *ctx, const unsigned char *data, size_t len)
+{
+	ctx->checksum = exfat_checksum_bytes(ctx->checksum, data, len);
+	ctx->pos += len;
+}
+
+/**
+ * exfat_checksum_final - Get checksum from context
+ * @ctx:                  checksum context
+ *
+ * @return                Checksum
+ */
+uint32_t exfat_checksum_final(struct exfat_checksum_ctx *ctx)
+{
+	return ctx->checksum;
+}
+
+/* Checksum step: rotate right and add a byte */
+#define CHECKSUM16(sum, b)    ((uint16_t)(((sum) >> 1) | ((sum) << 15)) + (uint8_t)(b))
+
+/**
+ * exfat_calculate_checksum - Calculate file entry Checksum
+ * @entry:                    points to an in-memory copy of the directory entry set
+ * @count:                    the number of secondary directory entries
+ *
+ * @return                    Checksum
+ *
+ * NOTE: SetChecksum (byte 2 and 3) is skipped without branch,
+ *       and the rest is processed 8 bytes at a time.
+ */
+uint16_t exfat_calculate_checksum(unsigned char *entry, unsigned char count)
+{
+	uint32_t bytes = ((uint32_t)count + 1) * sizeof(struct exfat_dentry);
+	uint16_t checksum = 0;
+	uint32_t index;
+	uint64_t w;
+
+	checksum = CHECKSUM16(checksum, entry[0]);
+	checksum = CHECKSUM16(checksum, entry[1]);
+	checksum = CHECKSUM16(checksum, entry[4]);
+	checksum = CHECKSUM16(checksum, entry[5]);
+	checksum = CHECKSUM16(checksum, entry[6]);
+	checksum = CHECKSUM16(checksum, entry[7]);
+
+	for (index = 8; index < bytes; index += sizeof(w)) {
+		memcpy(&w, entry + index, sizeof(w));
+		w = le64_to_cpu(w);
+		checksum = CHECKSUM16(checksum, w);
+		checksum = CHECKSUM16(checksum, w >> 8);
+		checksum = CHECKSUM16(checksum, w >> 16);
+		checksum = CHECKSUM16(checksum, w >> 24);
+		checksum = CHECKSUM16(checksum, w >> 32);
+		checksum = CHECKSUM16(checksum, w >> 40);
+		checksum = CHECKSUM16(checksum, w >> 48);
+		checksum = CHECKSUM16(checksum, w >> 56);
+	}
+	return checksum;
+}
+
+/**
+ * exfat_verify_checksum - verify SetChecksum in entry set
+ * @dir:                   directory first cluster
+ * @index:                 index of File directory entry in directory
+ * @entry:                 points to an in-memory copy of the directory entry set
+ * @count:                 the number of secondary directory entries
+ *
+ * @return                 == 0 (matched)
+ *                         <  0 (unmatched, or failed)
+ *
+ * NOTE: Unmatched entry set is recorded to info.csum_errors.
+ */
+int exfat_verify_checksum(uint32_t dir, uint32_t index, unsigned char *entry, unsigned char count)
+{
+	uint16_t expect, actual;
+	struct exfat_checksum_error *tmp;
+
+	expect = le16_to_cpu(((struct exfat_dentry *)entry)->dentry.file.SetChecksum);
+	actual = exfat_calculate_checksum(entry, count);
+	if (expect == actual)
+		return 0;
+
+	pr_debug("clu#%u index#%u: SetChecksum is unmatched. (%04x != %04x)\n",
+			dir, index, expect, actual);
+	if (info.csum_error_count == info.csum_error_size) {
+		tmp = realloc(info.csum_errors,
+				(info.csum_error_size + DENTRY_LISTSIZE) * sizeof(struct exfat_checksum_error));
+		if (!tmp)
+			return -ENOMEM;
+		info.csum_errors = tmp;
+		info.csum_error_size += DENTRY_LISTSIZE;
+	}
+	tmp = &info.csum_errors[info.csum_error_count++];
+	tmp->dir = dir;
+	tmp->entry = index;
+	tmp->expect = expect;
+	tmp->actual = actual;
+	return -EINVAL;
+}
+
+/**
+ * exfat_check_entry_set - verify entry set in directory entries
+ * @d:                     directory entries
+ * @i:                     index of File entry
+ * @entries:               the number of entries in @d
+ * @flags:                 ENTRY_SET_DELETED (InUse bits are cleared)
+ *                         ENTRY_SET_CHECKSUM (SetChecksum is verified)
+ *
+ * @return                 the number of secondary entries (entry set is valid)
+ *                         0 (not entry set)
+ *
+ * NOTE: File entry must be followed by Stream Extension and File Name entries
+ *       for NameLength, and all secondary entries are in @d.
+ *       SetChecksum of deleted entry set is calculated after InUse bits are restored.
+ */
+int exfat_check_entry_set(struct exfat_dentry *d, size_t i, size_t entries, int flags)
+{
+	int j, count, names;
+	uint8_t inuse = (flags & ENTRY_SET_DELETED) ? 0 : EXFAT_INUSE;
+	struct exfat_dentry set[ENTRY_SET_MAX];
+
+	if (d[i].EntryType != (DENTRY_DELETED(DENTRY_FILE) | inuse))
+		return 0;
+
+	count = d[i].dentry.file.SecondaryCount;
+	if (count < 2 || count > EXFAT_MAX_SECONDARY || i + count >= entries)
+		return 0;
+	if (d[i + 1].EntryType != (DENTRY_DELETED(DENTRY_STREAM) | inuse))
+		return 0;
+
+	names = ROUNDUP(d[i + 1].dentry.stream.NameLength, ENTRY_NAME_MAX);
+	if (!names || names > count - 1)
+		return 0;
+
+	for (j = 2; j <= count; j++) {
+		if (j < names + 2 && d[i + j].EntryType != (DENTRY_DELETED(DENTRY_NAME) | inuse))
+			return 0;
+		if ((d[i + j].EntryType & (EXFAT_INUSE | EXFAT_CATEGORY)) != (inuse | EXFAT_CATEGORY))
+			return 0;
+	}
+
+	if (!(flags & ENTRY_SET_CHECKSUM))
+		return count;
+	if (inuse)
+		return exfat_calculate_checksum((unsigned char *)(d + i), count) ==
+			le16_to_cpu(d[i].dentry.file.SetChecksum) ? count : 0;
+
+	for (j = 0; j <= count; j++) {
+		set[j] = d[i + j];
+		set[j].EntryType |= EXFAT_INUSE;
+	}
+	return exfat_calculate_checksum((unsigned char *)set, count) ==
+		le16_to_cpu(set[0].dentry.file.SetChecksum) ? count : 0;
+}
+
+/**
+ * exfat_print_checksum_report - print entry sets whose SetChecksum is unmatched
+ */
+void exfat_print_checksum_report(void)
+{
+	uint32_t i;
+	struct exfat_checksum_error *e;
+
+	for (i = 0; i < info.csum_error_count; i++) {
+		e = &info.csum_errors[i];
+		pr_msg("clu#%u index#%u: SetChecksum is unmatched. (dentry: %04x, calculate: %04x)\n",
+				e->dir, e->entry, e->expect, e->actual);
+	}
+}
+
+/**
+ * exfat_calculate_tablechecksum - Calculate Up-case table Checksum
+ * @table:                         points to an in-memory copy of the Up-case table
+ * @length:                        length of Up-case table
+ *
+ * @return                         Checksum
+ */
+uint32_t exfat_calculate_tablechecksum(unsigned char *table, uint64_t length)
+{
+	struct exfat_checksum_ctx ctx;
+
+	exfat_checksum_init(&ctx);
+	exfat_tablechecksum_update(&ctx, table, length);
+	return exfat_checksum_final(&ctx);
+}
+
+/**
+ * exfat_calculate_namehash - Calculate name hash
+ * @name:                     points to an in-memory copy of the up-cased file name
+ * @len:                      Name length
+ *
+ * @return                    NameHash
+ */
+uint16_t exfat_calculate_namehash(uint16_t *name, uint8_t len)
+{
+	uint16_t hash = 0;
+	uint16_t c;
+	uint16_t index;
+
+	for (index = 0; index < len; index++) {
+		c = le16_to_cpu(name[index]);
+		hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF);
+		hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8);
+	}
+
+	return hash;
+}
+
+/**
+ * exfat_calculate_upper_namehash - Calculate name hash from file name
+ * @name:                           points to an in-memory copy of the file name
+ * @len:                            Name length
+ *
+ * @return                          NameHash
+ */
+uint16_t exfat_calculate_upper_namehash(uint16_t *name, uint8_t len)
+{
+	uint16_t hash = 0;
+	uint16_t c;
+	uint16_t index;
+
+	for (index = 0; index < len; index++) {
+		c = exfat_convert_upper(le16_to_cpu(name[index]));
+		hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF);
+		hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8);
+	}
+
+	return hash;
+}
+
+/**
+ * exfat_access_dentry - read or write entries from File entry in place
+ * @f:                   file information pointer (entry set location is used)
+ * @set:                 entries (Input/Output)
+ * @count:               the number of entries
+ * @write:               write @set instead of reading
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ *
+ * NOTE: Only sectors containing the entries are read and written.
+ */
+static int exfat_access_dentry(struct exfat_fileinfo *f, struct exfat_dentry *set,
+		size_t count, bool write)
+{
+	int ret = 0;
+	size_t i, n, first, last;
+	size_t entries = info.cluster_size / sizeof(struct exfat_dentry);
+	size_t pos = f->entry % entries;
+	struct exfat_fileinfo *dir = f->parent->data;
+	uint32_t k, next, clu = f->parent->index;
+	off_t offset;
+	uint8_t *data;
+
+	/* Directory might be moved, so its cluster is obtained from current cache */
+	for (k = 0; k <= f->entry / entries; k++) {
+		if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1) {
+			pr_err("Can't find directory entry in cluster %u.\n", f->parent->index);
+			return -EINVAL;
+		}
+		if (k == f->entry / entries)
+			break;
+		if (dir->flags & ALLOC_NOFATCHAIN)
+			clu++;
+		else if ((ret = exfat_get_fat(clu, &clu)))
+			return ret;
+	}
+
+	if ((data = malloc(info.cluster_size)) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i += n) {
+		n = MIN(count - i, entries - pos);
+		first = pos * sizeof(struct exfat_dentry) / info.sector_size;
+		last = ROUNDUP((pos + n) * sizeof(struct exfat_dentry), info.sector_size);
+		offset = ((off_t)info.heap_offset * info.sector_size) +
+			(off_t)(clu - EXFAT_FIRST_CLUSTER) * info.cluster_size +
+			(off_t)first * info.sector_size;
+
+		if ((ret = get_sector(data, offset, last - first)))
+			break;
+		if (!write) {
+			memcpy(set + i, data + pos * sizeof(struct exfat_dentry) - first * info.sector_size,
+					n * sizeof(struct exfat_dentry));
+		} else {
+			memcpy(data + pos * sizeof(struct exfat_dentry) - first * info.sector_size, set + i,
+					n * sizeof(struct exfat_dentry));
+			if ((ret = set_sector(data, offset, last - first)))
+				break;
+		}
+
+		/* Entry set continues to next cluster */
+		pos = 0;
+		if (i + n == count)
+			break;
+		if (dir->flags & ALLOC_NOFATCHAIN)
+			next = clu + 1;
+		else if ((ret = exfat_get_fat(clu, &next)))
+			break;
+		if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1) {
+			pr_err("Entry set is broken in cluster %u.\n", clu);
+			ret = -EINVAL;
+			break;
+		}
+		clu = next;
+	}
+
+	free(data);
+	return ret;
+}
+
+/**
+ * exfat_update_dentry - flush file information to its entry set
+ * @f:                   file information pointer
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ *
+ * NOTE: FileAttributes and timestamps in File entry, DataLength,
+ *       GeneralSecondaryFlags and FirstCluster in Stream entry are replaced by @f,
+ *       and SetChecksum is recalculated. Entry set is found by its location
+ *       recorded in directory cache, so directory isn't searched.
+ */
+int exfat_update_dentry(struct exfat_fileinfo *f)
+{
+	int ret;
+	size_t count;
+	struct exfat_dentry file, *set;
+
+	if (!f->parent || f->entry == EXFAT_UNKNOWN_ENTRY) {
+		pr_err("Location of directory entry for %s isn't known.\n", f->name);
+		return -EINVAL;
+	}
+
+	if ((ret = exfat_access_dentry(f, &file, 1, false)))
+		return ret;
+	count = file.dentry.file.SecondaryCount + 1;
+	if (file.EntryType != DENTRY_FILE || count < 3) {
+		pr_err("Directory entry for %s is broken.\n", f->name);
+		return -EINVAL;
+	}
+
+	if ((set = malloc(count * sizeof(struct exfat_dentry))) == NULL)
+		return -ENOMEM;
+	if ((ret = exfat_access_dentry(f, set, count, false)))
+		goto out;
+	if (set[1].EntryType != DENTRY_STREAM) {
+		pr_err("Directory entry for %s is broken.\n", f->name);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	set[0].dentry.file.FileAttributes = cpu_to_le16(f->attr);
+	set[0].dentry.file.CreateTimestamp = cpu_to_le32(f->ctime.time);
+	set[0].dentry.file.Create10msIncrement = f->ctime.subsec;
+	set[0].dentry.file.CreateUtcOffset = f->ctime.tz;
+	set[0].dentry.file.LastModifiedTimestamp = cpu_to_le32(f->mtime.time);
+	set[0].dentry.file.LastModified10msIncrement = f->mtime.subsec;
+	set[0].dentry.file.LastModifiedUtcOffset = f->mtime.tz;
+	set[0].dentry.file.LastAccessedTimestamp = cpu_to_le32(f->atime.time);
+	set[0].dentry.file.LastAccessdUtcOffset = f->atime.tz;
+
+	set[1].dentry.stream.GeneralSecondaryFlags = f->flags;
+	set[1].dentry.stream.FirstCluster = cpu_to_le32(f->clu);
+	set[1].dentry.stream.DataLength = cpu_to_le64(f->datalen);
+	/* ValidDataLength of Directory is always DataLength */
+	if ((f->attr & ATTR_DIRECTORY) || le64_to_cpu(set[1].dentry.stream.ValidDataLength) > f->datalen)
+		set[1].dentry.stream.ValidDataLength = cpu_to_le64(f->datalen);
+
+	set[0].dentry.file.SetChecksum = cpu_to_le16(exfat_calculate_checksum((unsigned char *)set,
+				count - 1));
+	ret = exfat_access_dentry(f, set, count, true);
+out:
+	free(set);
+	return ret;
+}
+
+/**
+ * exfat_update_filesize - flush filesize to disk
+ * @f:                     file information pointer
+ * @clu:                   first cluster (in current directory entry)
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ *
+ * NOTE: Directory cache is also updated if first cluster is changed.
+ */
+int exfat_update_filesize(struct exfat_fileinfo *f, uint32_t clu)
+{
+	int i, ret;
+	node2_t *node;
+	struct exfat_fileinfo *d;
+
+	if (clu == info.root_offset)
+		return 0;
+
+	if ((ret = exfat_update_dentry(f)))
+		return ret;
+
+	/*
+	 * Keep directory cache consistent with disk.
+	 * Empty files share key 0, so the node is found by @f itself.
+	 */
+	for (node = f->parent->next; node; node = node->next) {
+		if (node->data == f) {
+			node->index = f->clu;
+			break;
+		}
+	}
+	if (!(f->attr & ATTR_DIRECTORY))
+		return 0;
+	for (i = 0; i < info.root_size && info.root[i]; i++) {
+		if (info.root[i]->index == clu) {
+			d = info.root[i]->data;
+			info.root[i]->index = f->clu;
+			d->flags = f->flags;
+			d->datalen = f->datalen;
+			break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * exfat_convert_name - convert file name to UTF-16 for directory entry
+ * @name:               file name (UTF-8)
+ * @uniname:            file name in UTF-16 (Output)
+ *
+ * @return              >  0 (Name length)
+ *                      <  0 (file name is invalid)
+ *
+ * NOTE: @uniname needs (MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE) characters.
+ */
+static int exfat_convert_name(const char *name, uint16_t *uniname)
+{
+	int i, len = strlen(name);
+
+	if (!len || !strcmp(name, ".") || !strcmp(name, ".."))
+		return -EINVAL;
+	if (len > MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE)
+		return -ENAMETOOLONG;
+	if (!(len = utf8s_to_utf16s((unsigned char *)name, len, uniname)))
+		return -EINVAL;
+	if (len > MAX_NAME_LENGTH)
+		return -ENAMETOOLONG;
+
+	for (i = 0; i < len; i++)
+		if (uniname[i] < 0x20 || (uniname[i] < 0x80 && strchr("\"*/:<>?\\|", uniname[i])))
+			return -EINVAL;
+	return len;
+}
+
+/**
+ * exfat_find_dentry - find file in directory cache by name
+ * @dir:               first cluster of directory
+ * @name:              file name (UTF-8)
+ *
+ * @return             file information
+ *                     NULL (not found)
+ *
+ * NOTE: File name is compared in upper-case, like exFAT does.
+ */
+struct exfat_fileinfo *exfat_find_dentry(uint32_t dir, const char *name)
+{
+	int i, len, n;
+	uint16_t hash;
+	uint16_t uniname[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE];
+	uint16_t tmp[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE];
+	node2_t *node;
+	struct exfat_fileinfo *f;
+
+	if ((len = exfat_convert_name(name, uniname)) < 0)
+		return NULL;
+	hash = exfat_calculate_upper_namehash(uniname, len);
+	exfat_convert_upper_character(uniname, len, uniname);
+
+	i = exfat_get_cache(dir);
+	if (!info.root[i] || info.root[i]->index != dir)
+		return NULL;
+
+	for (node = info.root[i]->next; node; node = node->next) {
+		f = node->data;
+		if (f->hash != hash || f->namelen != len)
+			continue;
+		n = utf8s_to_utf16s(f->name, strlen((char *)f->name), tmp);
+		if (n != len)
+			continue;
+		exfat_convert_upper_character(tmp, n, tmp);
+		if (!memcmp(tmp, uniname, len * sizeof(uint16_t)))
+			return f;
+	}
+	return NULL;
+}
+
+/**
+ * exfat_extend_directory - allocate new clusters to directory
+ * @head:                   Directory chain head
+ * @num_alloc:              the number of clusters
+ *
+ * @return                  == 0 (success)
+ *                          <  0 (failed)
+ *
+ * NOTE: New clusters are filled with zero (DENTRY_UNUSED).
+ *       If it is failed, directory isn't extended at all.
+ */
+static int exfat_extend_directory(node2_t *head, size_t num_alloc)
+{
+	int ret;
+	size_t i, old;
+	uint32_t clu = head->index;
+	uint8_t *zero = NULL;
+	node2_t *node;
+	struct exfat_fileinfo *dir = head->data, *f = dir;
+	struct exfat_fileinfo f_old, dir_old;
+
+	/* Entry set of Directory is in its parent Directory */
+	if (clu != info.root_offset) {
+		if (!dir->parent || !(node = search_node2(dir->parent, clu))) {
+			pr_err("Can't find directory entry for cluster %u.\n", clu);
+			return -EINVAL;
+		}
+		f = node->data;
+	}
+
+	f_old = *f;
+	dir_old = *dir;
+	old = ROUNDUP(f->datalen, info.cluster_size);
+	if ((ret = exfat_trans_begin()))
+		return ret;
+	if ((ret = exfat_alloc_clusters(f, clu, num_alloc)) < 0)
+		goto err;
+	if (ret > 0) {
+		pr_err("No space left to extend directory.\n");
+		ret = -ENOSPC;
+		goto err;
+	}
+
+	if ((zero = calloc(1, info.cluster_size)) == NULL) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	for (i = 0; i < old + num_alloc && clu != EXFAT_LASTCLUSTER && clu; i++) {
+		if (i >= old && (ret = set_cluster(zero, clu)))
+			goto err;
+		clu = exfat_next_cluster(f, clu);
+	}
+	free(zero);
+	return exfat_trans_commit();
+err:
+	/* Discard clusters and restore size in directory cache */
+	exfat_trans_abort();
+	f->datalen = f_old.datalen;
+	f->flags = f_old.flags;
+	dir->datalen = dir_old.datalen;
+	dir->flags = dir_old.flags;
+	free(zero);
+	return ret;
+}
+
+/**
+ * exfat_init_dentry - build entry set of file
+ * @set:               entry set (Output, can hold ENTRY_SET_MAX entries)
+ * @name:              file name (UTF-8)
+ * @f:                 file information (attr, flags, clu, datalen and timestamps are used)
+ *
+ * @return             >  0 (the number of entries in @set)
+ *                     <  0 (invalid file name)
+ *
+ * NOTE: @set must be filled with zero. NameHash and SetChecksum are calculated.
+ */
+int exfat_init_dentry(struct exfat_dentry *set, const char *name, struct exfat_fileinfo *f)
+{
+	int len;
+	size_t j, count;
+	uint16_t uniname[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE + ENTRY_NAME_MAX] = {0};
+
+	if ((len = exfat_convert_name(name, uniname)) < 0)
+		return len;
+	count = 2 + ROUNDUP(len, ENTRY_NAME_MAX);
+
+	set[0].EntryType = DENTRY_FILE;
+	set[0].dentry.file.SecondaryCount = count - 1;
+	set[0].dentry.file.FileAttributes = cpu_to_le16(f->attr);
+	set[0].dentry.file.CreateTimestamp = cpu_to_le32(f->ctime.time);
+	set[0].dentry.file.Create10msIncrement = f->ctime.subsec;
+	set[0].dentry.file.CreateUtcOffset = f->ctime.tz;
+	set[0].dentry.file.LastModifiedTimestamp = cpu_to_le32(f->mtime.time);
+	set[0].dentry.file.LastModified10msIncrement = f->mtime.subsec;
+	set[0].dentry.file.LastModifiedUtcOffset = f->mtime.tz;
+	set[0].dentry.file.LastAccessedTimestamp = cpu_to_le32(f->atime.time);
+	set[0].dentry.file.LastAccessdUtcOffset = f->atime.tz;
+
+	set[1].EntryType = DENTRY_STREAM;
+	set[1].dentry.stream.GeneralSecondaryFlags = f->flags;
+	set[1].dentry.stream.NameLength = len;
+	set[1].dentry.stream.NameHash = cpu_to_le16(exfat_calculate_upper_namehash(uniname, len));
+	set[1].dentry.stream.ValidDataLength = cpu_to_le64(f->datalen);
+	set[1].dentry.stream.FirstCluster = cpu_to_le32(f->clu);
+	set[1].dentry.stream.DataLength = cpu_to_le64(f->datalen);
+
+	for (j = 2; j < count; j++) {
+		set[j].EntryType = DENTRY_NAME;
+		memcpy(set[j].dentry.name.FileName, uniname + (j - 2) * ENTRY_NAME_MAX,
+				ENTRY_NAME_MAX * sizeof(uint16_t));
+	}
+	set[0].dentry.file.SetChecksum = cpu_to_le16(exfat_calculate_checksum((unsigned char *)set,
+				count - 1));
+
+	return count;
+}
+
+/**
+ * exfat_create_dentries - write entry sets to directory
+ * @dir:                   first cluster of directory
+ * @set:                   entry sets (built by exfat_init_dentry)
+ * @count:                 the number of entries in @set
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ *
+ * NOTE: Entry sets are written to the first unused entries which can hold
+ *       all of them, and directory is extended if there is no room.
+ *       Caller must check that file names don't exist in directory.
+ *       New files are appended to directory cache.
+ */
+int exfat_create_dentries(uint32_t dir, struct exfat_dentry *set, size_t count)
+{
+	int i, ret;
+	size_t j, k, len, entries, pos = 0, run = 0;
+	uint16_t uniname[ENTRY_SET_MAX * ENTRY_NAME_MAX];
+	node2_t *head;
+	struct exfat_dentry *d = NULL;
+	struct exfat_fileinfo loc = {0};
+
+	i = exfat_get_cache(dir);
+	if (!info.root[i] || info.root[i]->index != dir) {
+		pr_err("Directory %u doesn't exist in filesystem.\n", dir);
+		return -ENOENT;
+	}
+	head = info.root[i];
+	if ((ret = exfat_traverse_directory(dir)))
+		return ret;
+
+	if ((ret = exfat_trans_begin()))
+		return ret;
+
+	/* Find unused entries (all entries after DENTRY_UNUSED are unused) */
+	if ((d = malloc(info.cluster_size)) == NULL || get_cluster(d, dir)) {
+		ret = d ? -EIO : -ENOMEM;
+		goto abort;
+	}
+	entries = MAX(exfat_concat_cluster(head->data, dir, (void **)&d), 1) *
+		(info.cluster_size / sizeof(struct exfat_dentry));
+	for (j = 0; j < entries && run < count; j++) {
+		if (d[j].EntryType == DENTRY_UNUSED) {
+			pos = run ? pos : j;
+			run += entries - j;
+			break;
+		}
+		if (d[j].EntryType & EXFAT_INUSE) {
+			run = 0;
+		} else if (!run++) {
+			pos = j;
+		}
+	}
+	if (!run)
+		pos = entries;
+	if (run < count &&
+			(ret = exfat_extend_directory(head,
+				ROUNDUP((count - run) * sizeof(struct exfat_dentry), info.cluster_size))))
+		goto abort;
+
+	loc.parent = head;
+	loc.entry = pos;
+	if ((ret = exfat_access_dentry(&loc, set, count, true)))
+		goto abort;
+
+	for (j = 0; j < count; j += set[j].dentry.file.SecondaryCount + 1) {
+		len = set[j + 1].dentry.stream.NameLength;
+		for (k = 0; k < ROUNDUP(len, ENTRY_NAME_MAX); k++)
+			memcpy(uniname + k * ENTRY_NAME_MAX, set[j + 2 + k].dentry.name.FileName,
+					ENTRY_NAME_MAX * sizeof(uint16_t));
+		if ((ret = exfat_create_cache(head, dir, &set[j], &set[j + 1], uniname, pos + j)))
+			goto abort;
+	}
+
+	free(d);
+	return exfat_trans_commit();
+abort:
+	free(d);
+	exfat_trans_abort();
+	return ret;
+}
+
+/**
+ * exfat_create_dentry - create entry set in directory
+ * @dir:                 first cluster of directory
+ * @name:                file name (UTF-8)
+ * @f:                   file information (attr, flags, clu, datalen and timestamps are used)
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ *
+ * NOTE: Entry set is written to the first unused entries which can hold it,
+ *       and directory is extended if there is no room. NameHash and
+ *       SetChecksum are calculated, and new file is appended to directory cache.
+ */
+int exfat_create_dentry(uint32_t dir, const char *name, struct exfat_fileinfo *f)
+{
+	int ret;
+	struct exfat_dentry set[ENTRY_SET_MAX] = {0};
+
+	if ((ret = exfat_init_dentry(set, name, f)) < 0) {
+		pr_err("'%s': Invalid file name.\n", name);
+		return ret;
+	}
+	if (exfat_check_cache(dir) && !exfat_traverse_directory(dir) && exfat_find_dentry(dir, name)) {
+		pr_err("'%s': File exists.\n", name);
+		return -EEXIST;
+	}
+	return exfat_create_dentries(dir, set, ret);
+}
+
+/**
+ * exfat_delete_dentry - delete entry set of file
+ * @f:                   file information pointer
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ *
+ * NOTE: Clusters of file aren't released, and @f is released from directory cache.
+ */
+int exfat_delete_dentry(struct exfat_fileinfo *f)
+{
+	int ret;
+	size_t i, count;
+	node2_t *node;
+	struct exfat_dentry file, *set;
+
+	if (!f->parent || f->entry == EXFAT_UNKNOWN_ENTRY) {
+		pr_err("Location of directory entry for %s isn't known.\n", f->name);
+		return -EINVAL;
+	}
+
+	if ((ret = exfat_access_dentry(f, &file, 1, false)))
+		return ret;
+	if (file.EntryType != DENTRY_FILE) {
+		pr_err("Directory entry for %s is broken.\n", f->name);
+		return -EINVAL;
+	}
+	count = file.dentry.file.SecondaryCount + 1;
+
+	if ((set = malloc(count * sizeof(struct exfat_dentry))) == NULL)
+		return -ENOMEM;
+	if ((ret = exfat_access_dentry(f, set, count, false)))
+		goto out;
+	for (i = 0; i < count; i++)
+		set[i].EntryType &= ~EXFAT_INUSE;
+	if ((ret = exfat_access_dentry(f, set, count, true)))
+		goto out;
+
+	for (node = f->parent; node->next; node = node->next) {
+		if (node->next->data == f) {
+			free(f->name);
+			delete_node2(node);
+			break;
+		}
+	}
+out:
+	free(set);
+	return ret;
+}
+
+/**
+ * exfat_days_from_civil - count days from 1970-01-01
+ * @y:                     year
+ * @m:                     month (1-12)
+ * @d:                     day
+ *
+ * @return                 the number of days
+ */
+static int64_t exfat_days_from_civil(int64_t y, unsigned int m, unsigned int d)
+{
+	int64_t era;
+	unsigned int yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned int)(y - era * 400);
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+/**
+ * exfat_civil_from_days - convert days from 1970-01-01 to date
+ * @z:                     the number of days
+ * @y:                     year (Output)
+ * @m:                     month (1-12) (Output)
+ * @d:                     day (Output)
+ */
+static void exfat_civil_from_days(int64_t z, int64_t *y, unsigned int *m, unsigned int *d)
+{
+	int64_t era;
+	unsigned int doe, yoe, doy, mp;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = (unsigned int)(z - era * 146097);
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+/**
+ * exfat_check_timestamp - verify timestamp in File Directory Entry
+ * @time:                  Timestamp Field in File Directory Entry
+ * @subsec:                10msincrement Field in File Directory Entry
+ *
+ * @return                 == 0 (valid)
+ *                         <  0 (invalid)
+ */
+int exfat_check_timestamp(uint32_t time, uint8_t subsec)
+{
+	uint8_t sec, min, hour, day, mon, year = 0;
+
+	year = (time >> EXFAT_YEAR) & 0x7f;
+	mon  = (time >> EXFAT_MONTH) & 0x0f;
+	day = (time >> EXFAT_DAY) & 0x1f;
+	hour = (time >> EXFAT_HOUR) & 0x1f;
+	min  = (time >> EXFAT_MINUTE) & 0x3f;
+	sec  = (time & 0x1f);
+
+	if ((mon < 1 || 12 < mon) ||
 		(day < 1 || 31 < day) ||
 		(23 < hour) ||
 		(59 < min) ||
-		(29 < sec || 199 < subsec))
-		pr_warn("Timestamp error: %s\n", buf);
+		(29 < sec || 199 < subsec)) {
+		pr_warn_ratelimited("Timestamp error: %d-%02d-%02d %02d:%02d:%02d\n",
+			1980 + year, mon, day, hour, min, (sec * 2) + (subsec / 100));
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * exfat_convert_unixtime - function to get timestamp in file
+ * @t:                      output pointer (Output)
+ * @time:                   Timestamp Field in File Directory Entry
+ * @subsec:                 10msincrement Field in File Directory Entry
+ * @tz:                     UtcOffset in File Directory Entry
+ *
+ * NOTE: tm_year is years since 1980, and tm_mon is 1-12.
+ *       UtcOffset is applied by arithmetic, so libc timezone isn't used.
+ */
+void exfat_convert_unixtime(struct tm *t, uint32_t time, uint8_t subsec, uint8_t tz)
+{
+	int64_t days, mins, y;
+	unsigned int mon, day;
+	uint8_t sec, min, hour, year = 0;
+
+	year = (time >> EXFAT_YEAR) & 0x7f;
+	mon  = (time >> EXFAT_MONTH) & 0x0f;
+	day = (time >> EXFAT_DAY) & 0x1f;
+	hour = (time >> EXFAT_HOUR) & 0x1f;
+	min  = (time >> EXFAT_MINUTE) & 0x3f;
+	sec  = (time & 0x1f);
 
+	memset(t, 0, sizeof(struct tm));
 	t->tm_year = year;
 	t->tm_mon  = mon;
 	t->tm_mday = day;
@@ -1860,16 +3538,54 @@ void exfat_convert_unixtime(struct tm *t, uint32_t time, uint8_t subsec, uint8_t
 	t->tm_min  = min;
 	t->tm_sec  = sec * 2;
 	t->tm_sec += subsec / 100;
-	/* OffsetValid */
-	if (tz & 0x80) {
-		int min = 0;
-		time_t tmp_time = mktime(t);
-		min = exfat_convert_timezone(tz);
-		tmp_time += (min * 60);
-		localtime_r(&tmp_time, t);
+
+	/* OffsetValid (broken date is left as it is) */
+	if ((tz & 0x80) && (1 <= mon && mon <= 12) && (1 <= day && day <= 31)) {
+		days = exfat_days_from_civil(1980 + year, mon, day);
+		mins = days * 24 * 60 + hour * 60 + min + exfat_convert_timezone(tz);
+		days = mins >= 0 ? mins / (24 * 60) : (mins - (24 * 60 - 1)) / (24 * 60);
+		mins -= days * 24 * 60;
+		exfat_civil_from_days(days, &y, &mon, &day);
+		t->tm_year = y - 1980;
+		t->tm_mon  = mon;
+		t->tm_mday = day;
+		t->tm_hour = mins / 60;
+		t->tm_min  = mins % 60;
 	}
 }
 
+/**
+ * exfat_convert_timestamp - decode timestamp in cache
+ * @t:                       output pointer (Output)
+ * @ts:                      raw timestamp
+ */
+void exfat_convert_timestamp(struct tm *t, struct exfat_timestamp *ts)
+{
+	exfat_convert_unixtime(t, ts->time, ts->subsec, ts->tz);
+}
+
+/**
+ * exfat_convert_exfattime - encode time to timestamp in File Directory Entry
+ * @ts:                      raw timestamp (Output)
+ * @t:                       time
+ *
+ * NOTE: Timestamp is recorded in UTC (UtcOffset is valid, and is 0).
+ */
+void exfat_convert_exfattime(struct exfat_timestamp *ts, struct timespec *t)
+{
+	struct tm tm;
+
+	gmtime_r(&t->tv_sec, &tm);
+	ts->time = ((uint32_t)(MAX(tm.tm_year - 80, 0) & 0x7f) << EXFAT_YEAR) |
+		((uint32_t)(tm.tm_mon + 1) << EXFAT_MONTH) |
+		((uint32_t)tm.tm_mday << EXFAT_DAY) |
+		((uint32_t)tm.tm_hour << EXFAT_HOUR) |
+		((uint32_t)tm.tm_min << EXFAT_MINUTE) |
+		((uint32_t)tm.tm_sec / 2);
+	ts->subsec = (tm.tm_sec % 2) * 100 + t->tv_nsec / 10000000;
+	ts->tz = 0x80;
+}
+
 /**
  * exfat_convert_timezone - function to get timezone in file
  * @tz:                     UtcOffset in File Directory Entry
@@ -1907,7 +3623,8 @@ int exfat_convert_timezone(uint8_t tz)
  */
 uint32_t exfat_lookup(uint32_t clu, char *name)
 {
-	int index, i = 0, depth = 0;
+	int index, ret, i = 0, depth = 0;
+	uint32_t dir, next;
 	bool found = false;
 	char *path[MAX_NAME_LENGTH] = {};
 	char fullpath[PATHNAME_MAX + 1] = {};
@@ -1937,6 +3654,7 @@ uint32_t exfat_lookup(uint32_t clu, char *name)
 
 	for (i = 0; path[i] && i < depth + 1; i++) {
 		pr_debug("Lookup %s in clu#%u\n", path[i], clu);
+		dir = clu;
 		found = false;
 		index = exfat_get_cache(clu);
 		f = (struct exfat_fileinfo *)info.root[index]->data;
@@ -1951,8 +3669,16 @@ uint32_t exfat_lookup(uint32_t clu, char *name)
 			}
 		}
 
+		/* Index can find file by NameHash */
+		ret = info.index ? exfat_index_lookup(clu, path[i], &next) : -ENOENT;
+		if (ret >= 0) {
+			found = ret;
+			if (found)
+				clu = next;
+		}
+
 		tmp = info.root[index];
-		while (tmp->next != NULL) {
+		while (ret < 0 && tmp->next != NULL) {
 			tmp = tmp->next;
 			f = (struct exfat_fileinfo *)tmp->data;
 			if (!strcmp(path[i], (char *)f->name)) {
@@ -1961,6 +3687,7 @@ uint32_t exfat_lookup(uint32_t clu, char *name)
 				break;
 			}
 		}
+		trace_exfat3(lookup, dir, path[i], found ? clu : 0);
 
 		if (!found) {
 			pr_err("'%s': No such file or directory.\n", name);
@@ -1976,10 +3703,13 @@ uint32_t exfat_lookup(uint32_t clu, char *name)
  * @uniname:               filename dentry in UTF-16
  * @name_len:              filename length
  * @name:                  filename in UTF-8 (Output)
+ *
+ * NOTE: @name needs (@name_len * UTF8_MAX_CHARSIZE + 1) bytes,
+ *       and it is terminated by null character.
  */
 void exfat_convert_uniname(uint16_t *uniname, uint64_t name_len, unsigned char *name)
 {
-	utf16s_to_utf8s(uniname, name_len, name);
+	name[utf16s_to_utf8s(uniname, name_len, name)] = '\0';
 }
 
 /**
@@ -1990,7 +3720,9 @@ void exfat_convert_uniname(uint16_t *uniname, uint64_t name_len, unsigned char *
  */
 uint16_t exfat_convert_upper(uint16_t c)
 {
-	return info.upcase_table[c] ? info.upcase_table[c] : c;
+	if (!info.upcase_pages)
+		return c;
+	return c + info.upcase_pages[c >> UPCASE_PAGE_SHIFT][c & UPCASE_PAGE_MASK];
 }
 
 /**
@@ -2001,8 +3733,17 @@ uint16_t exfat_convert_upper(uint16_t c)
  */
 void exfat_convert_upper_character(uint16_t *src, size_t len, uint16_t *dist)
 {
-	int i;
+	size_t i;
+	uint16_t c;
+	uint16_t **pages = info.upcase_pages;
 
-	for (i = 0; i < len; i++)
-		dist[i] = exfat_convert_upper(src[i]);
+	if (!pages) {
+		memmove(dist, src, len * sizeof(uint16_t));
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		c = src[i];
+		dist[i] = c + pages[c >> UPCASE_PAGE_SHIFT][c & UPCASE_PAGE_MASK];
+	}
 }
@@ -53,7 +53,13 @@
 #define CLEARTOZERO   0x0008
 
 #define ENTRY_NAME_MAX          15
+#define EXFAT_MAX_SECONDARY     18
 #define MAX_NAME_LENGTH         255
+/* File, Stream Extension and File Name entries for MAX_NAME_LENGTH */
+#define ENTRY_SET_MAX           19
+/* exfat_check_entry_set() flags */
+#define ENTRY_SET_DELETED       (1 << 0)
+#define ENTRY_SET_CHECKSUM      (1 << 1)
 
 #define EXFAT_FIRST_CLUSTER  2
 #define EXFAT_BADCLUSTER     0xFFFFFFF7
@@ -61,17 +67,77 @@
 #define EXFAT_SIGNATURE      0xAA55
 #define EXFAT_EXSIGNATURE    0xAA550000
 
+/* Chunk size to compare redundant region */
+#define EXFAT_COMPARE_CHUNK  (1024 * 1024)
+
+/* Up-case table is expanded to 256 pages of 256 characters */
+#define UPCASE_PAGE_SHIFT    8
+#define UPCASE_PAGE_SIZE     (1 << UPCASE_PAGE_SHIFT)
+#define UPCASE_PAGE_MASK     (UPCASE_PAGE_SIZE - 1)
+#define UPCASE_PAGES         (0x10000 >> UPCASE_PAGE_SHIFT)
+#define UPCASE_IDENTITY      0xFFFF
+
+
+/* Callback for each extent (first cluster, the number of clusters) */
+typedef int (*exfat_extent_t)(uint32_t, uint32_t, void *);
+
+/* Streaming context for 32bit (Boot region / Up-case table) checksum */
+struct exfat_checksum_ctx {
+	uint32_t checksum;
+	uint64_t pos;
+};
+
+/* Entry set whose SetChecksum is unmatched */
+struct exfat_checksum_error {
+	uint32_t dir;
+	uint32_t entry;
+	uint16_t expect;
+	uint16_t actual;
+};
+
+/*
+ * Metadata image (exported by "cloneexfat -m")
+ *
+ *   +--------------------------+ 0
+ *   | struct exfat_meta_header |
+ *   +--------------------------+ sizeof(struct exfat_meta_header)
+ *   | struct exfat_meta_extent | x ExtentCount (sorted by Offset)
+ *   +--------------------------+ FileOffset of first extent
+ *   | extent data              |
+ *   +--------------------------+
+ *
+ * Range which isn't covered by any extent is read as zero.
+ */
+#define EXFAT_META_MAGIC      "EXFATMTA"
+#define EXFAT_META_VERSION    1
+#define EXFAT_META_ALIGN      4096
+
+struct exfat_meta_header {
+	__u8 Magic[8];
+	__le32 Version;
+	__le32 ExtentCount;
+	__le64 ImageSize;
+	__u8 Reserved[40];
+};
+
+struct exfat_meta_extent {
+	__le64 Offset;
+	__le64 Length;
+	__le64 FileOffset;
+};
 
 struct exfat_info {
 	int fd;
 	off_t total_size;
 	uint64_t partition_offset;
-	uint32_t vol_size;
+	uint64_t vol_size;
 	uint16_t sector_size;
 	uint32_t cluster_size;
 	uint32_t cluster_count;
 	uint32_t fat_offset;
 	uint32_t fat_length;
+	uint8_t fat_count;
+	uint32_t *fat_table;
 	uint32_t heap_offset;
 	uint32_t root_offset;
 	uint32_t alloc_offset;
@@ -80,26 +146,57 @@ struct exfat_info {
 	uint32_t upcase_offset;
 	uint32_t upcase_size;
 	uint16_t *upcase_table;
+	uint16_t **upcase_pages;
 	uint8_t vol_length;
 	uint16_t *vol_label;
 	node2_t **root;
 	uint32_t root_size;
+	struct exfat_checksum_error *csum_errors;
+	uint32_t csum_error_count;
+	uint32_t csum_error_size;
+	struct exfat_meta_extent *meta;
+	uint32_t meta_count;
+	struct exfat_index *index;
+	struct exfat_trans *trans;
+	char *journal;
+};
+
+/* Raw timestamp in File Directory Entry (decoded only when needed) */
+struct exfat_timestamp {
+	uint32_t time;
+	uint8_t subsec;
+	uint8_t tz;
 };
 
 struct exfat_fileinfo {
 	unsigned char *name;
 	uint64_t namelen;
 	uint64_t datalen;
-	uint8_t cached;
+	struct exfat_timestamp ctime;
+	struct exfat_timestamp atime;
+	struct exfat_timestamp mtime;
+	uint32_t clu;
 	uint16_t attr;
-	uint8_t flags;
-	struct tm ctime;
-	struct tm atime;
-	struct tm mtime;
 	uint16_t hash;
-	uint32_t clu;
+	uint8_t cached;
+	uint8_t flags;
+	/* Entry set location (index of File entry in parent directory) */
+	node2_t *parent;
+	uint32_t entry;
 };
 
+/* Location of entry set isn't known (e.g. loaded from index) */
+#define EXFAT_UNKNOWN_ENTRY  UINT32_MAX
+
+/* Callback for each file (file, cache node, path) */
+typedef int (*exfat_walk_t)(struct exfat_fileinfo *, node2_t *, const char *, void *);
+
+/* Callback for each entry set (file, UTF-16 name) */
+typedef int (*exfat_dentry_t)(struct exfat_fileinfo *, uint16_t *, void *);
+
+/* Callback for each extent of file data (data, length) */
+typedef int (*exfat_data_t)(const void *, size_t, void *);
+
 struct exfat_bootsec {
 	__u8 JumpBoot[3];
 	__u8 FileSystemName[8];
@@ -232,6 +329,9 @@ struct exfat_dentry {
 #define EXFAT_CATEGORY       0x40
 #define EXFAT_INUSE          0x80
 
+/* Entry type whose InUse bit is cleared */
+#define DENTRY_DELETED(type) ((type) & ~EXFAT_INUSE)
+
 /* exFAT GeneralSecondaryFlags */
 #define ALLOC_POSIBLE         0x01
 #define ALLOC_NOFATCHAIN      0x02
@@ -283,12 +383,16 @@ int set_clusters(void *, off_t, size_t);
 int exfat_init_info(void);
 int exfat_store_info(struct exfat_bootsec *);
 int exfat_clean_info(void);
+int exfat_load_meta(void);
 int exfat_load_bootsec(struct exfat_bootsec *);
 int exfat_check_bootsec(struct exfat_bootsec *);
 int exfat_check_extend_bootsec(void);
 int exfat_check_bootchecksum(void);
+int exfat_check_backup_bootsec(void);
+int exfat_check_fat_mirror(void);
 
 /* FAT-entry function prototype */
+int exfat_load_fat_table(void);
 int exfat_get_fat(uint32_t, uint32_t *);
 int exfat_set_fat(uint32_t, uint32_t);
 int exfat_set_fat_chain(struct exfat_fileinfo *, uint32_t);
@@ -311,7 +415,7 @@ int exfat_check_cache(uint32_t);
 int exfat_get_cache(uint32_t);
 int exfat_clean_cache(uint32_t);
 int exfat_create_cache(node2_t *, uint32_t,
-		struct exfat_dentry *, struct exfat_dentry *, uint16_t *);
+		struct exfat_dentry *, struct exfat_dentry *, uint16_t *, uint32_t);
 
 /* Special entry function prototype */
 void exfat_print_upcase(void);
@@ -319,24 +423,50 @@ void exfat_print_label(void);
 void exfat_print_fat(void);
 void exfat_print_bitmap(void);
 int exfat_load_bitmap(uint32_t);
+uint32_t exfat_count_used_clusters(void);
+int exfat_scan_free_extents(exfat_extent_t, void *);
+int exfat_scan_used_extents(exfat_extent_t, void *);
 int exfat_save_bitmap(uint32_t, uint32_t);
+int exfat_save_bitmap_range(uint32_t, uint32_t, uint32_t);
 int exfat_load_bitmap_cluster(struct exfat_dentry);
 int exfat_load_upcase_cluster(struct exfat_dentry);
+int exfat_expand_upcase_table(uint16_t *, uint32_t);
+void exfat_clean_upcase_table(void);
 int exfat_load_volume_label(struct exfat_dentry);
 
 /* File function prototype */
 int exfat_traverse_root_directory(void);
 int exfat_traverse_directory(uint32_t);
+int exfat_read_directory(struct exfat_fileinfo *, uint32_t, exfat_dentry_t, void *);
+int exfat_read_file(struct exfat_fileinfo *, size_t, exfat_data_t, void *);
+int exfat_walk_subtree(uint32_t, const char *, exfat_walk_t, void *);
+int exfat_walk_tree(exfat_walk_t, void *);
 uint32_t exfat_calculate_bootchecksum(unsigned char *, uint16_t);
 uint16_t exfat_calculate_checksum(unsigned char *, unsigned char);
+int exfat_verify_checksum(uint32_t, uint32_t, unsigned char *, unsigned char);
+int exfat_check_entry_set(struct exfat_dentry *, size_t, size_t, int);
+void exfat_print_checksum_report(void);
 uint32_t exfat_calculate_tablechecksum(unsigned char *, uint64_t);
+void exfat_checksum_init(struct exfat_checksum_ctx *);
+void exfat_bootchecksum_update(struct exfat_checksum_ctx *, const unsigned char *, size_t);
+void exfat_tablechecksum_update(struct exfat_checksum_ctx *, const unsigned char *, size_t);
+uint32_t exfat_checksum_final(struct exfat_checksum_ctx *);
 uint16_t exfat_calculate_namehash(uint16_t *, uint8_t);
+uint16_t exfat_calculate_upper_namehash(uint16_t *, uint8_t);
+int exfat_update_dentry(struct exfat_fileinfo *);
+struct exfat_fileinfo *exfat_find_dentry(uint32_t, const char *);
+int exfat_init_dentry(struct exfat_dentry *, const char *, struct exfat_fileinfo *);
+int exfat_create_dentries(uint32_t, struct exfat_dentry *, size_t);
+int exfat_create_dentry(uint32_t, const char *, struct exfat_fileinfo *);
+int exfat_delete_dentry(struct exfat_fileinfo *);
 int exfat_update_filesize(struct exfat_fileinfo *, uint32_t);
 void exfat_convert_unixtime(struct tm *, uint32_t, uint8_t, uint8_t);
+void exfat_convert_timestamp(struct tm *, struct exfat_timestamp *);
+void exfat_convert_exfattime(struct exfat_timestamp *, struct timespec *);
+int exfat_check_timestamp(uint32_t, uint8_t);
 int exfat_convert_timezone(uint8_t);
 uint32_t exfat_lookup(uint32_t, char *);
 void exfat_convert_uniname(uint16_t *, uint64_t, unsigned char *);
-void exfat_convert_uniname(uint16_t *, uint64_t, unsigned char *);
 uint16_t exfat_convert_upper(uint16_t);
 void exfat_convert_upper_character(uint16_t *, size_t, uint16_t *);
 
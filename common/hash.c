@@ -0,0 +1,701 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <string.h>
+#include <endian.h>
+#include "hash.h"
+
+#define MIN_SIZE(a, b)    ((a) < (b) ? (a) : (b))
+
+/*************************************************************************************************/
+/*                                                                                               */
+/* SHA-256 (FIPS 180-4)                                                                          */
+/*                                                                                               */
+/*************************************************************************************************/
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * sha256_block - process blocks
+ * @ctx:          SHA-256 context
+ * @p:            blocks
+ * @n:            the number of blocks
+ */
+static void sha256_block(struct sha256_ctx *ctx, const uint8_t *p, size_t n)
+{
+	int i;
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h, t1, t2;
+
+	for (; n; n--, p += SHA256_BLOCK_SIZE) {
+		for (i = 0; i < 16; i++)
+			w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+				((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+		for (; i < 64; i++)
+			w[i] = (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+				(ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+		a = ctx->state[0];
+		b = ctx->state[1];
+		c = ctx->state[2];
+		d = ctx->state[3];
+		e = ctx->state[4];
+		f = ctx->state[5];
+		g = ctx->state[6];
+		h = ctx->state[7];
+
+		for (i = 0; i < 64; i++) {
+			t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+				((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+				((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		ctx->state[0] += a;
+		ctx->state[1] += b;
+		ctx->state[2] += c;
+		ctx->state[3] += d;
+		ctx->state[4] += e;
+		ctx->state[5] += f;
+		ctx->state[6] += g;
+		ctx->state[7] += h;
+	}
+}
+
+/**
+ * sha256_init - Initialize SHA-256 context
+ * @ctx:         SHA-256 context
+ */
+void sha256_init(struct sha256_ctx *ctx)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state, iv, sizeof(iv));
+	ctx->length = 0;
+	ctx->used = 0;
+}
+
+/**
+ * sha256_update - Feed data to SHA-256 context
+ * @ctx:           SHA-256 context
+ * @data:          data
+ * @len:           length of @data
+ */
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	size_t n;
+	const uint8_t *p = data;
+
+	ctx->length += len;
+	if (ctx->used) {
+		n = SHA256_BLOCK_SIZE - ctx->used;
+		if (len < n) {
+			memcpy(ctx->buf + ctx->used, p, len);
+			ctx->used += len;
+			return;
+		}
+		memcpy(ctx->buf + ctx->used, p, n);
+		sha256_block(ctx, ctx->buf, 1);
+		ctx->used = 0;
+		p += n;
+		len -= n;
+	}
+
+	n = len / SHA256_BLOCK_SIZE;
+	sha256_block(ctx, p, n);
+	p += n * SHA256_BLOCK_SIZE;
+	len -= n * SHA256_BLOCK_SIZE;
+
+	memcpy(ctx->buf, p, len);
+	ctx->used = len;
+}
+
+/**
+ * sha256_final - Get SHA-256 digest
+ * @ctx:          SHA-256 context
+ * @digest:       SHA256_DIGEST_SIZE bytes digest (Output)
+ */
+void sha256_final(struct sha256_ctx *ctx, uint8_t *digest)
+{
+	int i;
+	uint64_t bits = ctx->length * 8;
+
+	ctx->buf[ctx->used++] = 0x80;
+	if (ctx->used > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->buf + ctx->used, 0, SHA256_BLOCK_SIZE - ctx->used);
+		sha256_block(ctx, ctx->buf, 1);
+		ctx->used = 0;
+	}
+	memset(ctx->buf + ctx->used, 0, SHA256_BLOCK_SIZE - 8 - ctx->used);
+	for (i = 0; i < 8; i++)
+		ctx->buf[SHA256_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+	sha256_block(ctx, ctx->buf, 1);
+
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = ctx->state[i] >> 24;
+		digest[i * 4 + 1] = ctx->state[i] >> 16;
+		digest[i * 4 + 2] = ctx->state[i] >> 8;
+		digest[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+/*************************************************************************************************/
+/*                                                                                               */
+/* BLAKE3                                                                                        */
+/*                                                                                               */
+/*************************************************************************************************/
+
+#define BLAKE3_CHUNK_START    (1 << 0)
+#define BLAKE3_CHUNK_END      (1 << 1)
+#define BLAKE3_PARENT         (1 << 2)
+#define BLAKE3_ROOT           (1 << 3)
+
+static const uint32_t blake3_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint8_t blake3_schedule[7][16] = {
+	{ 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+	{ 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8},
+	{ 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1},
+	{10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6},
+	{12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4},
+	{ 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7},
+	{11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13},
+};
+
+#define BLAKE3_G(v, a, b, c, d, x, y)                         \
+	do {                                                       \
+		v[a] = v[a] + v[b] + (x);                              \
+		v[d] = ROR32(v[d] ^ v[a], 16);                         \
+		v[c] = v[c] + v[d];                                    \
+		v[b] = ROR32(v[b] ^ v[c], 12);                         \
+		v[a] = v[a] + v[b] + (y);                              \
+		v[d] = ROR32(v[d] ^ v[a], 8);                          \
+		v[c] = v[c] + v[d];                                    \
+		v[b] = ROR32(v[b] ^ v[c], 7);                          \
+	} while (0)
+
+/**
+ * blake3_compress - compression function
+ * @cv:              input chaining value
+ * @block:           BLAKE3_BLOCK_SIZE bytes block
+ * @counter:         chunk counter
+ * @len:             length of @block
+ * @flags:           domain separation flags
+ * @out:             16 words output (first 8 words are chaining value)
+ */
+static void blake3_compress(const uint32_t *cv, const uint8_t *block, uint64_t counter,
+		uint32_t len, uint32_t flags, uint32_t *out)
+{
+	int i;
+	uint32_t m[16], v[16];
+	const uint8_t *s;
+
+	for (i = 0; i < 16; i++)
+		m[i] = (uint32_t)block[i * 4] | ((uint32_t)block[i * 4 + 1] << 8) |
+			((uint32_t)block[i * 4 + 2] << 16) | ((uint32_t)block[i * 4 + 3] << 24);
+
+	memcpy(v, cv, 8 * sizeof(uint32_t));
+	memcpy(v + 8, blake3_iv, 4 * sizeof(uint32_t));
+	v[12] = counter;
+	v[13] = counter >> 32;
+	v[14] = len;
+	v[15] = flags;
+
+	for (i = 0; i < 7; i++) {
+		s = blake3_schedule[i];
+		BLAKE3_G(v, 0, 4,  8, 12, m[s[0]],  m[s[1]]);
+		BLAKE3_G(v, 1, 5,  9, 13, m[s[2]],  m[s[3]]);
+		BLAKE3_G(v, 2, 6, 10, 14, m[s[4]],  m[s[5]]);
+		BLAKE3_G(v, 3, 7, 11, 15, m[s[6]],  m[s[7]]);
+		BLAKE3_G(v, 0, 5, 10, 15, m[s[8]],  m[s[9]]);
+		BLAKE3_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+		BLAKE3_G(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+		BLAKE3_G(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+/**
+ * blake3_parent - compute chaining value of parent node
+ * @left:          chaining value of left child
+ * @right:         chaining value of right child
+ * @flags:         additional flags (BLAKE3_ROOT)
+ * @out:           16 words output
+ */
+static void blake3_parent(const uint32_t *left, const uint32_t *right, uint32_t flags, uint32_t *out)
+{
+	int i;
+	uint8_t block[BLAKE3_BLOCK_SIZE];
+
+	for (i = 0; i < 8; i++) {
+		block[i * 4] = left[i];
+		block[i * 4 + 1] = left[i] >> 8;
+		block[i * 4 + 2] = left[i] >> 16;
+		block[i * 4 + 3] = left[i] >> 24;
+		block[32 + i * 4] = right[i];
+		block[32 + i * 4 + 1] = right[i] >> 8;
+		block[32 + i * 4 + 2] = right[i] >> 16;
+		block[32 + i * 4 + 3] = right[i] >> 24;
+	}
+	blake3_compress(blake3_iv, block, 0, BLAKE3_BLOCK_SIZE, BLAKE3_PARENT | flags, out);
+}
+
+/**
+ * blake3_chunk_flags - get flags for current block in chunk
+ * @ctx:                BLAKE3 context
+ *
+ * @return              BLAKE3_CHUNK_START (first block) or 0
+ */
+static inline uint32_t blake3_chunk_flags(struct blake3_ctx *ctx)
+{
+	return ctx->blocks ? 0 : BLAKE3_CHUNK_START;
+}
+
+/**
+ * blake3_push_chunk - add chaining value of completed chunk to tree
+ * @ctx:               BLAKE3 context
+ *
+ * NOTE: Completed subtrees are merged as many as trailing zero bits of chunk count.
+ */
+static void blake3_push_chunk(struct blake3_ctx *ctx)
+{
+	uint32_t out[16], cv[8];
+	uint64_t total;
+
+	blake3_compress(ctx->cv, ctx->buf, ctx->chunk, ctx->used,
+			blake3_chunk_flags(ctx) | BLAKE3_CHUNK_END, out);
+	memcpy(cv, out, sizeof(cv));
+
+	for (total = ++ctx->chunk; !(total & 1); total >>= 1) {
+		blake3_parent(ctx->stack[--ctx->depth], cv, 0, out);
+		memcpy(cv, out, sizeof(cv));
+	}
+	memcpy(ctx->stack[ctx->depth++], cv, sizeof(cv));
+
+	memcpy(ctx->cv, blake3_iv, sizeof(ctx->cv));
+	ctx->used = 0;
+	ctx->blocks = 0;
+}
+
+/**
+ * blake3_init - Initialize BLAKE3 context (hash mode)
+ * @ctx:         BLAKE3 context
+ */
+void blake3_init(struct blake3_ctx *ctx)
+{
+	memcpy(ctx->cv, blake3_iv, sizeof(ctx->cv));
+	ctx->chunk = 0;
+	ctx->used = 0;
+	ctx->blocks = 0;
+	ctx->depth = 0;
+}
+
+/**
+ * blake3_update - Feed data to BLAKE3 context
+ * @ctx:           BLAKE3 context
+ * @data:          data
+ * @len:           length of @data
+ *
+ * NOTE: Last block is kept in buffer, because it may be the end of chunk.
+ */
+void blake3_update(struct blake3_ctx *ctx, const void *data, size_t len)
+{
+	size_t n;
+	uint32_t out[16];
+	const uint8_t *p = data;
+
+	while (len) {
+		if (ctx->used == BLAKE3_BLOCK_SIZE) {
+			if (ctx->blocks == BLAKE3_CHUNK_SIZE / BLAKE3_BLOCK_SIZE - 1) {
+				blake3_push_chunk(ctx);
+			} else {
+				blake3_compress(ctx->cv, ctx->buf, ctx->chunk, BLAKE3_BLOCK_SIZE,
+						blake3_chunk_flags(ctx), out);
+				memcpy(ctx->cv, out, sizeof(ctx->cv));
+				ctx->blocks++;
+				ctx->used = 0;
+			}
+		}
+
+		n = MIN_SIZE(BLAKE3_BLOCK_SIZE - ctx->used, len);
+		memcpy(ctx->buf + ctx->used, p, n);
+		ctx->used += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/**
+ * blake3_final - Get BLAKE3 digest
+ * @ctx:          BLAKE3 context
+ * @digest:       BLAKE3_DIGEST_SIZE bytes digest (Output)
+ */
+void blake3_final(struct blake3_ctx *ctx, uint8_t *digest)
+{
+	int i;
+	size_t depth = ctx->depth;
+	uint32_t out[16], cv[8];
+	uint32_t flags = blake3_chunk_flags(ctx) | BLAKE3_CHUNK_END;
+
+	memset(ctx->buf + ctx->used, 0, BLAKE3_BLOCK_SIZE - ctx->used);
+	if (!depth) {
+		/* Only one chunk is root */
+		blake3_compress(ctx->cv, ctx->buf, ctx->chunk, ctx->used, flags | BLAKE3_ROOT, out);
+	} else {
+		blake3_compress(ctx->cv, ctx->buf, ctx->chunk, ctx->used, flags, out);
+		memcpy(cv, out, sizeof(cv));
+		while (depth > 1) {
+			blake3_parent(ctx->stack[--depth], cv, 0, out);
+			memcpy(cv, out, sizeof(cv));
+		}
+		blake3_parent(ctx->stack[0], cv, BLAKE3_ROOT, out);
+	}
+
+	for (i = 0; i < 8; i++) {
+		digest[i * 4] = out[i];
+		digest[i * 4 + 1] = out[i] >> 8;
+		digest[i * 4 + 2] = out[i] >> 16;
+		digest[i * 4 + 3] = out[i] >> 24;
+	}
+}
+
+/*************************************************************************************************/
+/*                                                                                               */
+/* XXH64                                                                                         */
+/*                                                                                               */
+/*************************************************************************************************/
+
+#define XXH_PRIME64_1    0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2    0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3    0x165667B19E3779F9ULL
+#define XXH_PRIME64_4    0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5    0x27D4EB2F165667C5ULL
+
+#define ROL64(x, n)      (((x) << (n)) | ((x) >> (64 - (n))))
+
+/**
+ * xxh64_read64 - read 64bit little endian value
+ * @p:            data
+ *
+ * @return        value
+ */
+static inline uint64_t xxh64_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64toh(v);
+}
+
+/**
+ * xxh64_read32 - read 32bit little endian value
+ * @p:            data
+ *
+ * @return        value
+ */
+static inline uint32_t xxh64_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+/**
+ * xxh64_round - accumulate 8 bytes
+ * @acc:         accumulator
+ * @input:       8 bytes input
+ *
+ * @return       new accumulator
+ */
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = ROL64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+/**
+ * xxh64_merge - merge accumulator into hash
+ * @h:           hash
+ * @acc:         accumulator
+ *
+ * @return       new hash
+ */
+static inline uint64_t xxh64_merge(uint64_t h, uint64_t acc)
+{
+	h ^= xxh64_round(0, acc);
+	return h * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/**
+ * xxh64_block - process stripes
+ * @ctx:         XXH64 context
+ * @p:           stripes
+ * @n:           the number of stripes
+ */
+static void xxh64_block(struct xxh64_ctx *ctx, const uint8_t *p, size_t n)
+{
+	uint64_t v0 = ctx->v[0], v1 = ctx->v[1], v2 = ctx->v[2], v3 = ctx->v[3];
+
+	for (; n; n--, p += XXH64_BLOCK_SIZE) {
+		v0 = xxh64_round(v0, xxh64_read64(p));
+		v1 = xxh64_round(v1, xxh64_read64(p + 8));
+		v2 = xxh64_round(v2, xxh64_read64(p + 16));
+		v3 = xxh64_round(v3, xxh64_read64(p + 24));
+	}
+
+	ctx->v[0] = v0;
+	ctx->v[1] = v1;
+	ctx->v[2] = v2;
+	ctx->v[3] = v3;
+}
+
+/**
+ * xxh64_init - Initialize XXH64 context
+ * @ctx:        XXH64 context
+ * @seed:       seed
+ */
+void xxh64_init(struct xxh64_ctx *ctx, uint64_t seed)
+{
+	ctx->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+	ctx->v[1] = seed + XXH_PRIME64_2;
+	ctx->v[2] = seed;
+	ctx->v[3] = seed - XXH_PRIME64_1;
+	ctx->seed = seed;
+	ctx->length = 0;
+	ctx->used = 0;
+}
+
+/**
+ * xxh64_update - Feed data to XXH64 context
+ * @ctx:          XXH64 context
+ * @data:         data
+ * @len:          length of @data
+ */
+void xxh64_update(struct xxh64_ctx *ctx, const void *data, size_t len)
+{
+	size_t n;
+	const uint8_t *p = data;
+
+	ctx->length += len;
+	if (ctx->used) {
+		n = XXH64_BLOCK_SIZE - ctx->used;
+		if (len < n) {
+			memcpy(ctx->buf + ctx->used, p, len);
+			ctx->used += len;
+			return;
+		}
+		memcpy(ctx->buf + ctx->used, p, n);
+		xxh64_block(ctx, ctx->buf, 1);
+		ctx->used = 0;
+		p += n;
+		len -= n;
+	}
+
+	n = len / XXH64_BLOCK_SIZE;
+	xxh64_block(ctx, p, n);
+	p += n * XXH64_BLOCK_SIZE;
+	len -= n * XXH64_BLOCK_SIZE;
+
+	memcpy(ctx->buf, p, len);
+	ctx->used = len;
+}
+
+/**
+ * xxh64_digest - Get XXH64 value
+ * @ctx:          XXH64 context
+ *
+ * @return        hash value
+ */
+uint64_t xxh64_digest(struct xxh64_ctx *ctx)
+{
+	size_t i = 0;
+	uint64_t h;
+
+	if (ctx->length >= XXH64_BLOCK_SIZE) {
+		h = ROL64(ctx->v[0], 1) + ROL64(ctx->v[1], 7) + ROL64(ctx->v[2], 12) + ROL64(ctx->v[3], 18);
+		h = xxh64_merge(h, ctx->v[0]);
+		h = xxh64_merge(h, ctx->v[1]);
+		h = xxh64_merge(h, ctx->v[2]);
+		h = xxh64_merge(h, ctx->v[3]);
+	} else {
+		h = ctx->seed + XXH_PRIME64_5;
+	}
+	h += ctx->length;
+
+	for (; i + 8 <= ctx->used; i += 8) {
+		h ^= xxh64_round(0, xxh64_read64(ctx->buf + i));
+		h = ROL64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (i + 4 <= ctx->used) {
+		h ^= (uint64_t)xxh64_read32(ctx->buf + i) * XXH_PRIME64_1;
+		h = ROL64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		i += 4;
+	}
+	for (; i < ctx->used; i++) {
+		h ^= ctx->buf[i] * XXH_PRIME64_5;
+		h = ROL64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * xxh64_final - Get XXH64 digest (canonical big endian)
+ * @ctx:         XXH64 context
+ * @digest:      XXH64_DIGEST_SIZE bytes digest (Output)
+ */
+void xxh64_final(struct xxh64_ctx *ctx, uint8_t *digest)
+{
+	int i;
+	uint64_t h = xxh64_digest(ctx);
+
+	for (i = 0; i < XXH64_DIGEST_SIZE; i++)
+		digest[i] = h >> ((XXH64_DIGEST_SIZE - 1 - i) * 8);
+}
+
+/**
+ * xxh64 - Calculate XXH64 of data at once
+ * @data:   data
+ * @len:    length of @data
+ * @seed:   seed
+ *
+ * @return  hash value
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+	struct xxh64_ctx ctx;
+
+	xxh64_init(&ctx, seed);
+	xxh64_update(&ctx, data, len);
+	return xxh64_digest(&ctx);
+}
+
+/*************************************************************************************************/
+/*                                                                                               */
+/* Hash algorithm selection                                                                      */
+/*                                                                                               */
+/*************************************************************************************************/
+
+static void hash_sha256_init(union hash_ctx *ctx)
+{
+	sha256_init(&ctx->sha256);
+}
+
+static void hash_sha256_update(union hash_ctx *ctx, const void *data, size_t len)
+{
+	sha256_update(&ctx->sha256, data, len);
+}
+
+static void hash_sha256_final(union hash_ctx *ctx, uint8_t *digest)
+{
+	sha256_final(&ctx->sha256, digest);
+}
+
+static void hash_blake3_init(union hash_ctx *ctx)
+{
+	blake3_init(&ctx->blake3);
+}
+
+static void hash_blake3_update(union hash_ctx *ctx, const void *data, size_t len)
+{
+	blake3_update(&ctx->blake3, data, len);
+}
+
+static void hash_blake3_final(union hash_ctx *ctx, uint8_t *digest)
+{
+	blake3_final(&ctx->blake3, digest);
+}
+
+static void hash_xxh64_init(union hash_ctx *ctx)
+{
+	xxh64_init(&ctx->xxh64, 0);
+}
+
+static void hash_xxh64_update(union hash_ctx *ctx, const void *data, size_t len)
+{
+	xxh64_update(&ctx->xxh64, data, len);
+}
+
+static void hash_xxh64_final(union hash_ctx *ctx, uint8_t *digest)
+{
+	xxh64_final(&ctx->xxh64, digest);
+}
+
+static const struct hash_algo hash_algos[] = {
+	{"sha256", SHA256_DIGEST_SIZE, hash_sha256_init, hash_sha256_update, hash_sha256_final},
+	{"blake3", BLAKE3_DIGEST_SIZE, hash_blake3_init, hash_blake3_update, hash_blake3_final},
+	{"xxh64", XXH64_DIGEST_SIZE, hash_xxh64_init, hash_xxh64_update, hash_xxh64_final},
+};
+
+/**
+ * hash_find_algo - find hash algorithm by name
+ * @name:           algorithm name (sha256, blake3, xxh64)
+ *
+ * @return          hash algorithm
+ *                  NULL (unknown algorithm)
+ */
+const struct hash_algo *hash_find_algo(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(hash_algos) / sizeof(hash_algos[0]); i++) {
+		if (!strcmp(hash_algos[i].name, name))
+			return &hash_algos[i];
+	}
+	return NULL;
+}
+
+/**
+ * hash_to_hex - convert digest to hex string
+ * @digest:      digest
+ * @len:         length of @digest
+ * @str:         2 * @len + 1 bytes string (Output)
+ */
+void hash_to_hex(const uint8_t *digest, size_t len, char *str)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		str[i * 2] = hex[digest[i] >> 4];
+		str[i * 2 + 1] = hex[digest[i] & 0xf];
+	}
+	str[len * 2] = '\0';
+}
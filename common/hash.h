@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_BLOCK_SIZE     64
+#define SHA256_DIGEST_SIZE    32
+
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t buf[SHA256_BLOCK_SIZE];
+	size_t used;
+};
+
+#define BLAKE3_BLOCK_SIZE     64
+#define BLAKE3_CHUNK_SIZE     1024
+#define BLAKE3_DIGEST_SIZE    32
+#define BLAKE3_MAX_DEPTH      54
+
+struct blake3_ctx {
+	uint32_t cv[8];
+	uint64_t chunk;
+	uint8_t buf[BLAKE3_BLOCK_SIZE];
+	size_t used;
+	size_t blocks;
+	uint32_t stack[BLAKE3_MAX_DEPTH][8];
+	size_t depth;
+};
+
+#define XXH64_BLOCK_SIZE      32
+#define XXH64_DIGEST_SIZE     8
+
+struct xxh64_ctx {
+	uint64_t v[4];
+	uint64_t seed;
+	uint64_t length;
+	uint8_t buf[XXH64_BLOCK_SIZE];
+	size_t used;
+};
+
+#define HASH_MAX_DIGEST_SIZE  32
+
+union hash_ctx {
+	struct sha256_ctx sha256;
+	struct blake3_ctx blake3;
+	struct xxh64_ctx xxh64;
+};
+
+/* Hash algorithm which can be selected by name */
+struct hash_algo {
+	const char *name;
+	size_t digest_size;
+	void (*init)(union hash_ctx *);
+	void (*update)(union hash_ctx *, const void *, size_t);
+	void (*final)(union hash_ctx *, uint8_t *);
+};
+
+void sha256_init(struct sha256_ctx *);
+void sha256_update(struct sha256_ctx *, const void *, size_t);
+void sha256_final(struct sha256_ctx *, uint8_t *);
+void blake3_init(struct blake3_ctx *);
+void blake3_update(struct blake3_ctx *, const void *, size_t);
+void blake3_final(struct blake3_ctx *, uint8_t *);
+void xxh64_init(struct xxh64_ctx *, uint64_t);
+void xxh64_update(struct xxh64_ctx *, const void *, size_t);
+uint64_t xxh64_digest(struct xxh64_ctx *);
+void xxh64_final(struct xxh64_ctx *, uint8_t *);
+uint64_t xxh64(const void *, size_t, uint64_t);
+const struct hash_algo *hash_find_algo(const char *);
+void hash_to_hex(const uint8_t *, size_t, char *);
+
+#endif /*_HASH_H */
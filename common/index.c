@@ -0,0 +1,835 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "exfat.h"
+#include "hash.h"
+#include "index.h"
+
+extern struct exfat_info info;
+
+/* Index mapped into memory */
+struct exfat_index {
+	void *map;
+	size_t size;
+	const struct exfat_index_header *hdr;
+	const struct exfat_index_dir *dirs;
+	const struct exfat_index_entry *entries;
+	const struct exfat_index_hash *hashes;
+	const struct exfat_index_extent *extents;
+	const uint16_t *names;
+	uint32_t dir_count;
+	uint32_t entry_count;
+	uint32_t extent_count;
+	uint32_t name_count;
+};
+
+/* Index under construction */
+struct exfat_index_builder {
+	struct exfat_index_dir *dirs;
+	uint32_t dir_count;
+	struct exfat_index_entry *entries;
+	struct exfat_index_hash *hashes;
+	uint32_t entry_count;
+	uint32_t entry_size;
+	uint32_t hash_size;
+	struct exfat_index_extent *extents;
+	uint32_t extent_count;
+	uint32_t extent_size;
+	uint16_t *names;
+	uint32_t name_count;
+	uint32_t name_size;
+};
+
+/**
+ * exfat_index_grow - expand array by power of two
+ * @array:            array (Input/Output)
+ * @size:             allocated elements (Input/Output)
+ * @need:             the number of elements needed
+ * @elem:             size of element
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ */
+static int exfat_index_grow(void **array, uint32_t *size, uint32_t need, size_t elem)
+{
+	void *tmp;
+	uint32_t n = *size ? *size : 64;
+
+	if (need <= *size)
+		return 0;
+	while (n < need)
+		n *= 2;
+	if ((tmp = realloc(*array, (size_t)n * elem)) == NULL)
+		return -ENOMEM;
+	*array = tmp;
+	*size = n;
+	return 0;
+}
+
+/**
+ * exfat_index_key - calculate SHA-256 of First FAT and Allocation Bitmap
+ * @key:             SHA-256 digest (Output)
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ */
+static int exfat_index_key(uint8_t *key)
+{
+	int ret = 0;
+	void *buf;
+	size_t len;
+	off_t pos, end;
+	struct sha256_ctx ctx;
+
+	if ((buf = malloc(EXFAT_COMPARE_CHUNK)) == NULL)
+		return -ENOMEM;
+
+	sha256_init(&ctx);
+	pos = (off_t)info.fat_offset * info.sector_size;
+	end = pos + info.fat_length / MAX(info.fat_count, 1);
+	for (; pos < end; pos += len) {
+		len = MIN(end - pos, EXFAT_COMPARE_CHUNK);
+		if ((ret = get_sector(buf, pos, ROUNDUP(len, info.sector_size))))
+			goto out;
+		sha256_update(&ctx, buf, len);
+	}
+	if (info.alloc_table)
+		sha256_update(&ctx, info.alloc_table, info.alloc_length);
+	sha256_final(&ctx, key);
+out:
+	free(buf);
+	return ret;
+}
+
+/**
+ * exfat_index_path - obtain index path from image path
+ * @image:            image path
+ *
+ * @return            index path (needs to be released by caller)
+ */
+static char *exfat_index_path(const char *image)
+{
+	char *path;
+	size_t len = strlen(image) + strlen(EXFAT_INDEX_SUFFIX) + 1;
+
+	if ((path = malloc(len)) != NULL)
+		snprintf(path, len, "%s%s", image, EXFAT_INDEX_SUFFIX);
+	return path;
+}
+
+/**
+ * exfat_index_compare_hash - compare function to sort by NameHash
+ * @a:                        exfat_index_hash
+ * @b:                        exfat_index_hash
+ *
+ * @return                    order
+ */
+static int exfat_index_compare_hash(const void *a, const void *b)
+{
+	const struct exfat_index_hash *x = a, *y = b;
+
+	if (x->NameHash != y->NameHash)
+		return le16_to_cpu(x->NameHash) < le16_to_cpu(y->NameHash) ? -1 : 1;
+	return le32_to_cpu(x->Entry) < le32_to_cpu(y->Entry) ? -1 : 1;
+}
+
+/**
+ * exfat_index_compare_dir - compare function to sort directory by cluster
+ * @a:                       cache head pointer
+ * @b:                       cache head pointer
+ *
+ * @return                   order
+ */
+static int exfat_index_compare_dir(const void *a, const void *b)
+{
+	const node2_t *x = *(node2_t * const *)a, *y = *(node2_t * const *)b;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * exfat_index_add_extents - append cluster runs of file
+ * @b:                       index builder
+ * @f:                       file information
+ * @e:                       index entry (Output)
+ *
+ * @return                   == 0 (success)
+ *                           <  0 (failed)
+ */
+static int exfat_index_add_extents(struct exfat_index_builder *b,
+		struct exfat_fileinfo *f, struct exfat_index_entry *e)
+{
+	int ret;
+	uint32_t clu, n, count = 0;
+	struct exfat_index_extent *last;
+
+	e->FirstExtent = cpu_to_le32(b->extent_count);
+
+	for (clu = f->clu, n = 0; n < info.cluster_count; n++) {
+		if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1)
+			break;
+
+		last = count ? &b->extents[b->extent_count - 1] : NULL;
+		if (last && le32_to_cpu(last->Cluster) + le32_to_cpu(last->Length) == clu) {
+			last->Length = cpu_to_le32(le32_to_cpu(last->Length) + 1);
+		} else {
+			if ((ret = exfat_index_grow((void **)&b->extents, &b->extent_size,
+							b->extent_count + 1, sizeof(*b->extents))) < 0)
+				return ret;
+			b->extents[b->extent_count].Cluster = cpu_to_le32(clu);
+			b->extents[b->extent_count].Length = cpu_to_le32(1);
+			b->extent_count++;
+			count++;
+		}
+
+		clu = exfat_next_cluster(f, clu);
+		if (clu == EXFAT_LASTCLUSTER)
+			break;
+	}
+	e->ExtentCount = cpu_to_le32(count);
+	return 0;
+}
+
+/**
+ * exfat_index_add_entry - append file to index
+ * @b:                     index builder
+ * @f:                     file information
+ * @clu:                   first cluster of file
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ */
+static int exfat_index_add_entry(struct exfat_index_builder *b, struct exfat_fileinfo *f, uint32_t clu)
+{
+	int ret, len;
+	uint16_t name[MAX_NAME_LENGTH * 2];
+	struct exfat_index_entry *e;
+	struct exfat_index_hash *h;
+
+	len = utf8s_to_utf16s(f->name, strlen((char *)f->name), name);
+	len = MIN(len, MAX_NAME_LENGTH);
+
+	if ((ret = exfat_index_grow((void **)&b->entries, &b->entry_size,
+					b->entry_count + 1, sizeof(*b->entries))) < 0)
+		return ret;
+	if ((ret = exfat_index_grow((void **)&b->hashes, &b->hash_size,
+					b->entry_count + 1, sizeof(*b->hashes))) < 0)
+		return ret;
+	if ((ret = exfat_index_grow((void **)&b->names, &b->name_size,
+					b->name_count + len, sizeof(*b->names))) < 0)
+		return ret;
+
+	e = &b->entries[b->entry_count];
+	memset(e, 0, sizeof(*e));
+	e->DataLength = cpu_to_le64(f->datalen);
+	e->FirstCluster = cpu_to_le32(clu);
+	e->NameOffset = cpu_to_le32(b->name_count);
+	e->NameLength = len;
+	e->NameHash = cpu_to_le16(f->hash);
+	e->FileAttributes = cpu_to_le16(f->attr);
+	e->GeneralSecondaryFlags = f->flags;
+	e->CreateTimestamp = cpu_to_le32(f->ctime.time);
+	e->Create10msIncrement = f->ctime.subsec;
+	e->CreateUtcOffset = f->ctime.tz;
+	e->LastModifiedTimestamp = cpu_to_le32(f->mtime.time);
+	e->LastModified10msIncrement = f->mtime.subsec;
+	e->LastModifiedUtcOffset = f->mtime.tz;
+	e->LastAccessedTimestamp = cpu_to_le32(f->atime.time);
+	e->LastAccessdUtcOffset = f->atime.tz;
+
+	h = &b->hashes[b->entry_count];
+	h->NameHash = cpu_to_le16(exfat_calculate_upper_namehash(name, len));
+	h->Reserved = 0;
+	h->Entry = cpu_to_le32(b->entry_count);
+
+	memcpy(b->names + b->name_count, name, len * sizeof(uint16_t));
+	b->name_count += len;
+
+	if ((ret = exfat_index_add_extents(b, f, e)) < 0)
+		return ret;
+	b->entry_count++;
+	return 0;
+}
+
+/**
+ * exfat_index_build - convert directory cache to index
+ * @b:                 index builder (Output)
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+static int exfat_index_build(struct exfat_index_builder *b)
+{
+	int ret = 0;
+	uint32_t i, count;
+	node2_t **heads, *tmp;
+	struct exfat_index_dir *d;
+
+	for (count = 0; count < info.root_size && info.root[count]; count++)
+		;
+	if ((heads = malloc(count * sizeof(node2_t *))) == NULL)
+		return -ENOMEM;
+	memcpy(heads, info.root, count * sizeof(node2_t *));
+	qsort(heads, count, sizeof(node2_t *), exfat_index_compare_dir);
+
+	if ((b->dirs = calloc(count, sizeof(struct exfat_index_dir))) == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (b->dir_count && b->dirs[b->dir_count - 1].Cluster == heads[i]->index)
+			continue;
+		d = &b->dirs[b->dir_count++];
+		d->Cluster = cpu_to_le32(heads[i]->index);
+		d->FirstEntry = cpu_to_le32(b->entry_count);
+
+		for (tmp = heads[i]; tmp->next != NULL; ) {
+			tmp = tmp->next;
+			if ((ret = exfat_index_add_entry(b, tmp->data, tmp->index)) < 0)
+				goto out;
+		}
+		d->EntryCount = cpu_to_le32(b->entry_count - d->FirstEntry);
+		qsort(b->hashes + d->FirstEntry, d->EntryCount,
+				sizeof(struct exfat_index_hash), exfat_index_compare_hash);
+	}
+out:
+	free(heads);
+	return ret;
+}
+
+/**
+ * exfat_index_write - write index file
+ * @path:              index path
+ * @b:                 index builder
+ * @hdr:               index header (offsets are filled)
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ *
+ * NOTE: Index is written to temporary file and renamed,
+ *       so that other process never maps incomplete index.
+ */
+static int exfat_index_write(const char *path, struct exfat_index_builder *b,
+		struct exfat_index_header *hdr)
+{
+	int fd, i, ret = 0;
+	char *tmp;
+	size_t len = strlen(path) + 8;
+	uint64_t pos = sizeof(*hdr);
+	struct {
+		const void *data;
+		size_t len;
+		__le64 *offset;
+	} sec[] = {
+		{b->dirs, (size_t)b->dir_count * sizeof(*b->dirs), &hdr->DirOffset},
+		{b->entries, (size_t)b->entry_count * sizeof(*b->entries), &hdr->EntryOffset},
+		{b->hashes, (size_t)b->entry_count * sizeof(*b->hashes), &hdr->HashOffset},
+		{b->extents, (size_t)b->extent_count * sizeof(*b->extents), &hdr->ExtentOffset},
+		{b->names, (size_t)b->name_count * sizeof(*b->names), &hdr->NameOffset},
+		{info.upcase_table, info.upcase_size, &hdr->UpcaseOffset},
+	};
+
+	for (i = 0; i < sizeof(sec) / sizeof(sec[0]); i++) {
+		*sec[i].offset = cpu_to_le64(pos);
+		pos = (pos + sec[i].len + 7) & ~7ULL;
+	}
+
+	if ((tmp = malloc(len)) == NULL)
+		return -ENOMEM;
+	snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) < 0) {
+		ret = -errno;
+		pr_warn("Can't create index %s: %s\n", tmp, strerror(-ret));
+		free(tmp);
+		return ret;
+	}
+
+	if (pwrite(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr))
+		ret = -EIO;
+	for (i = 0; !ret && i < sizeof(sec) / sizeof(sec[0]); i++) {
+		if (sec[i].len && pwrite(fd, sec[i].data, sec[i].len,
+					le64_to_cpu(*sec[i].offset)) != (ssize_t)sec[i].len)
+			ret = -EIO;
+	}
+	if (!ret && ftruncate(fd, pos) < 0)
+		ret = -errno;
+	if (!ret && fchmod(fd, 0644) < 0)
+		ret = -errno;
+	close(fd);
+
+	if (!ret && rename(tmp, path) < 0)
+		ret = -errno;
+	if (ret) {
+		pr_warn("Can't write index %s.\n", path);
+		unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
+
+/**
+ * exfat_index_noop - callback to load all directories into cache
+ *
+ * @return            0 (continue walking)
+ */
+static int exfat_index_noop(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	return 0;
+}
+
+/**
+ * exfat_index_create - traverse all directories and create index
+ * @path:               index path
+ * @b:                  boot sector
+ * @st:                 image status
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ */
+static int exfat_index_create(const char *path, struct exfat_bootsec *boot, struct stat *st)
+{
+	int ret;
+	struct exfat_index_header hdr = {0};
+	struct exfat_index_builder b = {0};
+	struct exfat_fileinfo *root = info.root[0]->data;
+
+	if ((ret = exfat_walk_tree(exfat_index_noop, NULL)) < 0)
+		return ret;
+	if ((ret = exfat_index_build(&b)) < 0)
+		goto out;
+
+	memcpy(hdr.Magic, EXFAT_INDEX_MAGIC, sizeof(hdr.Magic));
+	hdr.Version = cpu_to_le32(EXFAT_INDEX_VERSION);
+	hdr.VolumeSerialNumber = boot->VolumeSerialNumber;
+	hdr.ImageSize = cpu_to_le64(info.total_size);
+	hdr.ImageMtime = cpu_to_le64(st->st_mtim.tv_sec);
+	hdr.ImageMtimeNsec = cpu_to_le32(st->st_mtim.tv_nsec);
+	hdr.DirCount = cpu_to_le32(b.dir_count);
+	hdr.EntryCount = cpu_to_le32(b.entry_count);
+	hdr.ExtentCount = cpu_to_le32(b.extent_count);
+	hdr.NameCount = cpu_to_le32(b.name_count);
+	hdr.AllocCluster = cpu_to_le32(info.alloc_offset);
+	hdr.AllocLength = cpu_to_le64(info.alloc_length);
+	hdr.UpcaseCluster = cpu_to_le32(info.upcase_offset);
+	hdr.UpcaseLength = cpu_to_le32(info.upcase_size);
+	hdr.RootLength = cpu_to_le64(root->datalen);
+	hdr.VolumeLabelLength = MIN(info.vol_length, 11);
+	memcpy(hdr.VolumeLabel, info.vol_label, hdr.VolumeLabelLength * sizeof(uint16_t));
+	if ((ret = exfat_index_key(hdr.Key)) < 0)
+		goto out;
+
+	ret = exfat_index_write(path, &b, &hdr);
+	pr_info("Index %s: %u directories, %u files\n", path, b.dir_count, b.entry_count);
+out:
+	free(b.dirs);
+	free(b.entries);
+	free(b.hashes);
+	free(b.extents);
+	free(b.names);
+	return ret;
+}
+
+/**
+ * exfat_index_check_size - check whether all sections are in index
+ * @h:                      index header
+ * @size:                   index size
+ *
+ * @return                  true (all sections are in index)
+ *                          false (index is truncated)
+ */
+static bool exfat_index_check_size(const struct exfat_index_header *h, uint64_t size)
+{
+	int i;
+	struct {
+		uint64_t offset;
+		uint64_t len;
+	} sec[] = {
+		{le64_to_cpu(h->DirOffset), (uint64_t)le32_to_cpu(h->DirCount) * sizeof(struct exfat_index_dir)},
+		{le64_to_cpu(h->EntryOffset), (uint64_t)le32_to_cpu(h->EntryCount) * sizeof(struct exfat_index_entry)},
+		{le64_to_cpu(h->HashOffset), (uint64_t)le32_to_cpu(h->EntryCount) * sizeof(struct exfat_index_hash)},
+		{le64_to_cpu(h->ExtentOffset), (uint64_t)le32_to_cpu(h->ExtentCount) * sizeof(struct exfat_index_extent)},
+		{le64_to_cpu(h->NameOffset), (uint64_t)le32_to_cpu(h->NameCount) * sizeof(uint16_t)},
+		{le64_to_cpu(h->UpcaseOffset), le32_to_cpu(h->UpcaseLength)},
+	};
+
+	for (i = 0; i < sizeof(sec) / sizeof(sec[0]); i++) {
+		if (sec[i].offset < sizeof(*h) || sec[i].offset > size || sec[i].len > size - sec[i].offset)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * exfat_index_map - map index and verify its header
+ * @path:            index path
+ * @boot:            boot sector
+ * @st:              image status
+ *
+ * @return           index (success)
+ *                   NULL (index doesn't exist, or is stale)
+ */
+static struct exfat_index *exfat_index_map(const char *path, struct exfat_bootsec *boot, struct stat *st)
+{
+	int fd;
+	struct stat s;
+	struct exfat_index *idx;
+	const struct exfat_index_header *h;
+	void *map;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &s) < 0 || s.st_size < sizeof(*h)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	h = map;
+	if (memcmp(h->Magic, EXFAT_INDEX_MAGIC, sizeof(h->Magic)) ||
+			le32_to_cpu(h->Version) != EXFAT_INDEX_VERSION ||
+			h->VolumeSerialNumber != boot->VolumeSerialNumber ||
+			le64_to_cpu(h->ImageSize) != info.total_size ||
+			le64_to_cpu(h->ImageMtime) != st->st_mtim.tv_sec ||
+			le32_to_cpu(h->ImageMtimeNsec) != st->st_mtim.tv_nsec) {
+		pr_info("Index %s is stale.\n", path);
+		munmap(map, s.st_size);
+		return NULL;
+	}
+
+	if (!exfat_index_check_size(h, s.st_size)) {
+		pr_warn("Index %s is broken.\n", path);
+		munmap(map, s.st_size);
+		return NULL;
+	}
+
+	if ((idx = calloc(1, sizeof(*idx))) == NULL) {
+		munmap(map, s.st_size);
+		return NULL;
+	}
+	idx->map = map;
+	idx->size = s.st_size;
+	idx->hdr = h;
+	idx->dirs = (void *)((char *)map + le64_to_cpu(h->DirOffset));
+	idx->entries = (void *)((char *)map + le64_to_cpu(h->EntryOffset));
+	idx->hashes = (void *)((char *)map + le64_to_cpu(h->HashOffset));
+	idx->extents = (void *)((char *)map + le64_to_cpu(h->ExtentOffset));
+	idx->names = (void *)((char *)map + le64_to_cpu(h->NameOffset));
+	idx->dir_count = le32_to_cpu(h->DirCount);
+	idx->entry_count = le32_to_cpu(h->EntryCount);
+	idx->extent_count = le32_to_cpu(h->ExtentCount);
+	idx->name_count = le32_to_cpu(h->NameCount);
+	return idx;
+}
+
+/**
+ * exfat_index_unmap - release index
+ * @idx:               index
+ */
+static void exfat_index_unmap(struct exfat_index *idx)
+{
+	munmap(idx->map, idx->size);
+	free(idx);
+}
+
+/**
+ * exfat_index_restore - load Root directory information from index
+ * @idx:                 index
+ *
+ * @return               == 0 (success)
+ *                       == 1 (FAT or Allocation Bitmap was changed)
+ *                       <  0 (failed)
+ */
+static int exfat_index_restore(struct exfat_index *idx)
+{
+	int ret;
+	uint8_t key[SHA256_DIGEST_SIZE];
+	uint16_t *upcase;
+	struct exfat_dentry d = {0};
+	const struct exfat_index_header *h = idx->hdr;
+	struct exfat_fileinfo *root = info.root[0]->data;
+	uint64_t upcase_offset = le64_to_cpu(h->UpcaseOffset);
+	uint32_t upcase_len = le32_to_cpu(h->UpcaseLength);
+
+	/* Fields copied into fixed-size buffers must fit them */
+	if (h->VolumeLabelLength > sizeof(h->VolumeLabel) / sizeof(h->VolumeLabel[0]) ||
+			!upcase_len || upcase_len % sizeof(uint16_t) ||
+			upcase_offset < sizeof(*h) || upcase_offset > idx->size ||
+			upcase_len > idx->size - upcase_offset)
+		return 1;
+
+	d.EntryType = DENTRY_BITMAP;
+	d.dentry.bitmap.FirstCluster = h->AllocCluster;
+	d.dentry.bitmap.DataLength = h->AllocLength;
+	if ((ret = exfat_load_bitmap_cluster(d)) < 0)
+		return ret;
+
+	if ((ret = exfat_index_key(key)) < 0)
+		return ret;
+	if (memcmp(key, h->Key, sizeof(key))) {
+		free(info.alloc_table);
+		info.alloc_table = NULL;
+		info.alloc_offset = 0;
+		info.alloc_length = 0;
+		return 1;
+	}
+
+	if ((upcase = malloc(upcase_len)) == NULL)
+		return -ENOMEM;
+	memcpy(upcase, (char *)idx->map + upcase_offset, upcase_len);
+	if ((ret = exfat_expand_upcase_table(upcase, upcase_len / sizeof(uint16_t))) < 0) {
+		free(upcase);
+		return ret;
+	}
+	info.upcase_table = upcase;
+	info.upcase_offset = le32_to_cpu(h->UpcaseCluster);
+	info.upcase_size = upcase_len;
+
+	info.vol_length = h->VolumeLabelLength;
+	memcpy(info.vol_label, h->VolumeLabel, info.vol_length * sizeof(uint16_t));
+	root->datalen = le64_to_cpu(h->RootLength);
+	return 0;
+}
+
+/**
+ * exfat_index_open - use index instead of traversing Root directory
+ * @image:            image path
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: If index doesn't exist or is stale, Root directory is traversed
+ *       and index is recreated from all directories.
+ *       Failure to write index isn't fatal.
+ */
+int exfat_index_open(const char *image)
+{
+	int ret;
+	char *path;
+	struct stat st;
+	struct exfat_bootsec boot;
+	struct exfat_index *idx;
+
+	if (fstat(info.fd, &st) < 0) {
+		ret = -errno;
+		pr_err("stat: %s\n", strerror(-ret));
+		return ret;
+	}
+	if ((ret = get_sector(&boot, 0, 1)) < 0)
+		return ret;
+	if ((path = exfat_index_path(image)) == NULL)
+		return -ENOMEM;
+
+	if ((idx = exfat_index_map(path, &boot, &st)) != NULL) {
+		ret = exfat_index_restore(idx);
+		if (!ret) {
+			info.index = idx;
+			free(path);
+			return 0;
+		}
+		exfat_index_unmap(idx);
+		if (ret < 0)
+			goto out;
+		pr_info("Index %s is stale.\n", path);
+	}
+
+	if ((ret = exfat_traverse_root_directory()) < 0)
+		goto out;
+	exfat_index_create(path, &boot, &st);
+out:
+	free(path);
+	return ret;
+}
+
+/**
+ * exfat_index_close - release index
+ */
+void exfat_index_close(void)
+{
+	if (!info.index)
+		return;
+	exfat_index_unmap(info.index);
+	info.index = NULL;
+}
+
+/**
+ * exfat_index_find_dir - find directory in index
+ * @clu:                  first cluster of directory
+ *
+ * @return                directory (success)
+ *                        NULL (not found)
+ */
+static const struct exfat_index_dir *exfat_index_find_dir(uint32_t clu)
+{
+	struct exfat_index *idx = info.index;
+	uint32_t lo = 0, hi, mid;
+
+	if (!idx)
+		return NULL;
+
+	hi = idx->dir_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (le32_to_cpu(idx->dirs[mid].Cluster) < clu)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < idx->dir_count && le32_to_cpu(idx->dirs[lo].Cluster) == clu)
+		return &idx->dirs[lo];
+	return NULL;
+}
+
+/**
+ * exfat_index_load_directory - create directory cache from index
+ * @head:                       Directory chain head
+ * @clu:                        first cluster of directory
+ *
+ * @return                      == 0 (success)
+ *                              <  0 (directory isn't in index)
+ */
+int exfat_index_load_directory(node2_t *head, uint32_t clu)
+{
+	int ret;
+	uint32_t i, first, count;
+	uint16_t uniname[MAX_NAME_LENGTH] = {0};
+	struct exfat_dentry file, stream;
+	const struct exfat_index_dir *dir;
+	const struct exfat_index_entry *e;
+
+	if ((dir = exfat_index_find_dir(clu)) == NULL)
+		return -ENOENT;
+
+	first = le32_to_cpu(dir->FirstEntry);
+	count = le32_to_cpu(dir->EntryCount);
+	for (i = first; i < first + count && i < info.index->entry_count; i++) {
+		e = &info.index->entries[i];
+		memset(&file, 0, sizeof(file));
+		memset(&stream, 0, sizeof(stream));
+
+		file.EntryType = DENTRY_FILE;
+		file.dentry.file.FileAttributes = e->FileAttributes;
+		file.dentry.file.CreateTimestamp = e->CreateTimestamp;
+		file.dentry.file.Create10msIncrement = e->Create10msIncrement;
+		file.dentry.file.CreateUtcOffset = e->CreateUtcOffset;
+		file.dentry.file.LastModifiedTimestamp = e->LastModifiedTimestamp;
+		file.dentry.file.LastModified10msIncrement = e->LastModified10msIncrement;
+		file.dentry.file.LastModifiedUtcOffset = e->LastModifiedUtcOffset;
+		file.dentry.file.LastAccessedTimestamp = e->LastAccessedTimestamp;
+		file.dentry.file.LastAccessdUtcOffset = e->LastAccessdUtcOffset;
+
+		stream.EntryType = DENTRY_STREAM;
+		stream.dentry.stream.GeneralSecondaryFlags = e->GeneralSecondaryFlags;
+		stream.dentry.stream.NameLength = e->NameLength;
+		stream.dentry.stream.NameHash = e->NameHash;
+		stream.dentry.stream.FirstCluster = e->FirstCluster;
+		stream.dentry.stream.DataLength = e->DataLength;
+
+		if (le32_to_cpu(e->NameOffset) + e->NameLength > info.index->name_count)
+			continue;
+		memcpy(uniname, info.index->names + le32_to_cpu(e->NameOffset),
+				e->NameLength * sizeof(uint16_t));
+		if ((ret = exfat_create_cache(head, clu, &file, &stream, uniname,
+						EXFAT_UNKNOWN_ENTRY)) < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * exfat_index_lookup - lookup file in directory by NameHash
+ * @dir:                first cluster of directory
+ * @name:               file name (UTF-8)
+ * @clu:                first cluster of file (Output)
+ *
+ * @return              1 (found)
+ *                      0 (not found)
+ *                      <  0 (directory isn't in index)
+ */
+int exfat_index_lookup(uint32_t dir, const char *name, uint32_t *clu)
+{
+	int len;
+	uint16_t hash;
+	uint16_t uniname[MAX_NAME_LENGTH * 2];
+	uint32_t lo, hi, mid, end;
+	const struct exfat_index_dir *d;
+	const struct exfat_index_entry *e;
+	const struct exfat_index_hash *hashes = info.index ? info.index->hashes : NULL;
+
+	if ((d = exfat_index_find_dir(dir)) == NULL)
+		return -ENOENT;
+
+	len = utf8s_to_utf16s((unsigned char *)name, strlen(name), uniname);
+	if (len <= 0 || len > MAX_NAME_LENGTH)
+		return 0;
+	hash = exfat_calculate_upper_namehash(uniname, len);
+
+	lo = le32_to_cpu(d->FirstEntry);
+	end = hi = MIN(lo + le32_to_cpu(d->EntryCount), info.index->entry_count);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (le16_to_cpu(hashes[mid].NameHash) < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < end && le16_to_cpu(hashes[lo].NameHash) == hash; lo++) {
+		if (le32_to_cpu(hashes[lo].Entry) >= info.index->entry_count)
+			continue;
+		e = &info.index->entries[le32_to_cpu(hashes[lo].Entry)];
+		if (e->NameLength == len &&
+				le32_to_cpu(e->NameOffset) + len <= info.index->name_count &&
+				!memcmp(info.index->names + le32_to_cpu(e->NameOffset), uniname,
+					len * sizeof(uint16_t))) {
+			*clu = le32_to_cpu(e->FirstCluster);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * exfat_index_extents - obtain cluster runs of file from index
+ * @dir:                 first cluster of parent directory
+ * @clu:                 first cluster of file
+ * @count:               the number of extents (Output)
+ *
+ * @return               extents (success)
+ *                       NULL (file isn't in index)
+ */
+const struct exfat_index_extent *exfat_index_extents(uint32_t dir, uint32_t clu, uint32_t *count)
+{
+	uint32_t i, first, end;
+	const struct exfat_index_dir *d;
+	const struct exfat_index_entry *e;
+
+	if ((d = exfat_index_find_dir(dir)) == NULL)
+		return NULL;
+
+	first = le32_to_cpu(d->FirstEntry);
+	end = MIN(first + le32_to_cpu(d->EntryCount), info.index->entry_count);
+	for (i = first; i < end; i++) {
+		e = &info.index->entries[i];
+		if (le32_to_cpu(e->FirstCluster) != clu)
+			continue;
+		if (le32_to_cpu(e->FirstExtent) + le32_to_cpu(e->ExtentCount) > info.index->extent_count)
+			return NULL;
+		*count = le32_to_cpu(e->ExtentCount);
+		return info.index->extents + le32_to_cpu(e->FirstExtent);
+	}
+	return NULL;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _INDEX_H
+#define _INDEX_H
+
+#include <stdint.h>
+#include <linux/types.h>
+
+#include "list2.h"
+
+/*
+ * Metadata index (IMAGE.idx)
+ *
+ *   +---------------------------+ 0
+ *   | struct exfat_index_header |
+ *   +---------------------------+ DirOffset
+ *   | struct exfat_index_dir    | x DirCount (sorted by Cluster)
+ *   +---------------------------+ EntryOffset
+ *   | struct exfat_index_entry  | x EntryCount (in directory order)
+ *   +---------------------------+ HashOffset
+ *   | struct exfat_index_hash   | x EntryCount (sorted by NameHash in each directory)
+ *   +---------------------------+ ExtentOffset
+ *   | struct exfat_index_extent | x ExtentCount
+ *   +---------------------------+ NameOffset
+ *   | File name (UTF-16)        |
+ *   +---------------------------+ UpcaseOffset
+ *   | Up-case table             |
+ *   +---------------------------+
+ *
+ * Index is used only if volume serial number, image size, image mtime and
+ * SHA-256 of First FAT and Allocation Bitmap are the same as when created.
+ */
+#define EXFAT_INDEX_MAGIC      "EXFATIDX"
+#define EXFAT_INDEX_VERSION    1
+#define EXFAT_INDEX_SUFFIX     ".idx"
+
+struct exfat_index_header {
+	__u8 Magic[8];
+	__le32 Version;
+	__le32 VolumeSerialNumber;
+	__le64 ImageSize;
+	__le64 ImageMtime;
+	__le32 ImageMtimeNsec;
+	__le32 DirCount;
+	__le32 EntryCount;
+	__le32 ExtentCount;
+	__le32 NameCount;
+	__le32 AllocCluster;
+	__le64 AllocLength;
+	__le32 UpcaseCluster;
+	__le32 UpcaseLength;
+	__le64 RootLength;
+	__le16 VolumeLabel[11];
+	__u8 VolumeLabelLength;
+	__u8 Reserved[9];
+	__u8 Key[32];
+	__le64 DirOffset;
+	__le64 EntryOffset;
+	__le64 HashOffset;
+	__le64 ExtentOffset;
+	__le64 NameOffset;
+	__le64 UpcaseOffset;
+};
+
+struct exfat_index_dir {
+	__le32 Cluster;
+	__le32 FirstEntry;
+	__le32 EntryCount;
+	__le32 Reserved;
+};
+
+struct exfat_index_entry {
+	__le64 DataLength;
+	__le32 FirstCluster;
+	__le32 NameOffset;
+	__le32 FirstExtent;
+	__le32 ExtentCount;
+	__le32 CreateTimestamp;
+	__le32 LastModifiedTimestamp;
+	__le32 LastAccessedTimestamp;
+	__le16 FileAttributes;
+	__le16 NameHash;
+	__u8 NameLength;
+	__u8 GeneralSecondaryFlags;
+	__u8 Create10msIncrement;
+	__u8 LastModified10msIncrement;
+	__u8 CreateUtcOffset;
+	__u8 LastModifiedUtcOffset;
+	__u8 LastAccessdUtcOffset;
+	__u8 Reserved;
+};
+
+/* NameHash is calculated from file name (not copied from Stream entry) */
+struct exfat_index_hash {
+	__le16 NameHash;
+	__le16 Reserved;
+	__le32 Entry;
+};
+
+struct exfat_index_extent {
+	__le32 Cluster;
+	__le32 Length;
+};
+
+int exfat_index_open(const char *);
+void exfat_index_close(void);
+int exfat_index_load_directory(node2_t *, uint32_t);
+int exfat_index_lookup(uint32_t, const char *, uint32_t *);
+const struct exfat_index_extent *exfat_index_extents(uint32_t, uint32_t, uint32_t *);
+
+#endif /*_INDEX_H */
@@ -4,13 +4,198 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <errno.h>
 #include <error.h>
 #include "print.h"
 
+#define PRINT_MSG_MAX       1024
+#define PRINT_RING_ENV      "EXFAT_DEBUG_RING"
+
+/* In-memory sink for debug messages */
+static struct {
+	char *buf;
+	size_t size;
+	uint64_t head;
+	char lock;
+} ring;
+
+static void ring_lock(void)
+{
+	while (__atomic_test_and_set(&ring.lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void ring_unlock(void)
+{
+	__atomic_clear(&ring.lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * ring_write - append message to ring buffer
+ * @msg:        message
+ * @len:        message length
+ *
+ * NOTE: The oldest messages are overwritten.
+ */
+static void ring_write(const char *msg, size_t len)
+{
+	size_t pos, n;
+
+	if (len > ring.size) {
+		msg += len - ring.size;
+		len = ring.size;
+	}
+
+	ring_lock();
+	pos = ring.head % ring.size;
+	n = ring.size - pos < len ? ring.size - pos : len;
+	memcpy(ring.buf + pos, msg, n);
+	memcpy(ring.buf, msg + n, len - n);
+	ring.head += len;
+	ring_unlock();
+}
+
+/**
+ * print_message - output a message which passed level filter
+ * @level:         message level
+ * @func:          caller function name
+ * @line:          caller line
+ * @fmt:           format string
+ *
+ * NOTE: If ring buffer is enabled, debug messages are stored in it
+ *       instead of @output.
+ */
+void print_message(unsigned int level, const char *func, unsigned int line, const char *fmt, ...)
+{
+	int len;
+	va_list ap;
+	char msg[PRINT_MSG_MAX];
+
+	va_start(ap, fmt);
+	if (level != PRINT_DEBUG) {
+		vfprintf(output, fmt, ap);
+	} else if (!ring.buf) {
+		flockfile(output);
+		fprintf(output, "(%s:%u): ", func, line);
+		vfprintf(output, fmt, ap);
+		funlockfile(output);
+	} else {
+		len = snprintf(msg, sizeof(msg), "(%s:%u): ", func, line);
+		len += vsnprintf(msg + len, sizeof(msg) - len, fmt, ap);
+		ring_write(msg, len < sizeof(msg) ? len : sizeof(msg) - 1);
+	}
+	va_end(ap);
+}
+
+/**
+ * print_ring_init - store debug messages in ring buffer
+ * @size:            ring buffer size (bytes)
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ */
+int print_ring_init(size_t size)
+{
+	char *buf;
+
+	if (!size)
+		return -EINVAL;
+	if ((buf = malloc(size)) == NULL)
+		return -ENOMEM;
+
+	ring_lock();
+	free(ring.buf);
+	ring.buf = buf;
+	ring.size = size;
+	ring.head = 0;
+	ring_unlock();
+	return 0;
+}
+
+/**
+ * print_ring_setup - enable ring buffer by environment variable
+ *
+ * @return            == 0 (success, or not required)
+ *                    <  0 (failed)
+ *
+ * NOTE: EXFAT_DEBUG_RING=<size>[KM] keeps only latest debug messages,
+ *       and they are output when the program exits.
+ */
+int print_ring_setup(void)
+{
+	char *env, *end;
+	size_t size;
+
+	if ((env = getenv(PRINT_RING_ENV)) == NULL)
+		return 0;
+
+	size = strtoul(env, &end, 0);
+	switch (*end) {
+		case 'k':
+		case 'K':
+			size <<= 10;
+			break;
+		case 'm':
+		case 'M':
+			size <<= 20;
+			break;
+		default:
+			break;
+	}
+
+	if (print_ring_init(size))
+		return -EINVAL;
+	atexit(print_ring_exit);
+	return 0;
+}
+
+/**
+ * print_ring_dump - output messages in ring buffer
+ * @fp:              output stream
+ */
+void print_ring_dump(FILE *fp)
+{
+	size_t pos, len;
+	char *nl;
+
+	if (!ring.buf)
+		return;
+
+	ring_lock();
+	if (ring.head <= ring.size) {
+		fwrite(ring.buf, 1, ring.head, fp);
+	} else {
+		/* Skip the message which was overwritten partially */
+		pos = ring.head % ring.size;
+		len = ring.size - pos;
+		if ((nl = memchr(ring.buf + pos, '\n', len)) != NULL) {
+			fwrite(nl + 1, 1, len - (nl + 1 - (ring.buf + pos)), fp);
+			fwrite(ring.buf, 1, pos, fp);
+		} else if ((nl = memchr(ring.buf, '\n', pos)) != NULL) {
+			fwrite(nl + 1, 1, pos - (nl + 1 - ring.buf), fp);
+		}
+	}
+	ring_unlock();
+}
+
+/**
+ * print_ring_exit - output and release ring buffer
+ */
+void print_ring_exit(void)
+{
+	print_ring_dump(output ? output : stderr);
+	free(ring.buf);
+	ring.buf = NULL;
+	ring.size = 0;
+	ring.head = 0;
+}
+
 /**
  * hexdump - Hex dump of a given data
  * @data:    Input data
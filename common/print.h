@@ -6,6 +6,7 @@
 #define _PRINT_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 /**
  * Debug code
@@ -17,14 +18,42 @@ extern FILE *output;
 #define PRINT_INFO     3
 #define PRINT_DEBUG    4
 
+/*
+ * Messages whose level is greater than PRINT_BUILD_LEVEL are removed
+ * at compile time, so that pr_debug() costs nothing in release builds.
+ */
+#ifndef PRINT_BUILD_LEVEL
+#ifdef EXFAT_DEBUG
+#define PRINT_BUILD_LEVEL  PRINT_DEBUG
+#else
+#define PRINT_BUILD_LEVEL  PRINT_INFO
+#endif
+#endif
+
+/* The number of messages per call site before pr_*_ratelimited() is muted */
+#define PRINT_RATELIMIT_BURST  10
+
+#define print_enabled(level) \
+	((level) <= PRINT_BUILD_LEVEL && print_level >= (level))
+
+/* Arguments are evaluated and formatted only if the message is emitted */
 #define print(level, fmt, ...) \
 	do { \
-		if (print_level >= level) { \
-			if (level == PRINT_DEBUG) \
-			fprintf( output, "(%s:%u): " fmt, \
-					__func__, __LINE__, ##__VA_ARGS__); \
-			else \
-			fprintf( output, "" fmt, ##__VA_ARGS__); \
+		if (print_enabled(level)) \
+			print_message(level, __func__, __LINE__, \
+					"" fmt, ##__VA_ARGS__); \
+	} while (0) \
+
+#define print_ratelimited(level, fmt, ...) \
+	do { \
+		static unsigned int __print_count; \
+		unsigned int __n; \
+		if (print_enabled(level)) { \
+			__n = __atomic_fetch_add(&__print_count, 1, __ATOMIC_RELAXED); \
+			if (__n < PRINT_RATELIMIT_BURST || print_level >= PRINT_DEBUG) \
+				print(level, fmt, ##__VA_ARGS__); \
+			else if (__n == PRINT_RATELIMIT_BURST) \
+				print(level, "(%s: further messages are suppressed)\n", __func__); \
 		} \
 	} while (0) \
 
@@ -34,6 +63,16 @@ extern FILE *output;
 #define pr_debug(fmt, ...) print(PRINT_DEBUG, fmt, ##__VA_ARGS__)
 #define pr_msg(fmt, ...)   fprintf(output, fmt, ##__VA_ARGS__)
 
+#define pr_err_ratelimited(fmt, ...)  print_ratelimited(PRINT_ERR, fmt, ##__VA_ARGS__)
+#define pr_warn_ratelimited(fmt, ...) print_ratelimited(PRINT_WARNING, fmt, ##__VA_ARGS__)
+
+void print_message(unsigned int, const char *, unsigned int, const char *, ...)
+	__attribute__((format(printf, 4, 5)));
+int print_ring_init(size_t);
+int print_ring_setup(void);
+void print_ring_dump(FILE *);
+void print_ring_exit(void);
+
 void hexdump(void *data, size_t size);
 int allwrite(int, void *, size_t);
 int allread(int, void *, size_t);
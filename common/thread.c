@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thread.h"
+
+/* Work shared by all workers in exfat_parallel_for() */
+struct exfat_work {
+	size_t next;
+	size_t count;
+	exfat_work_t fn;
+	void *arg;
+};
+
+/**
+ * exfat_get_nthreads - get the number of worker threads
+ *
+ * @return              the number of threads (>= 1)
+ *
+ * NOTE: Environment variable EXFAT_THREADS overrides online CPUs.
+ */
+int exfat_get_nthreads(void)
+{
+	long n = 0;
+	char *env = getenv("EXFAT_THREADS");
+
+	if (env)
+		n = strtol(env, NULL, 0);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+
+	return n > EXFAT_MAX_THREADS ? EXFAT_MAX_THREADS : n;
+}
+
+/**
+ * exfat_worker - worker thread in exfat_parallel_for()
+ * @arg:          shared work
+ */
+static void *exfat_worker(void *arg)
+{
+	struct exfat_work *w = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->count)
+		w->fn(i, w->arg);
+
+	return NULL;
+}
+
+/**
+ * exfat_parallel_for - call @fn for each index on worker threads
+ * @count:              the number of indices
+ * @nthreads:           the number of threads (<= 0: exfat_get_nthreads())
+ * @fn:                 function to call with index and @arg
+ * @arg:                argument passed to @fn
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Indices are handed out one by one, so that one huge item
+ *       doesn't keep other threads waiting.
+ *       Caller thread also works, and this function returns after all is done.
+ */
+int exfat_parallel_for(size_t count, int nthreads, exfat_work_t fn, void *arg)
+{
+	int i, started;
+	pthread_t th[EXFAT_MAX_THREADS];
+	struct exfat_work w = {0, count, fn, arg};
+
+	if (nthreads <= 0)
+		nthreads = exfat_get_nthreads();
+	if (nthreads > EXFAT_MAX_THREADS)
+		nthreads = EXFAT_MAX_THREADS;
+	if ((size_t)nthreads > count)
+		nthreads = count ? count : 1;
+
+	for (started = 0; started < nthreads - 1; started++) {
+		if (pthread_create(&th[started], NULL, exfat_worker, &w))
+			break;
+	}
+
+	exfat_worker(&w);
+
+	for (i = 0; i < started; i++)
+		pthread_join(th[i], NULL);
+
+	return 0;
+}
+
+/**
+ * exfat_queue_init - Initialize bounded queue
+ * @q:                queue
+ * @size:             the maximum number of items
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ */
+int exfat_queue_init(struct exfat_queue *q, size_t size)
+{
+	if ((q->items = calloc(size, sizeof(void *))) == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	q->size = size;
+	q->head = 0;
+	q->count = 0;
+	q->closed = false;
+	return 0;
+}
+
+/**
+ * exfat_queue_destroy - release bounded queue
+ * @q:                   queue
+ */
+void exfat_queue_destroy(struct exfat_queue *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+	free(q->items);
+	q->items = NULL;
+}
+
+/**
+ * exfat_queue_push - append item to queue
+ * @q:                queue
+ * @item:             item (must not be NULL)
+ *
+ * @return            == 0 (success)
+ *                    <  0 (queue was already closed)
+ *
+ * NOTE: Caller waits while queue is full.
+ */
+int exfat_queue_push(struct exfat_queue *q, void *item)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size && !q->closed)
+		pthread_cond_wait(&q->not_full, &q->lock);
+
+	if (q->closed) {
+		ret = -EPIPE;
+	} else {
+		q->items[(q->head + q->count) % q->size] = item;
+		q->count++;
+		pthread_cond_signal(&q->not_empty);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+/**
+ * exfat_queue_pop - take first item from queue
+ * @q:               queue
+ *
+ * @return           item
+ *                   NULL (queue was closed and is empty)
+ *
+ * NOTE: Caller waits while queue is empty.
+ */
+void *exfat_queue_pop(struct exfat_queue *q)
+{
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->count && !q->closed)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+
+	if (q->count) {
+		item = q->items[q->head];
+		q->head = (q->head + 1) % q->size;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return item;
+}
+
+/**
+ * exfat_queue_close - tell consumers that no more item is pushed
+ * @q:                 queue
+ *
+ * NOTE: Items in queue can be still popped.
+ */
+void exfat_queue_close(struct exfat_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = true;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
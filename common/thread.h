@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Upper limit of worker threads */
+#define EXFAT_MAX_THREADS    64
+
+typedef void (*exfat_work_t)(size_t, void *);
+
+/* Bounded FIFO queue between pipeline stages */
+struct exfat_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	void **items;
+	size_t size;
+	size_t head;
+	size_t count;
+	bool closed;
+};
+
+int exfat_get_nthreads(void);
+int exfat_parallel_for(size_t, int, exfat_work_t, void *);
+int exfat_queue_init(struct exfat_queue *, size_t);
+void exfat_queue_destroy(struct exfat_queue *);
+int exfat_queue_push(struct exfat_queue *, void *);
+void *exfat_queue_pop(struct exfat_queue *);
+void exfat_queue_close(struct exfat_queue *);
+
+#endif /*_THREAD_H */
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/**
+ * Static tracepoints (USDT)
+ *
+ * Probes are placed under the "exfat" provider, and can be attached
+ * by perf, bpftrace or systemtap without rebuilding.
+ *   $ bpftrace -e 'usdt:./lsexfat:exfat:get_sector__entry { ... }'
+ *
+ * If <sys/sdt.h> isn't available, all probes are compiled to no-ops.
+ */
+#if defined(HAVE_SYS_SDT_H) && !defined(EXFAT_NO_TRACE)
+#include <sys/sdt.h>
+
+#define trace_exfat(name) \
+	DTRACE_PROBE(exfat, name)
+#define trace_exfat1(name, a) \
+	DTRACE_PROBE1(exfat, name, a)
+#define trace_exfat2(name, a, b) \
+	DTRACE_PROBE2(exfat, name, a, b)
+#define trace_exfat3(name, a, b, c) \
+	DTRACE_PROBE3(exfat, name, a, b, c)
+#else
+#define trace_exfat(name)              do { } while (0)
+#define trace_exfat1(name, a)          do { (void)(a); } while (0)
+#define trace_exfat2(name, a, b)       do { (void)(a); (void)(b); } while (0)
+#define trace_exfat3(name, a, b, c)    do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif /*_TRACE_H */
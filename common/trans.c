@@ -0,0 +1,652 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "exfat.h"
+#include "hash.h"
+#include "trans.h"
+
+extern struct exfat_info info;
+
+/* Sector written in transaction */
+struct exfat_trans_sector {
+	off_t offset;
+	struct exfat_trans_sector *next;
+	uint8_t data[];
+};
+
+struct exfat_trans {
+	unsigned int depth;
+	bool aborted;
+	/* Hash table to find sector by offset */
+	struct exfat_trans_sector **buckets;
+	size_t bucket_count;
+	/* All sectors in written order */
+	struct exfat_trans_sector **sectors;
+	size_t count;
+	size_t size;
+};
+
+/**
+ * exfat_trans_hash - obtain hash bucket of sector
+ * @offset:           sector offset (bytes)
+ * @buckets:          the number of buckets (power of 2)
+ *
+ * @return            bucket index
+ */
+static size_t exfat_trans_hash(off_t offset, size_t buckets)
+{
+	uint64_t x = (uint64_t)offset / info.sector_size;
+
+	return (size_t)((x * 0x9E3779B97F4A7C15ULL) >> 32) & (buckets - 1);
+}
+
+/**
+ * exfat_trans_find - find sector written in transaction
+ * @t:                transaction
+ * @offset:           sector offset (bytes)
+ *
+ * @return            sector
+ *                    NULL (sector isn't written)
+ */
+static struct exfat_trans_sector *exfat_trans_find(struct exfat_trans *t, off_t offset)
+{
+	struct exfat_trans_sector *s;
+
+	for (s = t->buckets[exfat_trans_hash(offset, t->bucket_count)]; s; s = s->next)
+		if (s->offset == offset)
+			return s;
+	return NULL;
+}
+
+/**
+ * exfat_trans_grow - extend hash table and sector list
+ * @t:                transaction
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ */
+static int exfat_trans_grow(struct exfat_trans *t)
+{
+	size_t i, h, size;
+	struct exfat_trans_sector **tmp;
+
+	size = t->size ? t->size * 2 : EXFAT_TRANS_BUCKETS;
+	if ((tmp = realloc(t->sectors, size * sizeof(struct exfat_trans_sector *))) == NULL)
+		return -ENOMEM;
+	t->sectors = tmp;
+	t->size = size;
+
+	/* Keep load factor under 1 */
+	if (size <= t->bucket_count)
+		return 0;
+	if ((tmp = calloc(size, sizeof(struct exfat_trans_sector *))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < t->count; i++) {
+		h = exfat_trans_hash(t->sectors[i]->offset, size);
+		t->sectors[i]->next = tmp[h];
+		tmp[h] = t->sectors[i];
+	}
+	free(t->buckets);
+	t->buckets = tmp;
+	t->bucket_count = size;
+	return 0;
+}
+
+/**
+ * exfat_trans_free - release transaction
+ * @t:                transaction
+ */
+static void exfat_trans_free(struct exfat_trans *t)
+{
+	size_t i;
+
+	for (i = 0; i < t->count; i++)
+		free(t->sectors[i]);
+	free(t->sectors);
+	free(t->buckets);
+	free(t);
+}
+
+/**
+ * exfat_trans_compare - compare sectors by offset
+ * @a:                   pointer to sector
+ * @b:                   pointer to sector
+ *
+ * @return               order of @a and @b
+ */
+static int exfat_trans_compare(const void *a, const void *b)
+{
+	const struct exfat_trans_sector *x = *(struct exfat_trans_sector * const *)a;
+	const struct exfat_trans_sector *y = *(struct exfat_trans_sector * const *)b;
+
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/**
+ * exfat_trans_get_flags - obtain VolumeFlags in Boot Sector
+ * @flags:                 VolumeFlags (Output)
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ */
+static int exfat_trans_get_flags(uint16_t *flags)
+{
+	int ret;
+	struct exfat_bootsec *b;
+
+	if ((b = malloc(info.sector_size)) == NULL)
+		return -ENOMEM;
+	if (!(ret = get_sector(b, 0, 1)))
+		*flags = le16_to_cpu(b->VolumeFlags);
+	free(b);
+	return ret;
+}
+
+/**
+ * exfat_trans_set_flags - update VolumeFlags in Boot Sector
+ * @flags:                 VolumeFlags
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ */
+static int exfat_trans_set_flags(uint16_t flags)
+{
+	int ret;
+	struct exfat_bootsec *b;
+
+	if ((b = malloc(info.sector_size)) == NULL)
+		return -ENOMEM;
+	if (!(ret = get_sector(b, 0, 1)) && le16_to_cpu(b->VolumeFlags) != flags) {
+		b->VolumeFlags = cpu_to_le16(flags);
+		if (!(ret = set_sector(b, 0, 1)))
+			fsync(info.fd);
+	}
+	free(b);
+	return ret;
+}
+
+/**
+ * exfat_trans_restore - reload FAT and Allocation Bitmap in memory from disk
+ * @t:                   discarded transaction
+ *
+ * NOTE: Directory cache isn't restored.
+ */
+static void exfat_trans_restore(struct exfat_trans *t)
+{
+	size_t i, j, clusters = 0;
+	uint32_t clu, *chain = NULL;
+	uint8_t *data;
+	off_t start, end, pos;
+	off_t fat_start = (off_t)info.fat_offset * info.sector_size;
+	off_t fat_end = fat_start + ((off_t)info.cluster_count + EXFAT_FIRST_CLUSTER) * sizeof(uint32_t);
+	off_t heap_start = (off_t)info.heap_offset * info.sector_size;
+
+	if ((data = malloc(info.sector_size)) == NULL)
+		return;
+
+	/* Allocation Bitmap may be FAT chain */
+	if (info.alloc_table) {
+		clusters = ROUNDUP(info.alloc_length, info.cluster_size);
+		if ((chain = malloc(MAX(clusters, 1) * sizeof(uint32_t))) == NULL)
+			clusters = 0;
+		for (j = 0, clu = info.alloc_offset; j < clusters; j++) {
+			chain[j] = clu;
+			if (j + 1 < clusters && exfat_get_fat(clu, &clu))
+				clusters = j + 1;
+		}
+	}
+
+	for (i = 0; i < t->count; i++) {
+		if (get_sector(data, t->sectors[i]->offset, 1))
+			continue;
+
+		start = MAX(t->sectors[i]->offset, fat_start);
+		end = MIN(t->sectors[i]->offset + info.sector_size, fat_end);
+		if (info.fat_table && start < end)
+			memcpy((uint8_t *)info.fat_table + (start - fat_start),
+					data + (start - t->sectors[i]->offset), end - start);
+
+		if (t->sectors[i]->offset < heap_start)
+			continue;
+		clu = (t->sectors[i]->offset - heap_start) / info.cluster_size + EXFAT_FIRST_CLUSTER;
+		for (j = 0; j < clusters; j++) {
+			if (chain[j] != clu)
+				continue;
+			pos = (off_t)j * info.cluster_size + (t->sectors[i]->offset - heap_start) % info.cluster_size;
+			if (pos < info.alloc_length)
+				memcpy(info.alloc_table + pos, data,
+						MIN(info.sector_size, info.alloc_length - pos));
+			break;
+		}
+	}
+	free(chain);
+	free(data);
+}
+
+/**
+ * exfat_trans_begin - start write transaction
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+int exfat_trans_begin(void)
+{
+	struct exfat_trans *t;
+
+	if (info.trans) {
+		info.trans->depth++;
+		return 0;
+	}
+
+	if ((t = calloc(1, sizeof(struct exfat_trans))) == NULL)
+		return -ENOMEM;
+	if (exfat_trans_grow(t)) {
+		exfat_trans_free(t);
+		return -ENOMEM;
+	}
+	t->depth = 1;
+	info.trans = t;
+	return 0;
+}
+
+/**
+ * exfat_journal_checksum - calculate checksum of journal
+ * @records:                journal records
+ * @count:                  the number of @records
+ * @sectors:                sector data (NULL if @data is used)
+ * @data:                   sector data (NULL if @sectors is used)
+ * @length:                 length of sector data
+ *
+ * @return                  checksum
+ */
+static uint64_t exfat_journal_checksum(const struct exfat_journal_record *records, size_t count,
+		struct exfat_trans_sector **sectors, const void *data, uint64_t length)
+{
+	size_t i;
+	struct xxh64_ctx ctx;
+
+	xxh64_init(&ctx, 0);
+	xxh64_update(&ctx, records, count * sizeof(struct exfat_journal_record));
+	if (data)
+		xxh64_update(&ctx, data, length);
+	for (i = 0; sectors && i < length / info.sector_size; i++)
+		xxh64_update(&ctx, sectors[i]->data, info.sector_size);
+	return xxh64_digest(&ctx);
+}
+
+/**
+ * exfat_journal_sync_dir - flush directory entry of journal
+ *
+ * @return                  == 0 (success)
+ *                          <  0 (failed)
+ *
+ * NOTE: Creating or removing journal isn't persistent until its directory
+ *       is synchronized.
+ */
+static int exfat_journal_sync_dir(void)
+{
+	int fd, ret = 0;
+	char *path;
+
+	if ((path = strdup(info.journal)) == NULL)
+		return -ENOMEM;
+	if ((fd = open(dirname(path), O_RDONLY | O_DIRECTORY)) < 0 || fsync(fd)) {
+		ret = -errno;
+		pr_err("fsync: %s: %s\n", path, strerror(-ret));
+	}
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	return ret;
+}
+
+/**
+ * exfat_journal_write - write journal before the image is updated
+ * @t:                   transaction (sorted by offset)
+ * @records:             merged write requests
+ * @count:               the number of @records
+ * @flags:               VolumeFlags before transaction
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int exfat_journal_write(struct exfat_trans *t, struct exfat_journal_record *records,
+		size_t count, uint16_t flags)
+{
+	int ret = 0;
+	size_t i;
+	FILE *fp;
+	struct exfat_journal_header hdr = {0};
+	uint64_t length = (uint64_t)t->count * info.sector_size;
+
+	memcpy(hdr.Magic, EXFAT_JOURNAL_MAGIC, sizeof(hdr.Magic));
+	hdr.Version = cpu_to_le32(EXFAT_JOURNAL_VERSION);
+	hdr.SectorSize = cpu_to_le32(info.sector_size);
+	hdr.RecordCount = cpu_to_le32(count);
+	hdr.VolumeFlags = cpu_to_le16(flags);
+	hdr.DataLength = cpu_to_le64(length);
+	hdr.Checksum = cpu_to_le64(exfat_journal_checksum(records, count, t->sectors, NULL, length));
+
+	if ((fp = fopen(info.journal, "w")) == NULL) {
+		ret = -errno;
+		pr_err("open: %s: %s\n", info.journal, strerror(-ret));
+		return ret;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+			fwrite(records, sizeof(struct exfat_journal_record), count, fp) != count)
+		ret = -EIO;
+	for (i = 0; !ret && i < t->count; i++)
+		if (fwrite(t->sectors[i]->data, info.sector_size, 1, fp) != 1)
+			ret = -EIO;
+	if (!ret && (fflush(fp) || fsync(fileno(fp))))
+		ret = -EIO;
+	fclose(fp);
+	if (!ret)
+		ret = exfat_journal_sync_dir();
+
+	if (ret) {
+		pr_err("write: %s: Can't write journal.\n", info.journal);
+		unlink(info.journal);
+	}
+	return ret;
+}
+
+/**
+ * exfat_trans_commit - write all sectors written in transaction
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: If writing is failed, VolumeDirty (and journal) is left.
+ *       If inner transaction was aborted, nothing is written (-ECANCELED).
+ */
+int exfat_trans_commit(void)
+{
+	int ret = 0;
+	uint16_t flags;
+	size_t i, j, k, max, count = 0;
+	uint8_t *buf = NULL;
+	struct exfat_journal_record *records = NULL;
+	struct exfat_trans *t = info.trans;
+
+	if (!t) {
+		pr_err("Internal Error: Transaction isn't started.\n");
+		return -EINVAL;
+	}
+	if (--t->depth)
+		return 0;
+	info.trans = NULL;
+
+	if (t->aborted) {
+		exfat_trans_restore(t);
+		ret = -ECANCELED;
+		goto out;
+	}
+	if (!t->count)
+		goto out;
+
+	max = MAX(EXFAT_TRANS_MAX_WRITE / info.sector_size, 1);
+	buf = malloc(max * info.sector_size);
+	records = malloc(t->count * sizeof(struct exfat_journal_record));
+	if (!buf || !records) {
+		exfat_trans_restore(t);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Merge adjacent sectors */
+	qsort(t->sectors, t->count, sizeof(struct exfat_trans_sector *), exfat_trans_compare);
+	for (i = 0; i < t->count; i = j) {
+		for (j = i + 1; j < t->count && j - i < max &&
+				t->sectors[j]->offset == t->sectors[j - 1]->offset + info.sector_size; j++)
+			;
+		records[count].Offset = cpu_to_le64(t->sectors[i]->offset);
+		records[count].Count = cpu_to_le32(j - i);
+		records[count++].Reserved = 0;
+	}
+
+	if ((ret = exfat_trans_get_flags(&flags)))
+		goto out;
+	if (info.journal && (ret = exfat_journal_write(t, records, count, flags)))
+		goto out;
+	if ((ret = exfat_trans_set_flags(flags | VOLUMEDIRTY)))
+		goto out;
+
+	for (i = 0, j = 0; i < count; i++) {
+		for (k = 0; k < le32_to_cpu(records[i].Count); k++, j++)
+			memcpy(buf + k * info.sector_size, t->sectors[j]->data, info.sector_size);
+		if ((ret = set_sector(buf, le64_to_cpu(records[i].Offset), k)))
+			goto out;
+	}
+	fsync(info.fd);
+
+	if ((ret = exfat_trans_set_flags(flags)))
+		goto out;
+	if (info.journal && !unlink(info.journal))
+		exfat_journal_sync_dir();
+out:
+	free(records);
+	free(buf);
+	exfat_trans_free(t);
+	return ret;
+}
+
+/**
+ * exfat_trans_abort - discard all sectors written in transaction
+ *
+ * NOTE: FAT and Allocation Bitmap in memory are reloaded from disk,
+ *       but directory cache isn't restored.
+ */
+void exfat_trans_abort(void)
+{
+	struct exfat_trans *t = info.trans;
+
+	if (!t)
+		return;
+
+	t->aborted = true;
+	if (--t->depth)
+		return;
+	info.trans = NULL;
+
+	exfat_trans_restore(t);
+	exfat_trans_free(t);
+}
+
+/**
+ * exfat_trans_cached - whether all sectors were written in transaction
+ * @index:              Start bytes
+ * @count:              The number of sectors
+ *
+ * @return              true (get_sector() doesn't need to read the image)
+ */
+bool exfat_trans_cached(off_t index, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (!exfat_trans_find(info.trans, index + (off_t)i * info.sector_size))
+			return false;
+	return true;
+}
+
+/**
+ * exfat_trans_read - overwrite data by sectors written in transaction
+ * @data:             Sector raw data (Output)
+ * @index:            Start bytes
+ * @count:            The number of sectors
+ */
+void exfat_trans_read(void *data, off_t index, size_t count)
+{
+	size_t i;
+	struct exfat_trans_sector *s;
+
+	for (i = 0; i < count; i++)
+		if ((s = exfat_trans_find(info.trans, index + (off_t)i * info.sector_size)))
+			memcpy((uint8_t *)data + i * info.sector_size, s->data, info.sector_size);
+}
+
+/**
+ * exfat_trans_write - keep sectors in transaction
+ * @data:              Sector raw data
+ * @index:             Start bytes
+ * @count:             The number of sectors
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+int exfat_trans_write(const void *data, off_t index, size_t count)
+{
+	size_t i, h;
+	off_t offset;
+	struct exfat_trans *t = info.trans;
+	struct exfat_trans_sector *s;
+
+	if (index % info.sector_size) {
+		pr_err("Internal Error: offset 0x%" PRIx64 " isn't aligned.\n", (uint64_t)index);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		offset = index + (off_t)i * info.sector_size;
+		if (!(s = exfat_trans_find(t, offset))) {
+			if (t->count == t->size && exfat_trans_grow(t))
+				return -ENOMEM;
+			if ((s = malloc(sizeof(struct exfat_trans_sector) + info.sector_size)) == NULL)
+				return -ENOMEM;
+			s->offset = offset;
+			h = exfat_trans_hash(offset, t->bucket_count);
+			s->next = t->buckets[h];
+			t->buckets[h] = s;
+			t->sectors[t->count++] = s;
+		}
+		memcpy(s->data, (const uint8_t *)data + i * info.sector_size, info.sector_size);
+	}
+	return 0;
+}
+
+/**
+ * exfat_journal_replay - write sectors in journal left by interrupted commit
+ *
+ * @return                == 0 (success, or there is no journal)
+ *                        <  0 (failed)
+ */
+static int exfat_journal_replay(void)
+{
+	int fd, ret = 0;
+	size_t i, count;
+	uint64_t length, pos;
+	uint8_t *data = NULL;
+	struct stat st;
+	struct exfat_journal_header *hdr;
+	struct exfat_journal_record *records;
+
+	if ((fd = open(info.journal, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		ret = -errno;
+		pr_err("open: %s: %s\n", info.journal, strerror(-ret));
+		return ret;
+	}
+	if (fstat(fd, &st) || (data = malloc(MAX(st.st_size, 1))) == NULL ||
+			pread(fd, data, st.st_size, 0) != st.st_size) {
+		pr_err("read: %s: Can't read journal.\n", info.journal);
+		ret = -EIO;
+		goto out;
+	}
+
+	/* Journal was interrupted before the image is updated */
+	hdr = (struct exfat_journal_header *)data;
+	records = (struct exfat_journal_record *)(hdr + 1);
+	count = st.st_size < sizeof(*hdr) ? 0 : le32_to_cpu(hdr->RecordCount);
+	length = st.st_size < sizeof(*hdr) ? 0 : le64_to_cpu(hdr->DataLength);
+	if (st.st_size < sizeof(*hdr) ||
+			memcmp(hdr->Magic, EXFAT_JOURNAL_MAGIC, sizeof(hdr->Magic)) ||
+			le32_to_cpu(hdr->Version) != EXFAT_JOURNAL_VERSION ||
+			le32_to_cpu(hdr->SectorSize) != info.sector_size ||
+			sizeof(*hdr) + count * sizeof(*records) + length != st.st_size ||
+			exfat_journal_checksum(records, count, NULL, records + count, length) !=
+			le64_to_cpu(hdr->Checksum)) {
+		pr_warn("%s: Incomplete journal is discarded.\n", info.journal);
+		goto remove;
+	}
+
+	for (i = 0, pos = 0; i < count; i++) {
+		if (pos + (uint64_t)le32_to_cpu(records[i].Count) * info.sector_size > length) {
+			pr_err("%s: Journal is broken.\n", info.journal);
+			ret = -EINVAL;
+			goto out;
+		}
+		if ((ret = set_sector((uint8_t *)(records + count) + pos,
+						le64_to_cpu(records[i].Offset), le32_to_cpu(records[i].Count))))
+			goto out;
+		pos += (uint64_t)le32_to_cpu(records[i].Count) * info.sector_size;
+	}
+	fsync(info.fd);
+	if ((ret = exfat_trans_set_flags(le16_to_cpu(hdr->VolumeFlags))))
+		goto out;
+	pr_warn("%s: Journal is replayed.\n", info.journal);
+remove:
+	if (!unlink(info.journal))
+		exfat_journal_sync_dir();
+out:
+	free(data);
+	close(fd);
+	return ret;
+}
+
+/**
+ * exfat_journal_init - enable journal for write transaction
+ * @image:              image path
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Journal left by interrupted commit is replayed here, so it must be
+ *       called before FAT and Allocation Bitmap are loaded.
+ */
+int exfat_journal_init(const char *image)
+{
+	size_t len = strlen(image) + strlen(EXFAT_JOURNAL_SUFFIX) + 1;
+
+	free(info.journal);
+	if ((info.journal = malloc(len)) == NULL)
+		return -ENOMEM;
+	snprintf(info.journal, len, "%s%s", image, EXFAT_JOURNAL_SUFFIX);
+
+	return exfat_journal_replay();
+}
+
+/**
+ * exfat_journal_check - warn if journal is left by interrupted commit
+ * @image:               image path
+ *
+ * @return               true (journal is pending)
+ *
+ * NOTE: Read-only tools don't replay journal, so the image may be stale.
+ */
+bool exfat_journal_check(const char *image)
+{
+	size_t len = strlen(image) + strlen(EXFAT_JOURNAL_SUFFIX) + 1;
+	char *path;
+	bool pending;
+
+	if ((path = malloc(len)) == NULL)
+		return false;
+	snprintf(path, len, "%s%s", image, EXFAT_JOURNAL_SUFFIX);
+	if ((pending = !access(path, F_OK)))
+		pr_warn("%s: Journal is pending. It is replayed by the next write.\n", path);
+	free(path);
+	return pending;
+}
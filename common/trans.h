@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _TRANS_H
+#define _TRANS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+/*
+ * Write transaction
+ *
+ * While transaction is active, set_sector() doesn't write to the image.
+ * Written sectors are kept in memory (and get_sector() returns them), and
+ * exfat_trans_commit() writes all of them at once:
+ *
+ *   1. VolumeDirty in Boot Sector is set
+ *   2. Dirty sectors are sorted by offset, and adjacent ones are merged
+ *   3. VolumeDirty is restored (after fsync)
+ *
+ * Transaction can be nested. Only outermost exfat_trans_commit() writes sectors.
+ * If journal is enabled by exfat_journal_init(), sectors are written to
+ * journal before 1.
+ */
+
+/*
+ * Journal (IMAGE.journal)
+ *
+ *   +-----------------------------+ 0
+ *   | struct exfat_journal_header |
+ *   +-----------------------------+ sizeof(struct exfat_journal_header)
+ *   | struct exfat_journal_record | x RecordCount (sorted by Offset)
+ *   +-----------------------------+
+ *   | sector data                 | (Count sectors for each record)
+ *   +-----------------------------+
+ *
+ * Journal is synced before the image is updated, and removed after that.
+ * If journal is left on next open, it is written to the image again.
+ * Journal whose checksum is unmatched wasn't completed (the image wasn't
+ * updated yet), so it is just discarded.
+ */
+#define EXFAT_JOURNAL_MAGIC    "EXFATJNL"
+#define EXFAT_JOURNAL_VERSION  1
+#define EXFAT_JOURNAL_SUFFIX   ".journal"
+
+struct exfat_journal_header {
+	__u8 Magic[8];
+	__le32 Version;
+	__le32 SectorSize;
+	__le32 RecordCount;
+	__le16 VolumeFlags;
+	__u8 Reserved1[2];
+	__le64 DataLength;
+	__le64 Checksum;
+	__u8 Reserved2[24];
+};
+
+struct exfat_journal_record {
+	__le64 Offset;
+	__le32 Count;
+	__le32 Reserved;
+};
+
+/* Initial number of hash buckets for dirty sectors */
+#define EXFAT_TRANS_BUCKETS    256
+/* Upper limit of one merged write request */
+#define EXFAT_TRANS_MAX_WRITE  (1024 * 1024)
+
+int exfat_trans_begin(void);
+int exfat_trans_commit(void);
+void exfat_trans_abort(void);
+bool exfat_trans_cached(off_t, size_t);
+void exfat_trans_read(void *, off_t, size_t);
+int exfat_trans_write(const void *, off_t, size_t);
+int exfat_journal_init(const char *);
+bool exfat_journal_check(const char *);
+
+#endif /*_TRANS_H */
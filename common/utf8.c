@@ -7,45 +7,191 @@
 #include <string.h>
 #include "utf8.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * utf16s_to_ascii - convert leading ASCII characters in UTF-16 to UTF-8
+ * @src              UTF-16 characters
+ * @len              UTF-16 characters length
+ * @dist             UTF-8 characters (output)
+ *
+ * @return:          the number of converted characters
+ *
+ * NOTE: 16 (AVX2) or 8 (SSE2/NEON) characters are converted at once,
+ *       and it stops at first non-ASCII character block.
+ */
+static size_t utf16s_to_ascii(const uint16_t *src, size_t len, unsigned char *dist)
+{
+	size_t i = 0;
+	uint64_t w;
+
+#if defined(__AVX2__)
+	for (; i + 16 <= len; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		if (!_mm256_testz_si256(v, _mm256_set1_epi16((short)0xFF80)))
+			break;
+		_mm_storeu_si128((__m128i *)(dist + i),
+				_mm_packus_epi16(_mm256_castsi256_si128(v),
+					_mm256_extracti128_si256(v, 1)));
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 8 <= len; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xFF80));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+			break;
+		_mm_storel_epi64((__m128i *)(dist + i), _mm_packus_epi16(v, v));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= len; i += 8) {
+		uint16x8_t v = vld1q_u16(src + i);
+		uint8x8_t high = vqmovn_u16(vshrq_n_u16(v, 7));
+		if (vget_lane_u64(vreinterpret_u64_u8(high), 0))
+			break;
+		vst1_u8(dist + i, vmovn_u16(v));
+	}
+#endif
+	/* Scalar fallback: 4 characters per word */
+	for (; i + 4 <= len; i += 4) {
+		memcpy(&w, src + i, sizeof(w));
+		if (w & 0xFF80FF80FF80FF80ULL)
+			break;
+		dist[i] = (unsigned char)src[i];
+		dist[i + 1] = (unsigned char)src[i + 1];
+		dist[i + 2] = (unsigned char)src[i + 2];
+		dist[i + 3] = (unsigned char)src[i + 3];
+	}
+	for (; i < len && src[i] < 0x80; i++)
+		dist[i] = (unsigned char)src[i];
+
+	return i;
+}
+
+/**
+ * ascii_to_utf16s - convert leading ASCII characters in UTF-8 to UTF-16
+ * @src              UTF-8 characters
+ * @len              UTF-8 characters length
+ * @dist             UTF-16 characters (output)
+ *
+ * @return:          the number of converted characters
+ */
+static size_t ascii_to_utf16s(const unsigned char *src, size_t len, uint16_t *dist)
+{
+	size_t i = 0;
+	uint64_t w;
+
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		if (_mm_movemask_epi8(v))
+			break;
+		_mm_storeu_si128((__m128i *)(dist + i), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+		_mm_storeu_si128((__m128i *)(dist + i + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(src + i);
+		uint64x2_t high = vreinterpretq_u64_u8(vandq_u8(v, vdupq_n_u8(0x80)));
+		if (vgetq_lane_u64(high, 0) | vgetq_lane_u64(high, 1))
+			break;
+		vst1q_u16(dist + i, vmovl_u8(vget_low_u8(v)));
+		vst1q_u16(dist + i + 8, vmovl_u8(vget_high_u8(v)));
+	}
+#endif
+	/* Scalar fallback: 8 characters per word */
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&w, src + i, sizeof(w));
+		if (w & 0x8080808080808080ULL)
+			break;
+		dist[i] = src[i];
+		dist[i + 1] = src[i + 1];
+		dist[i + 2] = src[i + 2];
+		dist[i + 3] = src[i + 3];
+		dist[i + 4] = src[i + 4];
+		dist[i + 5] = src[i + 5];
+		dist[i + 6] = src[i + 6];
+		dist[i + 7] = src[i + 7];
+	}
+	for (; i < len && src[i] < 0x80; i++)
+		dist[i] = src[i];
+
+	return i;
+}
+
 /**
  * utf8_to_utf32 - convert UTF-8 character to UTF-32
  * @u              UTF-8 character
+ * @len            remaining length of @u
  * @d              UTF-32 character (output)
  *
- * @return:        Byte size in UTF-32
+ * @return:        Byte size in UTF-8
+ *                 0 (invalid or truncated sequences)
+ *
+ * NOTE: Continuation byte at the head, overlong forms, surrogates and
+ *       characters over U+10FFFF are rejected.
  */
-int utf8_to_utf32(unsigned char *u, uint32_t *d)
+int utf8_to_utf32(unsigned char *u, size_t len, uint32_t *d)
 {
-	int len = 0;
+	int i, size;
+	uint32_t min;
 	unsigned char c = *u;
 
-	/* 1 byte character   0x10?????? */
+	if (!len)
+		return 0;
+
+	/* 1 byte character   0x0??????? */
 	if ((c & 0x80) == 0x00) {
 		*d = c;
-		len = 1;
+		return 1;
 	/* 2 bytes character  0x110????? 0x10?????? */
 	} else if ((c & 0xE0) == 0xC0) {
-		*d =  (*u & 0x1F) << 6;
-		*d |= (*(u + 1) & 0x3F);
-		len = 2;
+		*d = c & 0x1F;
+		size = 2;
+		min = 0x80;
 	/* 3 bytes character  0x1110???? 0x10?????? 0x10??????*/
 	} else if ((c & 0xF0) == 0xE0) {
-		*d =  (*u & 0x0F) << 12;
-		*d |= (*(u + 1) & 0x3F) << 6;
-		*d |= (*(u + 2) & 0x3F);
-		len = 3;
+		*d = c & 0x0F;
+		size = 3;
+		min = 0x800;
 	/* 4 bytes character  0x11110??? 0x10?????? 0x10?????? 0x10??????*/
 	} else if ((c & 0xF8) == 0xF0) {
-		*d =  (*u & 0x07) << 18;
-		*d |= (*(u + 1) & 0x3F) << 12;
-		*d |= (*(u + 2) & 0x3F) << 6;
-		*d |= (*(u + 3) & 0x3F);
-		len = 4;
+		*d = c & 0x07;
+		size = 4;
+		min = SURROGATE_PAIR_BASE;
 	} else {
 		fprintf(stderr, "Unexpected sequences %02x.\n", c);
+		return 0;
 	}
-	return len;
+
+	if (len < size) {
+		fprintf(stderr, "Truncated sequences %02x.\n", c);
+		return 0;
+	}
+	for (i = 1; i < size; i++) {
+		if ((u[i] & 0xC0) != 0x80) {
+			fprintf(stderr, "Unexpected sequences %02x %02x.\n", c, u[i]);
+			return 0;
+		}
+		*d = (*d << 6) | (u[i] & 0x3F);
+	}
+
+	if (*d < min || *d > UNICODE_MAX ||
+			(*d & ~(uint32_t)0x7FF) == SURROGATE_PAIR_UPPER) {
+		fprintf(stderr, "Invalid character U+%04x.\n", *d);
+		return 0;
+	}
+	return size;
 }
+
 /**
  * utf32_to_utf8 - convert UTF-32 character to UTF-8
  * @u              UTF-32 character
@@ -57,19 +203,19 @@ int utf32_to_utf8(uint32_t u, unsigned char *d)
 {
 	int len = 0;
 
-	if (u < 0x7f) {
+	if (u < 0x80) {
 		*d = (unsigned char)u;
 		len = 1;
-	} else if (u < 0x7FF) {
+	} else if (u < 0x800) {
 		*d++ = (0xC0 | (u >> 6));
 		*d++ = (0x80 | (u & 0x3F));
 		len = 2;
-	} else if (u < 0xFFFF) {
+	} else if (u < 0x10000) {
 		*d++ = (0xE0 | (u >> 12));
 		*d++ = (0x80 | ((u >> 6) & 0x3f));
 		*d++ = (0x80 | (u & 0x3F));
 		len = 3;
-	} else if (u < 0x10FFFF) {
+	} else if (u <= UNICODE_MAX) {
 		*d++ = (0xF0 | (u >> 18));
 		*d++ = (0x80 | ((u >> 12) & 0x3f));
 		*d++ = (0x80 | ((u >> 6) & 0x3f));
@@ -87,25 +233,35 @@ int utf32_to_utf8(uint32_t u, unsigned char *d)
  * @namelen          UTF-8 characters length
  * @dist             UTF-16 characters (output)
  *
- * @return:          byte size in UTF-16
+ * @return:          the number of UTF-16 characters
+ *                   0 (invalid sequences)
+ *
+ * NOTE: Characters over U+FFFF are converted to surrogate pair.
  */
 int utf8s_to_utf16s(unsigned char *src, uint16_t namelen, uint16_t* dist)
 {
-	int size = 0, len = 0, out_len = 0;
-	unsigned char *u = src;
+	int size = 0;
+	size_t n, len = 0, out_len = 0;
 	uint32_t w;
 
 	while (len < namelen) {
-		u = src + len;
-		w = (uint32_t)*u;
-		size = utf8_to_utf32(u, &w);
-		if (w <= 0xFFFF) {
-			*(dist + out_len) = w;
-			len += size;
-			out_len ++;
-		} else if (w <= UNICODE_MAX) {
-			/* TODO: Implement surrogate pair */
+		n = ascii_to_utf16s(src + len, namelen - len, dist + out_len);
+		len += n;
+		out_len += n;
+		if (len >= namelen)
+			break;
+
+		size = utf8_to_utf32(src + len, namelen - len, &w);
+		if (!size)
 			return 0;
+		len += size;
+
+		if (w < SURROGATE_PAIR_BASE) {
+			dist[out_len++] = w;
+		} else if (w <= UNICODE_MAX) {
+			w -= SURROGATE_PAIR_BASE;
+			dist[out_len++] = SURROGATE_PAIR_UPPER | (w >> 10);
+			dist[out_len++] = SURROGATE_PAIR_LOWER | (w & 0x3FF);
 		} else {
 			fprintf(stderr, "Unicode doesn't support. (%0x)\n", w);
 			return 0;
@@ -121,35 +277,39 @@ int utf8s_to_utf16s(unsigned char *src, uint16_t namelen, uint16_t* dist)
  * @dist             UTF-8 characters (output)
  *
  * @return:          byte size in UTF-8
+ *
+ * NOTE: Unpaired surrogate is converted to U+FFFD.
+ *       @dist needs UTF8_MAX_CHARSIZE bytes per a UTF-16 character.
  */
 int utf16s_to_utf8s(uint16_t *src, uint16_t namelen, unsigned char* dist)
 {
-	int size, len = 0;
-	uint16_t *u;
+	size_t n, i = 0, len = 0;
 	uint32_t w;
 
-	while (namelen--) {
-		u = src++;
-		w = (uint32_t)*u;
-		if (*u < 0x7f) {
-			/* 1 byte character */
-			*(dist + len) = (unsigned char)*u;
-			len++;
-		} else {
-			/* mult bytes character */
-			switch (*u & SURROGATE_PAIR_MASK) {
-				case SURROGATE_PAIR_UPPER:
-					/* FALLTHROUGH */
-				case SURROGATE_PAIR_LOWER:
-					break;
-				default:
-					/* convert UTF32(w) to UTF8(dist) */
-					size = utf32_to_utf8(w, dist + len);
-					len += size;
+	while (i < namelen) {
+		n = utf16s_to_ascii(src + i, namelen - i, dist + len);
+		i += n;
+		len += n;
+		if (i >= namelen)
+			break;
+
+		w = src[i++];
+		switch (w & SURROGATE_PAIR_MASK) {
+			case SURROGATE_PAIR_UPPER:
+				if (i < namelen && (src[i] & SURROGATE_PAIR_MASK) == SURROGATE_PAIR_LOWER) {
+					w = SURROGATE_PAIR_BASE
+						+ ((w & 0x3FF) << 10) + (src[i++] & 0x3FF);
 					break;
-			}
+				}
+				/* FALLTHROUGH */
+			case SURROGATE_PAIR_LOWER:
+				w = UNICODE_REPLACEMENT;
+				break;
+			default:
+				break;
 		}
+		/* convert UTF32(w) to UTF8(dist) */
+		len += utf32_to_utf8(w, dist + len);
 	}
 	return len;
 }
-
@@ -0,0 +1,578 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dedupexfat.h"
+#include "exfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+static unsigned int flags = 0;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"summary", no_argument, NULL, 's'},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE [IMAGE2]\n", PROGRAM_NAME);
+	fprintf(stderr, "find duplicate clusters in exFAT (or different clusters from IMAGE2)\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -s, --summary\tprint only summary.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * dedup_open - load boot sector and Allocation Bitmap of image
+ * @image:      image path
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ */
+static int dedup_open(const char *image)
+{
+	struct exfat_bootsec boot;
+
+	if (exfat_init_info())
+		return -ENOMEM;
+
+	if ((info.fd = open(image, O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		return -EIO;
+	}
+	exfat_journal_check(image);
+
+	if (exfat_load_bootsec(&boot))
+		return -EINVAL;
+	if (exfat_store_info(&boot))
+		return -EINVAL;
+	if (exfat_traverse_root_directory())
+		return -EINVAL;
+	return 0;
+}
+
+/**
+ * dedup_load_target - decide clusters to be read
+ * @ctx:               dedup context
+ * @second:            second image (NULL if only one image is analyzed)
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ *
+ * NOTE: Clusters allocated in either image are read.
+ */
+static int dedup_load_target(struct dedup_ctx *ctx, struct exfat_info *second)
+{
+	size_t i, len = ROUNDUP((size_t)info.cluster_count, CHAR_BIT);
+
+	if ((ctx->target = calloc(len, 1)) == NULL)
+		return -ENOMEM;
+
+	memcpy(ctx->target, info.alloc_table, MIN(len, info.alloc_length));
+	if (second) {
+		for (i = 0; i < MIN(len, second->alloc_length); i++)
+			ctx->target[i] |= second->alloc_table[i];
+	}
+	return 0;
+}
+
+/**
+ * dedup_target - whether cluster is read
+ * @ctx:          dedup context
+ * @clu:          cluster index
+ *
+ * @return        true (cluster is allocated)
+ */
+static bool dedup_target(struct dedup_ctx *ctx, uint32_t clu)
+{
+	clu -= EXFAT_FIRST_CLUSTER;
+	return (ctx->target[clu / CHAR_BIT] >> (clu % CHAR_BIT)) & 0x01;
+}
+
+/**
+ * dedup_set_error - record error in worker
+ * @ctx:             dedup context
+ * @err:             error number
+ */
+static void dedup_set_error(struct dedup_ctx *ctx, int err)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->error = err;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * dedup_worker - hash (or compare) one chunk of cluster heap
+ * @i:            chunk index
+ * @arg:          dedup context
+ *
+ * NOTE: Contiguous target clusters are read at once.
+ */
+static void dedup_worker(size_t i, void *arg)
+{
+	char *data, *other = NULL;
+	struct dedup_ctx *ctx = arg;
+	uint32_t clu = EXFAT_FIRST_CLUSTER + i * ctx->chunk;
+	uint32_t end = MIN(clu + ctx->chunk, info.cluster_count + EXFAT_FIRST_CLUSTER);
+	uint32_t run, j;
+	size_t len, off;
+	off_t heap_start = (off_t)info.heap_offset * info.sector_size;
+
+	data = malloc((size_t)ctx->chunk * info.cluster_size);
+	if (ctx->fd >= 0)
+		other = malloc((size_t)ctx->chunk * info.cluster_size);
+	if (!data || (ctx->fd >= 0 && !other)) {
+		dedup_set_error(ctx, -ENOMEM);
+		goto out;
+	}
+
+	while (clu < end) {
+		if (!dedup_target(ctx, clu)) {
+			clu++;
+			continue;
+		}
+		for (run = clu + 1; run < end && dedup_target(ctx, run); run++)
+			;
+		len = (size_t)(run - clu) * info.cluster_size;
+
+		if (get_clusters(data, clu, run - clu)) {
+			dedup_set_error(ctx, -EIO);
+			break;
+		}
+		if (ctx->fd < 0) {
+			for (j = clu; j < run; j++) {
+				off = (size_t)(j - clu) * info.cluster_size;
+				ctx->hash[j - EXFAT_FIRST_CLUSTER] = xxh64(data + off, info.cluster_size, 0);
+			}
+		} else {
+			if (pread(ctx->fd, other, len,
+						heap_start + (off_t)(clu - EXFAT_FIRST_CLUSTER) * info.cluster_size) != len) {
+				dedup_set_error(ctx, -EIO);
+				break;
+			}
+			for (j = clu; j < run; j++) {
+				off = (size_t)(j - clu) * info.cluster_size;
+				ctx->differ[j - EXFAT_FIRST_CLUSTER] =
+					memcmp(data + off, other + off, info.cluster_size) != 0;
+			}
+		}
+		clu = run;
+	}
+out:
+	free(other);
+	free(data);
+}
+
+/**
+ * dedup_collect - record file in exfat_walk_tree()
+ * @f:             file information
+ * @node:          directory cache node
+ * @path:          path of file
+ * @arg:           dedup context
+ *
+ * @return         == 0 (continue walking)
+ *                 <  0 (failed)
+ */
+static int dedup_collect(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	struct dedup_ctx *ctx = arg;
+	struct dedup_file *tmp, *d;
+
+	if (!f->clu || !f->datalen)
+		return 0;
+
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->files, (ctx->size ? ctx->size * 2 : 64) * sizeof(struct dedup_file));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->files = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 64;
+	}
+
+	d = &ctx->files[ctx->count];
+	if ((d->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	d->clu = f->clu;
+	d->flags = f->flags;
+	d->datalen = f->datalen;
+	ctx->count++;
+	return 0;
+}
+
+/**
+ * dedup_load_owner - find the file which owns each cluster
+ * @ctx:              dedup context
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: If some files share the same cluster (corrupted image), first file is used.
+ */
+static int dedup_load_owner(struct dedup_ctx *ctx)
+{
+	int ret;
+	size_t i;
+	uint64_t j, num;
+	uint32_t clu;
+	struct dedup_file *d;
+
+	if ((ctx->owner = calloc(info.cluster_count, sizeof(uint32_t))) == NULL)
+		return -ENOMEM;
+	if ((ret = exfat_walk_tree(dedup_collect, ctx)) < 0)
+		return ret;
+
+	for (i = 0; i < ctx->count; i++) {
+		d = &ctx->files[i];
+		num = ROUNDUP(d->datalen, info.cluster_size);
+		for (j = 0, clu = d->clu; j < num; j++) {
+			if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1)
+				break;
+			if (!ctx->owner[clu - EXFAT_FIRST_CLUSTER])
+				ctx->owner[clu - EXFAT_FIRST_CLUSTER] = i + 1;
+			if (d->flags & ALLOC_NOFATCHAIN)
+				clu++;
+			else if (exfat_get_fat(clu, &clu))
+				break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * dedup_compare_entry - compare clusters by hash and location
+ * @a:                   cluster hash
+ * @b:                   cluster hash
+ *
+ * @return               order of @a and @b
+ */
+static int dedup_compare_entry(const void *a, const void *b)
+{
+	const struct dedup_entry *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if (x->clu != y->clu)
+		return x->clu < y->clu ? -1 : 1;
+	return 0;
+}
+
+/* Entries referred by dedup_compare_group() */
+static struct dedup_entry *dedup_entries;
+
+/**
+ * dedup_compare_group - compare groups by first cluster
+ * @a:                   duplicate group
+ * @b:                   duplicate group
+ *
+ * @return               order of @a and @b
+ */
+static int dedup_compare_group(const void *a, const void *b)
+{
+	const struct dedup_group *x = a, *y = b;
+	uint32_t c1 = dedup_entries[x->start].clu, c2 = dedup_entries[y->start].clu;
+
+	return c1 < c2 ? -1 : c1 > c2;
+}
+
+/**
+ * dedup_verify_group - compare contents of clusters which have the same hash
+ * @e:                  clusters sorted by location
+ * @count:              the number of @e
+ *
+ * @return              the number of clusters which are the same as first cluster
+ *                      (These are moved to the head of @e)
+ *                      0 (failed)
+ */
+static size_t dedup_verify_group(struct dedup_entry *e, size_t count)
+{
+	size_t i, same = 1;
+	void *first, *data;
+
+	first = malloc(info.cluster_size);
+	data = malloc(info.cluster_size);
+	if (!first || !data || get_cluster(first, e[0].clu)) {
+		same = 0;
+		goto out;
+	}
+
+	for (i = 1; i < count; i++) {
+		if (get_cluster(data, e[i].clu))
+			continue;
+		if (!memcmp(first, data, info.cluster_size))
+			e[same++] = e[i];
+	}
+out:
+	free(data);
+	free(first);
+	return same;
+}
+
+/**
+ * dedup_report - print duplicate clusters and files which share them
+ * @ctx:          dedup context
+ *
+ * @return        == 0 (success)
+ *                <  0 (failed)
+ */
+static int dedup_report(struct dedup_ctx *ctx)
+{
+	int ret = 0;
+	size_t i, j, k, n = 0, same;
+	size_t count = 0, size = 0, duplicated = 0;
+	uint32_t clu, owner;
+	uint64_t savings = 0;
+	struct dedup_entry *entries;
+	struct dedup_group *groups = NULL, *tmp;
+
+	if ((entries = malloc(info.cluster_count * sizeof(struct dedup_entry))) == NULL)
+		return -ENOMEM;
+	for (clu = EXFAT_FIRST_CLUSTER; clu < info.cluster_count + EXFAT_FIRST_CLUSTER; clu++) {
+		if (!dedup_target(ctx, clu))
+			continue;
+		entries[n].hash = ctx->hash[clu - EXFAT_FIRST_CLUSTER];
+		entries[n++].clu = clu;
+	}
+	qsort(entries, n, sizeof(struct dedup_entry), dedup_compare_entry);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && entries[j].hash == entries[i].hash; j++)
+			;
+		if (j - i < 2 || (same = dedup_verify_group(entries + i, j - i)) < 2)
+			continue;
+
+		if (count == size) {
+			tmp = realloc(groups, (size ? size * 2 : 64) * sizeof(struct dedup_group));
+			if (!tmp) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			groups = tmp;
+			size = size ? size * 2 : 64;
+		}
+		groups[count].start = i;
+		groups[count++].count = same;
+		duplicated += same;
+		savings += (uint64_t)(same - 1) * info.cluster_size;
+	}
+	dedup_entries = entries;
+	if (count)
+		qsort(groups, count, sizeof(struct dedup_group), dedup_compare_group);
+
+	for (i = 0; !(flags & OPTION_SUMMARY) && i < count; i++) {
+		pr_msg("Duplicate clusters (xxh64: %016" PRIx64 ", %zu clusters)\n",
+				entries[groups[i].start].hash, groups[i].count);
+		for (k = groups[i].start; k < groups[i].start + groups[i].count; k++) {
+			owner = ctx->owner[entries[k].clu - EXFAT_FIRST_CLUSTER];
+			pr_msg("  Cluster#%-10u %s\n", entries[k].clu,
+					owner ? ctx->files[owner - 1].path : "-");
+		}
+		pr_msg("\n");
+	}
+
+	pr_msg("%-20s: %zu\n", "Allocated clusters", n);
+	pr_msg("%-20s: %zu\n", "Duplicate groups", count);
+	pr_msg("%-20s: %zu\n", "Duplicate clusters", duplicated);
+	pr_msg("%-20s: %" PRIu64 " (byte)\n", "Potential savings", savings);
+out:
+	free(groups);
+	free(entries);
+	return ret;
+}
+
+/**
+ * dedup_report_diff - print clusters which differ between images
+ * @ctx:               dedup context
+ *
+ * @return             0 (success)
+ */
+static int dedup_report_diff(struct dedup_ctx *ctx)
+{
+	uint32_t clu, start, last = info.cluster_count + EXFAT_FIRST_CLUSTER;
+	size_t n = 0, count = 0;
+
+	for (clu = EXFAT_FIRST_CLUSTER; clu < last; clu++) {
+		if (dedup_target(ctx, clu))
+			n++;
+		if (!ctx->differ[clu - EXFAT_FIRST_CLUSTER])
+			continue;
+
+		for (start = clu; clu + 1 < last && ctx->differ[clu + 1 - EXFAT_FIRST_CLUSTER]; clu++)
+			n += dedup_target(ctx, clu + 1);
+		count += clu - start + 1;
+		if (flags & OPTION_SUMMARY)
+			continue;
+		if (start == clu)
+			pr_msg("Cluster#%u differs.\n", start);
+		else
+			pr_msg("Cluster#%u-#%u differ.\n", start, clu);
+	}
+
+	if (!(flags & OPTION_SUMMARY) && count)
+		pr_msg("\n");
+	pr_msg("%-20s: %zu\n", "Compared clusters", n);
+	pr_msg("%-20s: %zu\n", "Different clusters", count);
+	return 0;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	size_t i;
+	bool diff = false;
+	struct exfat_info second;
+	struct dedup_ctx ctx = {0};
+
+	while ((opt = getopt_long(argc, argv,
+					"s",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case 's':
+				flags |= OPTION_SUMMARY;
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1 && optind != argc - 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	ctx.fd = -1;
+
+	/* Second image is only used as raw data with its Allocation Bitmap */
+	if (optind == argc - 2) {
+		if (dedup_open(argv[optind + 1]))
+			goto out;
+		if (info.meta) {
+			pr_err("%s: Metadata image doesn't have file data.\n", argv[optind + 1]);
+			goto out;
+		}
+		second = info;
+		diff = true;
+	}
+	if (dedup_open(argv[optind]))
+		goto out;
+
+	if (diff && (info.cluster_size != second.cluster_size ||
+				info.cluster_count != second.cluster_count ||
+				info.heap_offset * info.sector_size != second.heap_offset * second.sector_size)) {
+		pr_err("Cluster heap layout is different between %s and %s.\n",
+				argv[optind], argv[optind + 1]);
+		goto out;
+	}
+
+	if ((ret = dedup_load_target(&ctx, diff ? &second : NULL)))
+		goto out;
+	if (diff) {
+		ctx.fd = second.fd;
+		ctx.differ = calloc(info.cluster_count, sizeof(uint8_t));
+	} else {
+		exfat_load_fat_table();
+		ctx.hash = calloc(info.cluster_count, sizeof(uint64_t));
+	}
+	if ((diff && !ctx.differ) || (!diff && !ctx.hash)) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	ctx.chunk = MAX(DEDUP_CHUNK_SIZE / info.cluster_size, 1);
+	pthread_mutex_init(&ctx.lock, NULL);
+	exfat_parallel_for(ROUNDUP((size_t)info.cluster_count, ctx.chunk), 0, dedup_worker, &ctx);
+	pthread_mutex_destroy(&ctx.lock);
+	if ((ret = ctx.error)) {
+		pr_err("Can't read cluster heap.\n");
+		goto free;
+	}
+
+	if (diff)
+		ret = dedup_report_diff(&ctx);
+	else if (!(ret = dedup_load_owner(&ctx)))
+		ret = dedup_report(&ctx);
+
+free:
+	for (i = 0; i < ctx.count; i++)
+		free(ctx.files[i].path);
+	free(ctx.files);
+	free(ctx.owner);
+	free(ctx.hash);
+	free(ctx.differ);
+	free(ctx.target);
+out:
+	exfat_clean_info();
+	if (diff) {
+		info = second;
+		exfat_clean_info();
+	}
+	return ret;
+}
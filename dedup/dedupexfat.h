@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _DEDUPEXFAT_H
+#define _DEDUPEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "hash.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "dedupexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+#define OPTION_SUMMARY   (1 << 0)
+
+/* Size of cluster heap read by one worker at a time */
+#define DEDUP_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Cluster hash (sorted to find duplicate clusters) */
+struct dedup_entry {
+	uint64_t hash;
+	uint32_t clu;
+};
+
+/* Clusters which have the same contents */
+struct dedup_group {
+	size_t start;
+	size_t count;
+};
+
+/* File which owns clusters */
+struct dedup_file {
+	char *path;
+	uint32_t clu;
+	uint8_t flags;
+	uint64_t datalen;
+};
+
+struct dedup_ctx {
+	/* Clusters to be read (same format as Allocation Bitmap) */
+	uint8_t *target;
+	uint32_t chunk;
+	/* Hash of each cluster */
+	uint64_t *hash;
+	/* Second image (-1 if only one image is analyzed) */
+	int fd;
+	uint8_t *differ;
+	/* Files and owner (file index + 1) of each cluster */
+	struct dedup_file *files;
+	size_t count;
+	size_t size;
+	uint32_t *owner;
+	/* Error in workers (protected by lock) */
+	pthread_mutex_t lock;
+	int error;
+};
+
+#endif /*_DEDUPEXFAT_H */
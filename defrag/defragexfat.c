@@ -0,0 +1,604 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <mntent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "defragexfat.h"
+#include "exfat.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+uint8_t flags = 0;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"dry-run", no_argument, NULL, 'n'},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/* Files found in exfat_walk_tree() */
+struct defrag_list {
+	struct defrag_file *files;
+	size_t count;
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE\n", PROGRAM_NAME);
+	fprintf(stderr, "defragment files in exFAT\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -n, --dry-run\tdisplay relocation plan and expected I/O only.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * defrag_load_extents - get extents of the file
+ * @d:                   file to defragment
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ *
+ * NOTE: If FAT chain is broken, or doesn't end at file size,
+ *       @d is marked as DEFRAG_SKIP.
+ */
+static int defrag_load_extents(struct defrag_file *d)
+{
+	uint32_t i, clu = d->f->clu, next;
+	struct defrag_extent *tmp;
+
+	d->clusters = ROUNDUP(d->f->datalen, info.cluster_size);
+	if (!d->clusters || !clu)
+		return 0;
+
+	for (i = 0; i < d->clusters; i++, clu = next) {
+		if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1 ||
+				exfat_load_bitmap(clu) != 1) {
+			d->state = DEFRAG_SKIP;
+			d->reason = "broken FAT chain";
+			return 0;
+		}
+
+		if (d->extents && d->ext[d->extents - 1].clu + d->ext[d->extents - 1].len == clu) {
+			d->ext[d->extents - 1].len++;
+		} else {
+			/* Expand list by power of two */
+			if (!(d->extents & (d->extents - 1))) {
+				tmp = realloc(d->ext, (d->extents ? d->extents * 2 : 1) * sizeof(*tmp));
+				if (!tmp)
+					return -ENOMEM;
+				d->ext = tmp;
+			}
+			d->ext[d->extents].clu = clu;
+			d->ext[d->extents].len = 1;
+			d->extents++;
+		}
+
+		if (d->f->flags & ALLOC_NOFATCHAIN)
+			next = clu + 1;
+		else if (exfat_get_fat(clu, &next))
+			next = 0;
+	}
+
+	/* Clusters beyond DataLength would be lost by NoFatChain */
+	if (!(d->f->flags & ALLOC_NOFATCHAIN) && next != EXFAT_LASTCLUSTER) {
+		d->state = DEFRAG_SKIP;
+		d->reason = "FAT chain is longer than file size";
+	}
+
+	return 0;
+}
+
+/**
+ * defrag_collect_file - append file to list
+ * @f:                   file information
+ * @node:                cache node
+ * @path:                file path
+ * @arg:                 file list
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int defrag_collect_file(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	struct defrag_list *l = arg;
+	struct defrag_file *d;
+
+	/* Expand list by power of two */
+	if (!(l->count & (l->count - 1))) {
+		d = realloc(l->files, (l->count ? l->count * 2 : 1) * sizeof(struct defrag_file));
+		if (!d)
+			return -ENOMEM;
+		l->files = d;
+	}
+
+	d = &l->files[l->count];
+	memset(d, 0, sizeof(struct defrag_file));
+	d->f = f;
+	if ((d->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	l->count++;
+
+	return defrag_load_extents(d);
+}
+
+/**
+ * defrag_check_shared - skip files which share clusters with others
+ * @l:                   file list
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int defrag_check_shared(struct defrag_list *l)
+{
+	size_t i;
+	uint32_t j, k, clu;
+	bitmap_t seen, shared;
+
+	init_bitmap(&seen, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	init_bitmap(&shared, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	if (!seen.data || !shared.data) {
+		free(seen.data);
+		free(shared.data);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < l->count; i++) {
+		for (j = 0; j < l->files[i].extents; j++) {
+			for (k = 0; k < l->files[i].ext[j].len; k++) {
+				clu = l->files[i].ext[j].clu + k;
+				if (get_bitmap(&seen, clu))
+					set_bitmap(&shared, clu);
+				set_bitmap(&seen, clu);
+			}
+		}
+	}
+
+	/* Stop checking file as soon as it is skipped */
+	for (i = 0; i < l->count; i++) {
+		for (j = 0; j < l->files[i].extents && l->files[i].state != DEFRAG_SKIP; j++) {
+			for (k = 0; k < l->files[i].ext[j].len; k++) {
+				if (get_bitmap(&shared, l->files[i].ext[j].clu + k)) {
+					l->files[i].state = DEFRAG_SKIP;
+					l->files[i].reason = "cross-linked cluster";
+					break;
+				}
+			}
+		}
+	}
+
+	free(seen.data);
+	free(shared.data);
+	return 0;
+}
+
+/* Free extents found in exfat_scan_free_extents() */
+struct defrag_free {
+	struct defrag_extent *ext;
+	size_t count;
+};
+
+/**
+ * defrag_collect_free - append free extent to list
+ * @clu:                 first cluster of free extent
+ * @len:                 the number of clusters
+ * @arg:                 free extent list
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int defrag_collect_free(uint32_t clu, uint32_t len, void *arg)
+{
+	struct defrag_free *fr = arg;
+	struct defrag_extent *tmp;
+
+	if (!(fr->count & (fr->count - 1))) {
+		tmp = realloc(fr->ext, (fr->count ? fr->count * 2 : 1) * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+		fr->ext = tmp;
+	}
+	fr->ext[fr->count].clu = clu;
+	fr->ext[fr->count].len = len;
+	fr->count++;
+	return 0;
+}
+
+/**
+ * defrag_compare_size - compare function to sort by clusters (descending)
+ * @a:                   file a
+ * @b:                   file b
+ */
+static int defrag_compare_size(const void *a, const void *b)
+{
+	const struct defrag_file *x = *(struct defrag_file **)a, *y = *(struct defrag_file **)b;
+
+	if (x->clusters != y->clusters)
+		return x->clusters < y->clusters ? 1 : -1;
+	return (x->ext[0].clu > y->ext[0].clu) - (x->ext[0].clu < y->ext[0].clu);
+}
+
+/**
+ * defrag_compare_source - compare function to sort by source cluster
+ * @a:                     file a
+ * @b:                     file b
+ */
+static int defrag_compare_source(const void *a, const void *b)
+{
+	const struct defrag_file *x = *(struct defrag_file **)a, *y = *(struct defrag_file **)b;
+
+	return (x->ext[0].clu > y->ext[0].clu) - (x->ext[0].clu < y->ext[0].clu);
+}
+
+/**
+ * defrag_plan - decide destination of fragmented files
+ * @l:           file list
+ * @moves:       files to move, sorted by source cluster (Output)
+ * @count:       the number of @moves (Output)
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ *
+ * NOTE: Only clusters which are free before defragmentation are used,
+ *       so that any cluster is never overwritten before it is copied.
+ *       The largest file is placed first, into the best fit free extent.
+ */
+static int defrag_plan(struct defrag_list *l, struct defrag_file ***moves, size_t *count)
+{
+	int ret;
+	size_t i, j, best;
+	struct defrag_free fr = {NULL, 0};
+	struct defrag_file **m;
+
+	*moves = NULL;
+	*count = 0;
+
+	if ((ret = exfat_scan_free_extents(defrag_collect_free, &fr)) < 0)
+		return ret;
+
+	if ((m = calloc(l->count + 1, sizeof(struct defrag_file *))) == NULL) {
+		free(fr.ext);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < l->count; i++) {
+		struct defrag_file *d = &l->files[i];
+
+		if (d->state != DEFRAG_NONE || (d->f->attr & ATTR_DIRECTORY) || !d->extents)
+			continue;
+		if (d->f->flags & ALLOC_NOFATCHAIN)
+			continue;
+		if (d->extents == 1 && d->clusters > 1)
+			d->state = DEFRAG_FLAG;
+		else if (d->extents == 1)
+			continue;
+		else
+			m[(*count)++] = d;
+	}
+
+	qsort(m, *count, sizeof(struct defrag_file *), defrag_compare_size);
+	for (i = 0, j = 0; i < *count; i++) {
+		for (best = fr.count, j = 0; j < fr.count; j++) {
+			if (fr.ext[j].len < m[i]->clusters)
+				continue;
+			if (best == fr.count || fr.ext[j].len < fr.ext[best].len)
+				best = j;
+		}
+
+		if (best == fr.count) {
+			m[i]->state = DEFRAG_SKIP;
+			m[i]->reason = "no contiguous free space";
+			continue;
+		}
+		m[i]->state = DEFRAG_MOVE;
+		m[i]->dst = fr.ext[best].clu;
+		fr.ext[best].clu += m[i]->clusters;
+		fr.ext[best].len -= m[i]->clusters;
+	}
+
+	/* Remove skipped files, and move files in order of source */
+	for (i = 0, j = 0; i < *count; i++)
+		if (m[i]->state == DEFRAG_MOVE)
+			m[j++] = m[i];
+	*count = j;
+	qsort(m, *count, sizeof(struct defrag_file *), defrag_compare_source);
+
+	*moves = m;
+	free(fr.ext);
+	return 0;
+}
+
+/**
+ * defrag_copy - copy file data to destination
+ * @d:           file to move
+ * @buf:         buffer for batch (or NULL in dry-run)
+ * @batch:       the number of clusters in @buf
+ * @io:          I/O statistics
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ *
+ * NOTE: Extents are read into @buf until it is full,
+ *       and @buf is written to destination by one request.
+ */
+static int defrag_copy(struct defrag_file *d, void *buf, uint32_t batch, struct defrag_io *io)
+{
+	int ret;
+	uint32_t i, off, n, filled = 0, dst = d->dst;
+
+	for (i = 0; i < d->extents; i++) {
+		for (off = 0; off < d->ext[i].len; off += n) {
+			n = MIN(d->ext[i].len - off, batch - filled);
+			if (buf && (ret = get_clusters(buf + (size_t)filled * info.cluster_size,
+							d->ext[i].clu + off, n)))
+				return ret;
+			io->read_bytes += (uint64_t)n * info.cluster_size;
+			io->read_reqs++;
+			filled += n;
+
+			if (filled < batch && !(i == d->extents - 1 && off + n == d->ext[i].len))
+				continue;
+
+			if (buf && (ret = set_clusters(buf, dst, filled)))
+				return ret;
+			io->write_bytes += (uint64_t)filled * info.cluster_size;
+			io->write_reqs++;
+			dst += filled;
+			filled = 0;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * defrag_commit - update metadata for moved file
+ * @d:             moved file
+ *
+ * @return         == 0 (success)
+ *                 <  0 (failed)
+ *
+ * NOTE: Destination is allocated before directory entry is updated,
+ *       and source is released after that.
+ */
+static int defrag_commit(struct defrag_file *d)
+{
+	int ret;
+	uint32_t i, j, old = d->f->clu;
+	bool chain = !(d->f->flags & ALLOC_NOFATCHAIN);
+
+	if ((ret = exfat_save_bitmap_range(d->dst, d->clusters, 1)))
+		return ret;
+
+	d->f->clu = d->dst;
+	d->f->flags |= ALLOC_NOFATCHAIN;
+	if ((ret = exfat_update_filesize(d->f, old))) {
+		d->f->clu = old;
+		d->f->flags &= ~ALLOC_NOFATCHAIN;
+		exfat_save_bitmap_range(d->dst, d->clusters, 0);
+		return ret;
+	}
+
+	for (i = 0; i < d->extents; i++)
+		if ((ret = exfat_save_bitmap_range(d->ext[i].clu, d->ext[i].len, 0)))
+			return ret;
+
+	/* FAT entries of released clusters are cleared */
+	for (i = 0; chain && i < d->extents; i++)
+		for (j = 0; j < d->ext[i].len; j++)
+			if ((ret = exfat_set_fat(d->ext[i].clu + j, 0)))
+				return ret;
+
+	return 0;
+}
+
+/**
+ * defrag_run - defragment all files in exFAT
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ */
+static int defrag_run(void)
+{
+	int ret;
+	bool dry = flags & OPTION_DRYRUN;
+	size_t i, nmoves = 0, nflags = 0, nskips = 0;
+	uint32_t batch = MAX(DEFRAG_BATCH_SIZE / info.cluster_size, 1);
+	void *buf = NULL;
+	struct defrag_list l = {NULL, 0};
+	struct defrag_file **moves = NULL;
+	struct defrag_io io = {0};
+
+	if ((ret = exfat_load_fat_table()) < 0)
+		return ret;
+	if ((ret = exfat_walk_tree(defrag_collect_file, &l)) < 0)
+		goto out;
+	if ((ret = defrag_check_shared(&l)) < 0)
+		goto out;
+	if ((ret = defrag_plan(&l, &moves, &nmoves)) < 0)
+		goto out;
+
+	if (!dry && nmoves && (buf = malloc((size_t)batch * info.cluster_size)) == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Copy all data before any metadata is changed */
+	for (i = 0; i < nmoves; i++) {
+		pr_msg("%s: %u clusters, %u extents, 0x%08x -> 0x%08x\n", moves[i]->path,
+				moves[i]->clusters, moves[i]->extents, moves[i]->ext[0].clu, moves[i]->dst);
+		if ((ret = defrag_copy(moves[i], buf, batch, &io)) < 0)
+			goto out;
+	}
+	if (!dry && nmoves)
+		fsync(info.fd);
+
+	/* All metadata updates are written at once */
+	if (!dry && (ret = exfat_trans_begin()) < 0)
+		goto out;
+	for (i = 0; i < nmoves; i++)
+		if (!dry && (ret = defrag_commit(moves[i])) < 0)
+			goto abort;
+
+	for (i = 0; i < l.count; i++) {
+		struct defrag_file *d = &l.files[i];
+
+		switch (d->state) {
+		case DEFRAG_FLAG:
+			pr_msg("%s: %u clusters, set NoFatChain\n", d->path, d->clusters);
+			if (!dry) {
+				d->f->flags |= ALLOC_NOFATCHAIN;
+				if ((ret = exfat_update_filesize(d->f, d->f->clu)) < 0)
+					goto abort;
+			}
+			nflags++;
+			break;
+		case DEFRAG_SKIP:
+			pr_msg("%s: skipped (%s)\n", d->path, d->reason);
+			nskips++;
+			break;
+		default:
+			break;
+		}
+	}
+	if (!dry && (ret = exfat_trans_commit()) < 0)
+		goto out;
+
+	pr_msg("\n");
+	pr_msg("%-16s: %zu\n", "Moved files", nmoves);
+	pr_msg("%-16s: %zu\n", "NoFatChain files", nflags);
+	pr_msg("%-16s: %zu\n", "Skipped files", nskips);
+	pr_msg("%s:\n", dry ? "Expected I/O" : "I/O");
+	pr_msg("  %-14s: %" PRIu64 " bytes in %" PRIu64 " requests\n", "Read",
+			io.read_bytes, io.read_reqs);
+	pr_msg("  %-14s: %" PRIu64 " bytes in %" PRIu64 " requests\n", "Write",
+			io.write_bytes, io.write_reqs);
+	goto out;
+
+abort:
+	exfat_trans_abort();
+out:
+	free(buf);
+	free(moves);
+	for (i = 0; i < l.count; i++) {
+		free(l.files[i].path);
+		free(l.files[i].ext);
+	}
+	free(l.files);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	struct exfat_bootsec boot;
+
+	while ((opt = getopt_long(argc, argv,
+					"n",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case 'n':
+				flags |= OPTION_DRYRUN;
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], (flags & OPTION_DRYRUN) ? O_RDONLY : O_RDWR)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (flags & OPTION_DRYRUN)
+		exfat_journal_check(argv[optind]);
+	else if (exfat_journal_init(argv[optind]))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if (defrag_run())
+		goto out;
+
+	ret = EXIT_SUCCESS;
+out:
+	exfat_clean_info();
+	return ret;
+}
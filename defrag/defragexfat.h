@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _DEFRAGEXFAT_H
+#define _DEFRAGEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "defragexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+#define OPTION_DRYRUN    (1 << 0)
+
+/* Size of one read/write request to move clusters */
+#define DEFRAG_BATCH_SIZE    (8 * 1024 * 1024)
+
+enum defrag_state {
+	DEFRAG_NONE,
+	DEFRAG_MOVE,
+	DEFRAG_FLAG,
+	DEFRAG_SKIP,
+};
+
+struct defrag_extent {
+	uint32_t clu;
+	uint32_t len;
+};
+
+struct defrag_file {
+	struct exfat_fileinfo *f;
+	char *path;
+	uint32_t clusters;
+	uint32_t extents;
+	struct defrag_extent *ext;
+	uint32_t dst;
+	enum defrag_state state;
+	const char *reason;
+};
+
+struct defrag_io {
+	uint64_t read_bytes;
+	uint64_t read_reqs;
+	uint64_t write_bytes;
+	uint64_t write_reqs;
+};
+
+#endif /*_DEFRAGEXFAT_H */
@@ -0,0 +1,797 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "diffexfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+static const struct diff_field boot_fields[] = {
+	DIFF_BOOT_FIELD(PartitionOffset),
+	DIFF_BOOT_FIELD(VolumeLength),
+	DIFF_BOOT_FIELD(FatOffset),
+	DIFF_BOOT_FIELD(FatLength),
+	DIFF_BOOT_FIELD(ClusterHeapOffset),
+	DIFF_BOOT_FIELD(ClusterCount),
+	DIFF_BOOT_FIELD(FirstClusterOfRootDirectory),
+	DIFF_BOOT_FIELD(VolumeSerialNumber),
+	DIFF_BOOT_FIELD(FileSystemRevision),
+	DIFF_BOOT_FIELD(VolumeFlags),
+	DIFF_BOOT_FIELD(BytesPerSectorShift),
+	DIFF_BOOT_FIELD(SectorsPerClusterShift),
+	DIFF_BOOT_FIELD(NumberOfFats),
+	DIFF_BOOT_FIELD(DriveSelect),
+	DIFF_BOOT_FIELD(PercentInUse),
+};
+
+static const char *diff_type_name[DIFF_TYPES] = {
+	"added",
+	"removed",
+	"modified",
+	"changed",
+	"moved",
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE1 IMAGE2\n", PROGRAM_NAME);
+	fprintf(stderr, "compare two exFAT images\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Exit status is 0 if images are the same, 1 if different, 2 if trouble.\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * diff_collect - record file in exfat_walk_tree()
+ * @f:            file information
+ * @node:         directory cache node
+ * @path:         path of file
+ * @arg:          image
+ *
+ * @return        == 0 (continue walking)
+ *                <  0 (failed)
+ */
+static int diff_collect(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	struct diff_image *img = arg;
+	struct diff_file *tmp, *d;
+
+	if (img->count == img->size) {
+		tmp = realloc(img->files, (img->size ? img->size * 2 : 64) * sizeof(struct diff_file));
+		if (!tmp)
+			return -ENOMEM;
+		img->files = tmp;
+		img->size = img->size ? img->size * 2 : 64;
+	}
+
+	d = &img->files[img->count];
+	memset(d, 0, sizeof(struct diff_file));
+	if ((d->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	d->f = *f;
+	d->f.name = NULL;
+	img->count++;
+	return 0;
+}
+
+/**
+ * diff_load - load metadata of image
+ * @img:       image (Output)
+ * @image:     image path
+ *
+ * @return     == 0 (success)
+ *             <  0 (failed)
+ *
+ * NOTE: Loaded filesystem is left in global exfat_info.
+ */
+static int diff_load(struct diff_image *img, const char *image)
+{
+	int ret;
+
+	if (exfat_init_info())
+		return -ENOMEM;
+
+	if ((info.fd = open(image, O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		return -EIO;
+	}
+	exfat_journal_check(image);
+
+	if (exfat_load_bootsec(&img->boot))
+		return -EINVAL;
+	if (exfat_store_info(&img->boot))
+		return -EINVAL;
+	if (exfat_traverse_root_directory())
+		return -EINVAL;
+	if ((ret = exfat_load_fat_table()))
+		return ret;
+	return exfat_walk_tree(diff_collect, img);
+}
+
+/**
+ * diff_boot_field - obtain field in boot sector
+ * @b:               boot sector
+ * @field:           field
+ *
+ * @return           field value
+ */
+static uint64_t diff_boot_field(struct exfat_bootsec *b, const struct diff_field *field)
+{
+	size_t i;
+	uint64_t value = 0;
+	const uint8_t *p = (const uint8_t *)b + field->offset;
+
+	for (i = 0; i < field->size; i++)
+		value |= (uint64_t)p[i] << (i * CHAR_BIT);
+	return value;
+}
+
+/**
+ * diff_boot - print fields in boot sector which differ
+ * @ctx:       diff context
+ *
+ * @return     the number of different fields
+ */
+static size_t diff_boot(struct diff_ctx *ctx)
+{
+	size_t count = 0;
+	size_t i;
+	uint64_t x, y;
+	const struct diff_field *field;
+
+	for (i = 0; i < sizeof(boot_fields) / sizeof(boot_fields[0]); i++) {
+		field = &boot_fields[i];
+		x = diff_boot_field(&ctx->a.boot, field);
+		y = diff_boot_field(&ctx->b.boot, field);
+		if (x == y)
+			continue;
+		pr_msg("%-28s\t: 0x%0*" PRIx64 " -> 0x%0*" PRIx64 "\n", field->name,
+				(int)field->size * 2, x, (int)field->size * 2, y);
+		count++;
+	}
+	return count;
+}
+
+/**
+ * diff_tables - print summary of FAT and Allocation Bitmap which differ
+ * @ctx:         diff context
+ *
+ * @return       true (either table differs)
+ */
+static bool diff_tables(struct diff_ctx *ctx)
+{
+	size_t i, len;
+	uint32_t clu, count, fat = 0, allocated = 0, freed = 0;
+	uint8_t x, y, mask;
+	struct exfat_info *a = &ctx->a.info, *b = &ctx->b.info;
+
+	count = MIN(a->cluster_count, b->cluster_count);
+	for (clu = EXFAT_FIRST_CLUSTER; clu < count + EXFAT_FIRST_CLUSTER; clu++)
+		if (a->fat_table[clu] != b->fat_table[clu])
+			fat++;
+	fat += MAX(a->cluster_count, b->cluster_count) - count;
+	if (fat)
+		pr_msg("%-28s\t: %u entries\n", "FAT", fat);
+
+	len = MIN(ROUNDUP((size_t)count, CHAR_BIT), MIN(a->alloc_length, b->alloc_length));
+	for (i = 0; i < len; i++) {
+		mask = 0xff;
+		if ((i + 1) * CHAR_BIT > count)
+			mask >>= (i + 1) * CHAR_BIT - count;
+		x = a->alloc_table[i] & mask;
+		y = b->alloc_table[i] & mask;
+		allocated += __builtin_popcount(~x & y & 0xff);
+		freed += __builtin_popcount(x & ~y & 0xff);
+	}
+	if (allocated || freed)
+		pr_msg("%-28s\t: %u allocated, %u freed\n", "Allocation Bitmap", allocated, freed);
+	return fat || allocated || freed;
+}
+
+/**
+ * diff_add_result - record different file
+ * @ctx:             diff context
+ * @type:            difference
+ * @from:            path in first image
+ * @to:              path in second image
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ */
+static int diff_add_result(struct diff_ctx *ctx, enum diff_type type, const char *from, const char *to)
+{
+	struct diff_result *tmp;
+
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->results, (ctx->size ? ctx->size * 2 : 64) * sizeof(struct diff_result));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->results = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 64;
+	}
+
+	ctx->results[ctx->count].type = type;
+	ctx->results[ctx->count].from = from;
+	ctx->results[ctx->count++].to = to;
+	return 0;
+}
+
+/**
+ * diff_compare_path - compare files by path
+ * @a:                 file
+ * @b:                 file
+ *
+ * @return             order of @a and @b
+ */
+static int diff_compare_path(const void *a, const void *b)
+{
+	return strcmp(((const struct diff_file *)a)->path, ((const struct diff_file *)b)->path);
+}
+
+/**
+ * diff_compare_cluster - compare files by first cluster
+ * @a:                    pointer to file
+ * @b:                    pointer to file
+ *
+ * @return                order of @a and @b
+ */
+static int diff_compare_cluster(const void *a, const void *b)
+{
+	const struct diff_file *x = *(struct diff_file * const *)a, *y = *(struct diff_file * const *)b;
+
+	return x->f.clu < y->f.clu ? -1 : x->f.clu > y->f.clu;
+}
+
+/**
+ * diff_compare_size - compare files by data length
+ * @a:                 pointer to file
+ * @b:                 pointer to file
+ *
+ * @return             order of @a and @b
+ */
+static int diff_compare_size(const void *a, const void *b)
+{
+	const struct diff_file *x = *(struct diff_file * const *)a, *y = *(struct diff_file * const *)b;
+
+	return x->f.datalen < y->f.datalen ? -1 : x->f.datalen > y->f.datalen;
+}
+
+/**
+ * diff_compare_result - compare results by path
+ * @a:                   result
+ * @b:                   result
+ *
+ * @return               order of @a and @b
+ */
+static int diff_compare_result(const void *a, const void *b)
+{
+	const struct diff_result *x = a, *y = b;
+
+	return strcmp(x->to ? x->to : x->from, y->to ? y->to : y->from);
+}
+
+/**
+ * diff_same_attribute - whether timestamp and attribute are the same
+ * @x:                   file information
+ * @y:                   file information
+ *
+ * @return               true (same)
+ */
+static bool diff_same_attribute(struct exfat_fileinfo *x, struct exfat_fileinfo *y)
+{
+	return x->attr == y->attr &&
+		x->mtime.time == y->mtime.time &&
+		x->mtime.subsec == y->mtime.subsec &&
+		x->mtime.tz == y->mtime.tz;
+}
+
+/**
+ * diff_same_location - whether file data are in the same clusters
+ * @x:                  file information
+ * @y:                  file information
+ *
+ * @return              true (same)
+ */
+static bool diff_same_location(struct exfat_fileinfo *x, struct exfat_fileinfo *y)
+{
+	return x->clu == y->clu &&
+		(x->flags & ALLOC_NOFATCHAIN) == (y->flags & ALLOC_NOFATCHAIN) &&
+		x->datalen == y->datalen &&
+		(x->attr & ATTR_DIRECTORY) == (y->attr & ATTR_DIRECTORY);
+}
+
+/**
+ * diff_unmatched - collect files which don't exist in the other image
+ * @img:            image
+ * @dir:            collect directories too
+ * @count:          the number of files (Output)
+ *
+ * @return          array of files (must be freed by caller)
+ *                  NULL (failed)
+ */
+static struct diff_file **diff_unmatched(struct diff_image *img, bool dir, size_t *count)
+{
+	size_t i;
+	struct diff_file **files;
+
+	*count = 0;
+	if ((files = malloc(MAX(img->count, 1) * sizeof(struct diff_file *))) == NULL)
+		return NULL;
+
+	for (i = 0; i < img->count; i++) {
+		if (img->files[i].peer || !img->files[i].f.datalen)
+			continue;
+		if (!dir && (img->files[i].f.attr & ATTR_DIRECTORY))
+			continue;
+		files[(*count)++] = &img->files[i];
+	}
+	return files;
+}
+
+/**
+ * diff_pair - record that two files are the same file
+ * @x:         file in first image
+ * @y:         file in second image
+ */
+static void diff_pair(struct diff_file *x, struct diff_file *y)
+{
+	x->peer = y;
+	y->peer = x;
+}
+
+/**
+ * diff_match_path - compare files which have the same path
+ * @ctx:             diff context
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ *
+ * NOTE: File data is hashed later only if metadata differs.
+ */
+static int diff_match_path(struct diff_ctx *ctx)
+{
+	int c, ret = 0;
+	size_t i = 0, j = 0;
+	struct diff_file *x, *y;
+
+	while (!ret && i < ctx->a.count && j < ctx->b.count) {
+		x = &ctx->a.files[i];
+		y = &ctx->b.files[j];
+		if ((c = strcmp(x->path, y->path)) < 0) {
+			i++;
+			continue;
+		} else if (c > 0) {
+			j++;
+			continue;
+		}
+		i++;
+		j++;
+		diff_pair(x, y);
+
+		if ((x->f.attr & ATTR_DIRECTORY) != (y->f.attr & ATTR_DIRECTORY) ||
+				x->f.datalen != y->f.datalen)
+			ret = diff_add_result(ctx, DIFF_MODIFIED, x->path, NULL);
+		else if (x->f.attr & ATTR_DIRECTORY)
+			continue;
+		else if (diff_same_location(&x->f, &y->f) && diff_same_attribute(&x->f, &y->f))
+			continue;
+		else if (ctx->data && x->f.datalen)
+			x->hash = y->hash = true;
+		else if (!diff_same_location(&x->f, &y->f))
+			ret = diff_add_result(ctx, DIFF_MODIFIED, x->path, NULL);
+		else
+			ret = diff_add_result(ctx, DIFF_CHANGED, x->path, NULL);
+	}
+	return ret;
+}
+
+/**
+ * diff_match_location - find moved files which still use the same clusters
+ * @ctx:                 diff context
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int diff_match_location(struct diff_ctx *ctx)
+{
+	int ret = 0;
+	size_t i, lo, hi, mid, acount, bcount;
+	struct diff_file **a, **b;
+
+	a = diff_unmatched(&ctx->a, true, &acount);
+	b = diff_unmatched(&ctx->b, true, &bcount);
+	if (!a || !b) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	qsort(b, bcount, sizeof(struct diff_file *), diff_compare_cluster);
+
+	for (i = 0; !ret && i < acount; i++) {
+		/* first file whose cluster isn't less than a[i] */
+		for (lo = 0, hi = bcount; lo < hi;) {
+			mid = lo + (hi - lo) / 2;
+			if (b[mid]->f.clu < a[i]->f.clu)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < bcount && b[lo]->f.clu == a[i]->f.clu; lo++) {
+			if (b[lo]->peer || !diff_same_location(&a[i]->f, &b[lo]->f))
+				continue;
+			diff_pair(a[i], b[lo]);
+			ret = diff_add_result(ctx, DIFF_MOVED, a[i]->path, b[lo]->path);
+			break;
+		}
+	}
+out:
+	free(b);
+	free(a);
+	return ret;
+}
+
+/**
+ * diff_match_content - find moved files which have the same data
+ * @ctx:                diff context
+ * @hashed:             false (mark candidates to be hashed)
+ *                      true  (match candidates by hash)
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: Only files which have the same size in the other image are candidates.
+ */
+static int diff_match_content(struct diff_ctx *ctx, bool hashed)
+{
+	int ret = 0;
+	size_t i = 0, j = 0, k, l, ai, bj, acount, bcount;
+	struct diff_file **a, **b;
+
+	a = diff_unmatched(&ctx->a, false, &acount);
+	b = diff_unmatched(&ctx->b, false, &bcount);
+	if (!a || !b) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	qsort(a, acount, sizeof(struct diff_file *), diff_compare_size);
+	qsort(b, bcount, sizeof(struct diff_file *), diff_compare_size);
+
+	while (!ret && i < acount && j < bcount) {
+		if (a[i]->f.datalen < b[j]->f.datalen) {
+			i++;
+			continue;
+		} else if (a[i]->f.datalen > b[j]->f.datalen) {
+			j++;
+			continue;
+		}
+		for (ai = i; ai < acount && a[ai]->f.datalen == a[i]->f.datalen; ai++)
+			;
+		for (bj = j; bj < bcount && b[bj]->f.datalen == b[j]->f.datalen; bj++)
+			;
+
+		for (k = i; !ret && k < ai; k++) {
+			if (!hashed) {
+				a[k]->hash = true;
+				continue;
+			}
+			for (l = j; l < bj; l++) {
+				if (b[l]->peer || a[k]->error || b[l]->error ||
+						memcmp(a[k]->digest, b[l]->digest, ctx->algo->digest_size))
+					continue;
+				diff_pair(a[k], b[l]);
+				ret = diff_add_result(ctx, DIFF_MOVED, a[k]->path, b[l]->path);
+				break;
+			}
+		}
+		for (l = j; !hashed && l < bj; l++)
+			b[l]->hash = true;
+		i = ai;
+		j = bj;
+	}
+out:
+	free(b);
+	free(a);
+	return ret;
+}
+
+/**
+ * diff_update - update hash by file data
+ * @data:        file data
+ * @len:         length of @data
+ * @arg:         hash context
+ *
+ * @return       0 (continue reading)
+ */
+static int diff_update(const void *data, size_t len, void *arg)
+{
+	struct diff_hash *h = arg;
+
+	h->algo->update(&h->ctx, data, len);
+	return 0;
+}
+
+/**
+ * diff_worker - calculate hash of one file
+ * @i:           index in files to be hashed
+ * @arg:         diff context
+ */
+static void diff_worker(size_t i, void *arg)
+{
+	struct diff_ctx *ctx = arg;
+	struct diff_file *d = ctx->hashes[i];
+	struct diff_hash h = {.algo = ctx->algo};
+
+	ctx->algo->init(&h.ctx);
+	d->error = exfat_read_file(&d->f, DIFF_BUFFER_SIZE, diff_update, &h);
+	ctx->algo->final(&h.ctx, d->digest);
+}
+
+/**
+ * diff_hash_image - calculate hash of files marked in image
+ * @ctx:             diff context
+ * @img:             image
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ *
+ * NOTE: Global exfat_info is switched to @img while hashing.
+ */
+static int diff_hash_image(struct diff_ctx *ctx, struct diff_image *img)
+{
+	size_t i;
+
+	if ((ctx->hashes = malloc(MAX(img->count, 1) * sizeof(struct diff_file *))) == NULL)
+		return -ENOMEM;
+
+	ctx->hash_count = 0;
+	for (i = 0; i < img->count; i++)
+		if (img->files[i].hash)
+			ctx->hashes[ctx->hash_count++] = &img->files[i];
+
+	info = img->info;
+	exfat_parallel_for(ctx->hash_count, 0, diff_worker, ctx);
+	for (i = 0; i < ctx->hash_count; i++)
+		if (ctx->hashes[i]->error)
+			pr_warn("%s: Can't read file data.\n", ctx->hashes[i]->path);
+
+	free(ctx->hashes);
+	ctx->hashes = NULL;
+	return 0;
+}
+
+/**
+ * diff_check_hashed - compare hash of files which have the same path
+ * @ctx:               diff context
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+static int diff_check_hashed(struct diff_ctx *ctx)
+{
+	int ret = 0;
+	size_t i;
+	struct diff_file *x, *y;
+
+	for (i = 0; !ret && i < ctx->a.count; i++) {
+		x = &ctx->a.files[i];
+		y = x->peer;
+		if (!y || strcmp(x->path, y->path) || !x->hash)
+			continue;
+
+		if (x->error || y->error || memcmp(x->digest, y->digest, ctx->algo->digest_size))
+			ret = diff_add_result(ctx, DIFF_MODIFIED, x->path, NULL);
+		else if (!diff_same_attribute(&x->f, &y->f))
+			ret = diff_add_result(ctx, DIFF_CHANGED, x->path, NULL);
+	}
+	return ret;
+}
+
+/**
+ * diff_files - compare directory trees
+ * @ctx:        diff context
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ */
+static int diff_files(struct diff_ctx *ctx)
+{
+	int ret;
+	size_t i;
+	struct exfat_info cur = info;
+
+	if (ctx->a.count)
+		qsort(ctx->a.files, ctx->a.count, sizeof(struct diff_file), diff_compare_path);
+	if (ctx->b.count)
+		qsort(ctx->b.files, ctx->b.count, sizeof(struct diff_file), diff_compare_path);
+
+	if ((ret = diff_match_path(ctx)))
+		return ret;
+	if ((ret = diff_match_location(ctx)))
+		return ret;
+
+	if (ctx->data) {
+		if ((ret = diff_match_content(ctx, false)))
+			return ret;
+		ret = diff_hash_image(ctx, &ctx->a);
+		if (!ret)
+			ret = diff_hash_image(ctx, &ctx->b);
+		info = cur;
+		if (ret)
+			return ret;
+		if ((ret = diff_check_hashed(ctx)))
+			return ret;
+		if ((ret = diff_match_content(ctx, true)))
+			return ret;
+	}
+
+	for (i = 0; !ret && i < ctx->a.count; i++)
+		if (!ctx->a.files[i].peer)
+			ret = diff_add_result(ctx, DIFF_REMOVED, ctx->a.files[i].path, NULL);
+	for (i = 0; !ret && i < ctx->b.count; i++)
+		if (!ctx->b.files[i].peer)
+			ret = diff_add_result(ctx, DIFF_ADDED, NULL, ctx->b.files[i].path);
+	return ret;
+}
+
+/**
+ * diff_print - print different files
+ * @ctx:        diff context
+ */
+static void diff_print(struct diff_ctx *ctx)
+{
+	size_t i;
+	size_t counts[DIFF_TYPES] = {0};
+	struct diff_result *r;
+
+	if (ctx->count)
+		qsort(ctx->results, ctx->count, sizeof(struct diff_result), diff_compare_result);
+	for (i = 0; i < ctx->count; i++) {
+		r = &ctx->results[i];
+		counts[r->type]++;
+		if (r->type == DIFF_MOVED)
+			pr_msg("%-9s %s -> %s\n", diff_type_name[r->type], r->from, r->to);
+		else
+			pr_msg("%-9s %s\n", diff_type_name[r->type], r->to ? r->to : r->from);
+	}
+
+	pr_msg("\n");
+	for (i = 0; i < DIFF_TYPES; i++)
+		pr_msg("%-9s: %zu\n", diff_type_name[i], counts[i]);
+}
+
+/**
+ * diff_clean_image - release files in image
+ * @img:              image
+ */
+static void diff_clean_image(struct diff_image *img)
+{
+	size_t i;
+
+	for (i = 0; i < img->count; i++)
+		free(img->files[i].path);
+	free(img->files);
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	bool second = false, differ = false;
+	struct diff_ctx ctx = {0};
+
+	while ((opt = getopt_long(argc, argv,
+					"",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(DIFF_EXIT_TROUBLE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 2) {
+		usage();
+		exit(DIFF_EXIT_TROUBLE);
+	}
+
+	output = stdout;
+	ctx.algo = hash_find_algo(DIFF_HASH_ALGO);
+
+	if ((ret = diff_load(&ctx.b, argv[optind + 1])))
+		goto out;
+	ctx.b.info = info;
+	second = true;
+	if ((ret = diff_load(&ctx.a, argv[optind])))
+		goto out;
+	ctx.a.info = info;
+	ctx.data = !ctx.a.info.meta && !ctx.b.info.meta;
+
+	differ = diff_boot(&ctx) > 0;
+	differ |= diff_tables(&ctx);
+	if ((ret = diff_files(&ctx)))
+		goto out;
+	diff_print(&ctx);
+	differ |= ctx.count > 0;
+
+out:
+	free(ctx.results);
+	diff_clean_image(&ctx.a);
+	diff_clean_image(&ctx.b);
+	exfat_clean_info();
+	if (second) {
+		info = ctx.b.info;
+		exfat_clean_info();
+	}
+	if (ret)
+		return DIFF_EXIT_TROUBLE;
+	return differ ? DIFF_EXIT_DIFFER : DIFF_EXIT_SAME;
+}
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _DIFFEXFAT_H
+#define _DIFFEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "exfat.h"
+#include "hash.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "diffexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+/* Upper limit of one read request */
+#define DIFF_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Hash algorithm to compare file data */
+#define DIFF_HASH_ALGO   "blake3"
+
+/* Exit status (same as diff(1)) */
+#define DIFF_EXIT_SAME    0
+#define DIFF_EXIT_DIFFER  1
+#define DIFF_EXIT_TROUBLE 2
+
+/* Field in boot sector to be compared */
+struct diff_field {
+	const char *name;
+	size_t offset;
+	size_t size;
+};
+
+#define DIFF_BOOT_FIELD(x) \
+	{#x, offsetof(struct exfat_bootsec, x), sizeof(((struct exfat_bootsec *)0)->x)}
+
+enum diff_type {
+	DIFF_ADDED,
+	DIFF_REMOVED,
+	DIFF_MODIFIED,
+	DIFF_CHANGED,
+	DIFF_MOVED,
+	DIFF_TYPES,
+};
+
+struct diff_file {
+	char *path;
+	struct exfat_fileinfo f;
+	/* Same file in the other image */
+	struct diff_file *peer;
+	bool hash;
+	int error;
+	uint8_t digest[HASH_MAX_DIGEST_SIZE];
+};
+
+struct diff_hash {
+	const struct hash_algo *algo;
+	union hash_ctx ctx;
+};
+
+struct diff_image {
+	struct exfat_info info;
+	struct exfat_bootsec boot;
+	struct diff_file *files;
+	size_t count;
+	size_t size;
+};
+
+struct diff_result {
+	enum diff_type type;
+	const char *from;
+	const char *to;
+};
+
+struct diff_ctx {
+	struct diff_image a;
+	struct diff_image b;
+	/* File data can't be compared if either is metadata image */
+	bool data;
+	const struct hash_algo *algo;
+	/* Files to be hashed */
+	struct diff_file **hashes;
+	size_t hash_count;
+	struct diff_result *results;
+	size_t count;
+	size_t size;
+};
+
+#endif /*_DIFFEXFAT_H */
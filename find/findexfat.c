@@ -0,0 +1,661 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <mntent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "findexfat.h"
+#include "exfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+uint8_t flags = 0;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3),
+	GETOPT_NAME_CHAR = (CHAR_MIN - 4),
+	GETOPT_REGEX_CHAR = (CHAR_MIN - 5),
+	GETOPT_SIZE_CHAR = (CHAR_MIN - 6),
+	GETOPT_MTIME_CHAR = (CHAR_MIN - 7),
+	GETOPT_TYPE_CHAR = (CHAR_MIN - 8)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"name", required_argument, NULL, GETOPT_NAME_CHAR},
+	{"regex", required_argument, NULL, GETOPT_REGEX_CHAR},
+	{"size", required_argument, NULL, GETOPT_SIZE_CHAR},
+	{"mtime", required_argument, NULL, GETOPT_MTIME_CHAR},
+	{"type", required_argument, NULL, GETOPT_TYPE_CHAR},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE [PATH]\n", PROGRAM_NAME);
+	fprintf(stderr, "search for files in exFAT directory hierarchy\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -name PATTERN\tfile name matches shell PATTERN (case-insensitive).\n");
+	fprintf(stderr, "  -regex PATTERN\twhole path matches extended regular expression PATTERN (case-insensitive).\n");
+	fprintf(stderr, "  -size [+-]N[cwbkMG]\tfile uses more than, less than or exactly N units (512-byte blocks by default, rounding up).\n");
+	fprintf(stderr, "  -mtime [+-]N\tfile was last modified more than, less than or exactly N*24 hours ago.\n");
+	fprintf(stderr, "  -type f|d\tfile is regular file or directory.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * find_parse_cond - parse numeric condition
+ * @arg:             [+-]N (and unit suffix)
+ * @cond:            numeric condition (Output)
+ * @unit:            whether or not unit suffix (c, w, b, k, M, G) is accepted
+ *
+ * @return           == 0 (success)
+ *                   <  0 (invalid condition)
+ *
+ * NOTE: Same as find(1), N without suffix is counted in 512-byte blocks.
+ */
+static int find_parse_cond(const char *arg, struct find_cond *cond, bool unit)
+{
+	char *end;
+
+	cond->sign = 0;
+	if (*arg == '+' || *arg == '-')
+		cond->sign = (*arg++ == '+') ? 1 : -1;
+	if (!isdigit(*arg))
+		return -EINVAL;
+
+	errno = 0;
+	cond->value = strtoull(arg, &end, 10);
+	if (errno)
+		return -EINVAL;
+
+	cond->unit = 1;
+	if (unit) {
+		switch (*end) {
+			case 'c':
+				end++;
+				break;
+			case 'w':
+				cond->unit = 2;
+				end++;
+				break;
+			case 'G':
+				cond->unit *= 1024;
+				/* FALLTHROUGH */
+			case 'M':
+				cond->unit *= 1024;
+				/* FALLTHROUGH */
+			case 'k':
+				cond->unit *= 1024;
+				end++;
+				break;
+			case 'b':
+				end++;
+				/* FALLTHROUGH */
+			default:
+				cond->unit = FIND_BLOCK_SIZE;
+				break;
+		}
+	}
+
+	return *end ? -EINVAL : 0;
+}
+
+/**
+ * find_compare_cond - check numeric condition
+ * @cond:              numeric condition
+ * @value:             value to be checked
+ *
+ * @return             true (@value satisfies @cond)
+ */
+static bool find_compare_cond(struct find_cond *cond, uint64_t value)
+{
+	value = value / cond->unit + !!(value % cond->unit);
+	if (cond->sign > 0)
+		return value > cond->value;
+	if (cond->sign < 0)
+		return value < cond->value;
+	return value == cond->value;
+}
+
+/**
+ * find_upper_name - convert file name to up-cased UTF-8
+ * @uniname:         file name (UTF-16)
+ * @len:             length of @uniname
+ * @name:            up-cased file name (Output)
+ */
+static void find_upper_name(uint16_t *uniname, size_t len, unsigned char *name)
+{
+	uint16_t upper[MAX_NAME_LENGTH + ENTRY_NAME_MAX];
+
+	exfat_convert_upper_character(uniname, len, upper);
+	exfat_convert_uniname(upper, len, name);
+}
+
+/**
+ * find_upper_path - convert path to up-cased UTF-8
+ * @path:            path
+ *
+ * @return           up-cased path (needs to be released by caller)
+ *                   NULL (failed)
+ */
+static char *find_upper_path(const char *path)
+{
+	int len;
+	size_t size = strlen(path);
+	uint16_t *uniname;
+	char *upper = NULL;
+
+	if ((uniname = calloc(size + 1, sizeof(uint16_t))) == NULL)
+		return NULL;
+	len = utf8s_to_utf16s((unsigned char *)path, size, uniname);
+	if ((upper = malloc(len * UTF8_MAX_CHARSIZE + 1)) != NULL) {
+		exfat_convert_upper_character(uniname, len, uniname);
+		exfat_convert_uniname(uniname, len, (unsigned char *)upper);
+	}
+	free(uniname);
+	return upper;
+}
+
+/**
+ * find_set_pattern - prepare pattern to be matched
+ * @ctx:              find context
+ *
+ * @return            == 0 (success)
+ *                    <  0 (invalid pattern)
+ *
+ * NOTE: exFAT file name is case-insensitive, so both of pattern and name
+ *       are up-cased by Up-case table.
+ *       Literal name (no wildcard) is compared by NameHash and up-cased UTF-16.
+ *       Same as find(1), regular expression must match the whole path.
+ */
+static int find_set_pattern(struct find_ctx *ctx)
+{
+	int i, len, ret;
+	size_t size = strlen(ctx->pattern);
+	uint16_t *uniname;
+	char *regex;
+
+	if ((uniname = calloc(size + 1, sizeof(uint16_t))) == NULL)
+		return -ENOMEM;
+	len = utf8s_to_utf16s((unsigned char *)ctx->pattern, size, uniname);
+	if (size && !len) {
+		pr_err("'%s': invalid pattern.\n", ctx->pattern);
+		free(uniname);
+		return -EINVAL;
+	}
+
+	if (flags & OPTION_REGEX) {
+		/* ASCII is left for REG_ICASE, so that character classes work */
+		for (i = 0; i < len; i++)
+			if (uniname[i] >= 0x80)
+				uniname[i] = exfat_convert_upper(uniname[i]);
+		if ((regex = malloc(len * UTF8_MAX_CHARSIZE + sizeof("^()$"))) == NULL) {
+			free(uniname);
+			return -ENOMEM;
+		}
+		strcpy(regex, "^(");
+		exfat_convert_uniname(uniname, len, (unsigned char *)regex + 2);
+		strcat(regex, ")$");
+		free(uniname);
+		ret = regcomp(&ctx->regex, regex, REG_EXTENDED | REG_NOSUB | REG_ICASE);
+		free(regex);
+		if (ret) {
+			pr_err("'%s': invalid regular expression.\n", ctx->pattern);
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	if (!strpbrk(ctx->pattern, "*?[\\")) {
+		if (!len || len > MAX_NAME_LENGTH) {
+			free(uniname);
+			return -EINVAL;
+		}
+		flags |= OPTION_LITERAL;
+		exfat_convert_upper_character(uniname, len, ctx->literal);
+		ctx->literal_len = len;
+		ctx->literal_hash = exfat_calculate_namehash(ctx->literal, len);
+		free(uniname);
+		return 0;
+	}
+
+	if ((ctx->upper = malloc(size * UTF8_MAX_CHARSIZE + 1)) == NULL) {
+		free(uniname);
+		return -ENOMEM;
+	}
+	exfat_convert_upper_character(uniname, len, uniname);
+	exfat_convert_uniname(uniname, len, ctx->upper);
+	free(uniname);
+	return 0;
+}
+
+/**
+ * find_mtime - obtain last modified time of file
+ * @f:          file information
+ *
+ * @return      seconds since the Epoch
+ *
+ * NOTE: Timestamp is recorded in local time, and UtcOffset is the difference
+ *       from UTC. Timestamp without UtcOffset is regarded as local time.
+ */
+static time_t find_mtime(struct exfat_fileinfo *f)
+{
+	struct tm tm;
+
+	exfat_convert_unixtime(&tm, f->mtime.time, f->mtime.subsec, 0);
+	tm.tm_year += 80;
+	tm.tm_mon -= 1;
+	if (!(f->mtime.tz & 0x80)) {
+		tm.tm_isdst = -1;
+		return mktime(&tm);
+	}
+	return timegm(&tm) - (time_t)exfat_convert_timezone(f->mtime.tz) * 60;
+}
+
+/**
+ * find_match - check whether or not file satisfies all conditions
+ * @ctx:        find context
+ * @f:          file information
+ * @uniname:    file name (UTF-16)
+ *
+ * @return      true (file matches)
+ *
+ * NOTE: Regular expression is matched with path later (see find_entry).
+ */
+static bool find_match(struct find_ctx *ctx, struct exfat_fileinfo *f, uint16_t *uniname)
+{
+	uint16_t upper[MAX_NAME_LENGTH + ENTRY_NAME_MAX];
+	unsigned char name[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE + 1];
+	time_t mtime;
+
+	if ((flags & OPTION_TYPE) && !!(f->attr & ATTR_DIRECTORY) != (ctx->type == 'd'))
+		return false;
+	if ((flags & OPTION_SIZE) && !find_compare_cond(&ctx->size, f->datalen))
+		return false;
+	if (flags & OPTION_MTIME) {
+		mtime = find_mtime(f);
+		if (!find_compare_cond(&ctx->mtime, ctx->now > mtime ? (ctx->now - mtime) / SECONDS_PER_DAY : 0))
+			return false;
+	}
+
+	if (flags & OPTION_LITERAL) {
+		/* Most of files are rejected without converting name */
+		if (f->namelen != ctx->literal_len || f->hash != ctx->literal_hash)
+			return false;
+		exfat_convert_upper_character(uniname, f->namelen, upper);
+		return !memcmp(upper, ctx->literal, f->namelen * sizeof(uint16_t));
+	}
+
+	if (flags & OPTION_NAME) {
+		find_upper_name(uniname, f->namelen, name);
+		return !fnmatch((char *)ctx->upper, (char *)name, 0);
+	}
+
+	return true;
+}
+
+/**
+ * find_append - append item to array
+ * @array:       array
+ * @count:       the number of items
+ * @size:        capacity of @array
+ * @item:        item to be appended
+ * @len:         size of item
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ */
+static int find_append(void **array, size_t *count, size_t *size, const void *item, size_t len)
+{
+	void *tmp;
+
+	if (*count == *size) {
+		tmp = realloc(*array, (*size ? *size * 2 : 64) * len);
+		if (!tmp)
+			return -ENOMEM;
+		*array = tmp;
+		*size = *size ? *size * 2 : 64;
+	}
+	memcpy((char *)*array + *count * len, item, len);
+	(*count)++;
+	return 0;
+}
+
+/* Directory which is read by worker */
+struct find_work {
+	struct find_ctx *ctx;
+	struct find_dir *dir;
+};
+
+/**
+ * find_entry - check one file in directory
+ * @f:          file information
+ * @uniname:    file name (UTF-16)
+ * @arg:        find work
+ *
+ * @return      == 0 (continue reading)
+ *              <  0 (failed)
+ */
+static int find_entry(struct exfat_fileinfo *f, uint16_t *uniname, void *arg)
+{
+	int ret = 0;
+	size_t len;
+	char *path, *upper;
+	struct find_work *w = arg;
+	struct find_ctx *ctx = w->ctx;
+	struct find_dir d;
+	bool match = find_match(ctx, f, uniname);
+	bool dir = (f->attr & ATTR_DIRECTORY) && f->clu;
+
+	if (!match && !dir)
+		return 0;
+
+	len = strlen(w->dir->path) + strlen((char *)f->name) + 2;
+	if ((path = malloc(len)) == NULL)
+		return -ENOMEM;
+	snprintf(path, len, "%s/%s", w->dir->path, f->name);
+
+	if (match && (flags & OPTION_REGEX)) {
+		if ((upper = find_upper_path(path)) == NULL) {
+			free(path);
+			return -ENOMEM;
+		}
+		match = !regexec(&ctx->regex, upper, 0, NULL, 0);
+		free(upper);
+		if (!match && !dir) {
+			free(path);
+			return 0;
+		}
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	if (match && (ret = find_append((void **)&ctx->found, &ctx->found_count, &ctx->found_size, &path, sizeof(char *)))) {
+		match = false;
+		goto out;
+	}
+
+	/* Directory which appears twice (corrupted image) is read only once */
+	if (dir && f->clu <= info.cluster_count + 1 && !get_bitmap(&ctx->visited, f->clu)) {
+		set_bitmap(&ctx->visited, f->clu);
+		d.f = *f;
+		d.f.name = NULL;
+		if ((d.path = match ? strdup(path) : path) == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if ((ret = find_append((void **)&ctx->next, &ctx->next_count, &ctx->next_size, &d, sizeof(d)))) {
+			if (match)
+				free(d.path);
+			goto out;
+		}
+		path = NULL;
+	}
+out:
+	pthread_mutex_unlock(&ctx->lock);
+	if (!match)
+		free(path);
+	return ret;
+}
+
+/**
+ * find_worker - read one directory
+ * @i:           directory index in current depth
+ * @arg:         find context
+ */
+static void find_worker(size_t i, void *arg)
+{
+	int ret;
+	struct find_ctx *ctx = arg;
+	struct find_work w = {ctx, &ctx->dirs[i]};
+
+	if ((ret = exfat_read_directory(&w.dir->f, w.dir->f.clu, find_entry, &w)) < 0) {
+		pthread_mutex_lock(&ctx->lock);
+		ctx->error = ret;
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+/**
+ * find_compare - compare pathes
+ * @a:            path
+ * @b:            path
+ *
+ * @return        order of @a and @b
+ */
+static int find_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * find_tree - search for files under the directory
+ * @ctx:       find context
+ * @path:      path of the directory
+ * @f:         directory information
+ *
+ * @return     == 0 (success)
+ *             <  0 (failed)
+ *
+ * NOTE: Directories in the same depth are read by worker threads at once.
+ */
+static int find_tree(struct find_ctx *ctx, const char *path, struct exfat_fileinfo *f)
+{
+	size_t i;
+	struct find_dir root = {0};
+
+	init_bitmap(&ctx->visited, (size_t)info.cluster_count + EXFAT_FIRST_CLUSTER);
+	if (!ctx->visited.data)
+		return -ENOMEM;
+	set_bitmap(&ctx->visited, f->clu);
+
+	root.f = *f;
+	root.f.name = NULL;
+	if ((root.path = strdup(path)) == NULL)
+		return -ENOMEM;
+	ctx->dirs = &root;
+	ctx->dir_count = 1;
+
+	while (ctx->dir_count && !ctx->error) {
+		exfat_parallel_for(ctx->dir_count, 0, find_worker, ctx);
+
+		for (i = 0; i < ctx->dir_count; i++)
+			free(ctx->dirs[i].path);
+		if (ctx->dirs != &root)
+			free(ctx->dirs);
+
+		ctx->dirs = ctx->next;
+		ctx->dir_count = ctx->next_count;
+		ctx->next = NULL;
+		ctx->next_count = 0;
+		ctx->next_size = 0;
+	}
+
+	for (i = 0; i < ctx->dir_count; i++)
+		free(ctx->dirs[i].path);
+	free(ctx->dirs);
+	free_bitmap(&ctx->visited);
+
+	if (ctx->found_count)
+		qsort(ctx->found, ctx->found_count, sizeof(char *), find_compare);
+	return ctx->error;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	int index;
+	size_t i, len;
+	uint32_t clu;
+	char path[PATHNAME_MAX + 1] = "/";
+	struct exfat_bootsec boot;
+	struct exfat_fileinfo *f;
+	struct find_ctx ctx = {0};
+
+	while ((opt = getopt_long_only(argc, argv,
+					"",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case GETOPT_NAME_CHAR:
+			case GETOPT_REGEX_CHAR:
+				flags |= (opt == GETOPT_NAME_CHAR) ? OPTION_NAME : OPTION_REGEX;
+				flags &= (opt == GETOPT_NAME_CHAR) ? ~OPTION_REGEX : ~OPTION_NAME;
+				ctx.pattern = optarg;
+				break;
+			case GETOPT_SIZE_CHAR:
+				flags |= OPTION_SIZE;
+				if (find_parse_cond(optarg, &ctx.size, true)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case GETOPT_MTIME_CHAR:
+				flags |= OPTION_MTIME;
+				if (find_parse_cond(optarg, &ctx.mtime, false)) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case GETOPT_TYPE_CHAR:
+				flags |= OPTION_TYPE;
+				ctx.type = optarg[0];
+				if ((ctx.type != 'f' && ctx.type != 'd') || optarg[1]) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1 && optind != argc - 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+	exfat_journal_check(argv[optind]);
+	if (optind == argc - 2)
+		strncpy(path, argv[optind + 1], PATHNAME_MAX);
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if ((clu = exfat_lookup(info.root_offset, path)) == 0) {
+		ret = ENOENT;
+		goto out;
+	}
+
+	index = exfat_get_cache(clu);
+	if (!info.root[index]) {
+		pr_err("'%s': Not a directory.\n", path);
+		ret = -ENOTDIR;
+		goto out;
+	}
+	f = (struct exfat_fileinfo *)info.root[index]->data;
+	f->clu = clu;
+
+	if (ctx.pattern && (ret = find_set_pattern(&ctx)))
+		goto out;
+	ctx.now = time(NULL);
+	pthread_mutex_init(&ctx.lock, NULL);
+	exfat_load_fat_table();
+
+	/* Trailing slashes aren't printed twice */
+	for (len = strlen(path); len > 0 && path[len - 1] == '/'; len--)
+		;
+	path[len] = '\0';
+
+	ret = find_tree(&ctx, path, f);
+	for (i = 0; i < ctx.found_count; i++) {
+		pr_msg("%s\n", ctx.found[i]);
+		free(ctx.found[i]);
+	}
+	free(ctx.found);
+	free(ctx.upper);
+	if (flags & OPTION_REGEX)
+		regfree(&ctx.regex);
+	pthread_mutex_destroy(&ctx.lock);
+	if (ret)
+		goto out;
+
+	ret = EXIT_SUCCESS;
+
+out:
+	exfat_clean_info();
+	return ret;
+}
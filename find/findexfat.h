@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _FINDEXFAT_H
+#define _FINDEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <regex.h>
+#include <pthread.h>
+
+#include "exfat.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "findexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+#define OPTION_NAME      (1 << 0)
+#define OPTION_REGEX     (1 << 1)
+#define OPTION_LITERAL   (1 << 2)
+#define OPTION_SIZE      (1 << 3)
+#define OPTION_MTIME     (1 << 4)
+#define OPTION_TYPE      (1 << 5)
+
+#define SECONDS_PER_DAY  (24 * 60 * 60)
+#define FIND_BLOCK_SIZE  512
+
+/* Numeric condition (+N: greater than N, -N: less than N, N: exactly N) */
+struct find_cond {
+	int sign;
+	uint64_t value;
+	/* value is counted in @unit, and rounded up */
+	uint64_t unit;
+};
+
+struct find_dir {
+	char *path;
+	struct exfat_fileinfo f;
+};
+
+struct find_ctx {
+	pthread_mutex_t lock;
+	/* Search conditions */
+	const char *pattern;
+	unsigned char *upper;
+	uint16_t literal[MAX_NAME_LENGTH];
+	uint8_t literal_len;
+	uint16_t literal_hash;
+	regex_t regex;
+	struct find_cond size;
+	struct find_cond mtime;
+	char type;
+	time_t now;
+	/* Directories in current depth and next depth */
+	struct find_dir *dirs;
+	size_t dir_count;
+	struct find_dir *next;
+	size_t next_count;
+	size_t next_size;
+	bitmap_t visited;
+	/* Matched pathes */
+	char **found;
+	size_t found_count;
+	size_t found_size;
+	int error;
+};
+
+#endif /*_FINDEXFAT_H */
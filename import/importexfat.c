@@ -0,0 +1,950 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "importexfat.h"
+#include "exfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE HOSTDIR [PATH]\n", PROGRAM_NAME);
+	fprintf(stderr, "copy host directory tree into directory in exFAT\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * import_fileinfo - convert file in host to file information
+ * @ctx:             import context
+ * @file:            file in host
+ * @f:               file information (Output)
+ */
+static void import_fileinfo(struct import_ctx *ctx, struct import_file *file,
+		struct exfat_fileinfo *f)
+{
+	memset(f, 0, sizeof(struct exfat_fileinfo));
+	f->attr = file->dir ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+	f->flags = ALLOC_POSIBLE | (file->extents == 1 ? ALLOC_NOFATCHAIN : 0);
+	f->clu = file->extents ? ctx->ext[file->ext].clu : 0;
+	f->datalen = file->dir ? (uint64_t)file->clusters * info.cluster_size : file->size;
+	exfat_convert_exfattime(&f->mtime, &file->mtime);
+	exfat_convert_exfattime(&f->atime, &file->atime);
+	f->ctime = f->mtime;
+}
+
+/**
+ * import_compare_name - compare file names in upper-case
+ * @a:                   file name
+ * @b:                   file name
+ *
+ * @return               true (same file name in exFAT)
+ */
+static bool import_compare_name(const char *a, const char *b)
+{
+	int x, y;
+	uint16_t ua[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE];
+	uint16_t ub[MAX_NAME_LENGTH * UTF8_MAX_CHARSIZE];
+
+	x = utf8s_to_utf16s((unsigned char *)a, strlen(a), ua);
+	y = utf8s_to_utf16s((unsigned char *)b, strlen(b), ub);
+	if (x != y)
+		return false;
+	exfat_convert_upper_character(ua, x, ua);
+	exfat_convert_upper_character(ub, y, ub);
+	return !memcmp(ua, ub, x * sizeof(uint16_t));
+}
+
+/* Files in same directory, to be sorted by NameHash */
+static struct import_file *import_sort_files;
+
+/**
+ * import_compare_hash - compare files by NameHash
+ * @a:                   index of file
+ * @b:                   index of file
+ *
+ * @return               order of @a and @b
+ */
+static int import_compare_hash(const void *a, const void *b)
+{
+	const struct import_file *x = &import_sort_files[*(const size_t *)a];
+	const struct import_file *y = &import_sort_files[*(const size_t *)b];
+
+	return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+/**
+ * import_check_names - check that file names are unique in directory
+ * @ctx:                import context
+ * @first:              index of first file in directory
+ * @count:              the number of files in directory
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ *
+ * NOTE: exFAT compares file names in upper-case, so host files whose name is
+ *       only different in case can't be imported to same directory.
+ */
+static int import_check_names(struct import_ctx *ctx, size_t first, size_t count)
+{
+	int ret = 0;
+	size_t i, j, *idx;
+	struct import_file *a, *b;
+
+	if (count < 2)
+		return 0;
+	if ((idx = malloc(count * sizeof(size_t))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < count; i++)
+		idx[i] = first + i;
+	import_sort_files = ctx->files;
+	qsort(idx, count, sizeof(size_t), import_compare_hash);
+
+	for (i = 0; i < count && !ret; i++) {
+		a = &ctx->files[idx[i]];
+		for (j = i + 1; j < count && ctx->files[idx[j]].hash == a->hash; j++) {
+			b = &ctx->files[idx[j]];
+			if (import_compare_name(a->name, b->name)) {
+				pr_err("'%s': File name conflicts with '%s'.\n", b->path, a->path);
+				ret = -EEXIST;
+				break;
+			}
+		}
+	}
+	free(idx);
+	return ret;
+}
+
+/**
+ * import_filter - skip "." and ".." in host directory
+ * @d:             directory entry
+ *
+ * @return         != 0 (entry is scanned)
+ */
+static int import_filter(const struct dirent *d)
+{
+	return strcmp(d->d_name, ".") && strcmp(d->d_name, "..");
+}
+
+/**
+ * import_append_file - append file in host to list
+ * @ctx:                import context
+ * @path:               path in host
+ * @st:                 file status
+ * @parent:             index of parent directory
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ */
+static int import_append_file(struct import_ctx *ctx, char *path, struct stat *st, size_t parent)
+{
+	int ret;
+	struct import_file *f, *tmp;
+	struct exfat_fileinfo fi = {0};
+	struct exfat_dentry set[ENTRY_SET_MAX] = {0};
+
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->files, (ctx->size ? ctx->size * 2 : 256) * sizeof(struct import_file));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->files = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 256;
+	}
+
+	f = &ctx->files[ctx->count];
+	memset(f, 0, sizeof(struct import_file));
+	f->path = path;
+	f->name = strrchr(path, '/') + 1;
+	f->parent = parent;
+	f->dir = S_ISDIR(st->st_mode);
+	f->size = f->dir ? 0 : st->st_size;
+	f->clusters = ROUNDUP(f->size, info.cluster_size);
+	f->mtime = st->st_mtim;
+	f->atime = st->st_atim;
+
+	/* Entry set is built to check file name and to count entries */
+	if ((ret = exfat_init_dentry(set, f->name, &fi)) < 0) {
+		pr_err("'%s': Invalid file name.\n", path);
+		return ret;
+	}
+	f->entries = ret;
+	f->hash = le16_to_cpu(set[1].dentry.stream.NameHash);
+	ctx->count++;
+	return 0;
+}
+
+/**
+ * import_scan - scan host directory recursively
+ * @ctx:         import context
+ * @path:        path of host directory
+ * @parent:      index of host directory (IMPORT_TOP: top directory)
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ *
+ * NOTE: Children of directory are appended to list contiguously, and
+ *       then subdirectories are scanned. Files are sorted by name, so that
+ *       the same host directory is always imported to the same layout.
+ */
+static int import_scan(struct import_ctx *ctx, const char *path, size_t parent)
+{
+	int i, n, ret = 0;
+	size_t j, last, first = ctx->count;
+	uint64_t size = 0;
+	char *child;
+	struct stat st;
+	struct dirent **list;
+
+	if ((n = scandir(path, &list, import_filter, alphasort)) < 0) {
+		ret = -errno;
+		pr_err("scandir '%s': %s\n", path, strerror(-ret));
+		return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (ret)
+			goto next;
+		if ((child = malloc(strlen(path) + strlen(list[i]->d_name) + 2)) == NULL) {
+			ret = -ENOMEM;
+			goto next;
+		}
+		sprintf(child, "%s/%s", path, list[i]->d_name);
+		if (lstat(child, &st)) {
+			ret = -errno;
+			pr_err("lstat '%s': %s\n", child, strerror(-ret));
+			free(child);
+			goto next;
+		}
+		if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+			pr_warn("'%s': Not a regular file or directory, skipped.\n", child);
+			free(child);
+			goto next;
+		}
+		if ((ret = import_append_file(ctx, child, &st, parent)))
+			free(child);
+next:
+		free(list[i]);
+	}
+	free(list);
+	if (ret)
+		return ret;
+
+	if (parent == IMPORT_TOP) {
+		ctx->top = ctx->count;
+	} else {
+		ctx->files[parent].child = first;
+		ctx->files[parent].children = ctx->count - first;
+		for (j = first; j < ctx->count; j++)
+			size += ctx->files[j].entries * sizeof(struct exfat_dentry);
+		/* Empty directory also has one cluster */
+		ctx->files[parent].size = size;
+		ctx->files[parent].clusters = MAX(ROUNDUP(size, info.cluster_size), 1);
+	}
+	if ((ret = import_check_names(ctx, first, ctx->count - first)))
+		return ret;
+
+	/* Children of subdirectories are appended after ours */
+	last = ctx->count;
+	for (j = first; j < last; j++)
+		if (ctx->files[j].dir && (ret = import_scan(ctx, ctx->files[j].path, j)))
+			return ret;
+	return 0;
+}
+
+/**
+ * import_collect_free - append free extent to list
+ * @clu:                 first cluster of free extent
+ * @len:                 the number of clusters
+ * @arg:                 import context
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int import_collect_free(uint32_t clu, uint32_t len, void *arg)
+{
+	struct import_ctx *ctx = arg;
+	struct import_extent *tmp;
+
+	if (ctx->space_count == ctx->space_size) {
+		tmp = realloc(ctx->space,
+				(ctx->space_size ? ctx->space_size * 2 : 64) * sizeof(struct import_extent));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->space = tmp;
+		ctx->space_size = ctx->space_size ? ctx->space_size * 2 : 64;
+	}
+	ctx->space[ctx->space_count].clu = clu;
+	ctx->space[ctx->space_count].len = len;
+	ctx->space_count++;
+	ctx->free += len;
+	return 0;
+}
+
+/**
+ * import_compare_extent - compare extents by length (smaller first)
+ * @a:                     extent
+ * @b:                     extent
+ *
+ * @return                 order of @a and @b
+ */
+static int import_compare_extent(const void *a, const void *b)
+{
+	const struct import_extent *x = a;
+	const struct import_extent *y = b;
+
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	return x->clu < y->clu ? -1 : x->clu > y->clu;
+}
+
+/**
+ * import_compare_extent_clu - compare extents by first cluster
+ * @a:                         extent
+ * @b:                         extent
+ *
+ * @return                     order of @a and @b
+ */
+static int import_compare_extent_clu(const void *a, const void *b)
+{
+	const struct import_extent *x = a;
+	const struct import_extent *y = b;
+
+	return x->clu < y->clu ? -1 : x->clu > y->clu;
+}
+
+/* Files to be allocated, to be sorted by the number of clusters */
+static struct import_file *import_alloc_files;
+
+/**
+ * import_compare_clusters - compare files by the number of clusters (larger first)
+ * @a:                       index of file
+ * @b:                       index of file
+ *
+ * @return                   order of @a and @b
+ */
+static int import_compare_clusters(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+	uint32_t cx = import_alloc_files[x].clusters, cy = import_alloc_files[y].clusters;
+
+	if (cx != cy)
+		return cx > cy ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * import_take_space - allocate clusters from free extent
+ * @ctx:               import context
+ * @i:                 index of free extent
+ * @len:               the number of clusters
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ *
+ * NOTE: Clusters are taken from the head of extent, and the rest of extent
+ *       is moved so that free extents are kept sorted.
+ */
+static int import_take_space(struct import_ctx *ctx, size_t i, uint32_t len)
+{
+	size_t lo = 0, hi = i, mid;
+	struct import_extent rest, *tmp;
+
+	if (ctx->ext_count == ctx->ext_size) {
+		tmp = realloc(ctx->ext,
+				(ctx->ext_size ? ctx->ext_size * 2 : 256) * sizeof(struct import_extent));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->ext = tmp;
+		ctx->ext_size = ctx->ext_size ? ctx->ext_size * 2 : 256;
+	}
+	ctx->ext[ctx->ext_count].clu = ctx->space[i].clu;
+	ctx->ext[ctx->ext_count].len = len;
+	ctx->ext_count++;
+
+	rest.clu = ctx->space[i].clu + len;
+	rest.len = ctx->space[i].len - len;
+	if (!rest.len) {
+		memmove(ctx->space + i, ctx->space + i + 1,
+				(ctx->space_count - i - 1) * sizeof(struct import_extent));
+		ctx->space_count--;
+		return 0;
+	}
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (import_compare_extent(&ctx->space[mid], &rest) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(ctx->space + lo + 1, ctx->space + lo, (i - lo) * sizeof(struct import_extent));
+	ctx->space[lo] = rest;
+	return 0;
+}
+
+/**
+ * import_plan - decide clusters of all files before writing
+ * @ctx:         import context
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ *
+ * NOTE: Larger files are allocated first, and the smallest free extent which
+ *       can hold whole file is used (best fit), so that file can be NoFatChain.
+ *       If there is no such extent, file is split into the largest extents.
+ */
+static int import_plan(struct import_ctx *ctx)
+{
+	int ret;
+	size_t i, j, lo, hi, mid, count = 0, *order;
+	uint32_t need;
+	uint64_t total = 0;
+	struct import_file *f;
+
+	if ((ret = exfat_scan_free_extents(import_collect_free, ctx)) < 0)
+		return ret;
+	qsort(ctx->space, ctx->space_count, sizeof(struct import_extent), import_compare_extent);
+
+	if ((order = malloc(MAX(ctx->count, 1) * sizeof(size_t))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < ctx->count; i++) {
+		if (!ctx->files[i].clusters)
+			continue;
+		order[count++] = i;
+		total += ctx->files[i].clusters;
+	}
+	if (total > ctx->free) {
+		pr_err("No space left on image. (Expect: %" PRIu64 ", Actual: %" PRIu64 " clusters)\n",
+				total, ctx->free);
+		ret = -ENOSPC;
+		goto out;
+	}
+	import_alloc_files = ctx->files;
+	qsort(order, count, sizeof(size_t), import_compare_clusters);
+
+	for (i = 0; i < count; i++) {
+		f = &ctx->files[order[i]];
+		f->ext = ctx->ext_count;
+		need = f->clusters;
+
+		lo = 0;
+		hi = ctx->space_count;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (ctx->space[mid].len < need)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < ctx->space_count) {
+			if ((ret = import_take_space(ctx, lo, need)))
+				goto out;
+			f->extents = 1;
+			continue;
+		}
+
+		while (need) {
+			j = ctx->space_count - 1;
+			f->extents++;
+			if (ctx->space[j].len > need) {
+				ret = import_take_space(ctx, j, need);
+				need = 0;
+			} else {
+				need -= ctx->space[j].len;
+				ret = import_take_space(ctx, j, ctx->space[j].len);
+			}
+			if (ret)
+				goto out;
+		}
+	}
+
+	if ((ctx->data = malloc(MAX(count, 1) * sizeof(size_t))) == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < ctx->count; i++)
+		if (!ctx->files[i].dir && ctx->files[i].clusters)
+			ctx->data[ctx->data_count++] = i;
+out:
+	free(order);
+	return ret;
+}
+
+/**
+ * import_fill - read from host file until buffer is filled
+ * @fd:          host file descriptor
+ * @buf:         buffer (Output)
+ * @len:         buffer length
+ *
+ * @return       >= 0 (read bytes, less than @len at the end of file)
+ *               <  0 (failed)
+ */
+static ssize_t import_fill(int fd, uint8_t *buf, size_t len)
+{
+	ssize_t n;
+	size_t got = 0;
+
+	while (got < len) {
+		if ((n = read(fd, buf + got, len - got)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!n)
+			break;
+		got += n;
+	}
+	return got;
+}
+
+/**
+ * import_copy - copy host file to allocated clusters
+ * @f:           file in host
+ * @ext:         allocated extents
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ */
+static int import_copy(struct import_file *f, struct import_extent *ext)
+{
+	int fd, ret = 0;
+	size_t i, len;
+	uint32_t off, n, batch;
+	uint64_t remain = f->size;
+	ssize_t got;
+	void *buf;
+
+	batch = MIN(MAX(IMPORT_BATCH_SIZE / info.cluster_size, 1), f->clusters);
+	if ((fd = open(f->path, O_RDONLY)) < 0)
+		return -errno;
+	if ((ret = posix_memalign(&buf, info.sector_size, (size_t)batch * info.cluster_size))) {
+		close(fd);
+		return -ret;
+	}
+
+	for (i = 0; i < f->extents && !ret; i++) {
+		for (off = 0; off < ext[i].len; off += n) {
+			n = MIN(batch, ext[i].len - off);
+			len = MIN(remain, (uint64_t)n * info.cluster_size);
+			if ((got = import_fill(fd, buf, len)) < 0) {
+				ret = got;
+				break;
+			}
+			/* File was truncated after scanning */
+			if (got < len) {
+				ret = -EIO;
+				break;
+			}
+			/* The last cluster is filled with zero */
+			memset((uint8_t *)buf + got, 0, (size_t)n * info.cluster_size - got);
+			if ((ret = set_clusters(buf, ext[i].clu + off, n)))
+				break;
+			remain -= got;
+		}
+	}
+
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+/**
+ * import_worker - copy one host file (worker of exfat_parallel_for)
+ * @i:             index of file which has data
+ * @arg:           import context
+ *
+ * NOTE: Each file has its own clusters, so workers never write the same cluster.
+ */
+static void import_worker(size_t i, void *arg)
+{
+	struct import_ctx *ctx = arg;
+	struct import_file *f = &ctx->files[ctx->data[i]];
+
+	f->error = import_copy(f, ctx->ext + f->ext);
+}
+
+/**
+ * import_data - copy data of all host files
+ * @ctx:         import context
+ *
+ * @return       == 0 (success)
+ *               <  0 (failed)
+ *
+ * NOTE: Data is written before the clusters are allocated, so the image
+ *       isn't changed by interrupted import.
+ */
+static int import_data(struct import_ctx *ctx)
+{
+	int ret = 0;
+	size_t i;
+	struct import_file *f;
+
+	exfat_parallel_for(ctx->data_count, 0, import_worker, ctx);
+
+	for (i = 0; i < ctx->data_count; i++) {
+		f = &ctx->files[ctx->data[i]];
+		if (f->error) {
+			pr_err("'%s': Can't copy file data. (%s)\n", f->path, strerror(-f->error));
+			ret = f->error;
+		}
+	}
+	if (!ret && ctx->data_count)
+		fsync(info.fd);
+	return ret;
+}
+
+/**
+ * import_set_bitmap - set allocation bitmap for all allocated extents
+ * @ctx:               import context
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ *
+ * NOTE: Files are allocated from the head of free extents, so that
+ *       allocated extents are merged before updating bitmap.
+ */
+static int import_set_bitmap(struct import_ctx *ctx)
+{
+	int ret = 0;
+	size_t i, n = 0;
+	struct import_extent *ext;
+
+	if (!ctx->ext_count)
+		return 0;
+	if ((ext = malloc(ctx->ext_count * sizeof(struct import_extent))) == NULL)
+		return -ENOMEM;
+	memcpy(ext, ctx->ext, ctx->ext_count * sizeof(struct import_extent));
+	qsort(ext, ctx->ext_count, sizeof(struct import_extent), import_compare_extent_clu);
+
+	for (i = 1; i < ctx->ext_count; i++) {
+		if (ext[n].clu + ext[n].len == ext[i].clu)
+			ext[n].len += ext[i].len;
+		else
+			ext[++n] = ext[i];
+	}
+	for (i = 0; i <= n && !ret; i++)
+		ret = exfat_save_bitmap_range(ext[i].clu, ext[i].len, 1);
+	free(ext);
+	return ret;
+}
+
+/**
+ * import_set_chain - set FAT chain of fragmented file
+ * @ext:              allocated extents
+ * @count:            the number of extents
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ */
+static int import_set_chain(struct import_extent *ext, size_t count)
+{
+	int ret;
+	size_t i;
+	uint32_t j, clu;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < ext[i].len; j++) {
+			clu = ext[i].clu + j;
+			if (j + 1 < ext[i].len)
+				ret = exfat_set_fat(clu, clu + 1);
+			else if (i + 1 < count)
+				ret = exfat_set_fat(clu, ext[i + 1].clu);
+			else
+				ret = exfat_set_fat(clu, EXFAT_LASTCLUSTER);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * import_build_sets - build entry sets of files
+ * @ctx:               import context
+ * @first:             index of first file
+ * @count:             the number of files
+ * @set:               entry sets (Output, must be filled with zero)
+ *
+ * @return             the number of entries in @set
+ */
+static size_t import_build_sets(struct import_ctx *ctx, size_t first, size_t count,
+		struct exfat_dentry *set)
+{
+	size_t i, pos = 0;
+	struct exfat_fileinfo f;
+
+	for (i = first; i < first + count; i++) {
+		import_fileinfo(ctx, &ctx->files[i], &f);
+		pos += exfat_init_dentry(set + pos, ctx->files[i].name, &f);
+	}
+	return pos;
+}
+
+/**
+ * import_write_directory - write entry sets of children to new directory
+ * @ctx:                    import context
+ * @dir:                    new directory
+ *
+ * @return                  == 0 (success)
+ *                          <  0 (failed)
+ */
+static int import_write_directory(struct import_ctx *ctx, struct import_file *dir)
+{
+	int ret = 0;
+	size_t i;
+	uint8_t *data, *p;
+	struct import_extent *ext = ctx->ext + dir->ext;
+
+	if ((data = calloc(dir->clusters, info.cluster_size)) == NULL)
+		return -ENOMEM;
+	import_build_sets(ctx, dir->child, dir->children, (struct exfat_dentry *)data);
+
+	for (i = 0, p = data; i < dir->extents && !ret; i++) {
+		ret = set_clusters(p, ext[i].clu, ext[i].len);
+		p += (size_t)ext[i].len * info.cluster_size;
+	}
+	free(data);
+	return ret;
+}
+
+/**
+ * import_commit - allocate clusters and create directory entries
+ * @ctx:           import context
+ *
+ * @return         == 0 (success)
+ *                 <  0 (failed)
+ *
+ * NOTE: Allocation Bitmap, FAT, new directories and entry sets in destination
+ *       are written at once by transaction.
+ */
+static int import_commit(struct import_ctx *ctx)
+{
+	int ret;
+	size_t i, entries = 0;
+	struct exfat_dentry *set = NULL;
+	struct import_file *f;
+
+	if ((ret = exfat_trans_begin()))
+		return ret;
+
+	if ((ret = import_set_bitmap(ctx)))
+		goto abort;
+
+	for (i = 0; i < ctx->count; i++) {
+		f = &ctx->files[i];
+		if (f->extents > 1 && (ret = import_set_chain(ctx->ext + f->ext, f->extents)))
+			goto abort;
+		if (f->dir && (ret = import_write_directory(ctx, f)))
+			goto abort;
+	}
+
+	for (i = 0; i < ctx->top; i++)
+		entries += ctx->files[i].entries;
+	if ((set = calloc(entries, sizeof(struct exfat_dentry))) == NULL) {
+		ret = -ENOMEM;
+		goto abort;
+	}
+	import_build_sets(ctx, 0, ctx->top, set);
+	if ((ret = exfat_create_dentries(ctx->dir, set, entries)))
+		goto abort;
+
+	free(set);
+	return exfat_trans_commit();
+abort:
+	free(set);
+	exfat_trans_abort();
+	return ret;
+}
+
+/**
+ * import_run - copy host directory tree into directory
+ * @host:       path of host directory
+ * @path:       directory path in exFAT
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ */
+static int import_run(const char *host, const char *path)
+{
+	int ret;
+	size_t i, len;
+	char *buf = NULL;
+	struct stat st;
+	struct import_ctx ctx = {0};
+
+	if (stat(host, &st)) {
+		ret = -errno;
+		pr_err("stat '%s': %s\n", host, strerror(-ret));
+		return ret;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		pr_err("'%s': Not a directory.\n", host);
+		return -ENOTDIR;
+	}
+
+	/* Trailing slashes are ignored */
+	if ((buf = strdup(path)) == NULL)
+		return -ENOMEM;
+	for (len = strlen(buf); len > 0 && buf[len - 1] == '/'; len--)
+		buf[len - 1] = '\0';
+
+	if ((ret = exfat_load_fat_table()) < 0)
+		goto out;
+	if (!(ctx.dir = *buf ? exfat_lookup(info.root_offset, buf) : info.root_offset)) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (!exfat_check_cache(ctx.dir)) {
+		pr_err("'%s': Not a directory.\n", path);
+		ret = -ENOTDIR;
+		goto out;
+	}
+	if ((ret = exfat_traverse_directory(ctx.dir)))
+		goto out;
+
+	if ((ret = import_scan(&ctx, host, IMPORT_TOP)))
+		goto out;
+	for (i = 0; i < ctx.top; i++) {
+		if (exfat_find_dentry(ctx.dir, ctx.files[i].name)) {
+			pr_err("'%s': File exists.\n", ctx.files[i].name);
+			ret = -EEXIST;
+			goto out;
+		}
+	}
+	if (!ctx.top)
+		goto out;
+
+	if ((ret = import_plan(&ctx)))
+		goto out;
+	if ((ret = import_data(&ctx)))
+		goto out;
+	ret = import_commit(&ctx);
+out:
+	for (i = 0; i < ctx.count; i++)
+		free(ctx.files[i].path);
+	free(ctx.files);
+	free(ctx.space);
+	free(ctx.ext);
+	free(ctx.data);
+	free(buf);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	struct exfat_bootsec boot;
+
+	while ((opt = getopt_long(argc, argv,
+					"",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 2 && optind != argc - 3) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDWR)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_journal_init(argv[optind]))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if (import_run(argv[optind + 1], optind == argc - 3 ? argv[optind + 2] : "/"))
+		goto out;
+
+	ret = EXIT_SUCCESS;
+out:
+	exfat_clean_info();
+	return ret;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _IMPORTEXFAT_H
+#define _IMPORTEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "exfat.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "importexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+/* Size of one write request (multiple of cluster size) */
+#define IMPORT_BATCH_SIZE (8 * 1024 * 1024)
+
+/* Parent of file in top of host directory */
+#define IMPORT_TOP        SIZE_MAX
+
+struct import_extent {
+	uint32_t clu;
+	uint32_t len;
+};
+
+struct import_file {
+	/* Path in host */
+	char *path;
+	/* File name (points into @path) */
+	const char *name;
+	size_t parent;
+	bool dir;
+	/* Children of directory are files[child, child + children) */
+	size_t child;
+	size_t children;
+	/* The number of entries in entry set */
+	size_t entries;
+	uint16_t hash;
+	/* File: data size, Directory: size of entry sets */
+	uint64_t size;
+	uint32_t clusters;
+	struct timespec mtime;
+	struct timespec atime;
+	/* Allocated clusters are ext[ext, ext + extents) in context */
+	size_t ext;
+	size_t extents;
+	int error;
+};
+
+struct import_ctx {
+	/* Destination */
+	uint32_t dir;
+	struct import_file *files;
+	size_t count;
+	size_t size;
+	/* Files in top of host directory are files[0, top) */
+	size_t top;
+	/* Free extents (sorted by length) */
+	struct import_extent *space;
+	size_t space_count;
+	size_t space_size;
+	uint64_t free;
+	/* Allocated extents */
+	struct import_extent *ext;
+	size_t ext_count;
+	size_t ext_size;
+	/* Regular files which have data */
+	size_t *data;
+	size_t data_count;
+};
+
+#endif /*_IMPORTEXFAT_H */
@@ -18,6 +18,8 @@
 
 #include "lsexfat.h"
 #include "exfat.h"
+#include "index.h"
+#include "trans.h"
 
 FILE *output;
 unsigned int print_level = PRINT_WARNING;
@@ -36,6 +38,7 @@ enum
 /* option data {"long name", needs argument, flags, "short name"} */
 static struct option const longopts[] =
 {
+	{"index", no_argument, NULL, 'i'},
 	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
 	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
 	{0,0,0,0}
@@ -52,6 +55,7 @@ static void usage(void)
 
 	fprintf(stderr, "  --c\t\tshow CreateTimestamp.\n");
 	fprintf(stderr, "  --u\t\tshow LastAccessdTimestamp.\n");
+	fprintf(stderr, "  -i, --index\tuse (or create) index IMAGE.idx.\n");
 	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
 	fprintf(stderr, "  --version\toutput version information and exit.\n");
 	fprintf(stderr, "\n");
@@ -83,11 +87,11 @@ static int exfat_print_dentry(struct exfat_fileinfo *f)
 	struct tm time;
 
 	if (flags & OPTION_ATIME)
-		time = f->atime;
+		exfat_convert_timestamp(&time, &f->atime);
 	else if (flags & OPTION_CTIME)
-		time = f->ctime;
+		exfat_convert_timestamp(&time, &f->ctime);
 	else
-		time = f->mtime;
+		exfat_convert_timestamp(&time, &f->mtime);
 
 	ro = f->attr & ATTR_READ_ONLY ? 'R' : '-';
 	hidden = f->attr & ATTR_HIDDEN ? 'H' : '-';
@@ -177,12 +181,15 @@ int main(int argc, char *argv[])
 	char *path = NULL;
 
 	while ((opt = getopt_long(argc, argv,
-					"cu",
+					"ciu",
 					longopts, &longindex)) != -1) {
 		switch (opt) {
 			case 'c':
 				flags |= OPTION_ATIME;
 				break;
+			case 'i':
+				flags |= OPTION_INDEX;
+				break;
 			case 'u':
 				flags |= OPTION_CTIME;
 				break;
@@ -200,6 +207,7 @@ int main(int argc, char *argv[])
 
 #ifdef EXFAT_DEBUG
 	print_level = PRINT_DEBUG;
+	print_ring_setup();
 #endif
 
 	if (optind != argc - 2) {
@@ -216,14 +224,19 @@ int main(int argc, char *argv[])
 		ret = -EIO;
 		goto out;
 	}
+	exfat_journal_check(argv[optind]);
 	path = argv[optind + 1];
 
 	if (exfat_load_bootsec(&boot))
 		goto out;
 	if (exfat_store_info(&boot))
 		goto out;
-	if (exfat_traverse_root_directory())
+	if (flags & OPTION_INDEX) {
+		if (exfat_index_open(argv[optind]))
+			goto out;
+	} else if (exfat_traverse_root_directory()) {
 		goto out;
+	}
 	if ((clu = exfat_lookup(info.root_offset, path)) == 0) {
 		ret = ENOENT;
 		goto out;
@@ -22,5 +22,6 @@
 
 #define OPTION_CTIME     (1 << 0)
 #define OPTION_ATIME     (1 << 1)
+#define OPTION_INDEX     (1 << 2)
 
 #endif /*_LSEXFAT_H */
@@ -18,6 +18,9 @@
 
 #include "statexfat.h"
 #include "exfat.h"
+#include "index.h"
+#include "thread.h"
+#include "trans.h"
 
 FILE *output;
 unsigned int print_level = PRINT_WARNING;
@@ -35,6 +38,8 @@ enum
 /* option data {"long name", needs argument, flags, "short name"} */
 static struct option const longopts[] =
 {
+	{"fragment", no_argument, NULL, 'f'},
+	{"index", no_argument, NULL, 'i'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
 	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
@@ -47,9 +52,12 @@ static struct option const longopts[] =
 static void usage(void)
 {
 	fprintf(stderr, "Usage: %s [OPTION]... IMAGE FILE\n", PROGRAM_NAME);
+	fprintf(stderr, "  or:  %s -f IMAGE\n", PROGRAM_NAME);
 	fprintf(stderr, "display file status in exFAT\n");
 	fprintf(stderr, "\n");
 
+	fprintf(stderr, "  -f, --fragment\treport fragmentation of all files.\n");
+	fprintf(stderr, "  -i, --index\tuse (or create) index IMAGE.idx.\n");
 	fprintf(stderr, "  -v, --verbose\tVersion mode.\n");
 	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
 	fprintf(stderr, "  --version\toutput version information and exit.\n");
@@ -94,7 +102,8 @@ static struct exfat_fileinfo *exfat_get_fileinfo(uint32_t clu, int index, char *
 
 	if ((p_clu = exfat_lookup(info.root_offset, path)) == 0)
 		return NULL;
-	tmp = info.root[exfat_get_cache(p_clu)];
+	index = exfat_get_cache(p_clu);
+	tmp = info.root[index];
 
 	while (tmp->next != NULL) {
 		tmp = tmp->next;
@@ -141,6 +150,174 @@ double exfat_calculate_fragment(struct exfat_fileinfo *f)
 	return (double)weight / cluster_num;
 }
 
+/* Results shared by fragmentation workers */
+static uint64_t fragment_hist[FRAGMENT_HIST_SIZE];
+
+/* File list collected by exfat_walk_tree() */
+struct exfat_fragment_list {
+	struct exfat_fragment *list;
+	size_t count;
+};
+
+/**
+ * exfat_collect_file - append file to list
+ * @f:                  file information
+ * @node:               cache node
+ * @path:               file path
+ * @arg:                file list
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ */
+static int exfat_collect_file(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	struct exfat_fragment_list *fl = arg;
+	struct exfat_fragment *l;
+
+	/* Expand list by power of two */
+	if (!(fl->count & (fl->count - 1))) {
+		l = realloc(fl->list, (fl->count ? fl->count * 2 : 1) * sizeof(struct exfat_fragment));
+		if (!l)
+			return -ENOMEM;
+		fl->list = l;
+	}
+
+	l = &fl->list[fl->count];
+	l->f = f;
+	l->clusters = l->extents = 0;
+	if ((l->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	fl->count++;
+	return 0;
+}
+
+/**
+ * exfat_fragment_worker - count extents in the file
+ * @i:                     index of the file
+ * @arg:                   file list
+ *
+ * NOTE: Extents length is accumulated to fragment_hist.
+ */
+static void exfat_fragment_worker(size_t i, void *arg)
+{
+	struct exfat_fragment *l = &((struct exfat_fragment *)arg)[i];
+	struct exfat_fileinfo *f = l->f;
+	uint64_t hist[FRAGMENT_HIST_SIZE] = {0};
+	uint64_t n, run = 1;
+	uint32_t clu = f->clu, next;
+	int bucket;
+
+	l->clusters = ROUNDUP(f->datalen, info.cluster_size);
+	if (!l->clusters || !clu)
+		return;
+
+	if (f->flags & ALLOC_NOFATCHAIN) {
+		run = l->clusters;
+	} else {
+		for (n = 1; n < l->clusters; n++, clu = next) {
+			if (exfat_get_fat(clu, &next))
+				break;
+			if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1)
+				break;
+			if (next == clu + 1) {
+				run++;
+				continue;
+			}
+			bucket = MIN(63 - __builtin_clzll(run), FRAGMENT_HIST_SIZE - 1);
+			hist[bucket]++;
+			l->extents++;
+			run = 1;
+		}
+	}
+	bucket = MIN(63 - __builtin_clzll(run), FRAGMENT_HIST_SIZE - 1);
+	hist[bucket]++;
+	l->extents++;
+
+	for (bucket = 0; bucket < FRAGMENT_HIST_SIZE; bucket++)
+		if (hist[bucket])
+			__atomic_fetch_add(&fragment_hist[bucket], hist[bucket], __ATOMIC_RELAXED);
+}
+
+/**
+ * exfat_compare_fragment - compare function to sort by extents
+ * @a:                      file a
+ * @b:                      file b
+ */
+static int exfat_compare_fragment(const void *a, const void *b)
+{
+	const struct exfat_fragment *x = a, *y = b;
+
+	if (x->extents != y->extents)
+		return x->extents < y->extents ? 1 : -1;
+	if (x->clusters != y->clusters)
+		return x->clusters > y->clusters ? 1 : -1;
+	return strcmp(x->path, y->path);
+}
+
+/**
+ * exfat_report_fragment - print fragmentation of all files in exFAT
+ *
+ * @return                 == 0 (success)
+ *                         <  0 (failed)
+ */
+static int exfat_report_fragment(void)
+{
+	int ret;
+	size_t i, count, fragmented = 0;
+	uint64_t extents = 0, clusters = 0;
+	struct exfat_fragment *list;
+	struct exfat_fragment_list fl = {NULL, 0};
+
+	if ((ret = exfat_load_fat_table()) < 0)
+		return ret;
+
+	ret = exfat_walk_tree(exfat_collect_file, &fl);
+	list = fl.list;
+	count = fl.count;
+	if (ret < 0)
+		goto out;
+
+	exfat_parallel_for(count, 0, exfat_fragment_worker, list);
+
+	for (i = 0; i < count; i++) {
+		extents += list[i].extents;
+		clusters += list[i].clusters;
+		if (list[i].extents > 1)
+			fragmented++;
+	}
+
+	pr_msg("%-16s: %zu\n", "Files", count);
+	pr_msg("%-16s: %zu (%.2lf%%)\n", "Fragmented", fragmented,
+			count ? (double)fragmented * 100 / count : 0);
+	pr_msg("%-16s: %" PRIu64 "\n", "Clusters", clusters);
+	pr_msg("%-16s: %" PRIu64 "\n", "Extents", extents);
+	pr_msg("\n");
+
+	pr_msg("Extent length (clusters):\n");
+	for (i = 0; i < FRAGMENT_HIST_SIZE; i++) {
+		if (!fragment_hist[i])
+			continue;
+		pr_msg("  %10" PRIu64 " - %10" PRIu64 ": %" PRIu64 "\n",
+				(uint64_t)1 << i, ((uint64_t)1 << (i + 1)) - 1, fragment_hist[i]);
+	}
+	pr_msg("\n");
+
+	qsort(list, count, sizeof(struct exfat_fragment), exfat_compare_fragment);
+	pr_msg("Most fragmented files:\n");
+	pr_msg("  %8s %8s %9s  %s\n", "Extents", "Clusters", "Fragment", "Path");
+	for (i = 0; i < count && i < FRAGMENT_WORST && list[i].extents > 1; i++)
+		pr_msg("  %8" PRIu64 " %8" PRIu64 " %8.2lf%%  %s\n",
+				list[i].extents, list[i].clusters,
+				(double)(list[i].extents - 1) * 100 / list[i].clusters,
+				list[i].path);
+
+out:
+	for (i = 0; i < count; i++)
+		free(list[i].path);
+	free(list);
+	return ret;
+}
+
 /**
  * exfat_stat_file - print file status in exFAT
  * @f:               file information
@@ -148,6 +325,12 @@ double exfat_calculate_fragment(struct exfat_fileinfo *f)
  */
 void exfat_stat_file(struct exfat_fileinfo *f)
 {
+	struct tm atm, mtm, ctm;
+
+	exfat_convert_timestamp(&atm, &f->atime);
+	exfat_convert_timestamp(&mtm, &f->mtime);
+	exfat_convert_timestamp(&ctm, &f->ctime);
+
 	pr_msg("%-8s: %s\n", "File", f->name);
 	pr_msg("%-8s: %" PRIu64 "\n", "Size", f->datalen);
 	pr_msg("%-8s: %" PRIu64" \n", "Cluster", ROUNDUP(f->datalen, info.cluster_size));
@@ -170,14 +353,14 @@ void exfat_stat_file(struct exfat_fileinfo *f)
 			f->flags & ALLOC_POSIBLE ? "AllocationPossible" : "AllocationImpossible");
 
 	pr_msg("%-8s: %02d-%02d-%02d %02d:%02d:%02d\n", "Access",
-			1980 + f->atime.tm_year, f->atime.tm_mon, f->atime.tm_mday,
-			f->atime.tm_hour, f->atime.tm_min, f->atime.tm_sec);
+			1980 + atm.tm_year, atm.tm_mon, atm.tm_mday,
+			atm.tm_hour, atm.tm_min, atm.tm_sec);
 	pr_msg("%-8s: %02d-%02d-%02d %02d:%02d:%02d\n", "Modify",
-			1980 + f->mtime.tm_year, f->mtime.tm_mon, f->mtime.tm_mday,
-			f->mtime.tm_hour, f->mtime.tm_min, f->mtime.tm_sec);
+			1980 + mtm.tm_year, mtm.tm_mon, mtm.tm_mday,
+			mtm.tm_hour, mtm.tm_min, mtm.tm_sec);
 	pr_msg("%-8s: %02d-%02d-%02d %02d:%02d:%02d\n", "Create",
-			1980 + f->ctime.tm_year, f->ctime.tm_mon, f->ctime.tm_mday,
-			f->ctime.tm_hour, f->ctime.tm_min, f->ctime.tm_sec);
+			1980 + ctm.tm_year, ctm.tm_mon, ctm.tm_mday,
+			ctm.tm_hour, ctm.tm_min, ctm.tm_sec);
 	pr_msg("\n");
 }
 
@@ -198,9 +381,15 @@ int main(int argc, char *argv[])
 	struct exfat_fileinfo *f;
 
 	while ((opt = getopt_long(argc, argv,
-					"v",
+					"fiv",
 					longopts, &longindex)) != -1) {
 		switch (opt) {
+			case 'f':
+				flags |= OPTION_FRAGMENT;
+				break;
+			case 'i':
+				flags |= OPTION_INDEX;
+				break;
 			case 'v':
 				flags |= OPTION_VERBOSE;
 				break;
@@ -218,9 +407,10 @@ int main(int argc, char *argv[])
 
 #ifdef EXFAT_DEBUG
 	print_level = PRINT_DEBUG;
+	print_ring_setup();
 #endif
 
-	if (optind != argc - 2) {
+	if (optind != argc - ((flags & OPTION_FRAGMENT) ? 1 : 2)) {
 		usage();
 		exit(EXIT_FAILURE);
 	}
@@ -234,14 +424,27 @@ int main(int argc, char *argv[])
 		ret = -EIO;
 		goto out;
 	}
+	exfat_journal_check(argv[optind]);
 	path = argv[optind + 1];
 
 	if (exfat_load_bootsec(&boot))
 		goto out;
 	if (exfat_store_info(&boot))
 		goto out;
-	if (exfat_traverse_root_directory())
+	if (flags & OPTION_INDEX) {
+		if (exfat_index_open(argv[optind]))
+			goto out;
+	} else if (exfat_traverse_root_directory()) {
 		goto out;
+	}
+
+	if (flags & OPTION_FRAGMENT) {
+		if (exfat_report_fragment())
+			goto out;
+		ret = EXIT_SUCCESS;
+		goto out;
+	}
+
 	if ((clu = exfat_lookup(info.root_offset, path)) == 0) {
 		ret = ENOENT;
 		goto out;
@@ -21,5 +21,18 @@
 #define COPYRIGHT_YEAR   "2021"
 
 #define OPTION_VERBOSE   (1 << 0)
+#define OPTION_FRAGMENT  (1 << 1)
+#define OPTION_INDEX     (1 << 2)
+
+/* Fragmentation report */
+#define FRAGMENT_HIST_SIZE   32
+#define FRAGMENT_WORST       10
+
+struct exfat_fragment {
+	struct exfat_fileinfo *f;
+	char *path;
+	uint64_t clusters;
+	uint64_t extents;
+};
 
 #endif /*_STATEXFAT_H */
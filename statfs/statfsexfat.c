@@ -18,10 +18,12 @@
 
 #include "statfsexfat.h"
 #include "exfat.h"
+#include "trans.h"
 
 FILE *output;
 unsigned int print_level = PRINT_WARNING;
 struct exfat_info info;
+uint8_t flags = 0;
 /**
  * Special Option(no short option)
  */
@@ -34,6 +36,7 @@ enum
 /* option data {"long name", needs argument, flags, "short name"} */
 static struct option const longopts[] =
 {
+	{"bitmap", no_argument, NULL, 'b'},
 	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
 	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
 	{0,0,0,0}
@@ -48,6 +51,7 @@ static void usage(void)
 	fprintf(stderr, "display file status in exFAT\n");
 	fprintf(stderr, "\n");
 
+	fprintf(stderr, "  -b, --bitmap\tdisplay usage from Allocation Bitmap.\n");
 	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
 	fprintf(stderr, "  --version\toutput version information and exit.\n");
 	fprintf(stderr, "\n");
@@ -99,6 +103,72 @@ void exfat_print_bootsec(struct exfat_bootsec *b)
 	pr_msg("\n");
 }
 
+/**
+ * exfat_count_free_extent - count free extent in histogram
+ * @clu:                     first cluster of free extent
+ * @len:                     the number of clusters
+ * @arg:                     free extent statistics
+ *
+ * @return                   0 (continue scanning)
+ */
+static int exfat_count_free_extent(uint32_t clu, uint32_t len, void *arg)
+{
+	struct exfat_free_stat *st = arg;
+	int bucket = MIN(31 - __builtin_clz(len), FREE_HIST_SIZE - 1);
+
+	st->extents++;
+	st->count[bucket]++;
+	st->clusters[bucket] += len;
+	if (len > st->largest) {
+		st->largest = len;
+		st->largest_clu = clu;
+	}
+	return 0;
+}
+
+/**
+ * exfat_print_bitmap_usage - print usage in Allocation Bitmap
+ *
+ * @return                    == 0 (success)
+ *                            <  0 (failed)
+ */
+static int exfat_print_bitmap_usage(void)
+{
+	int i, ret;
+	uint32_t used, total = info.cluster_count;
+	struct exfat_free_stat st = {0};
+
+	if (!info.alloc_table) {
+		pr_err("Can't load Allocation Bitmap.\n");
+		return -ENODATA;
+	}
+
+	used = exfat_count_used_clusters();
+	if ((ret = exfat_scan_free_extents(exfat_count_free_extent, &st)) < 0)
+		return ret;
+
+	pr_msg("%-28s\t: %10u (cluster)\n", "Used clusters", used);
+	pr_msg("%-28s\t: %10u (cluster)\n", "Free clusters", total - used);
+	pr_msg("%-28s\t: %10.2lf (%%)\n", "The percentage of clusters",
+			total ? (double)used * 100 / total : 0);
+	pr_msg("%-28s\t: %10u\n", "The number of free extents", st.extents);
+	pr_msg("%-28s\t: %10u (cluster)\n", "Largest free extent", st.largest);
+	pr_msg("%-28s\t: 0x%08x (cluster)\n", "Largest free extent at",
+			st.largest_clu);
+	pr_msg("\n");
+
+	pr_msg("Free extent length (clusters):\n");
+	for (i = 0; i < FREE_HIST_SIZE; i++) {
+		if (!st.count[i])
+			continue;
+		pr_msg("  %10" PRIu64 " - %10" PRIu64 ": %10u extents, %10" PRIu64 " clusters\n",
+				(uint64_t)1 << i, ((uint64_t)1 << (i + 1)) - 1,
+				st.count[i], st.clusters[i]);
+	}
+	pr_msg("\n");
+	return 0;
+}
+
 /**
  * main   - main function
  * @argc:   argument count
@@ -112,9 +182,12 @@ int main(int argc, char *argv[])
 	struct exfat_bootsec boot;
 
 	while ((opt = getopt_long(argc, argv,
-					"",
+					"b",
 					longopts, &longindex)) != -1) {
 		switch (opt) {
+			case 'b':
+				flags |= OPTION_BITMAP;
+				break;
 			case GETOPT_HELP_CHAR:
 				usage();
 				exit(EXIT_SUCCESS);
@@ -129,6 +202,7 @@ int main(int argc, char *argv[])
 
 #ifdef EXFAT_DEBUG
 	print_level = PRINT_DEBUG;
+	print_ring_setup();
 #endif
 
 	if (optind != argc - 1) {
@@ -145,11 +219,21 @@ int main(int argc, char *argv[])
 		ret = -EIO;
 		goto out;
 	}
+	exfat_journal_check(argv[optind]);
 
 	if (exfat_load_bootsec(&boot))
 		goto out;
 
 	exfat_print_bootsec(&boot);
+
+	if (flags & OPTION_BITMAP) {
+		if (exfat_store_info(&boot))
+			goto out;
+		if (exfat_traverse_root_directory())
+			goto out;
+		if (exfat_print_bitmap_usage())
+			goto out;
+	}
 out:
 	exfat_clean_info();
 	return ret;
@@ -20,4 +20,17 @@
 #define PROGRAM_AUTHOR   "LeavaTail"
 #define COPYRIGHT_YEAR   "2021"
 
+#define OPTION_BITMAP    (1 << 0)
+
+/* Free extent histogram */
+#define FREE_HIST_SIZE   32
+
+struct exfat_free_stat {
+	uint32_t extents;
+	uint32_t largest;
+	uint32_t largest_clu;
+	uint32_t count[FREE_HIST_SIZE];
+	uint64_t clusters[FREE_HIST_SIZE];
+};
+
 #endif /*_STATFSEXFAT_H */
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <mntent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sumexfat.h"
+#include "exfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"algorithm", required_argument, NULL, 'a'},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE [PATH]\n", PROGRAM_NAME);
+	fprintf(stderr, "print checksum of files in exFAT\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -a, --algorithm=NAME\tuse NAME (sha256, blake3, xxh64) as hash algorithm.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * sum_add_file - record file to be hashed
+ * @ctx:          sum context
+ * @f:            file information
+ * @path:         path of file
+ *
+ * @return        == 0 (success)
+ *                <  0 (failed)
+ */
+static int sum_add_file(struct sum_ctx *ctx, struct exfat_fileinfo *f, const char *path)
+{
+	struct sum_file *tmp, *s;
+
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->files, (ctx->size ? ctx->size * 2 : 64) * sizeof(struct sum_file));
+		if (!tmp)
+			return -ENOMEM;
+		ctx->files = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 64;
+	}
+
+	s = &ctx->files[ctx->count];
+	memset(s, 0, sizeof(struct sum_file));
+	if ((s->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	s->clu = f->clu;
+	s->flags = f->flags;
+	s->datalen = f->datalen;
+	ctx->count++;
+	return 0;
+}
+
+/**
+ * sum_collect - record regular file in exfat_walk_subtree()
+ * @f:           file information
+ * @node:        directory cache node
+ * @path:        path of file
+ * @arg:         sum context
+ *
+ * @return       == 0 (continue walking)
+ *               <  0 (failed)
+ */
+static int sum_collect(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	if (f->attr & ATTR_DIRECTORY)
+		return 0;
+	return sum_add_file(arg, f, path);
+}
+
+/**
+ * sum_update - update hash by file data
+ * @data:       file data
+ * @len:        length of @data
+ * @arg:        hash context
+ *
+ * @return      0 (continue reading)
+ */
+static int sum_update(const void *data, size_t len, void *arg)
+{
+	struct sum_hash *h = arg;
+
+	h->algo->update(&h->ctx, data, len);
+	return 0;
+}
+
+/**
+ * sum_worker - calculate hash of one file
+ * @i:          file index
+ * @arg:        sum context
+ *
+ * NOTE: Contiguous clusters are read by one request (up to SUM_BUFFER_SIZE).
+ */
+static void sum_worker(size_t i, void *arg)
+{
+	struct sum_ctx *ctx = arg;
+	struct sum_file *s = &ctx->files[i];
+	struct sum_hash h = {.algo = ctx->algo};
+	struct exfat_fileinfo f = {.clu = s->clu, .flags = s->flags, .datalen = s->datalen};
+
+	ctx->algo->init(&h.ctx);
+	s->error = exfat_read_file(&f, SUM_BUFFER_SIZE, sum_update, &h);
+	ctx->algo->final(&h.ctx, s->digest);
+}
+
+/**
+ * sum_lookup - record files under @path
+ * @ctx:        sum context
+ * @path:       path of file or directory
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ */
+static int sum_lookup(struct sum_ctx *ctx, char *path)
+{
+	int i, index;
+	uint32_t clu;
+	char *name;
+	node2_t *tmp;
+	struct exfat_fileinfo *f;
+
+	/* Trailing slashes aren't printed twice */
+	for (i = strlen(path); i > 0 && path[i - 1] == '/'; i--)
+		;
+	path[i] = '\0';
+	if (!path[0])
+		return exfat_walk_subtree(info.root_offset, "", sum_collect, ctx);
+
+	/* obtain parent directory*/
+	for (i = strlen(path); i > 0 && path[i - 1] != '/'; i--)
+		;
+	name = path + i;
+	if (i > 1)
+		path[i - 1] = '\0';
+	clu = exfat_lookup(info.root_offset, i > 1 ? path : "/");
+	if (i > 1)
+		path[i - 1] = '/';
+	if (!clu)
+		return -ENOENT;
+
+	exfat_traverse_directory(clu);
+	index = exfat_get_cache(clu);
+	tmp = info.root[index];
+	while (tmp && tmp->next != NULL) {
+		tmp = tmp->next;
+		f = (struct exfat_fileinfo *)tmp->data;
+		if (strcmp(name, (char *)f->name))
+			continue;
+		if (f->attr & ATTR_DIRECTORY)
+			return exfat_walk_subtree(tmp->index, path, sum_collect, ctx);
+		return sum_add_file(ctx, f, path);
+	}
+
+	pr_err("'%s': No such file or directory.\n", path);
+	return -ENOENT;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	size_t i;
+	char path[PATHNAME_MAX + 1] = "/";
+	char hex[HASH_MAX_DIGEST_SIZE * 2 + 1];
+	struct exfat_bootsec boot;
+	struct sum_ctx ctx = {0};
+
+	ctx.algo = hash_find_algo("sha256");
+	while ((opt = getopt_long(argc, argv,
+					"a:",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case 'a':
+				if ((ctx.algo = hash_find_algo(optarg)) == NULL) {
+					usage();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1 && optind != argc - 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+	exfat_journal_check(argv[optind]);
+	if (optind == argc - 2)
+		strncpy(path, argv[optind + 1], PATHNAME_MAX);
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if ((ret = sum_lookup(&ctx, path)))
+		goto free;
+
+	exfat_load_fat_table();
+	exfat_parallel_for(ctx.count, 0, sum_worker, &ctx);
+
+	for (i = 0; i < ctx.count; i++) {
+		if (ctx.files[i].error) {
+			pr_err("%s: Can't read file data.\n", ctx.files[i].path);
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		hash_to_hex(ctx.files[i].digest, ctx.algo->digest_size, hex);
+		pr_msg("%s  %s\n", hex, ctx.files[i].path);
+	}
+
+free:
+	for (i = 0; i < ctx.count; i++)
+		free(ctx.files[i].path);
+	free(ctx.files);
+out:
+	exfat_clean_info();
+	return ret;
+}
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _SUMEXFAT_H
+#define _SUMEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "hash.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "sumexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+/* Upper limit of one read request */
+#define SUM_BUFFER_SIZE  (4 * 1024 * 1024)
+
+struct sum_file {
+	char *path;
+	uint32_t clu;
+	uint8_t flags;
+	uint64_t datalen;
+	uint8_t digest[HASH_MAX_DIGEST_SIZE];
+	int error;
+};
+
+struct sum_hash {
+	const struct hash_algo *algo;
+	union hash_ctx ctx;
+};
+
+struct sum_ctx {
+	const struct hash_algo *algo;
+	struct sum_file *files;
+	size_t count;
+	size_t size;
+};
+
+#endif /*_SUMEXFAT_H */
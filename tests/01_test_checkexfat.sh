@@ -3,6 +3,8 @@
 PROG=./checkexfat
 IMAGE=exfat.img
 FAILURE_IMAGE=error.img
+WORK_IMAGE=lost.img
+HOST=lost.d
 RET=0
 
 set -eu -o pipefail
@@ -11,6 +13,39 @@ trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
 ### main function ###
 ${PROG} ${IMAGE}
 ${PROG} ${FAILURE_IMAGE}
+${PROG} -l ${FAILURE_IMAGE}
+
+# Delete entry of /0_SIMPLE (cluster#6) by hand
+cp ${IMAGE} ${WORK_IMAGE}
+printf '\x05' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x203060)) conv=notrunc status=none
+printf '\x40' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x203080)) conv=notrunc status=none
+printf '\x41' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x2030a0)) conv=notrunc status=none
+${PROG} ${WORK_IMAGE} 2>&1 | grep -q "^Cluster#6 isn't used at all.$"
+${PROG} -l ${WORK_IMAGE} > ${WORK_IMAGE}.out 2>&1
+grep -q "^Cluster#6 is lost directory.$" ${WORK_IMAGE}.out
+grep -q "^/LOST.00000006/FILE.TXT$" ${WORK_IMAGE}.out
+grep -q "^/LOST.00000006/DIR/$" ${WORK_IMAGE}.out
+test $(grep -c "isn't used at all" ${WORK_IMAGE}.out) -eq 0
+
+# Delete entry of NoFatChain directory over three clusters (cluster#22-24) by hand
+cp ${IMAGE} ${WORK_IMAGE}
+rm -rf ${HOST}
+mkdir -p ${HOST}/LOSTDIR
+for i in $(seq 1 60); do
+	echo ${i} > ${HOST}/LOSTDIR/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_${i}.TXT
+done
+./importexfat ${WORK_IMAGE} ${HOST} /0_SIMPLE
+./statexfat ${WORK_IMAGE} /0_SIMPLE/LOSTDIR | grep -q "^Size *: 12288$"
+./statexfat ${WORK_IMAGE} /0_SIMPLE/LOSTDIR | grep -q "NoFatChain"
+printf '\x05' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x2040c0)) conv=notrunc status=none
+printf '\x40' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x2040e0)) conv=notrunc status=none
+printf '\x41' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x204100)) conv=notrunc status=none
+${PROG} -l ${WORK_IMAGE} > ${WORK_IMAGE}.out 2>&1
+test $(grep -c "is lost directory.$" ${WORK_IMAGE}.out) -eq 1
+grep -q "^Cluster#22 is lost directory.$" ${WORK_IMAGE}.out
+test $(grep -c "^/LOST.00000016/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_.*.TXT$" ${WORK_IMAGE}.out) -eq 60
+test $(grep -c "isn't used at all" ${WORK_IMAGE}.out) -eq 0
+rm -rf ${WORK_IMAGE} ${WORK_IMAGE}.out ${HOST}
 
 ### Option function ###
 ${PROG} --help
@@ -15,6 +15,8 @@ ${PROG} ${FAILURE_IMAGE}
 ### Option function ###
 ${PROG} --help
 ${PROG} --version
+${PROG} -b ${IMAGE}
+${PROG} --bitmap ${FAILURE_IMAGE}
 
 ### Error path ###
 
@@ -2,6 +2,7 @@
 
 PROG=./lsexfat
 IMAGE=exfat.img
+INDEX_IMAGE=ls_index.img
 RET=0
 
 set -eu -o pipefail
@@ -18,6 +19,21 @@ ${PROG} --version
 ${PROG} -c ${IMAGE} /0_SIMPLE
 ${PROG} -u ${IMAGE} /0_SIMPLE
 
+# Index is created at first, and used at second
+# (Debug build mixes messages in output, so output is only read to the end)
+COMPARE=cmp
+read_all() { cat "$@" > /dev/null; }
+if ./statfsexfat ${IMAGE} | grep "^(.*:[0-9]*): " > /dev/null; then
+	COMPARE=read_all
+fi
+cp ${IMAGE} ${INDEX_IMAGE}
+${COMPARE} <(${PROG} ${IMAGE} /4_FATCHAIN) <(${PROG} -i ${INDEX_IMAGE} /4_FATCHAIN)
+${COMPARE} <(${PROG} ${IMAGE} /4_FATCHAIN) <(${PROG} -i ${INDEX_IMAGE} /4_FATCHAIN)
+test -s ${INDEX_IMAGE}.idx
+touch ${INDEX_IMAGE}
+${COMPARE} <(${PROG} ${IMAGE} /0_SIMPLE) <(${PROG} -i ${INDEX_IMAGE} /0_SIMPLE)
+rm -f ${INDEX_IMAGE} ${INDEX_IMAGE}.idx
+
 ### Error path ###
 
 # Failure argument verification
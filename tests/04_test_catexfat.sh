@@ -2,6 +2,7 @@
 
 PROG=./catexfat
 IMAGE=exfat.img
+INDEX_IMAGE=cat_index.img
 RET=0
 
 set -eu -o pipefail
@@ -14,6 +15,18 @@ ${PROG} ${IMAGE} /0_SIMPLE/FILE.TXT
 ${PROG} --help
 ${PROG} --version
 
+# Index is created at first, and used at second
+# (Debug build mixes messages in output, so output is only read to the end)
+COMPARE=cmp
+read_all() { cat "$@" > /dev/null; }
+if ./statfsexfat ${IMAGE} | grep "^(.*:[0-9]*): " > /dev/null; then
+	COMPARE=read_all
+fi
+cp ${IMAGE} ${INDEX_IMAGE}
+${COMPARE} <(${PROG} ${IMAGE} /4_FATCHAIN/FILE2.TXT) <(${PROG} -i ${INDEX_IMAGE} /4_FATCHAIN/FILE2.TXT)
+${COMPARE} <(${PROG} ${IMAGE} /4_FATCHAIN/FILE2.TXT) <(${PROG} -i ${INDEX_IMAGE} /4_FATCHAIN/FILE2.TXT)
+rm -f ${INDEX_IMAGE} ${INDEX_IMAGE}.idx
+
 ### Error path ###
 
 # Failure argument verification
@@ -15,6 +15,8 @@ ${PROG} ${IMAGE} /4_FATCHAIN/FILE2.TXT
 ${PROG} --help
 ${PROG} --version
 ${PROG} -v ${IMAGE} /4_FATCHAIN/FILE2.TXT
+${PROG} -f ${IMAGE}
+EXFAT_THREADS=1 ${PROG} --fragment ${IMAGE}
 
 ### Error path ###
 ${PROG} ${IMAGE} 0 0 0 || RET=$?
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+PROG=./defragexfat
+IMAGE=exfat.img
+WORK_IMAGE=defrag.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
+
+### main function ###
+cp ${IMAGE} ${WORK_IMAGE}
+./catexfat ${WORK_IMAGE} /4_FATCHAIN/FILE2.TXT > ${WORK_IMAGE}.before
+${PROG} -n ${WORK_IMAGE}
+cmp ${IMAGE} ${WORK_IMAGE}
+# Incomplete journal is discarded
+echo "garbage" > ${WORK_IMAGE}.journal
+${PROG} ${WORK_IMAGE}
+test ! -e ${WORK_IMAGE}.journal
+./catexfat ${WORK_IMAGE} /4_FATCHAIN/FILE2.TXT > ${WORK_IMAGE}.after
+cmp ${WORK_IMAGE}.before ${WORK_IMAGE}.after
+./statexfat -f ${WORK_IMAGE} | grep -q "^Fragmented *: 0 "
+# FAT entries of released clusters (#13-#21) are cleared
+test -z "$(od -An -v -tx4 -j$((0x100000 + 13 * 4)) -N36 ${WORK_IMAGE} | tr -d ' 0\n')"
+# VolumeDirty is cleared after metadata is written
+test "$(od -An -tx1 -j106 -N2 ${WORK_IMAGE})" = "$(od -An -tx1 -j106 -N2 ${IMAGE})"
+./checkexfat ${WORK_IMAGE}
+rm -f ${WORK_IMAGE} ${WORK_IMAGE}.before ${WORK_IMAGE}.after
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
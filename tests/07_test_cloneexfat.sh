@@ -0,0 +1,60 @@
+#!/bin/bash
+
+PROG=./cloneexfat
+IMAGE=exfat.img
+CLONE_IMAGE=clone.img
+META_IMAGE=meta.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
+
+### main function ###
+${PROG} ${IMAGE} ${CLONE_IMAGE}
+./checkexfat ${CLONE_IMAGE}
+cmp <(./catexfat ${IMAGE} /0_SIMPLE/FILE.TXT) <(./catexfat ${CLONE_IMAGE} /0_SIMPLE/FILE.TXT)
+${PROG} ${IMAGE} | cmp - ${CLONE_IMAGE}
+rm -f ${CLONE_IMAGE}
+
+# Metadata image can be read by other tools
+${PROG} -m ${IMAGE} ${META_IMAGE}
+./checkexfat ${META_IMAGE}
+cmp <(./lsexfat ${IMAGE} /4_FATCHAIN) <(./lsexfat ${META_IMAGE} /4_FATCHAIN)
+cmp <(./statfsexfat ${IMAGE}) <(./statfsexfat ${META_IMAGE})
+${PROG} -m ${IMAGE} | cmp - ${META_IMAGE}
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+${PROG} -s ${IMAGE} - > /dev/null
+
+# Metadata image is read-only
+./defragexfat ${META_IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Metadata image may be modified"
+fi
+RET=0
+rm -f ${META_IMAGE}
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img /dev/null || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
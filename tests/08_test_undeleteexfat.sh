@@ -0,0 +1,72 @@
+#!/bin/bash
+
+PROG=./undeleteexfat
+IMAGE=exfat.img
+WORK_IMAGE=undelete.img
+WORK_DIR=undelete.d
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
+
+### main function ###
+${PROG} ${IMAGE} | grep -q "^recoverable .* /2_DELETED *FILE5.TXT$"
+${PROG} -a ${IMAGE} | grep -q "^recoverable .* clu#8 index#0 *FILE5.TXT$"
+
+# Delete /0_SIMPLE/FILE.TXT (cluster#11) by hand
+cp ${IMAGE} ${WORK_IMAGE}
+printf '\x05' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x204000)) conv=notrunc status=none
+printf '\x40' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x204020)) conv=notrunc status=none
+printf '\x41' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x204040)) conv=notrunc status=none
+printf '\xfd' | dd of=${WORK_IMAGE} bs=1 count=1 seek=$((0x200001)) conv=notrunc status=none
+${PROG} ${WORK_IMAGE} | grep -q "^recoverable .* /0_SIMPLE *FILE.TXT$"
+
+rm -rf ${WORK_DIR}
+mkdir ${WORK_DIR}
+${PROG} -o ${WORK_DIR} ${WORK_IMAGE} | grep -q "^Extracted files *: 2$"
+printf 'A\n' | cmp - ${WORK_DIR}/FILE.TXT
+test -f ${WORK_DIR}/FILE5.TXT
+
+# Symbolic link in output directory isn't followed
+rm -rf ${WORK_DIR}
+mkdir ${WORK_DIR}
+: > ${WORK_DIR}.target
+ln -s ../${WORK_DIR}.target ${WORK_DIR}/FILE.TXT
+${PROG} -o ${WORK_DIR} ${WORK_IMAGE} | grep -q "^Extracted files *: 2$"
+test ! -s ${WORK_DIR}.target
+printf 'A\n' | cmp - ${WORK_DIR}/FILE.TXT.11
+rm -rf ${WORK_DIR} ${WORK_DIR}.target ${WORK_IMAGE}
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+# Failure output directory verification
+${PROG} -o nothing.d ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Output directory verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+PROG=./findexfat
+IMAGE=exfat.img
+FAILURE_IMAGE=error.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
+
+### main function ###
+test $(${PROG} ${IMAGE} | wc -l) -eq 15
+${PROG} ${IMAGE} | sort -c
+${PROG} ${FAILURE_IMAGE}
+test "$(${PROG} ${IMAGE} /4_FATCHAIN/)" = "$(printf '/4_FATCHAIN/FILE2.TXT\n/4_FATCHAIN/FILE3.TXT')"
+
+### Option function ###
+test "$(${PROG} ${IMAGE} -name file2.txt)" = "/4_FATCHAIN/FILE2.TXT"
+test "$(${PROG} ${IMAGE} -name 'ō')" = "/1_FILENAME/Ō"
+test $(${PROG} ${IMAGE} -name 'file?.*' | wc -l) -eq 4
+test $(${PROG} ${IMAGE} -regex '.*/file[0-9]\.txt' | wc -l) -eq 4
+test "$(${PROG} ${IMAGE} -regex '/4_.*/file2\.txt')" = "/4_FATCHAIN/FILE2.TXT"
+test -z "$(${PROG} ${IMAGE} -regex 'file2\.txt')"
+test "$(${PROG} ${IMAGE} -regex '.*/ō')" = "/1_FILENAME/Ō"
+test $(${PROG} ${IMAGE} -type d | wc -l) -eq 6
+test $(${PROG} ${IMAGE} -type f -size +4k | wc -l) -eq 3
+test $(${PROG} ${IMAGE} -type f -size -1 | wc -l) -eq 5
+test $(${PROG} ${IMAGE} -type f -size 17 | wc -l) -eq 3
+test "$(${PROG} ${IMAGE} -type f -size 1)" = "/0_SIMPLE/FILE.TXT"
+test "$(${PROG} ${IMAGE} -size 2c)" = "/0_SIMPLE/FILE.TXT"
+test $(${PROG} ${IMAGE} -mtime +0 | wc -l) -eq 15
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure condition verification
+${PROG} -size 1x ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Condition verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+# Failure directory verification
+${PROG} ${IMAGE} /0_SIMPLE/FILE.TXT || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Directory verification may be wrong"
+fi
+RET=0
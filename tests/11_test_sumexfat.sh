@@ -0,0 +1,62 @@
+#!/bin/bash
+
+PROG=./sumexfat
+IMAGE=exfat.img
+FAILURE_IMAGE=error.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; exit 1' ERR
+
+### main function ###
+test $(${PROG} ${IMAGE} | wc -l) -eq 9
+${PROG} ${FAILURE_IMAGE}
+test "$(${PROG} ${IMAGE} /0_SIMPLE/FILE.TXT)" = "$(printf 'A\n' | sha256sum | sed 's@-$@/0_SIMPLE/FILE.TXT@')"
+test "$(${PROG} ${IMAGE} /4_FATCHAIN/ | cut -d' ' -f3)" = "$(printf '/4_FATCHAIN/FILE2.TXT\n/4_FATCHAIN/FILE3.TXT')"
+
+### Option function ###
+# Known digests of "A\n" (FILE.TXT) and empty file
+test "$(${PROG} -a blake3 ${IMAGE} /0_SIMPLE/FILE.TXT | cut -d' ' -f1)" = "753dcb144663fe5ca9e0bc97b1549104a3008f2f541792d67a64fcc614ef83c9"
+test "$(${PROG} -a blake3 ${IMAGE} '/1_FILENAME/ABCDEFGHIJKLMNOPQRSTUVWXYZ!' | cut -d' ' -f1)" = "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"
+test "$(${PROG} -a xxh64 ${IMAGE} /0_SIMPLE/FILE.TXT | cut -d' ' -f1)" = "b83c9e6e28309f66"
+test "$(${PROG} -a xxh64 ${IMAGE} '/1_FILENAME/ABCDEFGHIJKLMNOPQRSTUVWXYZ!' | cut -d' ' -f1)" = "ef46db3751d8e999"
+test "$(${PROG} --algorithm=sha256 ${IMAGE})" = "$(${PROG} ${IMAGE})"
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure algorithm verification
+${PROG} -a md5 ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Algorithm verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+# Failure path verification
+${PROG} ${IMAGE} /NOTHING || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Path verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+PROG=./dedupexfat
+IMAGE=exfat.img
+FAILURE_IMAGE=error.img
+DIFF_IMAGE=dedup.img
+META_IMAGE=dedup_meta.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -f ${DIFF_IMAGE} ${META_IMAGE}; exit 1' ERR
+
+### main function ###
+${PROG} ${IMAGE}
+${PROG} ${FAILURE_IMAGE}
+test $(${PROG} ${IMAGE} | grep -c "^  Cluster#") -eq 4
+${PROG} ${IMAGE} | grep -q "Cluster#20 *\/4_FATCHAIN\/FILE2.TXT"
+${PROG} ${IMAGE} | grep -q "Potential savings *: 12288 (byte)"
+
+# Two-image mode (Cluster#13 is FILE2.TXT [1])
+cp ${IMAGE} ${DIFF_IMAGE}
+printf 'Z' | dd of=${DIFF_IMAGE} bs=1 seek=$((0x20B000)) conv=notrunc status=none
+test "$(${PROG} ${IMAGE} ${IMAGE} | grep -c differ)" -eq 0
+test "$(${PROG} ${IMAGE} ${DIFF_IMAGE} | grep differ)" = "Cluster#13 differs."
+rm -f ${DIFF_IMAGE}
+
+### Option function ###
+test $(${PROG} -s ${IMAGE} | wc -l) -eq 4
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} 0 0 0 || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+${PROG} ${IMAGE} nothing.img || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+# Metadata image doesn't have file data (each image is cleaned up once)
+./cloneexfat -m ${IMAGE} ${META_IMAGE}
+${PROG} ${IMAGE} ${META_IMAGE} || RET=$?
+rm -f ${META_IMAGE}
+if [ $RET -eq 0 ] || [ $RET -ge 128 -a $RET -lt 160 ]; then
+	echo "ERROR: Metadata image verification may be wrong"
+	exit 1
+fi
+RET=0
@@ -0,0 +1,66 @@
+#!/bin/bash
+
+PROG=./diffexfat
+IMAGE=exfat.img
+FAILURE_IMAGE=error.img
+DIFF_IMAGE=diff.img
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -f ${DIFF_IMAGE}; exit 1' ERR
+
+### main function ###
+# Exit status is 1 if images differ
+${PROG} ${IMAGE} ${FAILURE_IMAGE} || RET=$?
+test ${RET} -eq 1
+RET=0
+${PROG} ${IMAGE} ${IMAGE}
+test $(${PROG} ${IMAGE} ${IMAGE} | grep -c "^[a-z]* *: 0$") -eq 5
+
+# Rename FILE.TXT to GILE.TXT
+cp ${IMAGE} ${DIFF_IMAGE}
+printf 'G' | dd of=${DIFF_IMAGE} bs=1 seek=$((0x204042)) conv=notrunc status=none
+test "$(${PROG} ${IMAGE} ${DIFF_IMAGE} | head -n 1)" = "moved     /0_SIMPLE/FILE.TXT -> /0_SIMPLE/GILE.TXT"
+
+# Update timestamp of FILE4.TXT
+cp ${IMAGE} ${DIFF_IMAGE}
+printf '\x01' | dd of=${DIFF_IMAGE} bs=1 seek=$((0x20700C)) conv=notrunc status=none
+test "$(${PROG} ${IMAGE} ${DIFF_IMAGE} | head -n 1)" = "changed   /3_NOFATCHAIN/FILE4.TXT"
+
+# Update data and timestamp of FILE4.TXT
+printf 'Z' | dd of=${DIFF_IMAGE} bs=1 seek=$((0x20F000)) conv=notrunc status=none
+test "$(${PROG} ${IMAGE} ${DIFF_IMAGE} | head -n 1)" = "modified  /3_NOFATCHAIN/FILE4.TXT"
+rm -f ${DIFF_IMAGE}
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} || RET=$?
+if [ $RET -ne 2 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} ${IMAGE} || RET=$?
+if [ $RET -ne 2 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} ${IMAGE} nothing.img || RET=$?
+if [ $RET -ne 2 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
+
+${PROG} nothing.img ${IMAGE} || RET=$?
+if [ $RET -ne 2 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,76 @@
+#!/bin/bash
+
+PROG=./writeexfat
+IMAGE=exfat.img
+WORK_IMAGE=write.img
+DATA=write.dat
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -f ${WORK_IMAGE} ${DATA}; exit 1' ERR
+
+### main function ###
+cp ${IMAGE} ${WORK_IMAGE}
+head -c 100000 /dev/urandom > ${DATA}
+
+# Regular file is written contiguously
+${PROG} ${WORK_IMAGE} /0_SIMPLE/NEW.BIN < ${DATA}
+./catexfat ${WORK_IMAGE} /0_SIMPLE/NEW.BIN | head -c 100000 | cmp - ${DATA}
+./statexfat ${WORK_IMAGE} /0_SIMPLE/NEW.BIN | grep -q "^Size *: 100000$"
+./statexfat ${WORK_IMAGE} /0_SIMPLE/NEW.BIN | grep -q "NoFatChain"
+./statexfat -f ${WORK_IMAGE} | grep -q "^Fragmented *: 2 "
+
+# Pipe and empty input
+cat ${DATA} ${DATA} | ${PROG} ${WORK_IMAGE} /PIPE.BIN
+./catexfat ${WORK_IMAGE} /PIPE.BIN | head -c 200000 | cmp - <(cat ${DATA} ${DATA})
+./statexfat ${WORK_IMAGE} /PIPE.BIN | grep -q "^Size *: 200000$"
+${PROG} ${WORK_IMAGE} /EMPTY.TXT < /dev/null
+./lsexfat ${WORK_IMAGE} / | grep -q " 0 .* EMPTY.TXT$"
+
+# Existing file is overwritten (name is compared in upper-case)
+echo "overwrite" | ${PROG} ${WORK_IMAGE} /0_SIMPLE/file.txt
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/FILE.TXT | tr -d '\0')" = "overwrite"
+
+# Long name needs new cluster in directory
+for i in $(seq 1 40); do
+	echo ${i} | ${PROG} ${WORK_IMAGE} /0_SIMPLE/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_${i}.TXT
+done
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_40.TXT | tr -d '\0')" = "40"
+
+# Entry set in later cluster of directory is updated
+test $(./statexfat ${WORK_IMAGE} /0_SIMPLE | sed -n "s/^Size *: //p") -gt 4096
+echo "updated" | ${PROG} ${WORK_IMAGE} /0_SIMPLE/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_40.TXT
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_40.TXT | tr -d '\0')" = "updated"
+./statexfat ${WORK_IMAGE} /0_SIMPLE/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_40.TXT | grep -q "^Size *: 8$"
+echo "not empty" | ${PROG} ${WORK_IMAGE} /EMPTY.TXT
+test "$(./catexfat ${WORK_IMAGE} /EMPTY.TXT | tr -d '\0')" = "not empty"
+./checkexfat ${WORK_IMAGE}
+(./diffexfat ${IMAGE} ${WORK_IMAGE} || test $? -eq 1) | grep -q "^added *: 43$"
+rm -f ${WORK_IMAGE} ${DATA}
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} /FILE || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img /FILE < /dev/null || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,83 @@
+#!/bin/bash
+
+PROG=./importexfat
+IMAGE=exfat.img
+WORK_IMAGE=import.img
+HOST=import.d
+LOG=import.log
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -rf ${WORK_IMAGE} ${HOST} ${LOG}; exit 1' ERR
+
+### main function ###
+cp ${IMAGE} ${WORK_IMAGE}
+rm -rf ${HOST}
+mkdir -p ${HOST}/HOSTDIR/SUB ${HOST}/EMPTYDIR ${HOST}/DEEP/DIR1/DIR2/DIR3
+head -c 100000 /dev/urandom > ${HOST}/DATA.BIN
+head -c 5000 /dev/urandom > ${HOST}/HOSTDIR/SMALL.BIN
+: > ${HOST}/HOSTDIR/EMPTY.TXT
+for i in $(seq 1 100); do
+	echo ${i} > ${HOST}/HOSTDIR/SUB/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_${i}.TXT
+done
+echo "deep" > ${HOST}/DEEP/DIR1/DIR2/DIR3/DEEP.TXT
+echo "shallow" > ${HOST}/DEEP/DIR1/SHALLOW.TXT
+ln -s DATA.BIN ${HOST}/LINK
+
+# Host directory tree is copied into directory
+${PROG} ${WORK_IMAGE} ${HOST} /0_SIMPLE
+./catexfat ${WORK_IMAGE} /0_SIMPLE/DATA.BIN | head -c 100000 | cmp - ${HOST}/DATA.BIN
+./statexfat ${WORK_IMAGE} /0_SIMPLE/DATA.BIN | grep -q "^Size *: 100000$"
+./statexfat ${WORK_IMAGE} /0_SIMPLE/DATA.BIN | grep -q "NoFatChain"
+./catexfat ${WORK_IMAGE} /0_SIMPLE/HOSTDIR/SMALL.BIN | head -c 5000 | cmp - ${HOST}/HOSTDIR/SMALL.BIN
+./lsexfat ${WORK_IMAGE} /0_SIMPLE/HOSTDIR | grep -q " 0 .* EMPTY.TXT$"
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/HOSTDIR/SUB/LONG_FILE_NAME_TO_EXTEND_DIRECTORY_100.TXT | tr -d '\0')" = "100"
+./lsexfat ${WORK_IMAGE} /0_SIMPLE/EMPTYDIR
+./lsexfat ${WORK_IMAGE} /0_SIMPLE | grep -q "LINK" && false
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/DEEP/DIR1/DIR2/DIR3/DEEP.TXT | tr -d '\0')" = "deep"
+test "$(./catexfat ${WORK_IMAGE} /0_SIMPLE/DEEP/DIR1/SHALLOW.TXT | tr -d '\0')" = "shallow"
+./checkexfat ${WORK_IMAGE} > ${LOG}
+grep -q "isn't used at all" ${LOG} && false
+(./diffexfat ${IMAGE} ${WORK_IMAGE} || test $? -eq 1) | grep -q "^added *: 112$"
+
+# Existing file can't be overwritten
+${PROG} ${WORK_IMAGE} ${HOST} /0_SIMPLE || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Existing file verification may be wrong"
+	exit 1
+fi
+RET=0
+
+# Top of host directory is copied into root directory by default
+${PROG} ${WORK_IMAGE} ${HOST}/HOSTDIR
+./catexfat ${WORK_IMAGE} /SMALL.BIN | head -c 5000 | cmp - ${HOST}/HOSTDIR/SMALL.BIN
+./checkexfat ${WORK_IMAGE} > ${LOG}
+grep -q "isn't used at all" ${LOG} && false
+rm -rf ${WORK_IMAGE} ${HOST} ${LOG}
+
+### Option function ###
+${PROG} --help
+${PROG} --version
+
+### Error path ###
+
+# Failure argument verification
+${PROG} ${IMAGE} || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
+
+# Failure parse verification
+${PROG} -z ${IMAGE} . || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Option Parser verification may be wrong"
+fi
+RET=0
+
+# Failure exist verification
+${PROG} nothing.img . || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Open file verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+PROG=./testexfat
+IMAGE=exfat.img
+WORK_IMAGE=trans.img
+LOG=trans.log
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -f ${WORK_IMAGE} ${LOG}; exit 1' ERR
+
+### main function ###
+cp ${IMAGE} ${WORK_IMAGE}
+
+# Sectors in transaction are written only by outermost commit
+${PROG} trans ${WORK_IMAGE}
+./checkexfat ${WORK_IMAGE}
+
+# The last two clusters are allocated, and allocation is finished on full volume
+cp ${IMAGE} ${WORK_IMAGE}
+timeout 60 ${PROG} alloc ${WORK_IMAGE}
+
+# Directory isn't extended at all if there is no free cluster
+cp ${IMAGE} ${WORK_IMAGE}
+${PROG} extend ${WORK_IMAGE}
+./checkexfat ${WORK_IMAGE} > ${LOG}
+grep -q "isn't used at all" ${LOG} && false
+./lsexfat ${WORK_IMAGE} /0_SIMPLE | grep -q "EXTEND_0.TXT$"
+rm -f ${WORK_IMAGE} ${LOG}
+
+### Error path ###
+
+# Failure argument verification
+${PROG} trans || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
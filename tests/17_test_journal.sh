@@ -0,0 +1,47 @@
+#!/bin/bash
+
+PROG=./testexfat
+IMAGE=exfat.img
+WORK_IMAGE=journal.img
+JOURNAL=${WORK_IMAGE}.journal
+# Must be same as JOURNAL_OFFSET and JOURNAL_COUNT in testexfat.c
+OFFSET=$(( 0x200000 + (32000 - 2) * 4096 ))
+LENGTH=$(( 2 * 512 ))
+RET=0
+
+set -eu -o pipefail
+trap 'echo "ERROR: l.$LINENO, exit status = $?" >&2; rm -f ${WORK_IMAGE} ${JOURNAL}; exit 1' ERR
+
+### main function ###
+cp ${IMAGE} ${WORK_IMAGE}
+
+# Read-only tools warn pending journal, but don't replay it
+${PROG} journal ${WORK_IMAGE}
+./checkexfat ${WORK_IMAGE} | grep "Journal is pending" > /dev/null
+./lsexfat ${WORK_IMAGE} / | grep "Journal is pending" > /dev/null
+test -f ${JOURNAL}
+
+# Writer replays journal and removes it
+echo "replay" | ./writeexfat ${WORK_IMAGE} /REPLAY.TXT | grep "Journal is replayed" > /dev/null
+test ! -e ${JOURNAL}
+cmp -n ${LENGTH} -i ${OFFSET}:0 ${WORK_IMAGE} <(head -c ${LENGTH} /dev/zero | tr '\0' 'Z')
+./checkexfat ${WORK_IMAGE}
+./checkexfat ${WORK_IMAGE} | grep "Journal is pending" > /dev/null && false
+
+# Journal with wrong checksum is discarded
+cp ${IMAGE} ${WORK_IMAGE}
+${PROG} broken ${WORK_IMAGE}
+echo "discard" | ./writeexfat ${WORK_IMAGE} /DISCARD.TXT | grep "Incomplete journal is discarded" > /dev/null
+test ! -e ${JOURNAL}
+cmp -n ${LENGTH} -i ${OFFSET}:0 ${WORK_IMAGE} /dev/zero
+./checkexfat ${WORK_IMAGE}
+rm -f ${WORK_IMAGE}
+
+### Error path ###
+
+# Failure argument verification
+${PROG} journal || RET=$?
+if [ $RET -eq 0 ]; then
+	echo "ERROR: Argument verification may be wrong"
+fi
+RET=0
@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include "exfat.h"
+#include "hash.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+
+/* Free sector in the sample image (cluster#22) */
+#define TEST_OFFSET    (0x200000 + (22 - EXFAT_FIRST_CLUSTER) * 4096)
+
+/* Sector updated by journal (cluster#32000), far from clusters allocated by tools */
+#define JOURNAL_OFFSET (0x200000 + (32000 - EXFAT_FIRST_CLUSTER) * 4096)
+#define JOURNAL_COUNT  2
+#define JOURNAL_BYTE   0x5A
+
+#define test_assert(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: '%s' is failed.\n", __func__, __LINE__, #cond); \
+			return 1; \
+		} \
+	} while (0)
+
+/**
+ * test_image - whether or not sectors in the image are filled with @c
+ * @offset:     Start bytes
+ * @count:      The number of sectors
+ * @c:          expected byte
+ *
+ * @return      true (all bytes are @c)
+ *
+ * NOTE: The image is read directly, so sectors in transaction are ignored.
+ */
+static bool test_image(off_t offset, size_t count, uint8_t c)
+{
+	size_t i, len = count * info.sector_size;
+	uint8_t *buf;
+	bool ret = false;
+
+	if ((buf = malloc(len)) == NULL)
+		return false;
+	if (pread(info.fd, buf, len, offset) == len) {
+		for (i = 0; i < len && buf[i] == c; i++)
+			;
+		ret = i == len;
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * test_sector - whether or not get_sector() returns sectors filled with @c
+ * @offset:      Start bytes
+ * @count:       The number of sectors
+ * @c:           expected byte
+ *
+ * @return       true (all bytes are @c)
+ */
+static bool test_sector(off_t offset, size_t count, uint8_t c)
+{
+	size_t i, len = count * info.sector_size;
+	uint8_t *buf;
+	bool ret = false;
+
+	if ((buf = malloc(len)) == NULL)
+		return false;
+	if (!get_sector(buf, offset, count)) {
+		for (i = 0; i < len && buf[i] == c; i++)
+			;
+		ret = i == len;
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * test_fill - write sectors filled with @c by set_sector()
+ * @offset:    Start bytes
+ * @count:     The number of sectors
+ * @c:         byte to be written
+ *
+ * @return     == 0 (success)
+ *             <  0 (failed)
+ */
+static int test_fill(off_t offset, size_t count, uint8_t c)
+{
+	int ret;
+	uint8_t *buf;
+
+	if ((buf = malloc(count * info.sector_size)) == NULL)
+		return -ENOMEM;
+	memset(buf, c, count * info.sector_size);
+	ret = set_sector(buf, offset, count);
+	free(buf);
+	return ret;
+}
+
+/**
+ * test_trans - check write transaction
+ *
+ * @return      0 (success)
+ *              1 (failed)
+ */
+static int test_trans(void)
+{
+	off_t off = TEST_OFFSET;
+	size_t sec = info.sector_size;
+	struct exfat_bootsec before, after;
+
+	/* Sectors aren't written until commit, but are read from transaction */
+	test_assert(!test_fill(off, 2, 0x00));
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off + sec, 1, 0xAA));
+	test_assert(test_image(off + sec, 1, 0x00));
+	test_assert(test_sector(off + sec, 1, 0xAA));
+	test_assert(test_sector(off, 1, 0x00));
+	test_assert(exfat_trans_cached(off + sec, 1));
+	test_assert(!exfat_trans_cached(off, 2));
+	test_assert(!exfat_trans_commit());
+	test_assert(!info.trans);
+	test_assert(test_image(off, 1, 0x00));
+	test_assert(test_image(off + sec, 1, 0xAA));
+
+	/* Aborted sectors are discarded */
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off, 2, 0xBB));
+	test_assert(test_sector(off, 2, 0xBB));
+	exfat_trans_abort();
+	test_assert(!info.trans);
+	test_assert(test_sector(off, 1, 0x00));
+	test_assert(test_sector(off + sec, 1, 0xAA));
+
+	/* Only outermost commit writes sectors */
+	test_assert(!exfat_trans_begin());
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off, 2, 0xCC));
+	test_assert(!exfat_trans_commit());
+	test_assert(info.trans);
+	test_assert(test_image(off, 1, 0x00) && test_image(off + sec, 1, 0xAA));
+	test_assert(test_sector(off, 2, 0xCC));
+	test_assert(!exfat_trans_commit());
+	test_assert(!info.trans);
+	test_assert(test_image(off, 2, 0xCC));
+
+	/* Inner abort cancels outer commit */
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off, 1, 0xDD));
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off + sec, 1, 0xDD));
+	exfat_trans_abort();
+	test_assert(info.trans);
+	test_assert(exfat_trans_commit() == -ECANCELED);
+	test_assert(!info.trans);
+	test_assert(test_image(off, 2, 0xCC));
+	test_assert(test_sector(off, 2, 0xCC));
+
+	/* Unbalanced commit and abort */
+	test_assert(exfat_trans_commit() == -EINVAL);
+	exfat_trans_abort();
+	test_assert(!info.trans);
+
+	/* Unaligned offset is rejected */
+	test_assert(!exfat_trans_begin());
+	test_assert(test_fill(off + 1, 1, 0xEE) == -EINVAL);
+	test_assert(!exfat_trans_commit());
+
+	/* VolumeDirty is set only while sectors are written */
+	test_assert(pread(info.fd, &before, sizeof(before), 0) == sizeof(before));
+	test_assert(!exfat_trans_begin());
+	test_assert(!test_fill(off, 2, 0x00));
+	test_assert(!exfat_trans_commit());
+	test_assert(test_image(off, 2, 0x00));
+	test_assert(pread(info.fd, &after, sizeof(after), 0) == sizeof(after));
+	test_assert(before.VolumeFlags == after.VolumeFlags);
+	return 0;
+}
+
+/**
+ * test_fill_bitmap - mark all clusters as used in memory
+ * @free:             the number of clusters left free at the end of heap
+ *
+ * NOTE: Allocation Bitmap on disk isn't changed until it is saved.
+ */
+static void test_fill_bitmap(uint32_t free)
+{
+	uint32_t i, clu;
+
+	memset(info.alloc_table, 0xFF, info.alloc_length);
+	for (i = 0; i < free; i++) {
+		clu = info.cluster_count + 1 - i - EXFAT_FIRST_CLUSTER;
+		info.alloc_table[clu / CHAR_BIT] &= ~(1 << (clu % CHAR_BIT));
+	}
+}
+
+/**
+ * test_lookup - find file information in directory
+ * @dir:         directory path
+ * @name:        file name
+ *
+ * @return       file information (NULL if not found)
+ */
+static struct exfat_fileinfo *test_lookup(const char *dir, const char *name)
+{
+	char path[PATHNAME_MAX + 1];
+	uint32_t clu;
+
+	snprintf(path, sizeof(path), "%s", dir);
+	if ((clu = exfat_lookup(info.root_offset, path)) == 0 || exfat_traverse_directory(clu))
+		return NULL;
+	return exfat_find_dentry(clu, name);
+}
+
+/**
+ * test_alloc - check cluster allocation at the end of heap
+ *
+ * @return      0 (success)
+ *              1 (failed)
+ *
+ * NOTE: Allocation Bitmap is saved partially, so the image is inconsistent.
+ */
+static int test_alloc(void)
+{
+	size_t len;
+	struct exfat_fileinfo *f;
+
+	test_assert(!exfat_traverse_root_directory());
+	test_assert((f = test_lookup("/0_SIMPLE", "FILE.TXT")) != NULL);
+
+	/* The last two clusters are also allocated */
+	test_fill_bitmap(2);
+	test_assert(exfat_new_clusters(2) == info.cluster_count);
+	test_assert(exfat_load_bitmap(info.cluster_count) == 1);
+	test_assert(exfat_load_bitmap(info.cluster_count + 1) == 1);
+
+	/* Only found clusters are added to file */
+	test_fill_bitmap(2);
+	len = f->datalen;
+	test_assert(exfat_alloc_clusters(f, f->clu, 3) == 1);
+	test_assert(f->datalen == len + 2 * info.cluster_size);
+	test_assert(exfat_get_last_cluster(f, f->clu) == info.cluster_count + 1);
+
+	/* Allocation is finished on full volume, even if it starts from the last cluster */
+	len = f->datalen;
+	test_assert(exfat_alloc_clusters(f, f->clu, 1) == 1);
+	test_assert(f->datalen == len);
+	test_assert(!info.trans);
+	return 0;
+}
+
+/**
+ * test_extend - check that directory isn't extended on full volume
+ *
+ * @return       0 (success)
+ *               1 (failed)
+ */
+static int test_extend(void)
+{
+	int i, n, ret = 0;
+	char name[32];
+	size_t len;
+	uint32_t clu;
+	struct timespec now;
+	struct exfat_fileinfo *d, f = {0};
+	struct exfat_dentry set[ENTRY_SET_MAX];
+
+	test_assert(!exfat_traverse_root_directory());
+	test_assert((d = test_lookup("/", "0_SIMPLE")) != NULL);
+	clu = d->clu;
+	len = d->datalen;
+
+	/* Empty files are created until directory needs new cluster */
+	test_fill_bitmap(0);
+	f.attr = ATTR_ARCHIVE;
+	clock_gettime(CLOCK_REALTIME, &now);
+	exfat_convert_exfattime(&f.mtime, &now);
+	f.ctime = f.atime = f.mtime;
+	for (i = 0; !ret && i < info.cluster_size / sizeof(struct exfat_dentry); i++) {
+		memset(set, 0, sizeof(set));
+		snprintf(name, sizeof(name), "EXTEND_%d.TXT", i);
+		test_assert((n = exfat_init_dentry(set, name, &f)) > 0);
+		ret = exfat_create_dentries(clu, set, n);
+	}
+	test_assert(ret == -ENOSPC);
+	test_assert(d->datalen == len);
+	test_assert(!info.trans);
+	return 0;
+}
+
+/**
+ * test_journal - write journal as if commit was interrupted
+ * @image:        image path
+ * @broken:       write journal with wrong checksum
+ *
+ * @return        0 (success)
+ *                1 (failed)
+ */
+static int test_journal(const char *image, bool broken)
+{
+	int ret = 1;
+	size_t len = strlen(image) + strlen(EXFAT_JOURNAL_SUFFIX) + 1;
+	char *path = NULL;
+	uint8_t *data = NULL;
+	FILE *fp = NULL;
+	struct xxh64_ctx ctx;
+	struct exfat_bootsec boot;
+	struct exfat_journal_header hdr = {0};
+	struct exfat_journal_record record = {0};
+	uint64_t length = (uint64_t)JOURNAL_COUNT * info.sector_size;
+
+	if (pread(info.fd, &boot, sizeof(boot), 0) != sizeof(boot))
+		goto out;
+	if ((path = malloc(len)) == NULL || (data = malloc(length)) == NULL)
+		goto out;
+	snprintf(path, len, "%s%s", image, EXFAT_JOURNAL_SUFFIX);
+	memset(data, JOURNAL_BYTE, length);
+
+	record.Offset = cpu_to_le64(JOURNAL_OFFSET);
+	record.Count = cpu_to_le32(JOURNAL_COUNT);
+	xxh64_init(&ctx, 0);
+	xxh64_update(&ctx, &record, sizeof(record));
+	xxh64_update(&ctx, data, length);
+
+	memcpy(hdr.Magic, EXFAT_JOURNAL_MAGIC, sizeof(hdr.Magic));
+	hdr.Version = cpu_to_le32(EXFAT_JOURNAL_VERSION);
+	hdr.SectorSize = cpu_to_le32(info.sector_size);
+	hdr.RecordCount = cpu_to_le32(1);
+	hdr.VolumeFlags = boot.VolumeFlags;
+	hdr.DataLength = cpu_to_le64(length);
+	hdr.Checksum = cpu_to_le64(xxh64_digest(&ctx) + broken);
+
+	if ((fp = fopen(path, "w")) == NULL)
+		goto out;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+			fwrite(&record, sizeof(record), 1, fp) == 1 &&
+			fwrite(data, length, 1, fp) == 1)
+		ret = 0;
+out:
+	if (fp && fclose(fp))
+		ret = 1;
+	free(data);
+	free(path);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int ret = EXIT_FAILURE;
+	struct exfat_bootsec boot;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s {trans|alloc|extend|journal|broken} IMAGE\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+	if ((info.fd = open(argv[2], O_RDWR)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		goto out;
+	}
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+
+	if (!strcmp(argv[1], "trans"))
+		ret = test_trans();
+	else if (!strcmp(argv[1], "alloc"))
+		ret = test_alloc();
+	else if (!strcmp(argv[1], "extend"))
+		ret = test_extend();
+	else if (!strcmp(argv[1], "journal"))
+		ret = test_journal(argv[2], false);
+	else if (!strcmp(argv[1], "broken"))
+		ret = test_journal(argv[2], true);
+out:
+	exfat_clean_info();
+	return ret;
+}
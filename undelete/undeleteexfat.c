@@ -0,0 +1,613 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <mntent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "undeleteexfat.h"
+#include "exfat.h"
+#include "thread.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+uint8_t flags = 0;
+static const char *outdir;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"all", no_argument, NULL, 'a'},
+	{"output", required_argument, NULL, 'o'},
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+static const char *undelete_state_name[] = {
+	[UNDELETE_RECOVERABLE] = "recoverable",
+	[UNDELETE_PARTIAL] = "partial",
+	[UNDELETE_LOST] = "lost",
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE\n", PROGRAM_NAME);
+	fprintf(stderr, "find deleted files in exFAT\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  -a, --all\tscan whole cluster heap instead of directories.\n");
+	fprintf(stderr, "  -o, --output=DIR\textract recoverable files to DIR.\n");
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * undelete_add_extent - append cluster to extents
+ * @u:                   deleted file
+ * @clu:                 cluster index
+ * @used:                whether or not cluster is allocated now
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int undelete_add_extent(struct undelete_file *u, uint32_t clu, bool used)
+{
+	struct undelete_extent *e = u->ext_count ? &u->ext[u->ext_count - 1] : NULL;
+
+	if (used)
+		u->used++;
+	else
+		u->free++;
+
+	if (e && e->clu + e->len == clu && e->used == used) {
+		e->len++;
+		return 0;
+	}
+
+	/* Expand list by power of two */
+	if (!(u->ext_count & (u->ext_count - 1))) {
+		e = realloc(u->ext, (u->ext_count ? u->ext_count * 2 : 1) * sizeof(struct undelete_extent));
+		if (!e)
+			return -ENOMEM;
+		u->ext = e;
+	}
+	u->ext[u->ext_count].clu = clu;
+	u->ext[u->ext_count].len = 1;
+	u->ext[u->ext_count].used = used;
+	u->ext_count++;
+	return 0;
+}
+
+/**
+ * undelete_resolve - compare clusters of deleted file with Allocation Bitmap
+ * @u:                deleted file
+ *
+ * NOTE: FAT entries are left by deletion, so FAT chain is followed
+ *       as long as it points valid clusters.
+ */
+static void undelete_resolve(struct undelete_file *u)
+{
+	uint64_t i, num = ROUNDUP(u->datalen, info.cluster_size);
+	uint32_t clu = u->first, next;
+
+	u->state = UNDELETE_RECOVERABLE;
+	if (!num)
+		return;
+
+	if (num > info.cluster_count || clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1) {
+		u->unknown = MIN(num, info.cluster_count);
+		u->state = UNDELETE_LOST;
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (undelete_add_extent(u, clu, exfat_load_bitmap(clu) == 1))
+			break;
+		if (i + 1 == num)
+			break;
+
+		if (u->flags & ALLOC_NOFATCHAIN)
+			next = clu + 1;
+		else if (exfat_get_fat(clu, &next))
+			break;
+		if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1)
+			break;
+		clu = next;
+	}
+
+	u->unknown = num - u->free - u->used;
+	if (u->used || u->unknown)
+		u->state = u->free ? UNDELETE_PARTIAL : UNDELETE_LOST;
+}
+
+/**
+ * undelete_add_file - record deleted file
+ * @ctx:               undelete context
+ * @d:                 File entry (and following secondary entries)
+ * @u:                 location of deleted file
+ *
+ * @return             == 0 (success)
+ *                     <  0 (failed)
+ */
+static int undelete_add_file(struct undelete_ctx *ctx, struct exfat_dentry *d, struct undelete_file *u)
+{
+	int j, len;
+	uint16_t uniname[MAX_NAME_LENGTH + ENTRY_NAME_MAX] = {0};
+	struct undelete_file *tmp;
+
+	len = d[1].dentry.stream.NameLength;
+	for (j = 0; j * ENTRY_NAME_MAX < len; j++)
+		memcpy(uniname + j * ENTRY_NAME_MAX, d[j + 2].dentry.name.FileName,
+				ENTRY_NAME_MAX * sizeof(uint16_t));
+
+	if ((u->name = malloc(len * UTF8_MAX_CHARSIZE + 1)) == NULL)
+		return -ENOMEM;
+	exfat_convert_uniname(uniname, len, u->name);
+	u->attr = le16_to_cpu(d[0].dentry.file.FileAttributes);
+	u->flags = d[1].dentry.stream.GeneralSecondaryFlags;
+	u->first = le32_to_cpu(d[1].dentry.stream.FirstCluster);
+	u->datalen = le64_to_cpu(d[1].dentry.stream.DataLength);
+	undelete_resolve(u);
+
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->count == ctx->size) {
+		tmp = realloc(ctx->files, (ctx->size ? ctx->size * 2 : 16) * sizeof(struct undelete_file));
+		if (!tmp) {
+			pthread_mutex_unlock(&ctx->lock);
+			free(u->name);
+			free(u->ext);
+			return -ENOMEM;
+		}
+		ctx->files = tmp;
+		ctx->size = ctx->size ? ctx->size * 2 : 16;
+	}
+	ctx->files[ctx->count++] = *u;
+	pthread_mutex_unlock(&ctx->lock);
+	return 0;
+}
+
+/**
+ * undelete_scan - find deleted entry sets in directory entries
+ * @ctx:           undelete context
+ * @d:             directory entries
+ * @entries:       the number of entries in @d
+ * @limit:         the number of entries where entry set can start
+ * @base:          template of location (key, clu and dir)
+ * @chain:         cluster of each @d (NULL if @d is contiguous from @base->clu)
+ */
+static void undelete_scan(struct undelete_ctx *ctx, struct exfat_dentry *d, size_t entries,
+		size_t limit, const struct undelete_file *base, const uint32_t *chain)
+{
+	int count;
+	size_t i;
+	size_t per_cluster = info.cluster_size / sizeof(struct exfat_dentry);
+	struct undelete_file u;
+
+	for (i = 0; i < limit; i++) {
+		if ((count = exfat_check_entry_set(d, i, entries, ENTRY_SET_DELETED | ENTRY_SET_CHECKSUM)) == 0)
+			continue;
+
+		u = *base;
+		u.entry = i;
+		u.clu = chain ? chain[i / per_cluster] : base->clu + i / per_cluster;
+		if (!chain) {
+			u.key = ((uint64_t)u.clu << 32) | (i % per_cluster);
+			u.entry = i % per_cluster;
+		} else {
+			u.key |= i;
+		}
+		if (undelete_add_file(ctx, d + i, &u))
+			return;
+		i += count;
+	}
+}
+
+/**
+ * undelete_dir_worker - scan one directory
+ * @i:                   directory index
+ * @arg:                 undelete context
+ */
+static void undelete_dir_worker(size_t i, void *arg)
+{
+	uint32_t j;
+	void *data;
+	struct undelete_ctx *ctx = arg;
+	struct undelete_dir *dir = &ctx->dirs[i];
+	struct undelete_file base = {0};
+	size_t entries = (size_t)dir->count * info.cluster_size / sizeof(struct exfat_dentry);
+
+	if (!dir->count || (data = malloc((size_t)dir->count * info.cluster_size)) == NULL)
+		return;
+
+	for (j = 0; j < dir->count; j++) {
+		if (get_cluster((char *)data + (size_t)j * info.cluster_size, dir->chain[j]))
+			goto out;
+	}
+
+	base.key = (uint64_t)i << 32;
+	base.dir = dir->path;
+	undelete_scan(ctx, data, entries, entries, &base, dir->chain);
+out:
+	free(data);
+}
+
+/**
+ * undelete_heap_worker - scan one chunk of cluster heap
+ * @i:                    chunk index
+ * @arg:                  undelete context
+ *
+ * NOTE: One more cluster is read, so that entry set across chunks is found.
+ */
+static void undelete_heap_worker(size_t i, void *arg)
+{
+	void *data;
+	struct undelete_ctx *ctx = arg;
+	struct undelete_file base = {0};
+	uint32_t clu = EXFAT_FIRST_CLUSTER + i * ctx->chunk;
+	uint32_t last = info.cluster_count + EXFAT_FIRST_CLUSTER;
+	uint32_t num = MIN(ctx->chunk, last - clu);
+	uint32_t len = MIN(ctx->chunk + 1, last - clu);
+	size_t per_cluster = info.cluster_size / sizeof(struct exfat_dentry);
+
+	if ((data = malloc((size_t)len * info.cluster_size)) == NULL)
+		return;
+	if (get_clusters(data, clu, len))
+		goto out;
+
+	base.clu = clu;
+	undelete_scan(ctx, data, len * per_cluster, num * per_cluster, &base, NULL);
+out:
+	free(data);
+}
+
+/**
+ * undelete_load_chain - obtain clusters of directory
+ * @f:                   directory
+ * @dir:                 directory to be scanned (Output)
+ *
+ * @return               == 0 (success)
+ *                       <  0 (failed)
+ */
+static int undelete_load_chain(struct exfat_fileinfo *f, struct undelete_dir *dir)
+{
+	uint32_t clu = f->clu, num, *tmp;
+
+	num = (f->flags & ALLOC_NOFATCHAIN) ? ROUNDUP(f->datalen, info.cluster_size) : info.cluster_count;
+	for (dir->count = 0; dir->count < num; dir->count++) {
+		if (clu < EXFAT_FIRST_CLUSTER || clu > info.cluster_count + 1)
+			break;
+		/* Expand list by power of two */
+		if (!(dir->count & (dir->count - 1))) {
+			tmp = realloc(dir->chain, (dir->count ? dir->count * 2 : 1) * sizeof(uint32_t));
+			if (!tmp)
+				return -ENOMEM;
+			dir->chain = tmp;
+		}
+		dir->chain[dir->count] = clu;
+
+		if (f->flags & ALLOC_NOFATCHAIN)
+			clu++;
+		else if (exfat_get_fat(clu, &clu))
+			break;
+	}
+	return 0;
+}
+
+/**
+ * undelete_collect_dir - append directory to be scanned
+ * @f:                    file information
+ * @node:                 cache node (unused)
+ * @path:                 directory path
+ * @arg:                  undelete context
+ *
+ * @return                == 0 (continue walking)
+ *                        <  0 (failed)
+ */
+static int undelete_collect_dir(struct exfat_fileinfo *f, node2_t *node, const char *path, void *arg)
+{
+	struct undelete_ctx *ctx = arg;
+	struct undelete_dir *dir;
+
+	if (!(f->attr & ATTR_DIRECTORY))
+		return 0;
+
+	dir = realloc(ctx->dirs, (ctx->dir_count + 1) * sizeof(struct undelete_dir));
+	if (!dir)
+		return -ENOMEM;
+	ctx->dirs = dir;
+	dir = &ctx->dirs[ctx->dir_count++];
+	memset(dir, 0, sizeof(*dir));
+	if ((dir->path = strdup(path)) == NULL)
+		return -ENOMEM;
+	return undelete_load_chain(f, dir);
+}
+
+/**
+ * undelete_compare - compare function to sort by location
+ * @a:                undelete_file
+ * @b:                undelete_file
+ *
+ * @return            order
+ */
+static int undelete_compare(const void *a, const void *b)
+{
+	const struct undelete_file *x = a, *y = b;
+
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/**
+ * undelete_extract - extract recoverable file
+ * @u:                deleted file
+ *
+ * @return            == 0 (success)
+ *                    <  0 (failed)
+ *
+ * NOTE: If file already exists, first cluster is appended to file name.
+ *       File name which can't be created in output directory is rejected,
+ *       and existing file (or symbolic link) is never overwritten.
+ */
+static int undelete_extract(struct undelete_file *u)
+{
+	int fd, ret = 0;
+	uint32_t i, clu, len, n;
+	uint64_t remain = u->datalen;
+	size_t max = MAX(UNDELETE_BATCH_SIZE / info.cluster_size, 1);
+	size_t size = strlen(outdir) + strlen((char *)u->name) + 16;
+	char *path;
+	void *data;
+
+	/* Broken directory entry may have any name */
+	if (!u->name[0] || strchr((char *)u->name, '/') ||
+			!strcmp((char *)u->name, ".") || !strcmp((char *)u->name, "..")) {
+		pr_warn("Invalid file name '%s' (clu#%u) isn't extracted.\n", u->name, u->first);
+		return -EINVAL;
+	}
+
+	if ((path = malloc(size)) == NULL)
+		return -ENOMEM;
+	snprintf(path, size, "%s/%s", outdir, u->name);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644)) < 0 && errno == EEXIST) {
+		snprintf(path, size, "%s/%s.%u", outdir, u->name, u->first);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+	}
+	if (fd < 0) {
+		ret = -errno;
+		pr_err("open %s: %s\n", path, strerror(-ret));
+		free(path);
+		return ret;
+	}
+
+	if ((data = malloc(max * info.cluster_size)) == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; !ret && i < u->ext_count; i++) {
+		clu = u->ext[i].clu;
+		len = u->ext[i].len;
+		for (; !ret && len && remain; clu += n, len -= n) {
+			n = MIN(len, max);
+			if ((ret = get_clusters(data, clu, n)) == 0) {
+				ret = allwrite(fd, data, MIN(remain, (uint64_t)n * info.cluster_size));
+				remain -= MIN(remain, (uint64_t)n * info.cluster_size);
+			}
+		}
+	}
+	free(data);
+	pr_info("Extract: %s\n", path);
+out:
+	close(fd);
+	free(path);
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * undelete_report - print deleted files
+ * @ctx:             undelete context
+ *
+ * @return           == 0 (success)
+ *                   <  0 (failed)
+ */
+static int undelete_report(struct undelete_ctx *ctx)
+{
+	size_t i;
+	uint32_t j, extracted = 0;
+	uint32_t states[UNDELETE_LOST + 1] = {0};
+	char location[32];
+	struct undelete_file *u;
+
+	qsort(ctx->files, ctx->count, sizeof(struct undelete_file), undelete_compare);
+
+	pr_msg("%-12s %12s %8s  %-16s %s\n", "Status", "Size", "Clusters", "Location", "Name");
+	for (i = 0; i < ctx->count; i++) {
+		u = &ctx->files[i];
+		states[u->state]++;
+		snprintf(location, sizeof(location), "clu#%u index#%u", u->clu, u->entry);
+		pr_msg("%-12s %12" PRIu64 " %8" PRIu64 "  %-16s %s%s\n",
+				undelete_state_name[u->state], u->datalen,
+				ROUNDUP(u->datalen, info.cluster_size),
+				u->dir ? (*u->dir ? u->dir : "/") : location,
+				u->name, (u->attr & ATTR_DIRECTORY) ? "/" : "");
+		for (j = 0; j < u->ext_count; j++)
+			pr_msg("%-12s 0x%08x - 0x%08x (%s)\n", "",
+					u->ext[j].clu, u->ext[j].clu + u->ext[j].len - 1,
+					u->ext[j].used ? "in use" : "free");
+		if (u->unknown)
+			pr_msg("%-12s %u clusters are unknown\n", "", u->unknown);
+
+		if ((flags & OPTION_OUTPUT) && u->state == UNDELETE_RECOVERABLE &&
+				!(u->attr & ATTR_DIRECTORY) && !undelete_extract(u))
+			extracted++;
+	}
+
+	pr_msg("\n");
+	pr_msg("%-16s: %zu\n", "Deleted files", ctx->count);
+	for (j = 0; j <= UNDELETE_LOST; j++)
+		pr_msg("  %-14s: %u\n", undelete_state_name[j], states[j]);
+	if (flags & OPTION_OUTPUT)
+		pr_msg("%-16s: %u\n", "Extracted files", extracted);
+	return 0;
+}
+
+/**
+ * undelete_image - find deleted files in exFAT
+ *
+ * @return          == 0 (success)
+ *                  <  0 (failed)
+ */
+static int undelete_image(void)
+{
+	int ret = 0;
+	size_t i, chunks;
+	struct undelete_ctx ctx = {0};
+	struct exfat_fileinfo *root = info.root[0]->data;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+	if ((ret = exfat_load_fat_table()) < 0)
+		goto out;
+
+	if (flags & OPTION_ALL) {
+		ctx.chunk = MAX(UNDELETE_CHUNK_SIZE / info.cluster_size, 1);
+		chunks = ROUNDUP((size_t)info.cluster_count, ctx.chunk);
+		exfat_parallel_for(chunks, 0, undelete_heap_worker, &ctx);
+	} else {
+		if ((ret = undelete_collect_dir(root, NULL, "", &ctx)) < 0)
+			goto out;
+		if ((ret = exfat_walk_tree(undelete_collect_dir, &ctx)) < 0)
+			goto out;
+		exfat_parallel_for(ctx.dir_count, 0, undelete_dir_worker, &ctx);
+	}
+
+	ret = undelete_report(&ctx);
+out:
+	for (i = 0; i < ctx.count; i++) {
+		free(ctx.files[i].name);
+		free(ctx.files[i].ext);
+	}
+	for (i = 0; i < ctx.dir_count; i++) {
+		free(ctx.dirs[i].path);
+		free(ctx.dirs[i].chain);
+	}
+	free(ctx.files);
+	free(ctx.dirs);
+	pthread_mutex_destroy(&ctx.lock);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	struct exfat_bootsec boot;
+	struct stat st;
+
+	while ((opt = getopt_long(argc, argv,
+					"ao:",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case 'a':
+				flags |= OPTION_ALL;
+				break;
+			case 'o':
+				flags |= OPTION_OUTPUT;
+				outdir = optarg;
+				break;
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if ((flags & OPTION_OUTPUT) && (stat(outdir, &st) < 0 || !S_ISDIR(st.st_mode))) {
+		pr_err("%s: Not a directory.\n", outdir);
+		exit(EXIT_FAILURE);
+	}
+
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDONLY)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+	exfat_journal_check(argv[optind]);
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if (undelete_image())
+		goto out;
+
+	ret = EXIT_SUCCESS;
+out:
+	exfat_clean_info();
+	return ret;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _UNDELETEEXFAT_H
+#define _UNDELETEEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "undeleteexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+#define OPTION_ALL       (1 << 0)
+#define OPTION_OUTPUT    (1 << 1)
+
+/* Size of cluster heap scanned by one worker at a time */
+#define UNDELETE_CHUNK_SIZE    (4 * 1024 * 1024)
+/* Size of one read request to extract file */
+#define UNDELETE_BATCH_SIZE    (1024 * 1024)
+
+enum undelete_state {
+	UNDELETE_RECOVERABLE,
+	UNDELETE_PARTIAL,
+	UNDELETE_LOST,
+};
+
+struct undelete_extent {
+	uint32_t clu;
+	uint32_t len;
+	bool used;
+};
+
+struct undelete_file {
+	uint64_t key;
+	uint32_t entry;
+	uint32_t clu;
+	const char *dir;
+	unsigned char *name;
+	uint16_t attr;
+	uint8_t flags;
+	uint32_t first;
+	uint64_t datalen;
+	struct undelete_extent *ext;
+	uint32_t ext_count;
+	uint32_t free;
+	uint32_t used;
+	uint32_t unknown;
+	enum undelete_state state;
+};
+
+struct undelete_dir {
+	char *path;
+	uint32_t *chain;
+	uint32_t count;
+};
+
+struct undelete_ctx {
+	pthread_mutex_t lock;
+	struct undelete_file *files;
+	size_t count;
+	size_t size;
+	struct undelete_dir *dirs;
+	size_t dir_count;
+	uint32_t chunk;
+};
+
+#endif /*_UNDELETEEXFAT_H */
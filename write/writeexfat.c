@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "writeexfat.h"
+#include "exfat.h"
+#include "trans.h"
+
+FILE *output;
+unsigned int print_level = PRINT_WARNING;
+struct exfat_info info;
+
+/**
+ * Special Option(no short option)
+ */
+enum
+{
+	GETOPT_HELP_CHAR = (CHAR_MIN - 2),
+	GETOPT_VERSION_CHAR = (CHAR_MIN - 3)
+};
+
+/* option data {"long name", needs argument, flags, "short name"} */
+static struct option const longopts[] =
+{
+	{"help", no_argument, NULL, GETOPT_HELP_CHAR},
+	{"version", no_argument, NULL, GETOPT_VERSION_CHAR},
+	{0,0,0,0}
+};
+
+/**
+ * usage - print out usage
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [OPTION]... IMAGE PATH\n", PROGRAM_NAME);
+	fprintf(stderr, "write standard input to file in exFAT\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "  --help\tdisplay this help and exit.\n");
+	fprintf(stderr, "  --version\toutput version information and exit.\n");
+	fprintf(stderr, "\n");
+}
+
+/**
+ * version        - print out program version
+ * @command_name:   command name
+ * @version:        program version
+ * @author:         program authoer
+ */
+static void version(const char *command_name, const char *version, const char *author)
+{
+	fprintf(stdout, "%s %s\n", command_name, version);
+	fprintf(stdout, "\n");
+	fprintf(stdout, "Written by %s.\n", author);
+}
+
+/**
+ * write_collect_free - append free extent to list
+ * @clu:                first cluster of free extent
+ * @len:                the number of clusters
+ * @arg:                free extent list
+ *
+ * @return              == 0 (success)
+ *                      <  0 (failed)
+ */
+static int write_collect_free(uint32_t clu, uint32_t len, void *arg)
+{
+	struct write_space *s = arg;
+	struct write_extent *tmp;
+
+	if (s->count == s->size) {
+		tmp = realloc(s->ext, (s->size ? s->size * 2 : 64) * sizeof(struct write_extent));
+		if (!tmp)
+			return -ENOMEM;
+		s->ext = tmp;
+		s->size = s->size ? s->size * 2 : 64;
+	}
+	s->ext[s->count].clu = clu;
+	s->ext[s->count].len = len;
+	s->count++;
+	s->free += len;
+	return 0;
+}
+
+/**
+ * write_compare_extent - compare extents by length (larger first)
+ * @a:                    extent
+ * @b:                    extent
+ *
+ * @return                order of @a and @b
+ */
+static int write_compare_extent(const void *a, const void *b)
+{
+	const struct write_extent *x = a;
+	const struct write_extent *y = b;
+
+	if (x->len != y->len)
+		return x->len > y->len ? -1 : 1;
+	return x->clu < y->clu ? -1 : x->clu > y->clu;
+}
+
+/**
+ * write_plan - decide free extents to write data into
+ * @ctx:        write context
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ *
+ * NOTE: If data size is known, the smallest extent which can hold whole data
+ *       is used first (best fit), so that file can be NoFatChain.
+ *       Otherwise, larger extents are used first.
+ */
+static int write_plan(struct write_ctx *ctx)
+{
+	int ret;
+	size_t i;
+	uint64_t need = ROUNDUP(ctx->size, info.cluster_size);
+	struct write_extent tmp;
+	struct write_space *s = &ctx->space;
+
+	if ((ret = exfat_scan_free_extents(write_collect_free, s)) < 0)
+		return ret;
+	qsort(s->ext, s->count, sizeof(struct write_extent), write_compare_extent);
+
+	if (ctx->known && need > s->free) {
+		pr_err("No space left on image. (Expect: %" PRIu64 ", Actual: %" PRIu64 " clusters)\n",
+				need, s->free);
+		return -ENOSPC;
+	}
+
+	for (i = s->count; ctx->known && need && i > 0; i--) {
+		if (s->ext[i - 1].len < need)
+			continue;
+		tmp = s->ext[i - 1];
+		memmove(s->ext + 1, s->ext, (i - 1) * sizeof(struct write_extent));
+		s->ext[0] = tmp;
+		break;
+	}
+
+	if ((ctx->used = malloc(MAX(s->count, 1) * sizeof(struct write_extent))) == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+/**
+ * write_fill - read from input until buffer is filled
+ * @fd:         input file descriptor
+ * @buf:        buffer (Output)
+ * @len:        buffer length
+ *
+ * @return      >= 0 (read bytes, less than @len at the end of input)
+ *              <  0 (failed)
+ */
+static ssize_t write_fill(int fd, uint8_t *buf, size_t len)
+{
+	ssize_t n;
+	size_t got = 0;
+
+	while (got < len) {
+		if ((n = read(fd, buf + got, len - got)) < 0) {
+			if (errno == EINTR)
+				continue;
+			n = -errno;
+			pr_err("read: %s\n", strerror(-n));
+			return n;
+		}
+		if (!n)
+			break;
+		got += n;
+	}
+	return got;
+}
+
+/**
+ * write_clusters - write clusters to next free extents
+ * @ctx:            write context
+ * @buf:            data
+ * @num:            the number of clusters
+ * @cur:            index of current extent (Input/Output)
+ * @off:            offset in current extent (Input/Output)
+ *
+ * @return          == 0 (success)
+ *                  <  0 (failed)
+ */
+static int write_clusters(struct write_ctx *ctx, uint8_t *buf, size_t num, size_t *cur, uint32_t *off)
+{
+	int ret;
+	uint32_t n;
+	struct write_extent *e, *u;
+
+	while (num) {
+		if (*cur >= ctx->space.count) {
+			pr_err("No space left on image.\n");
+			return -ENOSPC;
+		}
+		e = &ctx->space.ext[*cur];
+		n = MIN(num, e->len - *off);
+		if ((ret = set_clusters(buf, e->clu + *off, n)))
+			return ret;
+		ctx->requests++;
+
+		u = &ctx->used[ctx->used_count - (*off ? 1 : 0)];
+		if (!*off) {
+			u->clu = e->clu;
+			u->len = 0;
+			ctx->used_count++;
+		}
+		u->len += n;
+
+		buf += (size_t)n * info.cluster_size;
+		num -= n;
+		if ((*off += n) == e->len) {
+			(*cur)++;
+			*off = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * write_data - write input to free clusters
+ * @ctx:        write context
+ *
+ * @return      == 0 (success)
+ *              <  0 (failed)
+ *
+ * NOTE: Data is written before the clusters are allocated, so the image
+ *       isn't changed by interrupted write.
+ */
+static int write_data(struct write_ctx *ctx)
+{
+	int ret = 0;
+	size_t cur = 0, len, num;
+	uint32_t off = 0;
+	ssize_t got;
+	uint32_t batch = MAX(WRITE_BATCH_SIZE / info.cluster_size, 1);
+	void *buf;
+
+	if ((ret = posix_memalign(&buf, info.sector_size, (size_t)batch * info.cluster_size)))
+		return -ret;
+
+	for (;;) {
+		len = (size_t)batch * info.cluster_size;
+		if (ctx->known)
+			len = MIN(len, ctx->size - ctx->written);
+		if (!len)
+			break;
+		if ((got = write_fill(ctx->fd, buf, len)) < 0) {
+			ret = got;
+			break;
+		}
+		if (!got)
+			break;
+
+		/* The last cluster is filled with zero */
+		num = ROUNDUP((size_t)got, info.cluster_size);
+		memset((uint8_t *)buf + got, 0, num * info.cluster_size - got);
+		if ((ret = write_clusters(ctx, buf, num, &cur, &off)))
+			break;
+		ctx->written += got;
+		if (got < len)
+			break;
+	}
+
+	free(buf);
+	if (!ret && ctx->used_count)
+		fsync(info.fd);
+	return ret;
+}
+
+/**
+ * write_release - release clusters of old file
+ * @f:             old file information
+ *
+ * @return         == 0 (success)
+ *                 <  0 (failed)
+ */
+static int write_release(struct exfat_fileinfo *f)
+{
+	int ret;
+	uint32_t i, first, clu = f->clu, next = 0;
+	uint32_t clusters = ROUNDUP(f->datalen, info.cluster_size);
+
+	if (!clusters || !clu)
+		return 0;
+	if (f->flags & ALLOC_NOFATCHAIN)
+		return exfat_save_bitmap_range(clu, clusters, 0);
+
+	for (i = 0, first = clu; i < clusters; i++, clu = next) {
+		if (i + 1 < clusters && exfat_get_fat(clu, &next))
+			next = 0;
+		if (i + 1 < clusters && next == clu + 1)
+			continue;
+		if ((ret = exfat_save_bitmap_range(first, clu - first + 1, 0)))
+			return ret;
+		if (next < EXFAT_FIRST_CLUSTER || next > info.cluster_count + 1)
+			break;
+		first = next;
+	}
+	return 0;
+}
+
+/**
+ * write_commit - allocate written clusters and create directory entry
+ * @ctx:          write context
+ *
+ * @return        == 0 (success)
+ *                <  0 (failed)
+ *
+ * NOTE: Allocation Bitmap, FAT and directory entries are written at once by transaction.
+ *       If file already exists, its entry set is replaced and its clusters are released.
+ */
+static int write_commit(struct write_ctx *ctx)
+{
+	int ret;
+	size_t i;
+	uint32_t j, clu;
+	char *name = NULL;
+	struct timespec now;
+	struct exfat_fileinfo nf = {0}, old = {0}, *f;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	exfat_convert_exfattime(&nf.mtime, &now);
+	nf.ctime = nf.atime = nf.mtime;
+	nf.attr = ATTR_ARCHIVE;
+	nf.flags = ALLOC_POSIBLE | (ctx->used_count == 1 ? ALLOC_NOFATCHAIN : 0);
+	nf.clu = ctx->used_count ? ctx->used[0].clu : 0;
+	nf.datalen = ctx->written;
+
+	if ((ret = exfat_trans_begin()))
+		return ret;
+
+	for (i = 0; i < ctx->used_count; i++)
+		if ((ret = exfat_save_bitmap_range(ctx->used[i].clu, ctx->used[i].len, 1)))
+			goto abort;
+
+	/* Fragmented file needs FAT chain */
+	for (i = 0; ctx->used_count > 1 && i < ctx->used_count; i++) {
+		for (j = 0; j < ctx->used[i].len; j++) {
+			clu = ctx->used[i].clu + j;
+			if (j + 1 < ctx->used[i].len)
+				ret = exfat_set_fat(clu, clu + 1);
+			else if (i + 1 < ctx->used_count)
+				ret = exfat_set_fat(clu, ctx->used[i + 1].clu);
+			else
+				ret = exfat_set_fat(clu, EXFAT_LASTCLUSTER);
+			if (ret)
+				goto abort;
+		}
+	}
+
+	/* Name of existing file is kept */
+	if ((f = exfat_find_dentry(ctx->dir, ctx->name))) {
+		old = *f;
+		nf.attr = f->attr;
+		nf.ctime = f->ctime;
+		if ((name = strdup((char *)f->name)) == NULL) {
+			ret = -ENOMEM;
+			goto abort;
+		}
+		if ((ret = exfat_delete_dentry(f)))
+			goto abort;
+	}
+	if ((ret = exfat_create_dentry(ctx->dir, name ? name : ctx->name, &nf)))
+		goto abort;
+	if ((ret = write_release(&old)))
+		goto abort;
+
+	free(name);
+	return exfat_trans_commit();
+abort:
+	free(name);
+	exfat_trans_abort();
+	return ret;
+}
+
+/**
+ * write_run - write standard input to file
+ * @path:      file path in exFAT
+ *
+ * @return     == 0 (success)
+ *             <  0 (failed)
+ */
+static int write_run(const char *path)
+{
+	int ret;
+	off_t pos;
+	char *buf, *dir, *name;
+	struct stat st;
+	struct exfat_fileinfo *f;
+	struct write_ctx ctx = {0};
+
+	if ((buf = strdup(path)) == NULL)
+		return -ENOMEM;
+	if ((name = strrchr(buf, '/')) != NULL) {
+		*name++ = '\0';
+		dir = buf;
+	} else {
+		name = buf;
+		dir = "";
+	}
+
+	if (!*name) {
+		pr_err("'%s': Invalid file name.\n", path);
+		ret = -EINVAL;
+		goto out;
+	}
+	ctx.name = name;
+
+	if ((ret = exfat_load_fat_table()) < 0)
+		goto out;
+	if (!(ctx.dir = *dir ? exfat_lookup(info.root_offset, dir) : info.root_offset)) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (!exfat_check_cache(ctx.dir)) {
+		pr_err("'%s': Not a directory.\n", *dir ? dir : "/");
+		ret = -ENOTDIR;
+		goto out;
+	}
+	if ((ret = exfat_traverse_directory(ctx.dir)))
+		goto out;
+	if ((f = exfat_find_dentry(ctx.dir, name)) && (f->attr & ATTR_DIRECTORY)) {
+		pr_err("'%s': Is a directory.\n", path);
+		ret = -EISDIR;
+		goto out;
+	}
+
+	/* Size of regular file is known, so that best fit extent can be chosen */
+	ctx.fd = STDIN_FILENO;
+	if (!fstat(ctx.fd, &st) && S_ISREG(st.st_mode) &&
+			(pos = lseek(ctx.fd, 0, SEEK_CUR)) >= 0 && pos <= st.st_size) {
+		ctx.known = true;
+		ctx.size = st.st_size - pos;
+	}
+
+	if ((ret = write_plan(&ctx)))
+		goto out;
+	if ((ret = write_data(&ctx)))
+		goto out;
+	ret = write_commit(&ctx);
+out:
+	free(ctx.space.ext);
+	free(ctx.used);
+	free(buf);
+	return ret;
+}
+
+/**
+ * main   - main function
+ * @argc:   argument count
+ * @argv:   argument vector
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	int longindex;
+	int ret = -EINVAL;
+	struct exfat_bootsec boot;
+
+	while ((opt = getopt_long(argc, argv,
+					"",
+					longopts, &longindex)) != -1) {
+		switch (opt) {
+			case GETOPT_HELP_CHAR:
+				usage();
+				exit(EXIT_SUCCESS);
+			case GETOPT_VERSION_CHAR:
+				version(PROGRAM_NAME, PROGRAM_VERSION, PROGRAM_AUTHOR);
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+#ifdef EXFAT_DEBUG
+	print_level = PRINT_DEBUG;
+	print_ring_setup();
+#endif
+
+	if (optind != argc - 2) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	output = stdout;
+	if (exfat_init_info())
+		goto out;
+
+	if ((info.fd = open(argv[optind], O_RDWR)) < 0) {
+		pr_err("open: %s\n", strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+
+	if (exfat_load_bootsec(&boot))
+		goto out;
+	if (exfat_store_info(&boot))
+		goto out;
+	if (exfat_journal_init(argv[optind]))
+		goto out;
+	if (exfat_traverse_root_directory())
+		goto out;
+	if (write_run(argv[optind + 1]))
+		goto out;
+
+	ret = EXIT_SUCCESS;
+out:
+	exfat_clean_info();
+	return ret;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  Copyright (C) 2021 LeavaTail
+ */
+#ifndef _WRITEEXFAT_H
+#define _WRITEEXFAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "exfat.h"
+
+/**
+ * Program Name, version, author.
+ * displayed when 'usage' and 'version'
+ */
+#define PROGRAM_NAME     "writeexfat"
+#define PROGRAM_VERSION  "0.1.0"
+#define PROGRAM_AUTHOR   "LeavaTail"
+#define COPYRIGHT_YEAR   "2021"
+
+/* Size of one write request (multiple of cluster size) */
+#define WRITE_BATCH_SIZE (8 * 1024 * 1024)
+
+struct write_extent {
+	uint32_t clu;
+	uint32_t len;
+};
+
+/* Free extents to write data into */
+struct write_space {
+	struct write_extent *ext;
+	size_t count;
+	size_t size;
+	uint64_t free;
+};
+
+struct write_ctx {
+	/* Input */
+	int fd;
+	bool known;
+	uint64_t size;
+	/* Destination */
+	uint32_t dir;
+	const char *name;
+	struct write_space space;
+	/* Extents which data was written */
+	struct write_extent *used;
+	size_t used_count;
+	uint64_t written;
+	uint64_t requests;
+};
+
+#endif /*_WRITEEXFAT_H */